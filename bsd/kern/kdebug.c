@@ -2308,6 +2308,7 @@ _storage_free(struct kd_control *kd_ctrl_page, struct kd_buffer *kd_data_page, i
 	kdsp.raw = kdsp_raw;
 
 	int intrs_en = kdebug_storage_lock(kd_ctrl_page);
+	(void)kdebug_list_lock(kdbp);
 
 	if (kdsp.raw == kdbp->kd_list_head.raw) {
 		/*
@@ -2329,6 +2330,7 @@ _storage_free(struct kd_control *kd_ctrl_page, struct kd_buffer *kd_data_page, i
 		kd_ctrl_page->kdc_storage_used--;
 	}
 
+	kdebug_list_unlock(kdbp, false);
 	kdebug_storage_unlock(kd_ctrl_page, intrs_en);
 }
 
@@ -43,6 +43,21 @@ kdebug_storage_unlock(struct kd_control *kd_ctrl_page, int intrs_en)
 	ml_set_interrupts_enabled(intrs_en);
 }
 
+int
+kdebug_list_lock(struct kd_bufinfo *kdbp)
+{
+	int intrs_en = ml_set_interrupts_enabled(false);
+	lck_spin_lock_grp(&kdbp->kd_list_lock, &kdebug_lck_grp);
+	return intrs_en;
+}
+
+void
+kdebug_list_unlock(struct kd_bufinfo *kdbp, int intrs_en)
+{
+	lck_spin_unlock(&kdbp->kd_list_lock);
+	ml_set_interrupts_enabled(intrs_en);
+}
+
 // Turn on boot tracing and set the number of events.
 static TUNABLE(unsigned int, new_nkdbufs, "trace", 0);
 // Enable wrapping during boot tracing.
@@ -127,6 +142,9 @@ create_buffers(
 		goto out;
 	}
 	kd_data_page->kdb_info = kdbip;
+	for (i = 0; i < ncpus; i++) {
+		lck_spin_init(&kdbip[i].kd_list_lock, &kdebug_lck_grp, LCK_ATTR_NULL);
+	}
 
 	f_buffers = kdb_storage_count / N_STORAGE_UNITS_PER_BUFFER;
 	kd_data_page->kdb_region_count = f_buffers;
@@ -198,6 +216,8 @@ create_buffers(
 	kd_data_page->kdb_storage_count = count_storage_units;
 
 	for (i = 0; i < ncpus; i++) {
+		kdbip[i].kd_reserve.raw = KDS_PTR_NULL;
+		kdbip[i].kd_reserve_count = 0;
 		kdbip[i].kd_list_head.raw = KDS_PTR_NULL;
 		kdbip[i].kd_list_tail.raw = KDS_PTR_NULL;
 		kdbip[i].kd_lostevents = false;
@@ -244,6 +264,9 @@ delete_buffers(struct kd_control *kd_ctrl_page,
 	kd_ctrl_page->kds_free_list.raw = KDS_PTR_NULL;
 
 	if (kdbip) {
+		for (i = 0; i < kd_ctrl_page->alloc_cpus; i++) {
+			lck_spin_destroy(&kdbip[i].kd_list_lock, &kdebug_lck_grp);
+		}
 		kfree_type(struct kd_bufinfo, kd_ctrl_page->alloc_cpus, kdbip);
 		kd_data_page->kdb_info = NULL;
 	}
@@ -262,6 +285,151 @@ _register_out_of_space(struct kd_control *kd_ctrl_page)
 	commpage_update_kdebug_state();
 }
 
+/*
+ * Each CPU keeps a few free storage units in reserve, moved from the free list
+ * in batches under kdc_storage_lock, so that a CPU filling up a storage unit
+ * usually only needs its own list lock to start the next one.
+ *
+ * Refilling, reclaiming, and stealing still take kdc_storage_lock, and there
+ * is no mapped reader for the storage units yet; see
+ * doc/observability/kdebug_storage.md.
+ */
+#define KD_RESERVE_MAX 4
+
+static bool
+_storage_has_room(
+	struct kd_control *kd_ctrl_page,
+	struct kd_buffer *kd_data_page,
+	struct kd_bufinfo *kdbp)
+{
+	struct kd_storage *kdsp_actual;
+
+	if (kdbp->kd_list_tail.raw == KDS_PTR_NULL) {
+		return false;
+	}
+	kdsp_actual = POINTER_FROM_KDS_PTR(kd_data_page->kd_bufs, kdbp->kd_list_tail);
+	return kdsp_actual->kds_bufindx < kd_ctrl_page->kdebug_events_per_storage_unit;
+}
+
+static void
+_storage_reserve_push(
+	struct kd_buffer *kd_data_page,
+	struct kd_bufinfo *kdbp,
+	union kds_ptr kdsp)
+{
+	POINTER_FROM_KDS_PTR(kd_data_page->kd_bufs, kdsp)->kds_next = kdbp->kd_reserve;
+	kdbp->kd_reserve = kdsp;
+	kdbp->kd_reserve_count++;
+}
+
+static union kds_ptr
+_storage_reserve_pop(
+	struct kd_buffer *kd_data_page,
+	struct kd_bufinfo *kdbp)
+{
+	union kds_ptr kdsp = kdbp->kd_reserve;
+
+	if (kdsp.raw != KDS_PTR_NULL) {
+		kdbp->kd_reserve = POINTER_FROM_KDS_PTR(kd_data_page->kd_bufs, kdsp)->kds_next;
+		kdbp->kd_reserve_count--;
+	}
+	return kdsp;
+}
+
+/*
+ * Called with kdc_storage_lock and the list lock of kdbp held.
+ *
+ * Refill the reserve from the free list.  The batch shrinks as the free list
+ * runs out, so that reserves don't hold on to the last free units.
+ */
+static bool
+_storage_reserve_refill(
+	struct kd_control *kd_ctrl_page,
+	struct kd_buffer *kd_data_page,
+	struct kd_bufinfo *kdbp)
+{
+	union kds_ptr kdsp;
+	int count;
+
+	count = (kd_data_page->kdb_storage_count - kd_ctrl_page->kdc_storage_used) /
+	    (int)(4 * kd_ctrl_page->kdebug_cpus);
+	count = MAX(1, MIN(count, KD_RESERVE_MAX));
+
+	while (count-- > 0 && (kdsp = kd_ctrl_page->kds_free_list).raw != KDS_PTR_NULL) {
+		kd_ctrl_page->kds_free_list = POINTER_FROM_KDS_PTR(kd_data_page->kd_bufs, kdsp)->kds_next;
+		kd_ctrl_page->kdc_storage_used++;
+		_storage_reserve_push(kd_data_page, kdbp, kdsp);
+	}
+	return kdbp->kd_reserve.raw != KDS_PTR_NULL;
+}
+
+/*
+ * Called with kdc_storage_lock and the list lock of kdbp held.
+ *
+ * The free list is empty: take an unused unit from another CPU's reserve
+ * rather than dropping events.
+ */
+static bool
+_storage_reserve_reclaim(
+	struct kd_control *kd_ctrl_page,
+	struct kd_buffer *kd_data_page,
+	struct kd_bufinfo *kdbp)
+{
+	struct kd_bufinfo *kdbip = kd_data_page->kdb_info;
+	struct kd_bufinfo *kdbp_try;
+	union kds_ptr kdsp;
+
+	for (kdbp_try = &kdbip[0]; kdbp_try < &kdbip[kd_ctrl_page->kdebug_cpus]; kdbp_try++) {
+		if (kdbp_try == kdbp || kdbp_try->kd_reserve_count == 0) {
+			continue;
+		}
+
+		(void)kdebug_list_lock(kdbp_try);
+		kdsp = _storage_reserve_pop(kd_data_page, kdbp_try);
+		kdebug_list_unlock(kdbp_try, false);
+
+		if (kdsp.raw != KDS_PTR_NULL) {
+			_storage_reserve_push(kd_data_page, kdbp, kdsp);
+			return true;
+		}
+	}
+	return false;
+}
+
+/*
+ * Called with the list lock of kdbp held.
+ */
+static void
+_storage_append(
+	struct kd_control *kd_ctrl_page,
+	struct kd_buffer *kd_data_page,
+	struct kd_bufinfo *kdbp,
+	union kds_ptr kdsp)
+{
+	struct kd_storage *kdsp_actual = POINTER_FROM_KDS_PTR(kd_data_page->kd_bufs, kdsp);
+
+	if (kd_ctrl_page->mode == KDEBUG_MODE_TRACE) {
+		kdsp_actual->kds_timestamp = kdebug_timestamp();
+	} else {
+		kdsp_actual->kds_timestamp = mach_continuous_time();
+	}
+
+	kdsp_actual->kds_next.raw = KDS_PTR_NULL;
+	kdsp_actual->kds_bufcnt   = 0;
+	kdsp_actual->kds_readlast = 0;
+
+	kdsp_actual->kds_lostevents = kdbp->kd_lostevents;
+	kdbp->kd_lostevents = false;
+	kdsp_actual->kds_bufindx = 0;
+
+	if (kdbp->kd_list_head.raw == KDS_PTR_NULL) {
+		kdbp->kd_list_head = kdsp;
+	} else {
+		POINTER_FROM_KDS_PTR(kd_data_page->kd_bufs, kdbp->kd_list_tail)->kds_next = kdsp;
+	}
+	kdbp->kd_list_tail = kdsp;
+}
+
 bool
 kdebug_storage_alloc(
 	struct kd_control *kd_ctrl_page,
@@ -274,30 +442,40 @@ kdebug_storage_alloc(
 	uint64_t oldest_ts, ts;
 	bool retval = true;
 	struct kd_region *kd_bufs;
-
-	int intrs_en = kdebug_storage_lock(kd_ctrl_page);
+	int intrs_en;
 
 	kdbp = &kd_data_page->kdb_info[cpu];
 	kd_bufs = kd_data_page->kd_bufs;
 	kdbip = kd_data_page->kdb_info;
 
-	/* If someone beat us to the allocate, return success */
-	if (kdbp->kd_list_tail.raw != KDS_PTR_NULL) {
-		kdsp_actual = POINTER_FROM_KDS_PTR(kd_bufs, kdbp->kd_list_tail);
-
-		if (kdsp_actual->kds_bufindx < kd_ctrl_page->kdebug_events_per_storage_unit) {
-			goto out;
+	/*
+	 * Fast path: start the next storage unit from this CPU's reserve.
+	 */
+	intrs_en = kdebug_list_lock(kdbp);
+	if (!_storage_has_room(kd_ctrl_page, kd_data_page, kdbp)) {
+		kdsp = _storage_reserve_pop(kd_data_page, kdbp);
+		if (kdsp.raw == KDS_PTR_NULL) {
+			kdebug_list_unlock(kdbp, intrs_en);
+			goto slow;
 		}
+		_storage_append(kd_ctrl_page, kd_data_page, kdbp, kdsp);
 	}
+	kdebug_list_unlock(kdbp, intrs_en);
+	return true;
 
-	if ((kdsp = kd_ctrl_page->kds_free_list).raw != KDS_PTR_NULL) {
-		/*
-		 * If there's a free page, grab it from the free list.
-		 */
-		kdsp_actual = POINTER_FROM_KDS_PTR(kd_bufs, kdsp);
-		kd_ctrl_page->kds_free_list = kdsp_actual->kds_next;
+slow:
+	intrs_en = kdebug_storage_lock(kd_ctrl_page);
+	(void)kdebug_list_lock(kdbp);
 
-		kd_ctrl_page->kdc_storage_used++;
+	/* If someone beat us to the allocate, return success */
+	if (_storage_has_room(kd_ctrl_page, kd_data_page, kdbp)) {
+		goto out;
+	}
+
+	if (kdbp->kd_reserve.raw != KDS_PTR_NULL ||
+	    _storage_reserve_refill(kd_ctrl_page, kd_data_page, kdbp) ||
+	    _storage_reserve_reclaim(kd_ctrl_page, kd_data_page, kdbp)) {
+		kdsp = _storage_reserve_pop(kd_data_page, kdbp);
 	} else {
 		/*
 		 * Otherwise, we're going to lose events and repurpose the oldest
@@ -313,6 +491,11 @@ kdebug_storage_alloc(
 		kdbp_vict = NULL;
 		oldest_ts = UINT64_MAX;
 
+		/*
+		 * Heads only move without kdc_storage_lock when a CPU starts
+		 * an empty list, and such a unit isn't full: the ones seen
+		 * here stay put until the victim is picked.
+		 */
 		for (kdbp_try = &kdbip[0]; kdbp_try < &kdbip[kd_ctrl_page->kdebug_cpus]; kdbp_try++) {
 			if (kdbp_try->kd_list_head.raw == KDS_PTR_NULL) {
 				/*
@@ -352,6 +535,9 @@ kdebug_storage_alloc(
 			retval = false;
 			goto out;
 		}
+		if (kdbp_vict != kdbp) {
+			(void)kdebug_list_lock(kdbp_vict);
+		}
 		kdsp = kdbp_vict->kd_list_head;
 		kdsp_actual = POINTER_FROM_KDS_PTR(kd_bufs, kdsp);
 		kdbp_vict->kd_list_head = kdsp_actual->kds_next;
@@ -362,6 +548,9 @@ kdebug_storage_alloc(
 		} else {
 			kdbp_vict->kd_lostevents = true;
 		}
+		if (kdbp_vict != kdbp) {
+			kdebug_list_unlock(kdbp_vict, false);
+		}
 
 		if (kd_ctrl_page->kdc_oldest_time < oldest_ts) {
 			kd_ctrl_page->kdc_oldest_time = oldest_ts;
@@ -369,27 +558,9 @@ kdebug_storage_alloc(
 		kd_ctrl_page->kdc_live_flags |= KDBG_WRAPPED;
 	}
 
-	if (kd_ctrl_page->mode == KDEBUG_MODE_TRACE) {
-		kdsp_actual->kds_timestamp = kdebug_timestamp();
-	} else {
-		kdsp_actual->kds_timestamp = mach_continuous_time();
-	}
-
-	kdsp_actual->kds_next.raw = KDS_PTR_NULL;
-	kdsp_actual->kds_bufcnt   = 0;
-	kdsp_actual->kds_readlast = 0;
-
-	kdsp_actual->kds_lostevents = kdbp->kd_lostevents;
-	kdbp->kd_lostevents = false;
-	kdsp_actual->kds_bufindx = 0;
-
-	if (kdbp->kd_list_head.raw == KDS_PTR_NULL) {
-		kdbp->kd_list_head = kdsp;
-	} else {
-		POINTER_FROM_KDS_PTR(kd_bufs, kdbp->kd_list_tail)->kds_next = kdsp;
-	}
-	kdbp->kd_list_tail = kdsp;
+	_storage_append(kd_ctrl_page, kd_data_page, kdbp, kdsp);
 out:
+	kdebug_list_unlock(kdbp, false);
 	kdebug_storage_unlock(kd_ctrl_page, intrs_en);
 
 	return retval;
@@ -46,11 +46,13 @@
 #include <sys/user.h>
 
 #include <sys/aio_kern.h>
+#include <sys/aio_private.h>
 #include <sys/sysproto.h>
 
 #include <machine/limits.h>
 
 #include <mach/mach_types.h>
+#include <mach/thread_act.h>
 #include <kern/kern_types.h>
 #include <kern/waitq.h>
 #include <kern/zalloc.h>
@@ -112,6 +114,8 @@
 #define AIO_WQ_aio_select_req           145
 #define AIO_WQ_aio_thread_create_failed 146
 #define AIO_WQ_aio_thread_wakeup        147
+#define AIO_ring_submit                 150
+#define AIO_ring_complete               151
 
 static TUNABLE(uint32_t, bootarg_aio_new_workq, "aio_new_workq", 1);
 
@@ -228,6 +232,7 @@ typedef struct workq_aio_s {
 	struct workq_aio_uthread_head wa_thrunlist;
 	struct workq_aio_uthread_head wa_thidlelist;
 	TAILQ_HEAD(, aio_workq_entry) wa_aioq_entries;
+	struct aio_ring *wa_ring;
 	proc_t wa_proc;
 	workq_state_flags_t _Atomic wa_flags;
 	uint16_t wa_nthreads;
@@ -249,6 +254,7 @@ static int aio_workq_sysctl_handle_usecs SYSCTL_HANDLER_ARGS;
 	                        aio_workq_sysctl_handle_usecs, "I", "")
 
 AIO_WORKQ_SYSCTL_USECS(aio_wq_reduce_pool_window, WQ_REDUCE_POOL_WINDOW_USECS);
+AIO_WORKQ_SYSCTL_USECS(aio_ring_sqpoll_window, 20);
 
 #define WQ_AIO_TRACE(x, wq, a, b, c, d) \
 	        ({ KERNEL_DEBUG_CONSTANT(BSDDBG_CODE(DBG_BSD_AIO, (x)),\
@@ -330,6 +336,10 @@ static void             workq_aio_unpark_continue(void *parameter __unused, wait
 static void             workq_aio_mark_exiting(proc_t p);
 static void             workq_aio_exit(proc_t p);
 
+static bool             aio_ring_has_work_locked(workq_aio_t wq_aio);
+static void             aio_ring_process_locked(proc_t p, workq_aio_t wq_aio);
+static int              aio_ring_teardown(proc_t p, bool exiting);
+
 #define ASSERT_AIO_PROC_LOCK_OWNED(p)   LCK_MTX_ASSERT(aio_proc_mutex(p), LCK_MTX_ASSERT_OWNED)
 #define ASSERT_AIO_WORKQ_LOCK_OWNED(q)  LCK_SPIN_ASSERT(aio_workq_lock(q), LCK_ASSERT_OWNED)
 
@@ -928,11 +938,13 @@ _aio_exit(proc_t p)
 	/* quick check to see if there are any async IO requests queued up */
 	if (!aio_has_any_work()) {
 		workq_aio_mark_exiting(p);
+		aio_ring_teardown(p, true);
 		workq_aio_exit(p);
 		return;
 	}
 
 	workq_aio_mark_exiting(p);
+	aio_ring_teardown(p, true);
 
 	KERNEL_DEBUG(BSDDBG_CODE(DBG_BSD_AIO, AIO_exit) | DBG_FUNC_START,
 	    VM_KERNEL_ADDRPERM(p), 0, 0, 0, 0);
@@ -2379,6 +2391,8 @@ aio_init(void)
 
 	clock_interval_to_absolutetime_interval(aio_wq_reduce_pool_window.usecs,
 	    NSEC_PER_USEC, &aio_wq_reduce_pool_window.abstime);
+	clock_interval_to_absolutetime_interval(aio_ring_sqpoll_window.usecs,
+	    NSEC_PER_USEC, &aio_ring_sqpoll_window.abstime);
 }
 
 
@@ -3146,11 +3160,18 @@ workq_aio_unpark_select_req_or_park_and_unlock(proc_t p, workq_aio_t wq_aio,
 	WQ_AIO_TRACE_WQ(AIO_WQ_aio_select_req | DBG_FUNC_START, wq_aio);
 	thread_freeze_base_pri(get_machthread(uth));
 	workq_aio_thread_set_type(uth, 0);
-	while ((entryp = TAILQ_FIRST(&wq_aio->wa_aioq_entries))) {
+	while ((entryp = TAILQ_FIRST(&wq_aio->wa_aioq_entries)) ||
+	    aio_ring_has_work_locked(wq_aio)) {
 		if (__improbable(_wq_exiting(wq_aio))) {
 			break;
 		}
 
+		if (entryp == NULL) {
+			/* drops and retakes the aio proc lock */
+			aio_ring_process_locked(p, wq_aio);
+			continue;
+		}
+
 		TAILQ_REMOVE(&wq_aio->wa_aioq_entries, entryp, aio_workq_link);
 		entryp->aio_workq_link.tqe_prev = NULL; /* Not on a workq */
 
@@ -3395,3 +3416,766 @@ workq_aio_entry_remove_locked(struct proc *p, aio_workq_entry *entryp)
 
 	return true;
 }
+
+#pragma mark aio rings
+
+/*
+ * aio rings (see <sys/aio_private.h>) are serviced by the per process aio
+ * workqueue threads.  Those run in the address space of the process, so the
+ * shared region is accessed with copyin()/copyout(): a process that unmaps
+ * or corrupts its ring only loses its own completions.
+ *
+ * Locking:
+ *
+ * - ar_lock serializes accesses to the shared indices: fetching SQEs,
+ *   posting CQEs and polling the SQ.  It is never held across the I/O.
+ *
+ * - the aio proc lock protects wa_ring, ar_reqq, ar_runq, ar_running
+ *   and ar_dead.
+ *
+ * Workers hold a reference on the ring while they run a chain.  When the
+ * ring is torn down, the chains waiting to run are completed with ECANCELED,
+ * and the workers running chains are aborted (safely) so that a RECV or READ
+ * blocked in the kernel returns: the rest of their chain is cancelled.
+ *
+ * Every SQE fetched reserves a CQ slot (ar_cq_reserved) until its completion
+ * is posted, and SQEs are only fetched when the CQ has room for them, which
+ * means that the CQ never overflows unless the process corrupts cq_head.
+ */
+
+struct aio_ring_req {
+	TAILQ_ENTRY(aio_ring_req) arr_link;
+	thread_t                  arr_thread;     /* worker running the chain */
+	uint32_t                  arr_count;
+	errno_t                   arr_error;      /* fail the chain without running it */
+	struct aio_ring_sqe       arr_sqes[AIO_RING_LINK_MAX];
+};
+
+TAILQ_HEAD(aio_ring_req_head, aio_ring_req);
+
+struct aio_ring {
+	lck_mtx_t                 ar_lock;
+	os_refcnt_t               ar_refcount;
+
+	/* Initialized and never changed, safe to access */
+	user_addr_t               ar_uaddr;
+	user_addr_t               ar_cq_uaddr;
+	uint32_t                  ar_sq_mask;
+	uint32_t                  ar_cq_mask;
+	int                       ar_kqfd;
+	uint64_t                  ar_kqident;
+
+	/* ar_lock */
+	uint32_t                  ar_sq_head;
+	uint32_t                  ar_sq_flags;
+	uint32_t                  ar_cq_tail;
+	uint32_t                  ar_cq_reserved;
+	uint32_t                  ar_cq_overflow;
+	uint32_t                  ar_waiters;
+	bool                      ar_chain_broken; /* cancel SQEs up to the end of the chain */
+
+	/* aio proc lock */
+	bool                      ar_dead;
+	uint32_t                  ar_running;
+	struct aio_ring_req_head  ar_reqq;
+	struct aio_ring_req_head  ar_runq;
+};
+
+extern boolean_t current_thread_aborted(void);
+
+static LCK_GRP_DECLARE(aio_ring_lck_grp, "aio_ring");
+static KALLOC_TYPE_DEFINE(aio_ring_req_zone, struct aio_ring_req, KT_DEFAULT);
+os_refgrp_decl(static, aio_ring_refgrp, "aio_ring", NULL);
+
+#define AIO_RING_SHARED_OFFSET(field)   offsetof(struct aio_ring_shared, field)
+
+static int
+aio_ring_load(struct aio_ring *ring, size_t offset, uint32_t *value)
+{
+	return copyin(ring->ar_uaddr + offset, value, sizeof(*value));
+}
+
+static int
+aio_ring_store(struct aio_ring *ring, size_t offset, uint32_t value)
+{
+	return copyout(&value, ring->ar_uaddr + offset, sizeof(value));
+}
+
+static struct aio_ring *
+aio_ring_get(proc_t p)
+{
+	workq_aio_t wq_aio = proc_get_aio_wqptr(p);
+	struct aio_ring *ring = NULL;
+
+	if (wq_aio == NULL) {
+		return NULL;
+	}
+
+	aio_proc_lock_spin(p);
+	ring = wq_aio->wa_ring;
+	if (ring) {
+		os_ref_retain(&ring->ar_refcount);
+	}
+	aio_proc_unlock(p);
+
+	return ring;
+}
+
+static void
+aio_ring_release(struct aio_ring *ring)
+{
+	if (os_ref_release(&ring->ar_refcount) == 0) {
+		lck_mtx_destroy(&ring->ar_lock, &aio_ring_lck_grp);
+		kfree_type(struct aio_ring, ring);
+	}
+}
+
+static void
+aio_ring_free_reqs(struct aio_ring_req_head *reqs)
+{
+	struct aio_ring_req *req, *tmp;
+
+	TAILQ_FOREACH_SAFE(req, reqs, arr_link, tmp) {
+		TAILQ_REMOVE(reqs, req, arr_link);
+		zfree(aio_ring_req_zone, req);
+	}
+}
+
+/*
+ * Pull the SQEs published by the process, as long as the CQ has room for
+ * their completions, and group them into chains.
+ *
+ * A chain ends with an SQE without AIO_RING_SQE_LINK, or with the last SQE
+ * published.  A chain that doesn't fit in the CQ yet is left on the SQ.
+ */
+static uint32_t
+aio_ring_fetch_locked(struct aio_ring *ring, struct aio_ring_req_head *reqs)
+{
+	struct aio_ring_req *req = NULL;
+	uint32_t sq_tail, cq_head, avail, used, room;
+	uint32_t fetched = 0;
+
+	LCK_MTX_ASSERT(&ring->ar_lock, LCK_MTX_ASSERT_OWNED);
+
+	if (aio_ring_load(ring, AIO_RING_SHARED_OFFSET(sq_tail), &sq_tail) ||
+	    aio_ring_load(ring, AIO_RING_SHARED_OFFSET(cq_head), &cq_head)) {
+		return 0;
+	}
+
+	avail = sq_tail - ring->ar_sq_head;
+	if (avail > ring->ar_sq_mask + 1) {
+		/* bogus sq_tail, ignore it until the process fixes it */
+		return 0;
+	}
+
+	used = MIN(ring->ar_cq_tail - cq_head, ring->ar_cq_mask + 1);
+	used += ring->ar_cq_reserved;
+	room = used < ring->ar_cq_mask + 1 ? ring->ar_cq_mask + 1 - used : 0;
+
+	while (avail > 0 && room > 0) {
+		struct aio_ring_sqe *sqe;
+		user_addr_t uaddr;
+
+		if (req == NULL) {
+			req = zalloc_flags(aio_ring_req_zone, Z_WAITOK | Z_NOFAIL);
+			req->arr_count = 0;
+			req->arr_error = ring->ar_chain_broken ? ECANCELED : 0;
+		}
+
+		uaddr = ring->ar_uaddr + AIO_RING_SQ_OFFSET +
+		    (ring->ar_sq_head & ring->ar_sq_mask) * sizeof(*sqe);
+		sqe = &req->arr_sqes[req->arr_count];
+		if (copyin(uaddr, sqe, sizeof(*sqe))) {
+			break;
+		}
+
+		req->arr_count++;
+		ring->ar_sq_head++;
+		ring->ar_cq_reserved++;
+		fetched++;
+		avail--;
+		room--;
+
+		if ((sqe->flags & AIO_RING_SQE_LINK) && avail > 0) {
+			if (req->arr_count < AIO_RING_LINK_MAX) {
+				continue;
+			}
+			/* fail this part of the chain, and cancel the rest of it */
+			if (req->arr_error == 0) {
+				req->arr_error = E2BIG;
+			}
+			ring->ar_chain_broken = true;
+		} else {
+			ring->ar_chain_broken = false;
+		}
+
+		TAILQ_INSERT_TAIL(reqs, req, arr_link);
+		req = NULL;
+	}
+
+	if (req) {
+		/* the rest of the chain will be fetched with its head */
+		ring->ar_sq_head -= req->arr_count;
+		ring->ar_cq_reserved -= req->arr_count;
+		fetched -= req->arr_count;
+		zfree(aio_ring_req_zone, req);
+	}
+
+	if (fetched) {
+		aio_ring_store(ring, AIO_RING_SHARED_OFFSET(sq_head),
+		    ring->ar_sq_head);
+		if (ring->ar_sq_flags & AIO_RING_SQ_NEED_WAKEUP) {
+			ring->ar_sq_flags &= ~AIO_RING_SQ_NEED_WAKEUP;
+			aio_ring_store(ring, AIO_RING_SHARED_OFFSET(sq_flags),
+			    ring->ar_sq_flags);
+		}
+	}
+
+	return fetched;
+}
+
+/*
+ * Fetch the pending SQEs and hand them to the aio workqueue.
+ *
+ * Workers call this every time they complete a chain, which is what keeps
+ * a busy ring going without system calls.  The last worker to go idle polls
+ * the SQ for aio_ring_sqpoll_window before asking for a wakeup.
+ */
+static uint32_t
+aio_ring_submit(proc_t p, struct aio_ring *ring, bool worker)
+{
+	struct aio_ring_req_head reqs = TAILQ_HEAD_INITIALIZER(reqs);
+	struct aio_ring_req *req;
+	uint64_t deadline = 0;
+	uint32_t fetched;
+
+	for (;;) {
+		lck_mtx_lock(&ring->ar_lock);
+		fetched = aio_ring_fetch_locked(ring, &reqs);
+		if (fetched || !worker || ring->ar_cq_reserved) {
+			break;
+		}
+
+		if (deadline == 0) {
+			deadline = mach_absolute_time() + aio_ring_sqpoll_window.abstime;
+		} else if (mach_absolute_time() >= deadline) {
+			ring->ar_sq_flags |= AIO_RING_SQ_NEED_WAKEUP;
+			aio_ring_store(ring, AIO_RING_SHARED_OFFSET(sq_flags),
+			    ring->ar_sq_flags);
+			/*
+			 * Pairs with the barrier the process issues between
+			 * storing sq_tail and loading sq_flags.
+			 */
+			os_atomic_thread_fence(seq_cst);
+			fetched = aio_ring_fetch_locked(ring, &reqs);
+			break;
+		}
+		lck_mtx_unlock(&ring->ar_lock);
+	}
+	lck_mtx_unlock(&ring->ar_lock);
+
+	if (fetched == 0) {
+		return 0;
+	}
+
+	KERNEL_DEBUG(BSDDBG_CODE(DBG_BSD_AIO, AIO_ring_submit) | DBG_FUNC_NONE,
+	    VM_KERNEL_ADDRPERM(p), VM_KERNEL_ADDRPERM(ring), fetched, worker, 0);
+
+	aio_proc_lock(p);
+	if (__improbable(ring->ar_dead)) {
+		aio_proc_unlock(p);
+		aio_ring_free_reqs(&reqs);
+		return fetched;
+	}
+
+	/* wake up one thread per chain, the last one drops the lock */
+	while ((req = TAILQ_FIRST(&reqs))) {
+		TAILQ_REMOVE(&reqs, req, arr_link);
+		TAILQ_INSERT_TAIL(&ring->ar_reqq, req, arr_link);
+		if (TAILQ_EMPTY(&reqs)) {
+			break;
+		}
+		workq_aio_wakeup_thread(p);
+	}
+	workq_aio_wakeup_thread_and_unlock(p);
+
+	return fetched;
+}
+
+static void
+aio_ring_notify_kevent(proc_t p, struct aio_ring *ring)
+{
+	struct kevent_qos_s kev = {
+		.ident  = ring->ar_kqident,
+		.filter = EVFILT_USER,
+		.fflags = NOTE_TRIGGER,
+	};
+	struct fileproc *fp;
+
+	if (fp_get_ftype(p, ring->ar_kqfd, DTYPE_KQUEUE, EBADF, &fp) == 0) {
+		/* fails with ENOENT if the process didn't add the knote */
+		(void)kevent_register((struct kqueue *)fp_get_data(fp), &kev, NULL);
+		fp_drop(p, ring->ar_kqfd, fp, 0);
+	}
+}
+
+static void
+aio_ring_complete(proc_t p, struct aio_ring *ring,
+    const struct aio_ring_cqe *cqes, uint32_t count)
+{
+	bool wake;
+
+	lck_mtx_lock(&ring->ar_lock);
+
+	for (uint32_t i = 0; i < count; i++) {
+		user_addr_t uaddr = ring->ar_cq_uaddr +
+		    (ring->ar_cq_tail & ring->ar_cq_mask) * sizeof(cqes[i]);
+
+		if (copyout(&cqes[i], uaddr, sizeof(cqes[i])) == 0) {
+			ring->ar_cq_tail++;
+		} else {
+			ring->ar_cq_overflow++;
+		}
+	}
+	ring->ar_cq_reserved -= count;
+
+	/* the CQEs must be visible before the tail that publishes them */
+	os_atomic_thread_fence(release);
+	aio_ring_store(ring, AIO_RING_SHARED_OFFSET(cq_tail), ring->ar_cq_tail);
+	if (__improbable(ring->ar_cq_overflow)) {
+		aio_ring_store(ring, AIO_RING_SHARED_OFFSET(cq_overflow),
+		    ring->ar_cq_overflow);
+	}
+	wake = ring->ar_waiters > 0;
+
+	lck_mtx_unlock(&ring->ar_lock);
+
+	KERNEL_DEBUG(BSDDBG_CODE(DBG_BSD_AIO, AIO_ring_complete) | DBG_FUNC_NONE,
+	    VM_KERNEL_ADDRPERM(p), VM_KERNEL_ADDRPERM(ring), count, wake, 0);
+
+	if (wake) {
+		wakeup(&ring->ar_cq_tail);
+	}
+	if (ring->ar_kqfd >= 0) {
+		aio_ring_notify_kevent(p, ring);
+	}
+}
+
+static int
+aio_ring_do_fsync(proc_t p, const struct aio_ring_sqe *sqe, vfs_context_t ctx)
+{
+	struct fileproc *fp;
+	vnode_t vp;
+	int error;
+
+	error = fp_get_ftype(p, sqe->fd, DTYPE_VNODE, ENOTSUP, &fp);
+	if (error) {
+		return error;
+	}
+	vp = fp_get_data(fp);
+
+	if ((error = vnode_getwithref(vp)) == 0) {
+		error = VNOP_FSYNC(vp, (sqe->op_flags & AIO_RING_FSYNC_DATASYNC) ?
+		    MNT_DWAIT : MNT_WAIT, ctx);
+		(void)vnode_put(vp);
+	}
+
+	fp_drop(p, sqe->fd, fp, 0);
+	return error;
+}
+
+/*
+ * Run one SQE on behalf of the process, with the credentials of the
+ * process, like the equivalent system call would.
+ */
+static int
+aio_ring_do_sqe(proc_t p, const struct aio_ring_sqe *sqe, user_ssize_t *retval)
+{
+	vfs_context_t    ctx = vfs_context_current();
+	struct fileproc *fp;
+	off_t            offset = 0;
+	int              flags = 0;
+	int              error;
+
+	if (sqe->__reserved0 || sqe->__reserved1 ||
+	    (sqe->flags & ~AIO_RING_SQE_LINK)) {
+		return EINVAL;
+	}
+
+	switch (sqe->opcode) {
+	case AIO_RING_OP_NOP:
+		return 0;
+	case AIO_RING_OP_FSYNC:
+		if (sqe->op_flags & ~AIO_RING_FSYNC_DATASYNC) {
+			return EINVAL;
+		}
+		return aio_ring_do_fsync(p, sqe, ctx);
+	case AIO_RING_OP_READ:
+	case AIO_RING_OP_WRITE:
+	case AIO_RING_OP_RECV:
+	case AIO_RING_OP_SEND:
+		if (sqe->op_flags || sqe->nbytes > INT_MAX ||
+		    sqe->buf == USER_ADDR_NULL) {
+			return EINVAL;
+		}
+		break;
+	default:
+		return EINVAL;
+	}
+
+	if ((error = fp_lookup(p, sqe->fd, &fp, 0))) {
+		return error;
+	}
+
+	if (sqe->opcode == AIO_RING_OP_RECV || sqe->opcode == AIO_RING_OP_SEND) {
+		if (FILEGLOB_DTYPE(fp->fp_glob) != DTYPE_SOCKET) {
+			error = ENOTSOCK;
+		}
+	} else if (sqe->offset != AIO_RING_OFFSET_CURRENT) {
+		/* same rules as pread(2) and pwrite(2) */
+		if (FILEGLOB_DTYPE(fp->fp_glob) != DTYPE_VNODE ||
+		    vnode_isfifo((vnode_t)fp_get_data(fp))) {
+			error = ESPIPE;
+		} else if (sqe->offset < 0) {
+			error = EINVAL;
+		} else {
+			offset = sqe->offset;
+			flags = FOF_OFFSET;
+		}
+	}
+
+	if (error) {
+		/* nothing */
+	} else if (sqe->opcode == AIO_RING_OP_READ ||
+	    sqe->opcode == AIO_RING_OP_RECV) {
+		if (fp->fp_glob->fg_flag & FREAD) {
+			error = dofileread(ctx, fp, sqe->buf, sqe->nbytes,
+			    offset, flags, retval);
+		} else {
+			error = EBADF;
+		}
+	} else {
+		if (fp->fp_glob->fg_flag & FWRITE) {
+			if (fp->fp_glob->fg_flag & O_APPEND) {
+				flags = 0;
+			}
+			error = dofilewrite(ctx, fp, sqe->buf, sqe->nbytes,
+			    offset, flags, retval);
+		} else {
+			error = EBADF;
+		}
+	}
+
+	fp_drop(p, sqe->fd, fp, 0);
+	return error;
+}
+
+/*
+ * Run a chain: the first SQE that fails or transfers less than requested
+ * cancels the SQEs that follow it.
+ */
+static void
+aio_ring_execute(proc_t p, struct aio_ring *ring, struct aio_ring_req *req)
+{
+	struct aio_ring_cqe cqes[AIO_RING_LINK_MAX] = { };
+	errno_t chain_error = req->arr_error;
+
+	for (uint32_t i = 0; i < req->arr_count; i++) {
+		const struct aio_ring_sqe *sqe = &req->arr_sqes[i];
+		user_ssize_t retval = 0;
+		errno_t error = chain_error;
+
+		if (error == 0 && os_atomic_load(&ring->ar_dead, relaxed)) {
+			error = chain_error = ECANCELED;
+		}
+		if (error == 0) {
+			error = aio_ring_do_sqe(p, sqe, &retval);
+			if ((error == EINTR || error == ERESTART) &&
+			    os_atomic_load(&ring->ar_dead, relaxed)) {
+				/* interrupted by aio_ring_teardown() */
+				error = ECANCELED;
+			}
+			if (error || (sqe->opcode != AIO_RING_OP_NOP &&
+			    sqe->opcode != AIO_RING_OP_FSYNC &&
+			    (user_size_t)retval < sqe->nbytes)) {
+				chain_error = ECANCELED;
+			}
+		}
+
+		cqes[i].user_data = sqe->user_data;
+		cqes[i].result = error ? -(int64_t)error : (int64_t)retval;
+	}
+
+	aio_ring_complete(p, ring, cqes, req->arr_count);
+}
+
+static bool
+aio_ring_has_work_locked(workq_aio_t wq_aio)
+{
+	struct aio_ring *ring = wq_aio->wa_ring;
+
+	return ring && !TAILQ_EMPTY(&ring->ar_reqq);
+}
+
+/*
+ * Called by an aio workqueue thread with the aio proc lock held,
+ * returns with the lock held (spin).
+ */
+static void
+aio_ring_process_locked(proc_t p, workq_aio_t wq_aio)
+{
+	struct aio_ring *ring = wq_aio->wa_ring;
+	struct aio_ring_req *req;
+	bool dead;
+
+	ASSERT_AIO_PROC_LOCK_OWNED(p);
+
+	req = TAILQ_FIRST(&ring->ar_reqq);
+	TAILQ_REMOVE(&ring->ar_reqq, req, arr_link);
+	req->arr_thread = current_thread();
+	TAILQ_INSERT_TAIL(&ring->ar_runq, req, arr_link);
+	ring->ar_running++;
+	os_ref_retain(&ring->ar_refcount);
+	aio_proc_unlock(p);
+
+	aio_ring_execute(p, ring, req);
+
+	aio_proc_lock_spin(p);
+	TAILQ_REMOVE(&ring->ar_runq, req, arr_link);
+	dead = ring->ar_dead;
+	aio_proc_unlock(p);
+
+	zfree(aio_ring_req_zone, req);
+	if (dead) {
+		/*
+		 * Consume a safe abort from aio_ring_teardown() that didn't
+		 * interrupt any wait, so that it doesn't hit unrelated work.
+		 */
+		(void)current_thread_aborted();
+	} else {
+		aio_ring_submit(p, ring, true);
+	}
+
+	aio_proc_lock_spin(p);
+	if (--ring->ar_running == 0 && ring->ar_dead) {
+		wakeup(&ring->ar_running);
+	}
+	aio_ring_release(ring);
+}
+
+/*
+ * Detach the ring of the process, and cancel its chains: the ones nobody
+ * started yet are completed with ECANCELED, and the workers running the
+ * other ones are interrupted, which cancels the rest of their chain.
+ *
+ * When the process exits, this waits for the running chains so that
+ * nothing touches the shared region after this returns.  When the process
+ * unregisters the ring, the wait can be interrupted (EINTR), in which case
+ * the cancelled chains still running post their completions later.
+ */
+static int
+aio_ring_teardown(proc_t p, bool exiting)
+{
+	struct aio_ring_req_head reqs = TAILQ_HEAD_INITIALIZER(reqs);
+	workq_aio_t wq_aio = proc_get_aio_wqptr(p);
+	struct aio_ring_req *req;
+	struct aio_ring *ring;
+	int error = 0;
+
+	if (wq_aio == NULL) {
+		return 0;
+	}
+
+	aio_proc_lock(p);
+	ring = wq_aio->wa_ring;
+	if (ring == NULL) {
+		aio_proc_unlock(p);
+		return 0;
+	}
+
+	wq_aio->wa_ring = NULL;
+	os_atomic_store(&ring->ar_dead, true, relaxed);
+	TAILQ_CONCAT(&reqs, &ring->ar_reqq, arr_link);
+	TAILQ_FOREACH(req, &ring->ar_runq, arr_link) {
+		thread_abort_safely(req->arr_thread);
+	}
+	aio_proc_unlock(p);
+
+	/*
+	 * Kick the threads waiting in aio_ring_enter(): taking ar_lock
+	 * guarantees they either see ar_dead or are already asleep.
+	 */
+	lck_mtx_lock(&ring->ar_lock);
+	lck_mtx_unlock(&ring->ar_lock);
+	wakeup(&ring->ar_cq_tail);
+
+	if (exiting) {
+		aio_ring_free_reqs(&reqs);
+	} else {
+		while ((req = TAILQ_FIRST(&reqs))) {
+			TAILQ_REMOVE(&reqs, req, arr_link);
+			req->arr_error = ECANCELED;
+			aio_ring_execute(p, ring, req);
+			zfree(aio_ring_req_zone, req);
+		}
+	}
+
+	aio_proc_lock(p);
+	while (ring->ar_running) {
+		error = msleep(&ring->ar_running, aio_proc_mutex(p),
+		    exiting ? PRIBIO : PRIBIO | PCATCH, "aio_ring_teardown", 0);
+		if (error) {
+			error = EINTR;
+			break;
+		}
+	}
+	aio_proc_unlock(p);
+
+	aio_ring_release(ring);
+	return error;
+}
+
+/*
+ * aio_ring_setup - register the submission / completion ring region
+ * of the process.  Only one ring can be registered at a time.
+ */
+int
+aio_ring_setup(proc_t p, struct aio_ring_setup_args *uap, __unused int *retval)
+{
+	struct aio_ring_params params;
+	struct aio_ring_shared shared = {
+		.sq_flags = AIO_RING_SQ_NEED_WAKEUP,
+	};
+	struct aio_ring *ring;
+	workq_aio_t wq_aio;
+	int error;
+
+	if (!bootarg_aio_new_workq) {
+		return ENOTSUP;
+	}
+
+	if ((error = copyin(uap->params, &params, sizeof(params)))) {
+		return error;
+	}
+
+	if (params.flags != 0 ||
+	    params.sq_entries == 0 ||
+	    params.sq_entries > AIO_RING_MAX_ENTRIES ||
+	    !powerof2(params.sq_entries) ||
+	    params.cq_entries < MAX(params.sq_entries, AIO_RING_LINK_MAX) ||
+	    params.cq_entries > 2 * AIO_RING_MAX_ENTRIES ||
+	    !powerof2(params.cq_entries)) {
+		return EINVAL;
+	}
+
+	if (params.ring_addr == 0 ||
+	    (params.ring_addr & PAGE_MASK) ||
+	    params.ring_size < AIO_RING_SIZE(params.sq_entries, params.cq_entries)) {
+		return EINVAL;
+	}
+
+	if (params.kq_fd >= 0) {
+		struct fileproc *fp;
+
+		error = fp_get_ftype(p, params.kq_fd, DTYPE_KQUEUE, EBADF, &fp);
+		if (error) {
+			return error;
+		}
+		fp_drop(p, params.kq_fd, fp, 0);
+	}
+
+	/* this also checks that the header is mapped and writeable */
+	if ((error = copyout(&shared, (user_addr_t)params.ring_addr, sizeof(shared)))) {
+		return error;
+	}
+
+	workq_aio_prepare(p);
+
+	ring = kalloc_type(struct aio_ring, Z_WAITOK | Z_ZERO | Z_NOFAIL);
+	lck_mtx_init(&ring->ar_lock, &aio_ring_lck_grp, LCK_ATTR_NULL);
+	os_ref_init(&ring->ar_refcount, &aio_ring_refgrp);
+	ring->ar_uaddr = (user_addr_t)params.ring_addr;
+	ring->ar_cq_uaddr = ring->ar_uaddr + AIO_RING_CQ_OFFSET(params.sq_entries);
+	ring->ar_sq_mask = params.sq_entries - 1;
+	ring->ar_cq_mask = params.cq_entries - 1;
+	ring->ar_kqfd = params.kq_fd >= 0 ? params.kq_fd : -1;
+	ring->ar_kqident = params.kq_ident;
+	ring->ar_sq_flags = AIO_RING_SQ_NEED_WAKEUP;
+	TAILQ_INIT(&ring->ar_reqq);
+	TAILQ_INIT(&ring->ar_runq);
+
+	wq_aio = proc_get_aio_wqptr(p);
+	aio_proc_lock(p);
+	if (wq_aio == NULL || _wq_exiting(wq_aio)) {
+		error = ESRCH;
+	} else if (wq_aio->wa_ring) {
+		error = EBUSY;
+	} else {
+		wq_aio->wa_ring = ring;
+	}
+	aio_proc_unlock(p);
+
+	if (error) {
+		aio_ring_release(ring);
+	}
+	return error;
+}
+
+/*
+ * aio_ring_enter - submit the SQEs published on the ring of the process,
+ * and possibly wait until at least min_complete CQEs are available.
+ *
+ * to_submit is only a hint: every published SQE the CQ has room for is
+ * submitted.  Returns the number of SQEs submitted by this call.
+ */
+int
+aio_ring_enter(proc_t p, struct aio_ring_enter_args *uap, int *retval)
+{
+	struct aio_ring *ring;
+	uint32_t cq_head;
+	int error = 0;
+
+	if (uap->flags & ~(AIO_RING_ENTER_GETEVENTS | AIO_RING_ENTER_UNREGISTER)) {
+		return EINVAL;
+	}
+
+	ring = aio_ring_get(p);
+	if (ring == NULL) {
+		return ENXIO;
+	}
+
+	if (uap->flags & AIO_RING_ENTER_UNREGISTER) {
+		error = aio_ring_teardown(p, false);
+		aio_ring_release(ring);
+		*retval = 0;
+		return error;
+	}
+
+	*retval = (int)aio_ring_submit(p, ring, false);
+
+	if ((uap->flags & AIO_RING_ENTER_GETEVENTS) && uap->min_complete) {
+		lck_mtx_lock(&ring->ar_lock);
+		for (;;) {
+			error = aio_ring_load(ring, AIO_RING_SHARED_OFFSET(cq_head), &cq_head);
+			if (error || ring->ar_cq_tail - cq_head >= uap->min_complete) {
+				break;
+			}
+			if (os_atomic_load(&ring->ar_dead, relaxed)) {
+				error = ENXIO;
+				break;
+			}
+
+			ring->ar_waiters++;
+			error = msleep(&ring->ar_cq_tail, &ring->ar_lock,
+			    PRIBIO | PCATCH, "aio_ring_enter", 0);
+			ring->ar_waiters--;
+			if (error) {
+				break;
+			}
+		}
+		lck_mtx_unlock(&ring->ar_lock);
+	}
+
+	aio_ring_release(ring);
+	return error;
+}
@@ -235,8 +235,22 @@ enum {
 static void kqworkloop_update_threads_qos(struct kqworkloop *kqwl, int op, kq_index_t qos);
 static int kqworkloop_end_processing(struct kqworkloop *kqwl, int flags, int kevent_flags);
 
-static struct knote *knote_alloc(void);
+/*
+ * Stash of preallocated knotes used while registering a changelist,
+ * so that the knotes for a batch of EV_ADD changes come out of the
+ * knote zone with a single zalloc_n() rather than one allocation each.
+ */
+struct knote_stash {
+	zstack_t        ks_knotes;
+	uint32_t        ks_remaining;
+};
+#define KNOTE_STASH_BATCH_MAX   16
+
+static struct knote *knote_alloc(struct knote_stash *ks);
 static void knote_free(struct knote *kn);
+static void knote_stash_release(struct knote_stash *ks);
+static int kevent_register_ext(struct kqueue *kq, struct kevent_qos_s *kev,
+    struct knote **kn_out, struct knote_stash *ks);
 static int kq_add_knote(struct kqueue *kq, struct knote *kn,
     struct knote_lock_ctx *knlc, struct proc *p);
 static struct knote *kq_find_knote_and_kq_lock(struct kqueue *kq,
@@ -256,8 +270,8 @@ static void knote_drop(kqueue_t kqu, struct knote *kn, struct knote_lock_ctx *kn
 static void knote_adjust_qos(struct kqueue *kq, struct knote *kn, int result);
 static void knote_reset_priority(kqueue_t kqu, struct knote *kn, pthread_priority_t pp);
 
-static ZONE_DEFINE(knote_zone, "knote zone",
-    sizeof(struct knote), ZC_CACHING | ZC_ZFREE_CLEARMEM);
+ZONE_DEFINE_ID(ZONE_ID_KNOTE, "knote zone", struct knote,
+    ZC_CACHING | ZC_ZFREE_CLEARMEM);
 static ZONE_DEFINE(kqfile_zone, "kqueue file zone",
     sizeof(struct kqfile), ZC_ZFREE_CLEARMEM);
 static ZONE_DEFINE(kqworkq_zone, "kqueue workq zone",
@@ -2611,7 +2625,7 @@ kdp_workloop_sync_wait_find_owner(__assert_only thread_t thread,
 {
 	struct knote *kn = (struct knote *)event;
 
-	zone_require(knote_zone, kn);
+	zone_id_require(ZONE_ID_KNOTE, sizeof(struct knote), kn);
 
 	assert(kn->kn_thread == thread);
 
@@ -4005,6 +4019,13 @@ kevent_register_wait_return(struct _kevent_register *cont_args)
 int
 kevent_register(struct kqueue *kq, struct kevent_qos_s *kev,
     struct knote **kn_out)
+{
+	return kevent_register_ext(kq, kev, kn_out, NULL);
+}
+
+static int
+kevent_register_ext(struct kqueue *kq, struct kevent_qos_s *kev,
+    struct knote **kn_out, struct knote_stash *ks)
 {
 	struct proc *p = kq->kq_p;
 	const struct filterops *fops;
@@ -4090,7 +4111,7 @@ restart:
 			}
 		}
 
-		kn = knote_alloc();
+		kn = knote_alloc(ks);
 		kn->kn_fp = knote_fp;
 		kn->kn_is_fd = fops->f_isfd;
 		kn->kn_kq_packed = VM_PACK_POINTER((vm_offset_t)kq, KNOTE_KQ_PACKED);
@@ -6882,15 +6903,23 @@ kq_add_knote(struct kqueue *kq, struct knote *kn, struct knote_lock_ctx *knlc,
 		/* knote is fd based */
 
 		if ((u_int)fdp->fd_knlistsize <= kn->kn_id) {
+			uint64_t limit = (uint64_t)proc_limitgetcur_nofile(p);
 			u_int size = 0;
 
 			/* Make sure that fd stays below current process's soft limit AND system allowed per-process limits */
-			if (kn->kn_id >= (uint64_t)proc_limitgetcur_nofile(p)) {
+			if (kn->kn_id >= limit) {
 				ret = EINVAL;
 				goto out_locked;
 			}
-			/* have to grow the fd_knlist */
-			size = fdp->fd_knlistsize;
+			/*
+			 * have to grow the fd_knlist: double it (up to the limit)
+			 * so that registering knotes on many descriptors doesn't
+			 * reallocate and copy it every KQEXTENT descriptors.
+			 */
+			size = MAX((u_int)fdp->fd_knlistsize * 2, KQEXTENT);
+			if (size > limit) {
+				size = (u_int)limit;
+			}
 			while (size <= kn->kn_id) {
 				size += KQEXTENT;
 			}
@@ -7300,16 +7329,33 @@ knote_fops(struct knote *kn)
 }
 
 static struct knote *
-knote_alloc(void)
+knote_alloc(struct knote_stash *ks)
 {
-	return zalloc_flags(knote_zone, Z_WAITOK | Z_ZERO | Z_NOFAIL);
+	if (ks == NULL || ks->ks_remaining <= 1) {
+		return zalloc_id(ZONE_ID_KNOTE, Z_WAITOK | Z_ZERO | Z_NOFAIL);
+	}
+
+	if (zstack_empty(ks->ks_knotes)) {
+		ks->ks_knotes = zalloc_n(ZONE_ID_KNOTE,
+		    MIN(ks->ks_remaining, KNOTE_STASH_BATCH_MAX),
+		    Z_WAITOK | Z_ZERO | Z_NOFAIL);
+	}
+	return zstack_pop(&ks->ks_knotes);
 }
 
 static void
 knote_free(struct knote *kn)
 {
 	assert((kn->kn_status & (KN_LOCKED | KN_POSTING)) == 0);
-	zfree(knote_zone, kn);
+	zfree_id(ZONE_ID_KNOTE, kn);
+}
+
+static void
+knote_stash_release(struct knote_stash *ks)
+{
+	if (!zstack_empty(ks->ks_knotes)) {
+		zfree_n(ZONE_ID_KNOTE, ks->ks_knotes);
+	}
 }
 
 #pragma mark - syscalls: kevent, kevent64, kevent_qos, kevent_id
@@ -7480,107 +7526,151 @@ kevent_put_data_size(unsigned int flags, kevent_ctx_t kectx)
 	}
 }
 
+/*
+ * Changes are copied in, and events copied out, up to KEVENT_BATCH_MAX
+ * at a time through a kevent batch living on the kernel stack, which saves
+ * a copyin or copyout per kevent when registering or returning many.
+ */
+#define KEVENT_BATCH_MAX        8
+
+union kevent_batch {
+	struct kevent_qos_s     kb_qos[KEVENT_BATCH_MAX];
+	struct kevent64_s       kb_kev64[KEVENT_BATCH_MAX];
+	struct user64_kevent    kb_ukev64[KEVENT_BATCH_MAX];
+	struct user32_kevent    kb_ukev32[KEVENT_BATCH_MAX];
+};
+
+/*!
+ * @function kevent_user_size
+ *
+ * @brief
+ * Returns the size of a kevent in the user format selected by @c flags.
+ */
+static inline size_t
+kevent_user_size(unsigned int flags)
+{
+	if ((flags & (KEVENT_FLAG_LEGACY32 | KEVENT_FLAG_LEGACY64)) == 0) {
+		return sizeof(struct kevent_qos_s);
+	}
+	if (flags & KEVENT_FLAG_LEGACY64) {
+		return sizeof(struct kevent64_s);
+	}
+	if (flags & KEVENT_FLAG_PROC64) {
+		return sizeof(struct user64_kevent);
+	}
+	return sizeof(struct user32_kevent);
+}
+
 /*!
- * @function kevent_legacy_copyin
+ * @function kevent_changelist_copyin
  *
  * @brief
- * Handles the copyin of a kevent/kevent64 event.
+ * Copies in the next changes of a changelist into a kevent batch.
+ *
+ * @discussion
+ * Up to KEVENT_BATCH_MAX changes are copied in with a single copyin
+ * when @c batch is set, or only the next one otherwise.
+ *
+ * If the batched copyin faults, only the next change is copied in,
+ * so that the changes preceding a bad address still get registered.
  */
 static int
-kevent_legacy_copyin(user_addr_t *addrp, struct kevent_qos_s *kevp, unsigned int flags)
+kevent_changelist_copyin(user_addr_t *addrp, int nchanges, bool batch,
+    union kevent_batch *kb, int *countp, unsigned int flags)
 {
+	size_t size = kevent_user_size(flags);
+	int count = batch ? MIN(nchanges, KEVENT_BATCH_MAX) : 1;
 	int error;
 
+	error = copyin(*addrp, (caddr_t)kb, count * size);
+	if (__improbable(error && count > 1)) {
+		count = 1;
+		error = copyin(*addrp, (caddr_t)kb, size);
+	}
+	if (__probable(!error)) {
+		*addrp += count * size;
+		*countp = count;
+	}
+	return error;
+}
+
+/*!
+ * @function kevent_legacy_import
+ *
+ * @brief
+ * Converts a kevent/kevent64 change copied in a kevent batch.
+ */
+static void
+kevent_legacy_import(union kevent_batch *kb, int i,
+    struct kevent_qos_s *kevp, unsigned int flags)
+{
 	assert((flags & (KEVENT_FLAG_LEGACY32 | KEVENT_FLAG_LEGACY64)) != 0);
 
 	if (flags & KEVENT_FLAG_LEGACY64) {
-		struct kevent64_s kev64;
+		struct kevent64_s *kev64 = &kb->kb_kev64[i];
 
-		error = copyin(*addrp, (caddr_t)&kev64, sizeof(kev64));
-		if (__improbable(error)) {
-			return error;
-		}
-		*addrp += sizeof(kev64);
 		*kevp = (struct kevent_qos_s){
-			.ident  = kev64.ident,
-			.filter = kev64.filter,
+			.ident  = kev64->ident,
+			.filter = kev64->filter,
 			/* Make sure user doesn't pass in any system flags */
-			.flags  = kev64.flags & ~EV_SYSFLAGS,
-			.udata  = kev64.udata,
-			.fflags = kev64.fflags,
-			.data   = kev64.data,
-			.ext[0] = kev64.ext[0],
-			.ext[1] = kev64.ext[1],
+			.flags  = kev64->flags & ~EV_SYSFLAGS,
+			.udata  = kev64->udata,
+			.fflags = kev64->fflags,
+			.data   = kev64->data,
+			.ext[0] = kev64->ext[0],
+			.ext[1] = kev64->ext[1],
 		};
 	} else if (flags & KEVENT_FLAG_PROC64) {
-		struct user64_kevent kev64;
+		struct user64_kevent *kev64 = &kb->kb_ukev64[i];
 
-		error = copyin(*addrp, (caddr_t)&kev64, sizeof(kev64));
-		if (__improbable(error)) {
-			return error;
-		}
-		*addrp += sizeof(kev64);
 		*kevp = (struct kevent_qos_s){
-			.ident  = kev64.ident,
-			.filter = kev64.filter,
+			.ident  = kev64->ident,
+			.filter = kev64->filter,
 			/* Make sure user doesn't pass in any system flags */
-			.flags  = kev64.flags & ~EV_SYSFLAGS,
-			.udata  = kev64.udata,
-			.fflags = kev64.fflags,
-			.data   = kev64.data,
+			.flags  = kev64->flags & ~EV_SYSFLAGS,
+			.udata  = kev64->udata,
+			.fflags = kev64->fflags,
+			.data   = kev64->data,
 		};
 	} else {
-		struct user32_kevent kev32;
+		struct user32_kevent *kev32 = &kb->kb_ukev32[i];
 
-		error = copyin(*addrp, (caddr_t)&kev32, sizeof(kev32));
-		if (__improbable(error)) {
-			return error;
-		}
-		*addrp += sizeof(kev32);
 		*kevp = (struct kevent_qos_s){
-			.ident  = (uintptr_t)kev32.ident,
-			.filter = kev32.filter,
+			.ident  = (uintptr_t)kev32->ident,
+			.filter = kev32->filter,
 			/* Make sure user doesn't pass in any system flags */
-			.flags  = kev32.flags & ~EV_SYSFLAGS,
-			.udata  = CAST_USER_ADDR_T(kev32.udata),
-			.fflags = kev32.fflags,
-			.data   = (intptr_t)kev32.data,
+			.flags  = kev32->flags & ~EV_SYSFLAGS,
+			.udata  = CAST_USER_ADDR_T(kev32->udata),
+			.fflags = kev32->fflags,
+			.data   = (intptr_t)kev32->data,
 		};
 	}
-
-	return 0;
 }
 
 /*!
- * @function kevent_modern_copyin
+ * @function kevent_modern_import
  *
  * @brief
- * Handles the copyin of a kevent_qos/kevent_id event.
+ * Converts a kevent_qos/kevent_id change copied in a kevent batch.
  */
-static int
-kevent_modern_copyin(user_addr_t *addrp, struct kevent_qos_s *kevp)
+static void
+kevent_modern_import(union kevent_batch *kb, int i, struct kevent_qos_s *kevp)
 {
-	int error = copyin(*addrp, (caddr_t)kevp, sizeof(struct kevent_qos_s));
-	if (__probable(!error)) {
-		/* Make sure user doesn't pass in any system flags */
-		*addrp += sizeof(struct kevent_qos_s);
-		kevp->flags &= ~EV_SYSFLAGS;
-	}
-	return error;
+	*kevp = kb->kb_qos[i];
+	/* Make sure user doesn't pass in any system flags */
+	kevp->flags &= ~EV_SYSFLAGS;
 }
 
 /*!
- * @function kevent_legacy_copyout
+ * @function kevent_legacy_export
  *
  * @brief
- * Handles the copyout of a kevent/kevent64 event.
+ * Converts a kevent/kevent64 event into a kevent batch.
  */
-static int
-kevent_legacy_copyout(struct kevent_qos_s *kevp, user_addr_t *addrp, unsigned int flags)
+static void
+kevent_legacy_export(union kevent_batch *kb, int i,
+    struct kevent_qos_s *kevp, unsigned int flags)
 {
-	int advance;
-	int error;
-
 	assert((flags & (KEVENT_FLAG_LEGACY32 | KEVENT_FLAG_LEGACY64)) != 0);
 
 	/*
@@ -7593,7 +7683,7 @@ kevent_legacy_copyout(struct kevent_qos_s *kevp, user_addr_t *addrp, unsigned in
 	 *       initializers below do not leak kernel info.
 	 */
 	if (flags & KEVENT_FLAG_LEGACY64) {
-		struct kevent64_s kev64 = {
+		kb->kb_kev64[i] = (struct kevent64_s){
 			.ident  = kevp->ident,
 			.filter = kevp->filter,
 			.flags  = kevp->flags,
@@ -7603,8 +7693,6 @@ kevent_legacy_copyout(struct kevent_qos_s *kevp, user_addr_t *addrp, unsigned in
 			.ext[0] = kevp->ext[0],
 			.ext[1] = kevp->ext[1],
 		};
-		advance = sizeof(struct kevent64_s);
-		error = copyout((caddr_t)&kev64, *addrp, advance);
 	} else if (flags & KEVENT_FLAG_PROC64) {
 		/*
 		 * deal with the special case of a user-supplied
@@ -7612,7 +7700,8 @@ kevent_legacy_copyout(struct kevent_qos_s *kevp, user_addr_t *addrp, unsigned in
 		 */
 		uint64_t ident = (kevp->ident == (uintptr_t)-1) ?
 		    (uint64_t)-1LL : (uint64_t)kevp->ident;
-		struct user64_kevent kev64 = {
+
+		kb->kb_ukev64[i] = (struct user64_kevent){
 			.ident  = ident,
 			.filter = kevp->filter,
 			.flags  = kevp->flags,
@@ -7620,10 +7709,8 @@ kevent_legacy_copyout(struct kevent_qos_s *kevp, user_addr_t *addrp, unsigned in
 			.data   = (int64_t) kevp->data,
 			.udata  = (user_addr_t) kevp->udata,
 		};
-		advance = sizeof(kev64);
-		error = copyout((caddr_t)&kev64, *addrp, advance);
 	} else {
-		struct user32_kevent kev32 = {
+		kb->kb_ukev32[i] = (struct user32_kevent){
 			.ident  = (uint32_t)kevp->ident,
 			.filter = kevp->filter,
 			.flags  = kevp->flags,
@@ -7631,9 +7718,24 @@ kevent_legacy_copyout(struct kevent_qos_s *kevp, user_addr_t *addrp, unsigned in
 			.data   = (int32_t)kevp->data,
 			.udata  = (uint32_t)kevp->udata,
 		};
-		advance = sizeof(kev32);
-		error = copyout((caddr_t)&kev32, *addrp, advance);
 	}
+}
+
+/*!
+ * @function kevent_legacy_copyout
+ *
+ * @brief
+ * Handles the copyout of a single kevent/kevent64 event.
+ */
+static int
+kevent_legacy_copyout(struct kevent_qos_s *kevp, user_addr_t *addrp, unsigned int flags)
+{
+	union kevent_batch kb;
+	size_t advance = kevent_user_size(flags);
+	int error;
+
+	kevent_legacy_export(&kb, 0, kevp, flags);
+	error = copyout((caddr_t)&kb, *addrp, advance);
 	if (__probable(!error)) {
 		*addrp += advance;
 	}
@@ -7644,7 +7746,7 @@ kevent_legacy_copyout(struct kevent_qos_s *kevp, user_addr_t *addrp, unsigned in
  * @function kevent_modern_copyout
  *
  * @brief
- * Handles the copyout of a kevent_qos/kevent_id event.
+ * Handles the copyout of a single kevent_qos/kevent_id event.
  */
 OS_ALWAYS_INLINE
 static inline int
@@ -7657,6 +7759,31 @@ kevent_modern_copyout(struct kevent_qos_s *kevp, user_addr_t *addrp)
 	return error;
 }
 
+/*!
+ * @function kevent_eventlist_flush
+ *
+ * @brief
+ * Copies out the events accumulated in the kevent batch of a scan.
+ *
+ * @discussion
+ * Must be called with the kqueue unlocked.
+ */
+static int
+kevent_eventlist_flush(kevent_ctx_t kectx)
+{
+	size_t size = kevent_user_size(kectx->kec_process_flags) *
+	    (size_t)kectx->kec_process_nbatched;
+	int error;
+
+	error = copyout((caddr_t)kectx->kec_process_batch,
+	    kectx->kec_process_eventlist, size);
+	if (__probable(!error)) {
+		kectx->kec_process_eventlist += size;
+	}
+	kectx->kec_process_nbatched = 0;
+	return error;
+}
+
 #pragma mark kevent core implementation
 
 /*!
@@ -7673,18 +7800,26 @@ OS_ALWAYS_INLINE
 static inline int
 kevent_callback_inline(struct kevent_qos_s *kevp, kevent_ctx_t kectx, bool legacy)
 {
-	int error;
+	int i = kectx->kec_process_nbatched;
+	int error = 0;
 
 	assert(kectx->kec_process_noutputs < kectx->kec_process_nevents);
+	assert(i < KEVENT_BATCH_MAX);
 
 	/*
-	 * Copy out the appropriate amount of event data for this user.
+	 * Convert the event to the appropriate format for this user,
+	 * and copy it out with the rest of the batch once that is full
+	 * (kqueue_scan() copies out the remainder before returning).
 	 */
 	if (legacy) {
-		error = kevent_legacy_copyout(kevp, &kectx->kec_process_eventlist,
+		kevent_legacy_export(kectx->kec_process_batch, i, kevp,
 		    kectx->kec_process_flags);
 	} else {
-		error = kevent_modern_copyout(kevp, &kectx->kec_process_eventlist);
+		kectx->kec_process_batch->kb_qos[i] = *kevp;
+	}
+
+	if (++kectx->kec_process_nbatched == KEVENT_BATCH_MAX) {
+		error = kevent_eventlist_flush(kectx);
 	}
 
 	/*
@@ -7946,6 +8081,7 @@ kqueue_scan_continue(void *data, wait_result_t wait_result)
 	kevent_ctx_t kectx = &ut->uu_save.uus_kevent;
 	int error = 0, flags = kectx->kec_process_flags;
 	struct kqueue *kq = data;
+	union kevent_batch kb;
 
 	/*
 	 * only kevent variants call in here, so we know the callback is
@@ -7955,6 +8091,9 @@ kqueue_scan_continue(void *data, wait_result_t wait_result)
 
 	switch (wait_result) {
 	case THREAD_AWAKENED:
+		/* the batch used before blocking went away with its stack */
+		assert(kectx->kec_process_nbatched == 0);
+		kectx->kec_process_batch = &kb;
 		if (__improbable(flags & (KEVENT_FLAG_LEGACY32 | KEVENT_FLAG_LEGACY64))) {
 			error = kqueue_scan(kq, flags, kectx, kevent_legacy_callback);
 		} else {
@@ -8030,9 +8169,18 @@ kqueue_scan(kqueue_t kqu, int flags, kevent_ctx_t kectx,
 		 */
 		if (__probable(error || (flags & KEVENT_FLAG_IMMEDIATE))) {
 			kqunlock(kqu);
+			if (kectx->kec_process_nbatched) {
+				int rc = kevent_eventlist_flush(kectx);
+				if (rc && (error == 0 || error == EWOULDBLOCK)) {
+					error = rc;
+				}
+			}
 			return error == EWOULDBLOCK ? 0 : error;
 		}
 
+		/* we only block when no event was returned */
+		assert(kectx->kec_process_nbatched == 0);
+
 		assert((kqu.kq->kq_state & (KQ_WORKQ | KQ_WORKLOOP)) == 0);
 
 		kqu.kqf->kqf_state |= KQ_SLEEP;
@@ -8087,6 +8235,11 @@ kevent_internal(kqueue_t kqu,
     bool legacy)
 {
 	int error = 0, noutputs = 0, register_rc;
+	struct knote_stash ks = { };
+	union kevent_batch kb;
+	int kb_count = 0, kb_index = 0;
+	size_t kev_size = kevent_user_size(flags);
+	bool batch_changes;
 
 	/* only bound threads can receive events on workloops */
 	if (!legacy && (flags & KEVENT_FLAG_WORKLOOP)) {
@@ -8124,21 +8277,45 @@ kevent_internal(kqueue_t kqu,
 		}
 	}
 
+	/*
+	 * Receipts are copied out while the changelist is consumed,
+	 * and callers commonly use the same array for both.
+	 *
+	 * Changes are only copied in ahead of being registered when
+	 * this can't read back a receipt: when the eventlist starts
+	 * at or before the changelist, or is after it.
+	 */
+	batch_changes = nevents == 0 || ueventlist <= changelist ||
+	    ueventlist >= changelist + (user_addr_t)nchanges * kev_size;
+
 	/* register all the change requests the user provided... */
 	while (nchanges > 0 && error == 0) {
 		struct kevent_qos_s kev;
 		struct knote *kn = NULL;
 
+		if (kb_index == kb_count) {
+			error = kevent_changelist_copyin(&changelist, nchanges,
+			    batch_changes, &kb, &kb_count, flags);
+			if (error) {
+				break;
+			}
+			kb_index = 0;
+		}
 		if (legacy) {
-			error = kevent_legacy_copyin(&changelist, &kev, flags);
+			kevent_legacy_import(&kb, kb_index++, &kev, flags);
 		} else {
-			error = kevent_modern_copyin(&changelist, &kev);
-		}
-		if (error) {
-			break;
+			kevent_modern_import(&kb, kb_index++, &kev);
 		}
 
-		register_rc = kevent_register(kqu.kq, &kev, &kn);
+		/*
+		 * The last change may not return (FILTER_REGISTER_WAIT),
+		 * so make sure nothing is left in the stash by then.
+		 */
+		ks.ks_remaining = nchanges;
+		if (nchanges == 1) {
+			knote_stash_release(&ks);
+		}
+		register_rc = kevent_register_ext(kqu.kq, &kev, &kn, &ks);
 		if (__improbable(!legacy && (register_rc & FILTER_REGISTER_WAIT))) {
 			thread_t thread = current_thread();
 
@@ -8206,12 +8383,16 @@ kevent_internal(kqueue_t kqu,
 		nchanges--;
 	}
 
+	knote_stash_release(&ks);
+
 	if ((flags & KEVENT_FLAG_ERROR_EVENTS) == 0 &&
 	    nevents > 0 && noutputs == 0 && error == 0) {
 		kectx->kec_process_flags = flags;
 		kectx->kec_process_nevents = nevents;
 		kectx->kec_process_noutputs = 0;
 		kectx->kec_process_eventlist = ueventlist;
+		kectx->kec_process_batch = &kb;
+		kectx->kec_process_nbatched = 0;
 
 		if (legacy) {
 			error = kqueue_scan(kqu.kq, flags, kectx, kevent_legacy_callback);
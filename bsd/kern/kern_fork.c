@@ -1176,6 +1176,7 @@ forkproc(proc_t parent_proc, cloneproc_flags_t clone_flags)
 #if PSYNCH
 	pth_proc_hashinit(child_proc);
 #endif /* PSYNCH */
+	ulock_proc_init(child_proc);
 
 #if CONFIG_PERSONAS
 	child_proc->p_persona = NULL;
@@ -1468,6 +1468,9 @@ madvise(__unused proc_t p, struct madvise_args *uap, __unused int32_t *retval)
 	case MADV_ZERO:
 		new_behavior = VM_BEHAVIOR_ZERO;
 		break;
+	case MADV_FAULT_AROUND:
+		new_behavior = VM_BEHAVIOR_FAULT_AROUND;
+		break;
 	default:
 		return EINVAL;
 	}
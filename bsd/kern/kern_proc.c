@@ -148,6 +148,7 @@
 #include <security/mac.h>
 #include <sys/socketvar.h>
 #include <sys/kern_memorystatus_freeze.h>
+#include <sys/ulock.h>
 #include <net/necp.h>
 #include <bsm/audit_kevents.h>
 
@@ -1150,6 +1151,8 @@ proc_free(proc_t proc, proc_ro_t proc_ro)
 
 	zfree_ro(ZONE_ID_PROC_RO, proc_ro);
 
+	ulock_proc_destroy(proc);
+
 	zfree(proc_task_zone, proc);
 }
 
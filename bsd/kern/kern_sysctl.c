@@ -121,6 +121,7 @@
 #include <mach/processor_info.h>
 #include <mach/vm_param.h>
 #include <kern/debug.h>
+#include <kern/kcdata.h>
 #include <kern/mach_param.h>
 #include <kern/task.h>
 #include <kern/thread.h>
@@ -160,6 +161,7 @@
 #include <vm/vm_pageout_xnu.h>
 #include <vm/vm_compressor_algorithms_xnu.h>
 #include <vm/vm_compressor_xnu.h>
+#include <vm/vm_compressor_backing_store_xnu.h>
 #include <sys/imgsrc.h>
 #include <kern/timer_call.h>
 #include <sys/codesign.h>
@@ -643,6 +645,75 @@ sysctl_sched_stats_enable(__unused struct sysctl_oid *oidp, __unused void *arg1,
 
 SYSCTL_PROC(_kern, OID_AUTO, sched_stats_enable, CTLFLAG_LOCKED | CTLFLAG_WR, 0, 0, sysctl_sched_stats_enable, "-", "");
 
+extern size_t sysctl_sched_latency_hist(uint64_t *hist, size_t size);
+
+/*
+ * Histograms of the time threads waited to get on core, summed over all CPUs:
+ * uint64_t counts indexed by [wakeup, preemption][sched bucket][latency bucket],
+ * latency buckets as described for struct thread_group_latency_snapshot.
+ */
+STATIC int
+sysctl_sched_latency(__unused struct sysctl_oid *oidp, __unused void *arg1, __unused int arg2, struct sysctl_req *req)
+{
+	size_t size = sysctl_sched_latency_hist(NULL, 0);
+	uint64_t *hist;
+	int error;
+
+	if (req->oldptr == USER_ADDR_NULL) {
+		req->oldidx = size;
+		return 0;
+	}
+
+	hist = kalloc_data(size, Z_WAITOK | Z_ZERO);
+	sysctl_sched_latency_hist(hist, size);
+	error = SYSCTL_OUT(req, hist, size);
+	kfree_data(hist, size);
+	return error;
+}
+
+SYSCTL_PROC(_kern, OID_AUTO, sched_latency, CTLFLAG_RD | CTLFLAG_LOCKED | CTLTYPE_OPAQUE,
+    0, 0, sysctl_sched_latency, "-", "scheduling latency histograms");
+
+#if CONFIG_THREAD_GROUPS
+STATIC int
+sysctl_sched_latency_thread_groups(__unused struct sysctl_oid *oidp, __unused void *arg1, __unused int arg2, struct sysctl_req *req)
+{
+	struct thread_group_latency_snapshot *tgls;
+	uint32_t n, max;
+	size_t size;
+	int error;
+
+	n = thread_group_sched_latency_snapshot(NULL, 0);
+	if (req->oldptr == USER_ADDR_NULL) {
+		req->oldidx = (size_t)(n + n / 8) * sizeof(*tgls);
+		return 0;
+	}
+
+	if (n == 0) {
+		return 0;
+	}
+
+	/*
+	 * Leave some room for thread groups and buckets showing up meanwhile,
+	 * and fail rather than return a truncated list.
+	 */
+	max = n + n / 8;
+	size = (size_t)max * sizeof(*tgls);
+	tgls = kalloc_data(size, Z_WAITOK | Z_ZERO);
+	n = thread_group_sched_latency_snapshot(tgls, max);
+	if (n > max) {
+		error = ENOMEM;
+	} else {
+		error = SYSCTL_OUT(req, tgls, (size_t)n * sizeof(*tgls));
+	}
+	kfree_data(tgls, size);
+	return error;
+}
+
+SYSCTL_PROC(_kern, OID_AUTO, sched_latency_thread_groups, CTLFLAG_RD | CTLFLAG_LOCKED | CTLTYPE_OPAQUE,
+    0, 0, sysctl_sched_latency_thread_groups, "-", "scheduling latency histograms of each thread group");
+#endif /* CONFIG_THREAD_GROUPS */
+
 extern uint32_t sched_debug_flags;
 SYSCTL_INT(_debug, OID_AUTO, sched, CTLFLAG_RW | CTLFLAG_LOCKED, &sched_debug_flags, 0, "scheduler debug");
 
@@ -4130,6 +4201,35 @@ SYSCTL_PROC(_vm, VM_SWAPUSAGE, swapusage,
 extern int vm_swap_enabled;
 SYSCTL_INT(_vm, OID_AUTO, swap_enabled, CTLFLAG_RD | CTLFLAG_LOCKED, &vm_swap_enabled, 0, "");
 
+STATIC int
+sysctl_swapfile_stats(__unused struct sysctl_oid *oidp, __unused void *arg1, __unused int arg2, struct sysctl_req *req)
+{
+	struct vm_swapfile_stats *vss;
+	uint32_t n, max;
+	size_t size;
+	int error;
+
+	n = vm_swap_stats_snapshot(NULL, 0);
+	if (req->oldptr == USER_ADDR_NULL) {
+		req->oldidx = (size_t)(n + 1) * sizeof(*vss);
+		return 0;
+	}
+
+	max = (uint32_t)MIN(n + 1, req->oldlen / sizeof(*vss));
+	if (max == 0) {
+		return n == 0 ? 0 : ENOMEM;
+	}
+	size = max * sizeof(*vss);
+	vss = kalloc_data(size, Z_WAITOK | Z_ZERO);
+	n = vm_swap_stats_snapshot(vss, max);
+	error = SYSCTL_OUT(req, vss, MIN(n, max) * sizeof(*vss));
+	kfree_data(vss, size);
+	return error;
+}
+
+SYSCTL_PROC(_vm, OID_AUTO, swapfile_stats, CTLFLAG_RD | CTLFLAG_LOCKED | CTLTYPE_OPAQUE,
+    0, 0, sysctl_swapfile_stats, "-", "I/O statistics of each swapfile");
+
 #if DEVELOPMENT || DEBUG
 extern int vm_num_swap_files_config;
 extern int vm_num_swap_files;
@@ -4681,6 +4781,29 @@ SYSCTL_QUAD(_vm, OID_AUTO, compressor_ro_uncompressed_swap_pages_on_disk, CTLFLA
 extern int min_csegs_per_major_compaction;
 SYSCTL_INT(_vm, OID_AUTO, compressor_min_csegs_per_major_compaction, CTLFLAG_RW | CTLFLAG_LOCKED, &min_csegs_per_major_compaction, 0, "");
 
+extern uint32_t vm_compressor_major_compact_threads;
+extern uint32_t vm_compressor_major_compact_threads_max;
+
+STATIC int
+sysctl_compressor_major_compact_threads(__unused struct sysctl_oid *oidp, __unused void *arg1, __unused int arg2, struct sysctl_req *req)
+{
+	int new_value, changed;
+	int error = sysctl_io_number(req, vm_compressor_major_compact_threads, sizeof(int), &new_value, &changed);
+
+	if (error == 0 && changed) {
+		if (new_value < 1 || (uint32_t)new_value > vm_compressor_major_compact_threads_max) {
+			return EINVAL;
+		}
+		vm_compressor_major_compact_threads = new_value;
+	}
+	return error;
+}
+
+SYSCTL_PROC(_vm, OID_AUTO, compressor_major_compact_threads,
+    CTLTYPE_INT | CTLFLAG_LOCKED | CTLFLAG_RW,
+    0, 0, sysctl_compressor_major_compact_threads, "I", "");
+SYSCTL_UINT(_vm, OID_AUTO, compressor_major_compact_threads_max, CTLFLAG_RD | CTLFLAG_LOCKED, &vm_compressor_major_compact_threads_max, 0, "");
+
 SYSCTL_INT(_vm, OID_AUTO, vm_ripe_target_age_in_secs, CTLFLAG_RW | CTLFLAG_LOCKED, &vm_ripe_target_age, 0, "");
 
 SYSCTL_INT(_vm, OID_AUTO, compressor_eval_period_in_msecs, CTLFLAG_RW | CTLFLAG_LOCKED, &compressor_eval_period_in_msecs, 0, "");
@@ -4699,6 +4822,9 @@ SYSCTL_QUAD(_vm, OID_AUTO, compressor_swapper_swapout_fileq_throttled, CTLFLAG_R
 SYSCTL_QUAD(_vm, OID_AUTO, compressor_swapper_swapout_free_count_low, CTLFLAG_RD | CTLFLAG_LOCKED, &vmcs_stats.free_count_below_reserve, "");
 SYSCTL_QUAD(_vm, OID_AUTO, compressor_swapper_swapout_thrashing_detected, CTLFLAG_RD | CTLFLAG_LOCKED, &vmcs_stats.thrashing_detected, "");
 SYSCTL_QUAD(_vm, OID_AUTO, compressor_swapper_swapout_fragmentation_detected, CTLFLAG_RD | CTLFLAG_LOCKED, &vmcs_stats.fragmentation_detected, "");
+SYSCTL_QUAD(_vm, OID_AUTO, compressor_major_compactions, CTLFLAG_RD | CTLFLAG_LOCKED, &vmcs_stats.major_compactions, "");
+SYSCTL_QUAD(_vm, OID_AUTO, compressor_major_compactions_parallel, CTLFLAG_RD | CTLFLAG_LOCKED, &vmcs_stats.major_compactions_parallel, "");
+SYSCTL_QUAD(_vm, OID_AUTO, compressor_major_compactions_per_sec, CTLFLAG_RD | CTLFLAG_LOCKED, &vmcs_stats.major_compactions_per_sec, "");
 
 SYSCTL_STRING(_vm, OID_AUTO, swapfileprefix, CTLFLAG_RW | CTLFLAG_KERN | CTLFLAG_LOCKED, swapfilename, sizeof(swapfilename) - SWAPFILENAME_INDEX_LEN, "");
 
@@ -4833,6 +4959,11 @@ SYSCTL_QUAD(_vm, OID_AUTO, wks_decompressions, CTLFLAG_RD | CTLFLAG_LOCKED, &com
 SYSCTL_QUAD(_vm, OID_AUTO, wk_decompressed_bytes, CTLFLAG_RD | CTLFLAG_LOCKED, &compressor_stats.wk_decompressed_bytes, "");
 SYSCTL_QUAD(_vm, OID_AUTO, wk_sv_decompressions, CTLFLAG_RD | CTLFLAG_LOCKED, &compressor_stats.wk_sv_decompressions, "");
 
+SYSCTL_QUAD(_vm, OID_AUTO, compressor_prescreen_sv, CTLFLAG_RD | CTLFLAG_LOCKED, &compressor_stats.prescreen_sv, "");
+SYSCTL_QUAD(_vm, OID_AUTO, compressor_prescreen_raw, CTLFLAG_RD | CTLFLAG_LOCKED, &compressor_stats.prescreen_raw, "");
+SYSCTL_QUAD(_vm, OID_AUTO, compressor_prescreen_wk, CTLFLAG_RD | CTLFLAG_LOCKED, &compressor_stats.prescreen_wk, "");
+SYSCTL_QUAD(_vm, OID_AUTO, compressor_prescreen_lz4, CTLFLAG_RD | CTLFLAG_LOCKED, &compressor_stats.prescreen_lz4, "");
+
 SYSCTL_INT(_vm, OID_AUTO, lz4_threshold, CTLFLAG_RW | CTLFLAG_LOCKED, &vmctune.lz4_threshold, 0, "");
 SYSCTL_INT(_vm, OID_AUTO, wkdm_reeval_threshold, CTLFLAG_RW | CTLFLAG_LOCKED, &vmctune.wkdm_reeval_threshold, 0, "");
 SYSCTL_INT(_vm, OID_AUTO, lz4_max_failure_skips, CTLFLAG_RW | CTLFLAG_LOCKED, &vmctune.lz4_max_failure_skips, 0, "");
@@ -4841,6 +4972,9 @@ SYSCTL_INT(_vm, OID_AUTO, lz4_max_preselects, CTLFLAG_RW | CTLFLAG_LOCKED, &vmct
 SYSCTL_INT(_vm, OID_AUTO, lz4_run_preselection_threshold, CTLFLAG_RW | CTLFLAG_LOCKED, &vmctune.lz4_run_preselection_threshold, 0, "");
 SYSCTL_INT(_vm, OID_AUTO, lz4_run_continue_bytes, CTLFLAG_RW | CTLFLAG_LOCKED, &vmctune.lz4_run_continue_bytes, 0, "");
 SYSCTL_INT(_vm, OID_AUTO, lz4_profitable_bytes, CTLFLAG_RW | CTLFLAG_LOCKED, &vmctune.lz4_profitable_bytes, 0, "");
+SYSCTL_INT(_vm, OID_AUTO, compressor_prescreen, CTLFLAG_RW | CTLFLAG_LOCKED, &vmctune.prescreen_enabled, 0, "");
+SYSCTL_INT(_vm, OID_AUTO, compressor_prescreen_raw_collisions, CTLFLAG_RW | CTLFLAG_LOCKED, &vmctune.prescreen_raw_collisions, 0, "");
+SYSCTL_INT(_vm, OID_AUTO, compressor_prescreen_lz4_collisions, CTLFLAG_RW | CTLFLAG_LOCKED, &vmctune.prescreen_lz4_collisions, 0, "");
 #if DEVELOPMENT || DEBUG
 extern int vm_compressor_current_codec;
 extern int vm_compressor_test_seg_wp;
@@ -5080,6 +5214,14 @@ extern uint32_t ipc_voucher_trace_contents;
 SYSCTL_INT(_kern, OID_AUTO, ipc_voucher_trace_contents,
     CTLFLAG_RW | CTLFLAG_LOCKED, &ipc_voucher_trace_contents, 0, "Enable tracing voucher contents");
 
+/*
+ * Size above which physically copied OOL memory is sent copy-on-write
+ */
+extern uint32_t ipc_kmsg_ool_remap_threshold;
+
+SYSCTL_UINT(_kern, OID_AUTO, ipc_ool_remap_threshold,
+    CTLFLAG_RD | CTLFLAG_LOCKED, &ipc_kmsg_ool_remap_threshold, 0, "OOL copy-on-write send threshold");
+
 /*
  * Kernel stack size and depth
  */
@@ -39,9 +39,11 @@
 #include <sys/malloc.h>
 #include <sys/sysproto.h>
 #include <sys/pthread_shims.h>
+#include <sys/sysctl.h>
 
 #include <mach/mach_types.h>
 
+#include <kern/counter.h>
 #include <kern/cpu_data.h>
 #include <kern/mach_param.h>
 #include <kern/kern_types.h>
@@ -55,6 +57,7 @@
 #include <kern/telemetry.h>
 #include <kern/waitq.h>
 #include <kern/sched_prim.h>
+#include <kern/smr.h>
 #include <kern/turnstile.h>
 #include <kern/zalloc.h>
 #include <kern/debug.h>
@@ -92,6 +95,28 @@
  * relies on that thread to carry the torch for the other waiting threads.
  */
 
+/*
+ * How the ulock hash works:
+ *
+ * ull_t structures are hashed by key in buckets made of an SMR queue
+ * and a bucket lock. Insertions and removals are serialized by the
+ * bucket lock, and ull_t structures are freed through smr_call(),
+ * so that lookups can walk the chains in an SMR read section without
+ * taking the bucket lock at all.
+ *
+ * A lookup that finds a matching key takes the ull lock, and checks
+ * the key again: ulock_wait_cleanup() invalidates the key under the ull
+ * lock before the last reference goes away, so a key that still matches
+ * under the lock means ull_refcount can't be 0 and a new reference can
+ * be taken. Misses always fall back to a lookup with the bucket lock held,
+ * which is what serializes a waiter hashing a new ull_t with a waker
+ * looking for it.
+ *
+ * Process private ulocks (ULK_UADDR) can be hashed in a small per-process
+ * table instead of the global one with the "ulock_task_hash" boot-arg,
+ * so that unrelated processes never share a bucket (or its cache line).
+ */
+
 static LCK_GRP_DECLARE(ull_lck_grp, "ulocks");
 
 #if XNU_TARGET_OS_XR
@@ -177,7 +202,9 @@ typedef struct ull {
 	int32_t         ull_refcount;
 	uint8_t         ull_opcode;
 	struct turnstile *ull_turnstile;
-	queue_chain_t   ull_hash_link;
+	struct ull_bucket *ull_hash_bucket;
+	struct smrq_link ull_hash_link;
+	struct smr_node ull_smr_node;
 } ull_t;
 
 #define ULL_MUST_EXIST  0x0001
@@ -219,7 +246,7 @@ ull_dump(ull_t *ull)
 #endif
 
 typedef struct ull_bucket {
-	queue_head_t ulb_head;
+	struct smrq_list_head ulb_head;
 #if ULL_TICKET_LOCK
 	lck_ticket_t ulb_lock;
 #else
@@ -227,17 +254,50 @@ typedef struct ull_bucket {
 #endif /* ULL_TICKET_LOCK */
 } ull_bucket_t;
 
+/* number of buckets of the per-process hash tables, must be a power of 2 */
+#define ULL_TASK_HASH_BUCKETS   64
+
 static SECURITY_READ_ONLY_LATE(int) ull_hash_buckets;
 static SECURITY_READ_ONLY_LATE(ull_bucket_t *) ull_bucket;
 static uint32_t ull_nzalloc = 0;
 static KALLOC_TYPE_DEFINE(ull_zone, ull_t, KT_DEFAULT);
 
+/*
+ * The per-process hash mode can't change at runtime: waiters
+ * and wakers must agree on where a given ull_t is hashed.
+ */
+static TUNABLE(uint32_t, ull_task_hash_enabled, "ulock_task_hash", 0);
+static TUNABLE_WRITEABLE(int, ull_smr_lookup_enabled, "ulock_smr_lookup", 1);
+
+SCALABLE_COUNTER_DEFINE(ull_smr_hits);
+SCALABLE_COUNTER_DEFINE(ull_smr_miss);
+
+SYSCTL_NODE(_kern, OID_AUTO, ulock_hash, CTLFLAG_RW | CTLFLAG_LOCKED, 0,
+    "ulock hash");
+SYSCTL_INT(_kern_ulock_hash, OID_AUTO, smr_lookup, CTLFLAG_RW | CTLFLAG_LOCKED,
+    &ull_smr_lookup_enabled, 0, "lockless ulock lookups");
+SYSCTL_UINT(_kern_ulock_hash, OID_AUTO, task_hash, CTLFLAG_RD | CTLFLAG_LOCKED,
+    &ull_task_hash_enabled, 0, "per-process ulock hash tables");
+SYSCTL_SCALABLE_COUNTER(_kern_ulock_hash, smr_hits, ull_smr_hits,
+    "lockless lookups that found a ulock");
+SYSCTL_SCALABLE_COUNTER(_kern_ulock_hash, smr_misses, ull_smr_miss,
+    "lockless lookups that fell back to the bucket lock");
+
+#define ull_smr                  smr_system
+#define ull_smr_enter()          smr_enter(&ull_smr)
+#define ull_smr_leave()          smr_leave(&ull_smr)
+#define ull_smr_call(n, sz, cb)  smr_call(&ull_smr, n, sz, cb)
+
 #if ULL_TICKET_LOCK
-#define ull_bucket_lock(i)       lck_ticket_lock(&ull_bucket[i].ulb_lock, &ull_lck_grp)
-#define ull_bucket_unlock(i)     lck_ticket_unlock(&ull_bucket[i].ulb_lock)
+#define ull_bucket_lock_init(b)  lck_ticket_init(&(b)->ulb_lock, &ull_lck_grp)
+#define ull_bucket_lock_destroy(b) lck_ticket_destroy(&(b)->ulb_lock, &ull_lck_grp)
+#define ull_bucket_lock(b)       lck_ticket_lock(&(b)->ulb_lock, &ull_lck_grp)
+#define ull_bucket_unlock(b)     lck_ticket_unlock(&(b)->ulb_lock)
 #else
-#define ull_bucket_lock(i)       lck_spin_lock_grp(&ull_bucket[i].ulb_lock, &ull_lck_grp)
-#define ull_bucket_unlock(i)     lck_spin_unlock(&ull_bucket[i].ulb_lock)
+#define ull_bucket_lock_init(b)  lck_spin_init(&(b)->ulb_lock, &ull_lck_grp, NULL)
+#define ull_bucket_lock_destroy(b) lck_spin_destroy(&(b)->ulb_lock, &ull_lck_grp)
+#define ull_bucket_lock(b)       lck_spin_lock_grp(&(b)->ulb_lock, &ull_lck_grp)
+#define ull_bucket_unlock(b)     lck_spin_unlock(&(b)->ulb_lock)
 #endif /* ULL_TICKET_LOCK */
 static __inline__ uint32_t
 ull_hash_index(const void *key, size_t length)
@@ -251,6 +311,83 @@ ull_hash_index(const void *key, size_t length)
 
 #define ULL_INDEX(keyp) ull_hash_index(keyp, keyp->ulk_key_type == ULK_UADDR ? ULK_UADDR_LEN : ULK_XPROC_LEN)
 
+static void
+ull_bucket_init(ull_bucket_t *bucket)
+{
+	smrq_init(&bucket->ulb_head);
+	ull_bucket_lock_init(bucket);
+}
+
+/*
+ * Returns the per-process hash table of the task owning a ULK_UADDR key,
+ * or NULL if the key must be hashed in the global table.
+ */
+static ull_bucket_t *
+ull_task_hash(ulk_t *key)
+{
+	proc_t p;
+
+	if (!ull_task_hash_enabled || key->ulk_key_type != ULK_UADDR ||
+	    key->ulk_task == kernel_task) {
+		return NULL;
+	}
+
+	/*
+	 * The proc and task are allocated together, and the table
+	 * is set up in forkproc() before any thread can run in the task,
+	 * and only freed with the proc.
+	 */
+	p = task_get_proc_raw(key->ulk_task);
+	return p->p_ulock_hash;
+}
+
+static ull_bucket_t *
+ull_hash_bucket(ulk_t *key)
+{
+	ull_bucket_t *table = ull_task_hash(key);
+
+	if (table) {
+		uint32_t hash = os_hash_jenkins(&key->ulk_addr, sizeof(user_addr_t));
+
+		return &table[hash & (ULL_TASK_HASH_BUCKETS - 1)];
+	}
+	return &ull_bucket[ULL_INDEX(key)];
+}
+
+void
+ulock_proc_init(proc_t p)
+{
+	ull_bucket_t *table;
+
+	if (!ull_task_hash_enabled) {
+		return;
+	}
+
+	table = kalloc_type(ull_bucket_t, ULL_TASK_HASH_BUCKETS,
+	    Z_WAITOK | Z_ZERO | Z_NOFAIL);
+	for (int i = 0; i < ULL_TASK_HASH_BUCKETS; i++) {
+		ull_bucket_init(&table[i]);
+	}
+	p->p_ulock_hash = table;
+}
+
+void
+ulock_proc_destroy(proc_t p)
+{
+	ull_bucket_t *table = p->p_ulock_hash;
+
+	if (table == NULL) {
+		return;
+	}
+
+	p->p_ulock_hash = NULL;
+	for (int i = 0; i < ULL_TASK_HASH_BUCKETS; i++) {
+		assert(smrq_serialized_first(&table[i].ulb_head, ull_t, ull_hash_link) == NULL);
+		ull_bucket_lock_destroy(&table[i]);
+	}
+	kfree_type(ull_bucket_t, ULL_TASK_HASH_BUCKETS, table);
+}
+
 static void
 ulock_initialize(void)
 {
@@ -268,19 +405,40 @@ ulock_initialize(void)
 	assert(ull_bucket != NULL);
 
 	for (int i = 0; i < ull_hash_buckets; i++) {
-		queue_init(&ull_bucket[i].ulb_head);
-#if ULL_TICKET_LOCK
-		lck_ticket_init(&ull_bucket[i].ulb_lock, &ull_lck_grp);
-#else
-		lck_spin_init(&ull_bucket[i].ulb_lock, &ull_lck_grp, NULL);
-#endif /* ULL_TICKET_LOCK */
+		ull_bucket_init(&ull_bucket[i]);
 	}
 }
 STARTUP(EARLY_BOOT, STARTUP_RANK_FIRST, ulock_initialize);
 
 #if DEVELOPMENT || DEBUG
+static int
+ull_hash_dump_buckets(task_t task, ull_bucket_t *table, int nbuckets)
+{
+	int count = 0;
+
+	for (int i = 0; i < nbuckets; i++) {
+		ull_bucket_t *bucket = &table[i];
+		ull_t *elem;
+
+		ull_bucket_lock(bucket);
+		if (task == TASK_NULL &&
+		    smrq_serialized_first(&bucket->ulb_head, ull_t, ull_hash_link)) {
+			kprintf("%s>index %d:\n", __FUNCTION__, i);
+		}
+		smrq_serialized_foreach(elem, &bucket->ulb_head, ull_hash_link) {
+			if ((task == TASK_NULL) || ((elem->ull_key.ulk_key_type == ULK_UADDR)
+			    && (task == elem->ull_key.ulk_task))) {
+				ull_dump(elem);
+				count++;
+			}
+		}
+		ull_bucket_unlock(bucket);
+	}
+	return count;
+}
+
 /* Count the number of hash entries for a given task address.
- * if task==0, dump the whole table.
+ * if task==0, dump the whole global table.
  */
 static int
 ull_hash_dump(task_t task)
@@ -289,24 +447,18 @@ ull_hash_dump(task_t task)
 	if (task == TASK_NULL) {
 		kprintf("%s>total number of ull_t allocated %d\n", __FUNCTION__, ull_nzalloc);
 		kprintf("%s>BEGIN\n", __FUNCTION__);
-	}
-	for (int i = 0; i < ull_hash_buckets; i++) {
-		ull_bucket_lock(i);
-		if (!queue_empty(&ull_bucket[i].ulb_head)) {
-			ull_t *elem;
-			if (task == TASK_NULL) {
-				kprintf("%s>index %d:\n", __FUNCTION__, i);
-			}
-			qe_foreach_element(elem, &ull_bucket[i].ulb_head, ull_hash_link) {
-				if ((task == TASK_NULL) || ((elem->ull_key.ulk_key_type == ULK_UADDR)
-				    && (task == elem->ull_key.ulk_task))) {
-					ull_dump(elem);
-					count++;
-				}
-			}
+	} else if (ull_task_hash_enabled) {
+		ulk_t key = {
+			.ulk_key_type = ULK_UADDR,
+			.ulk_task = task,
+		};
+		ull_bucket_t *table = ull_task_hash(&key);
+
+		if (table) {
+			count += ull_hash_dump_buckets(task, table, ULL_TASK_HASH_BUCKETS);
 		}
-		ull_bucket_unlock(i);
 	}
+	count += ull_hash_dump_buckets(task, ull_bucket, ull_hash_buckets);
 	if (task == TASK_NULL) {
 		kprintf("%s>END\n", __FUNCTION__);
 		ull_nzalloc = 0;
@@ -323,7 +475,7 @@ ull_alloc(ulk_t *key)
 
 	ull->ull_refcount = 1;
 	ull->ull_key = *key;
-	ull->ull_bucket_index = ULL_INDEX(key);
+	ull->ull_hash_bucket = ull_hash_bucket(key);
 	ull->ull_nwaiters = 0;
 	ull->ull_opcode = 0;
 
@@ -349,6 +501,44 @@ ull_free(ull_t *ull)
 	zfree(ull_zone, ull);
 }
 
+static void
+ull_smr_free(smr_node_t node)
+{
+	ull_free(__container_of(node, ull_t, ull_smr_node));
+}
+
+/*
+ * Looks up an existing ulock structure (ull_t) without taking the bucket lock.
+ * Returns the ulock structure locked with a new reference, or NULL
+ * if the caller must look the key up again with the bucket lock held.
+ */
+static ull_t *
+ull_get_smr(ull_bucket_t *bucket, ulk_t *key)
+{
+	ull_t *elem;
+
+	ull_smr_enter();
+	smrq_entered_foreach(elem, &bucket->ulb_head, ull_hash_link) {
+		/* cheap racy check first, to avoid locking every ulock in the chain */
+		if (!ull_key_match(&elem->ull_key, key)) {
+			continue;
+		}
+		ull_lock(elem);
+		if (ull_key_match(&elem->ull_key, key)) {
+			assert(elem->ull_refcount > 0);
+			elem->ull_refcount++;
+			ull_smr_leave();
+			counter_inc(&ull_smr_hits);
+			return elem; /* still locked */
+		}
+		ull_unlock(elem);
+	}
+	ull_smr_leave();
+
+	counter_inc(&ull_smr_miss);
+	return NULL;
+}
+
 /* Finds an existing ulock structure (ull_t), or creates a new one.
  * If MUST_EXIST flag is set, returns NULL instead of creating a new one.
  * The ulock structure is returned with ull_lock locked
@@ -357,12 +547,21 @@ static ull_t *
 ull_get(ulk_t *key, uint32_t flags, ull_t **unused_ull)
 {
 	ull_t *ull = NULL;
-	uint i = ULL_INDEX(key);
-	ull_t *new_ull = (flags & ULL_MUST_EXIST) ? NULL : ull_alloc(key);
+	ull_bucket_t *bucket = ull_hash_bucket(key);
+	ull_t *new_ull;
 	ull_t *elem;
 
-	ull_bucket_lock(i);
-	qe_foreach_element(elem, &ull_bucket[i].ulb_head, ull_hash_link) {
+	if (ull_smr_lookup_enabled) {
+		ull = ull_get_smr(bucket, key);
+		if (ull) {
+			return ull; /* still locked */
+		}
+	}
+
+	new_ull = (flags & ULL_MUST_EXIST) ? NULL : ull_alloc(key);
+
+	ull_bucket_lock(bucket);
+	smrq_serialized_foreach(elem, &bucket->ulb_head, ull_hash_link) {
 		ull_lock(elem);
 		if (ull_key_match(&elem->ull_key, key)) {
 			ull = elem;
@@ -374,7 +573,7 @@ ull_get(ulk_t *key, uint32_t flags, ull_t **unused_ull)
 	if (ull == NULL) {
 		if (flags & ULL_MUST_EXIST) {
 			/* Must already exist (called from wake) */
-			ull_bucket_unlock(i);
+			ull_bucket_unlock(bucket);
 			assert(new_ull == NULL);
 			assert(unused_ull == NULL);
 			return NULL;
@@ -382,13 +581,13 @@ ull_get(ulk_t *key, uint32_t flags, ull_t **unused_ull)
 
 		if (new_ull == NULL) {
 			/* Alloc above failed */
-			ull_bucket_unlock(i);
+			ull_bucket_unlock(bucket);
 			return NULL;
 		}
 
 		ull = new_ull;
 		ull_lock(ull);
-		enqueue(&ull_bucket[i].ulb_head, &ull->ull_hash_link);
+		smrq_serialized_insert_head(&bucket->ulb_head, &ull->ull_hash_link);
 	} else if (!(flags & ULL_MUST_EXIST)) {
 		assert(new_ull);
 		assert(unused_ull);
@@ -398,7 +597,7 @@ ull_get(ulk_t *key, uint32_t flags, ull_t **unused_ull)
 
 	ull->ull_refcount++;
 
-	ull_bucket_unlock(i);
+	ull_bucket_unlock(bucket);
 
 	return ull; /* still locked */
 }
@@ -418,11 +617,12 @@ ull_put(ull_t *ull)
 		return;
 	}
 
-	ull_bucket_lock(ull->ull_bucket_index);
-	remqueue(&ull->ull_hash_link);
-	ull_bucket_unlock(ull->ull_bucket_index);
+	ull_bucket_lock(ull->ull_hash_bucket);
+	smrq_serialized_remove(&ull->ull_hash_bucket->ulb_head, &ull->ull_hash_link);
+	ull_bucket_unlock(ull->ull_hash_bucket);
 
-	ull_free(ull);
+	/* ull_get_smr() might still be looking at this ulock */
+	ull_smr_call(&ull->ull_smr_node, sizeof(ull_t), ull_smr_free);
 }
 
 
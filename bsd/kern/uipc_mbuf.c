@@ -347,6 +347,7 @@ static zstack_t mz_composite_alloc_n(mbuf_class_t, unsigned int, zalloc_flags_t)
 static void mz_composite_free(mbuf_class_t, struct mbuf *);
 static void mz_composite_free_n(mbuf_class_t, zstack_t);
 static void *mz_composite_build(zone_id_t, zalloc_flags_t);
+static zstack_t mz_composite_build_n(zone_id_t, uint32_t, zalloc_flags_t);
 static void *mz_composite_mark_valid(zone_id_t, void *);
 static void *mz_composite_mark_invalid(zone_id_t, void *);
 static void  mz_composite_destroy(zone_id_t, void *);
@@ -367,6 +368,7 @@ static_assert(sizeof(union m16kcluster) == M16KCLBYTES);
 
 static const struct zone_cache_ops mz_composite_ops = {
 	.zc_op_alloc        = mz_composite_build,
+	.zc_op_alloc_n      = mz_composite_build_n,
 	.zc_op_mark_valid   = mz_composite_mark_valid,
 	.zc_op_mark_invalid = mz_composite_mark_invalid,
 	.zc_op_free         = mz_composite_destroy,
@@ -831,6 +833,16 @@ mz_ref_alloc(zalloc_flags_t flags)
 	return zalloc_id(ZONE_ID_MBUF_REF, flags | Z_NOZZC);
 }
 
+__attribute__((always_inline))
+static inline zstack_t
+mz_ref_alloc_n(uint32_t count, zalloc_flags_t flags)
+{
+	if (flags & Z_NOWAIT) {
+		flags ^= Z_NOWAIT | Z_NOPAGEWAIT;
+	}
+	return zalloc_n(ZONE_ID_MBUF_REF, count, flags | Z_NOZZC);
+}
+
 __attribute__((always_inline))
 static inline void
 mz_ref_free(struct ext_ref *rfa)
@@ -861,6 +873,18 @@ mz_cl_alloc(zone_id_t zid, zalloc_flags_t flags)
 	return __unsafe_forge_bidi_indexable(void *, p, zone_get_elem_size(zone_by_id(zid)));
 }
 
+__attribute__((always_inline))
+static inline zstack_t
+mz_cl_alloc_n(zone_id_t zid, uint32_t count, zalloc_flags_t flags)
+{
+	if (flags & Z_NOWAIT) {
+		flags ^= Z_NOWAIT | Z_NOPAGEWAIT;
+	} else if (!(flags & Z_NOPAGEWAIT)) {
+		flags |= Z_NOFAIL;
+	}
+	return zalloc_n(zid, count, flags | Z_NOZZC);
+}
+
 __attribute__((always_inline))
 static inline void
 mz_cl_free(zone_id_t zid, void *cl)
@@ -919,6 +943,23 @@ mz_cl_zid(zone_id_t zid)
 	return ZONE_ID_CLUSTER_2K + zid - ZONE_ID_MBUF_CLUSTER_2K;
 }
 
+__attribute__((always_inline))
+static inline void
+mz_composite_init(zone_id_t zid, struct mbuf *m, void *cl,
+    struct ext_ref *rfa)
+{
+	mbuf_init(m, 0, MT_FREE);
+	if (zid == ZONE_ID_MBUF_CLUSTER_2K) {
+		MBUF_CL_INIT(m, cl, rfa, 0, EXTF_COMPOSITE);
+	} else if (zid == ZONE_ID_MBUF_CLUSTER_4K) {
+		MBUF_BIGCL_INIT(m, cl, rfa, 0, EXTF_COMPOSITE);
+	} else {
+		MBUF_16KCL_INIT(m, cl, rfa, 0, EXTF_COMPOSITE);
+	}
+	VERIFY(m->m_flags == M_EXT);
+	VERIFY(m_get_rfa(m) != NULL && MBUF_IS_COMPOSITE(m));
+}
+
 static void *
 mz_composite_build(zone_id_t zid, zalloc_flags_t flags)
 {
@@ -939,16 +980,7 @@ mz_composite_build(zone_id_t zid, zalloc_flags_t flags)
 	if (__improbable(m == NULL)) {
 		goto out_free_rfa;
 	}
-	mbuf_init(m, 0, MT_FREE);
-	if (zid == ZONE_ID_MBUF_CLUSTER_2K) {
-		MBUF_CL_INIT(m, cl, rfa, 0, EXTF_COMPOSITE);
-	} else if (zid == ZONE_ID_MBUF_CLUSTER_4K) {
-		MBUF_BIGCL_INIT(m, cl, rfa, 0, EXTF_COMPOSITE);
-	} else {
-		MBUF_16KCL_INIT(m, cl, rfa, 0, EXTF_COMPOSITE);
-	}
-	VERIFY(m->m_flags == M_EXT);
-	VERIFY(m_get_rfa(m) != NULL && MBUF_IS_COMPOSITE(m));
+	mz_composite_init(zid, m, cl, rfa);
 
 	return m;
 out_free_rfa:
@@ -959,6 +991,54 @@ out:
 	return NULL;
 }
 
+/*
+ * Builds up to `count' composite mbufs at once when the composite cache
+ * is empty: the mbufs, ext_refs and clusters are each allocated with
+ * a single zalloc_n() call so that whole magazines are taken from the
+ * underlying zones, rather than one element at a time.
+ *
+ * May return fewer than `count' objects (possibly none) when any of the
+ * underlying zones is depleted, leftovers are returned to their zones.
+ */
+static zstack_t
+mz_composite_build_n(zone_id_t zid, uint32_t count, zalloc_flags_t flags)
+{
+	const zone_id_t cl_zid = mz_cl_zid(zid);
+	const vm_size_t cl_size = zone_get_elem_size(zone_by_id(cl_zid));
+	zstack_t cls = {}, rfas = {}, ms = {}, out = {};
+	uint32_t n;
+
+	cls = mz_cl_alloc_n(cl_zid, count, flags);
+	n = zstack_count(cls);
+	if (n) {
+		rfas = mz_ref_alloc_n(n, flags);
+		n = zstack_count(rfas);
+	}
+	if (n) {
+		ms = mz_alloc_n(n, flags);
+		n = zstack_count(ms);
+	}
+
+	while (n-- > 0) {
+		struct mbuf *m = zstack_pop(&ms);
+		struct ext_ref *rfa = zstack_pop(&rfas);
+		void *cl = __unsafe_forge_bidi_indexable(void *,
+		    zstack_pop(&cls), cl_size);
+
+		mz_composite_init(zid, m, cl, rfa);
+		zstack_push(&out, m);
+	}
+
+	if (!zstack_empty(rfas)) {
+		zfree_nozero_n(ZONE_ID_MBUF_REF, rfas);
+	}
+	if (!zstack_empty(cls)) {
+		zfree_nozero_n(cl_zid, cls);
+	}
+
+	return out;
+}
+
 static void *
 mz_composite_mark_valid(zone_id_t zid, void *p)
 {
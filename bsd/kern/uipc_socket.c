@@ -5723,6 +5723,30 @@ sosetoptlock(struct socket *so, struct sockopt *sopt, int dolock)
 			}
 			break;
 		}
+		case SO_REUSEPORT_LB: {
+			if ((SOCK_DOM(so) != PF_INET && SOCK_DOM(so) != PF_INET6) ||
+			    SOCK_PROTO(so) != IPPROTO_TCP) {
+				error = ENOPROTOOPT;
+				goto out;
+			}
+			if (so->so_options & SO_ACCEPTCONN) {
+				error = EINVAL;
+				goto out;
+			}
+
+			error = sooptcopyin(sopt, &optval, sizeof(optval),
+			    sizeof(optval));
+			if (error != 0) {
+				goto out;
+			}
+
+			if (optval != 0) {
+				sotoinpcb(so)->inp_flags2 |= INP2_REUSEPORT_LB;
+			} else {
+				sotoinpcb(so)->inp_flags2 &= ~INP2_REUSEPORT_LB;
+			}
+			break;
+		}
 		default:
 			error = ENOPROTOOPT;
 			break;
@@ -6260,6 +6284,16 @@ integer:
 			    1 : 0;
 			goto integer;
 		}
+		case SO_REUSEPORT_LB: {
+			if ((SOCK_DOM(so) != PF_INET && SOCK_DOM(so) != PF_INET6) ||
+			    SOCK_PROTO(so) != IPPROTO_TCP) {
+				error = ENOPROTOOPT;
+				goto out;
+			}
+			optval = sotoinpcb(so)->inp_flags2 & INP2_REUSEPORT_LB ?
+			    1 : 0;
+			goto integer;
+		}
 		default:
 			error = ENOPROTOOPT;
 			break;
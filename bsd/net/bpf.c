@@ -205,6 +205,14 @@ static int bpf_hdr_comp_enable = 1;
 SYSCTL_INT(_debug, OID_AUTO, bpf_hdr_comp_enable, CTLFLAG_RW | CTLFLAG_LOCKED,
     &bpf_hdr_comp_enable, 1, "");
 
+/*
+ * bpf_jit_enable controls whether filters are compiled when
+ * they are set; it does not affect filters already installed.
+ */
+static int bpf_jit_enable = 1;
+SYSCTL_INT(_debug, OID_AUTO, bpf_jit_enable, CTLFLAG_RW | CTLFLAG_LOCKED,
+    &bpf_jit_enable, 0, "");
+
 static int sysctl_bpf_stats SYSCTL_HANDLER_ARGS;
 SYSCTL_PROC(_debug, OID_AUTO, bpf_stats, CTLTYPE_STRUCT | CTLFLAG_RD | CTLFLAG_LOCKED,
     0, 0,
@@ -2762,6 +2770,7 @@ bpf_setf(struct bpf_d *d, u_int bf_len, user_addr_t bf_insns,
     u_long cmd)
 {
 	struct bpf_insn *fcode, *old;
+	struct bpf_jit_program *jit, *old_jit;
 	u_int flen, size;
 
 	while (d->bd_hbuf_read) {
@@ -2773,16 +2782,21 @@ bpf_setf(struct bpf_d *d, u_int bf_len, user_addr_t bf_insns,
 	}
 
 	old = d->bd_filter;
+	old_jit = d->bd_filter_jit;
 	if (bf_insns == USER_ADDR_NULL) {
 		if (bf_len != 0) {
 			return EINVAL;
 		}
 		d->bd_filter = NULL;
 		d->bd_filter_len = 0;
+		d->bd_filter_jit = NULL;
 		reset_d(d);
 		if (old != 0) {
 			kfree_data_addr(old);
 		}
+		if (old_jit != NULL) {
+			bpf_jit_free(old_jit);
+		}
 		return 0;
 	}
 	flen = bf_len;
@@ -2797,8 +2811,18 @@ bpf_setf(struct bpf_d *d, u_int bf_len, user_addr_t bf_insns,
 	}
 	if (copyin(bf_insns, (caddr_t)fcode, size) == 0 &&
 	    bpf_validate(fcode, (int)flen)) {
+		/*
+		 * The interpreter is used if the filter
+		 * can't be compiled
+		 */
+		jit = NULL;
+		if (bpf_jit_enable) {
+			jit = bpf_jit_compile(fcode, flen);
+		}
+
 		d->bd_filter = fcode;
 		d->bd_filter_len = flen;
+		d->bd_filter_jit = jit;
 
 		if (cmd == BIOCSETF32 || cmd == BIOCSETF64) {
 			reset_d(d);
@@ -2807,6 +2831,9 @@ bpf_setf(struct bpf_d *d, u_int bf_len, user_addr_t bf_insns,
 		if (old != 0) {
 			kfree_data_addr(old);
 		}
+		if (old_jit != NULL) {
+			bpf_jit_free(old_jit);
+		}
 
 		return 0;
 	}
@@ -3356,9 +3383,14 @@ bpf_tap_imp(
 		}
 
 		++d->bd_rcount;
-		slen = bpf_filter(d->bd_filter, d->bd_filter_len,
-		    bpf_pkt_ptr,
-		    (u_int)bpf_pkt->bpfp_total_length, 0);
+		if (d->bd_filter_jit != NULL) {
+			slen = bpf_jit_filter(d->bd_filter_jit, bpf_pkt_ptr,
+			    (u_int)bpf_pkt->bpfp_total_length);
+		} else {
+			slen = bpf_filter(d->bd_filter, d->bd_filter_len,
+			    bpf_pkt_ptr,
+			    (u_int)bpf_pkt->bpfp_total_length, 0);
+		}
 
 		if (slen != 0) {
 			if (bp->bif_ifp->if_type == IFT_PKTAP &&
@@ -4359,6 +4391,10 @@ bpf_freed(struct bpf_d *d)
 	if (d->bd_filter) {
 		kfree_data_addr_sized_by(d->bd_filter, d->bd_filter_len);
 	}
+	if (d->bd_filter_jit != NULL) {
+		bpf_jit_free(d->bd_filter_jit);
+		d->bd_filter_jit = NULL;
+	}
 }
 
 /*
@@ -75,6 +75,7 @@
 #endif
 
 #ifdef KERNEL
+#include <sys/malloc.h>
 #include <sys/mbuf.h>
 #include <net/sockaddr_utils.h>
 #endif
@@ -902,3 +903,611 @@ bpf_validate(const struct bpf_insn *__counted_by(len) f, int len)
 	return BPF_CLASS(f[len - 1].code) == BPF_RET;
 }
 #endif
+
+#ifdef KERNEL
+/*
+ * BPF program compiler
+ *
+ * Filters are compiled once at BIOCSETF time into a pre-decoded form
+ * that bpf_jit_filter() can run without re-examining the classic BPF
+ * encoding for every packet:
+ *
+ * - opcodes are mapped to a dense set of operations and jump offsets are
+ *   resolved to absolute instruction indices,
+ * - codes that bpf_filter() would reject at run time become "ret #0",
+ * - scratch memory is only cleared if the program ever reads it,
+ * - a packet load immediately followed by a "jeq #k" that is not itself
+ *   a jump target is fused into a single operation.
+ *
+ * Packet loads are served straight out of the contiguous leading part of
+ * the packet (the optional header and the first mbuf or buflet), and fall
+ * back to the same mbuf/buflet walking accessors as the interpreter when
+ * the load crosses into a fragmented part of the chain.
+ *
+ * The kernel can't generate native code at run time, so the compiled
+ * program is executed by a tight dispatch loop rather than emitted as
+ * machine instructions.
+ */
+enum {
+	BJ_RET_K,
+	BJ_RET_A,
+	BJ_LD_W_ABS,
+	BJ_LD_H_ABS,
+	BJ_LD_B_ABS,
+	BJ_LD_W_IND,
+	BJ_LD_H_IND,
+	BJ_LD_B_IND,
+	BJ_LD_W_ABS_JEQ,
+	BJ_LD_H_ABS_JEQ,
+	BJ_LD_B_ABS_JEQ,
+	BJ_LD_LEN,
+	BJ_LDX_LEN,
+	BJ_LDX_MSH,
+	BJ_LD_IMM,
+	BJ_LDX_IMM,
+	BJ_LD_MEM,
+	BJ_LDX_MEM,
+	BJ_ST,
+	BJ_STX,
+	BJ_JA,
+	BJ_JGT_K,
+	BJ_JGE_K,
+	BJ_JEQ_K,
+	BJ_JSET_K,
+	BJ_JGT_X,
+	BJ_JGE_X,
+	BJ_JEQ_X,
+	BJ_JSET_X,
+	BJ_ADD_X,
+	BJ_SUB_X,
+	BJ_MUL_X,
+	BJ_DIV_X,
+	BJ_AND_X,
+	BJ_OR_X,
+	BJ_LSH_X,
+	BJ_RSH_X,
+	BJ_ADD_K,
+	BJ_SUB_K,
+	BJ_MUL_K,
+	BJ_DIV_K,
+	BJ_AND_K,
+	BJ_OR_K,
+	BJ_LSH_K,
+	BJ_RSH_K,
+	BJ_NEG,
+	BJ_TAX,
+	BJ_TXA,
+};
+
+struct bpf_jit_insn {
+	uint8_t         bji_op;
+	uint16_t        bji_jt;         /* absolute index of the true branch */
+	uint16_t        bji_jf;         /* absolute index of the false branch */
+	bpf_u_int32     bji_k;
+	bpf_u_int32     bji_k2;         /* comparand of fused load + jeq */
+};
+
+#define BJP_USES_MEM    0x1
+
+struct bpf_jit_program {
+	uint32_t        bjp_flags;
+	uint32_t        bjp_len;
+	struct bpf_jit_insn bjp_insns[] __counted_by(bjp_len);
+};
+
+static uint8_t
+bpf_jit_op(u_short code)
+{
+	switch (code) {
+	case BPF_RET | BPF_K:                   return BJ_RET_K;
+	case BPF_RET | BPF_A:                   return BJ_RET_A;
+	case BPF_LD | BPF_W | BPF_ABS:          return BJ_LD_W_ABS;
+	case BPF_LD | BPF_H | BPF_ABS:          return BJ_LD_H_ABS;
+	case BPF_LD | BPF_B | BPF_ABS:          return BJ_LD_B_ABS;
+	case BPF_LD | BPF_W | BPF_IND:          return BJ_LD_W_IND;
+	case BPF_LD | BPF_H | BPF_IND:          return BJ_LD_H_IND;
+	case BPF_LD | BPF_B | BPF_IND:          return BJ_LD_B_IND;
+	case BPF_LD | BPF_W | BPF_LEN:          return BJ_LD_LEN;
+	case BPF_LDX | BPF_W | BPF_LEN:         return BJ_LDX_LEN;
+	case BPF_LDX | BPF_MSH | BPF_B:         return BJ_LDX_MSH;
+	case BPF_LD | BPF_IMM:                  return BJ_LD_IMM;
+	case BPF_LDX | BPF_IMM:                 return BJ_LDX_IMM;
+	case BPF_LD | BPF_MEM:                  return BJ_LD_MEM;
+	case BPF_LDX | BPF_MEM:                 return BJ_LDX_MEM;
+	case BPF_ST:                            return BJ_ST;
+	case BPF_STX:                           return BJ_STX;
+	case BPF_JMP | BPF_JA:                  return BJ_JA;
+	case BPF_JMP | BPF_JGT | BPF_K:         return BJ_JGT_K;
+	case BPF_JMP | BPF_JGE | BPF_K:         return BJ_JGE_K;
+	case BPF_JMP | BPF_JEQ | BPF_K:         return BJ_JEQ_K;
+	case BPF_JMP | BPF_JSET | BPF_K:        return BJ_JSET_K;
+	case BPF_JMP | BPF_JGT | BPF_X:         return BJ_JGT_X;
+	case BPF_JMP | BPF_JGE | BPF_X:         return BJ_JGE_X;
+	case BPF_JMP | BPF_JEQ | BPF_X:         return BJ_JEQ_X;
+	case BPF_JMP | BPF_JSET | BPF_X:        return BJ_JSET_X;
+	case BPF_ALU | BPF_ADD | BPF_X:         return BJ_ADD_X;
+	case BPF_ALU | BPF_SUB | BPF_X:         return BJ_SUB_X;
+	case BPF_ALU | BPF_MUL | BPF_X:         return BJ_MUL_X;
+	case BPF_ALU | BPF_DIV | BPF_X:         return BJ_DIV_X;
+	case BPF_ALU | BPF_AND | BPF_X:         return BJ_AND_X;
+	case BPF_ALU | BPF_OR | BPF_X:          return BJ_OR_X;
+	case BPF_ALU | BPF_LSH | BPF_X:         return BJ_LSH_X;
+	case BPF_ALU | BPF_RSH | BPF_X:         return BJ_RSH_X;
+	case BPF_ALU | BPF_ADD | BPF_K:         return BJ_ADD_K;
+	case BPF_ALU | BPF_SUB | BPF_K:         return BJ_SUB_K;
+	case BPF_ALU | BPF_MUL | BPF_K:         return BJ_MUL_K;
+	case BPF_ALU | BPF_DIV | BPF_K:         return BJ_DIV_K;
+	case BPF_ALU | BPF_AND | BPF_K:         return BJ_AND_K;
+	case BPF_ALU | BPF_OR | BPF_K:          return BJ_OR_K;
+	case BPF_ALU | BPF_LSH | BPF_K:         return BJ_LSH_K;
+	case BPF_ALU | BPF_RSH | BPF_K:         return BJ_RSH_K;
+	case BPF_ALU | BPF_NEG:                 return BJ_NEG;
+	case BPF_MISC | BPF_TAX:                return BJ_TAX;
+	case BPF_MISC | BPF_TXA:                return BJ_TXA;
+	default:
+		return BJ_RET_K;
+	}
+}
+
+/*
+ * Compile a program that already passed bpf_validate().
+ * Returns NULL if the program can't be compiled, in which
+ * case the caller keeps using the interpreter.
+ */
+struct bpf_jit_program *
+bpf_jit_compile(const struct bpf_insn *__counted_by(len) f, u_int len)
+{
+	struct bpf_jit_program *prog;
+	struct bpf_jit_insn *ji;
+	const struct bpf_insn *p;
+	uint8_t targets[BPF_MAXINSNS] = { 0 };
+	u_int i;
+
+	if (len < 1 || len > BPF_MAXINSNS) {
+		return NULL;
+	}
+
+	prog = kalloc_type(struct bpf_jit_program, struct bpf_jit_insn, len,
+	    Z_WAITOK | Z_ZERO);
+	if (prog == NULL) {
+		return NULL;
+	}
+	prog->bjp_len = len;
+
+	for (i = 0; i < len; i++) {
+		p = &f[i];
+		ji = &prog->bjp_insns[i];
+
+		ji->bji_op = bpf_jit_op(p->code);
+		ji->bji_k = p->k;
+		if (ji->bji_op == BJ_RET_K && p->code != (BPF_RET | BPF_K)) {
+			/* bpf_filter() rejects the packet when it runs into these */
+			ji->bji_k = 0;
+		}
+
+		switch (ji->bji_op) {
+		case BJ_JA:
+			/* bpf_validate() made sure these are in range */
+			ji->bji_jt = (uint16_t)(i + 1 + p->k);
+			targets[ji->bji_jt] = 1;
+			break;
+		case BJ_JGT_K:
+		case BJ_JGE_K:
+		case BJ_JEQ_K:
+		case BJ_JSET_K:
+		case BJ_JGT_X:
+		case BJ_JGE_X:
+		case BJ_JEQ_X:
+		case BJ_JSET_X:
+			ji->bji_jt = (uint16_t)(i + 1 + p->jt);
+			ji->bji_jf = (uint16_t)(i + 1 + p->jf);
+			targets[ji->bji_jt] = 1;
+			targets[ji->bji_jf] = 1;
+			break;
+		case BJ_LD_MEM:
+		case BJ_LDX_MEM:
+			prog->bjp_flags |= BJP_USES_MEM;
+			break;
+		default:
+			break;
+		}
+	}
+
+	/*
+	 * Fuse "ld [k]; jeq #k2, jt, jf" when nothing else jumps
+	 * to the jeq, the latter then becomes unreachable.
+	 */
+	for (i = 0; i + 1 < len; i++) {
+		struct bpf_jit_insn *jeq = &prog->bjp_insns[i + 1];
+
+		ji = &prog->bjp_insns[i];
+		if (jeq->bji_op != BJ_JEQ_K || targets[i + 1]) {
+			continue;
+		}
+		switch (ji->bji_op) {
+		case BJ_LD_W_ABS:
+			ji->bji_op = BJ_LD_W_ABS_JEQ;
+			break;
+		case BJ_LD_H_ABS:
+			ji->bji_op = BJ_LD_H_ABS_JEQ;
+			break;
+		case BJ_LD_B_ABS:
+			ji->bji_op = BJ_LD_B_ABS_JEQ;
+			break;
+		default:
+			continue;
+		}
+		ji->bji_k2 = jeq->bji_k;
+		ji->bji_jt = jeq->bji_jt;
+		ji->bji_jf = jeq->bji_jf;
+	}
+
+	return prog;
+}
+
+void
+bpf_jit_free(struct bpf_jit_program *prog)
+{
+	kfree_type(struct bpf_jit_program, struct bpf_jit_insn, prog->bjp_len, prog);
+}
+
+/*
+ * The leading contiguous part of a packet: the optional header
+ * followed by the data of the first mbuf or buflet.
+ */
+struct bpf_jit_ctx {
+	u_char *__indexable     bjc_hdr;
+	size_t                  bjc_hdrlen;
+	u_char *__indexable     bjc_data;
+	size_t                  bjc_datalen;
+};
+
+static inline void
+bpf_jit_ctx_init(struct bpf_jit_ctx *ctx, struct bpf_packet *bp)
+{
+	ctx->bjc_hdr = bp->bpfp_header;
+	ctx->bjc_hdrlen = bp->bpfp_header_length;
+	ctx->bjc_data = NULL;
+	ctx->bjc_datalen = 0;
+
+	switch (bp->bpfp_type) {
+	case BPF_PACKET_TYPE_MBUF:
+		if (bp->bpfp_mbuf != NULL) {
+			ctx->bjc_data = mtod(bp->bpfp_mbuf, u_char *);
+			ctx->bjc_datalen = bp->bpfp_mbuf->m_len;
+		}
+		break;
+#if SKYWALK
+	case BPF_PACKET_TYPE_PKT: {
+		kern_buflet_t __single buflet;
+
+		buflet = kern_packet_get_next_buflet(bp->bpfp_pkt, NULL);
+		if (buflet != NULL) {
+			ctx->bjc_data = (u_char *)buflet_get_address(buflet);
+			if (ctx->bjc_data != NULL) {
+				ctx->bjc_datalen = kern_buflet_get_data_length(buflet);
+			}
+		}
+		break;
+	}
+#endif /* SKYWALK */
+	default:
+		break;
+	}
+}
+
+/*
+ * Returns a pointer to the `size' bytes at offset `k' if they are
+ * in the contiguous part of the packet, NULL otherwise.
+ */
+static inline u_char *__indexable
+bpf_jit_ptr(const struct bpf_jit_ctx *ctx, bpf_u_int32 k, size_t size)
+{
+	if (k < ctx->bjc_hdrlen) {
+		if (size <= ctx->bjc_hdrlen - k) {
+			return ctx->bjc_hdr + k;
+		}
+		return NULL;
+	}
+	k -= ctx->bjc_hdrlen;
+	if (k < ctx->bjc_datalen && size <= ctx->bjc_datalen - k) {
+		return ctx->bjc_data + k;
+	}
+	return NULL;
+}
+
+static inline u_int32_t
+bpf_jit_ldw(const struct bpf_jit_ctx *ctx, struct bpf_packet *bp, bpf_u_int32 k, int *err)
+{
+	u_char *cp = bpf_jit_ptr(ctx, k, sizeof(u_int32_t));
+
+	if (cp != NULL) {
+		*err = 0;
+		return EXTRACT_LONG(cp);
+	}
+	return bp_xword(bp, k, err);
+}
+
+static inline u_int16_t
+bpf_jit_ldh(const struct bpf_jit_ctx *ctx, struct bpf_packet *bp, bpf_u_int32 k, int *err)
+{
+	u_char *cp = bpf_jit_ptr(ctx, k, sizeof(u_int16_t));
+
+	if (cp != NULL) {
+		*err = 0;
+		return EXTRACT_SHORT(cp);
+	}
+	return bp_xhalf(bp, k, err);
+}
+
+static inline u_int8_t
+bpf_jit_ldb(const struct bpf_jit_ctx *ctx, struct bpf_packet *bp, bpf_u_int32 k, int *err)
+{
+	u_char *cp = bpf_jit_ptr(ctx, k, sizeof(u_int8_t));
+
+	if (cp != NULL) {
+		*err = 0;
+		return *cp;
+	}
+	return bp_xbyte(bp, k, err);
+}
+
+/*
+ * Run a compiled filter on the packet p, with the same
+ * semantics as bpf_filter(pc, len, p, wirelen, 0).
+ */
+u_int
+bpf_jit_filter(const struct bpf_jit_program *prog,
+    u_char *__sized_by(sizeof(struct bpf_packet)) p, u_int wirelen)
+{
+	struct bpf_packet *bp = (struct bpf_packet *)(void *)p;
+	const struct bpf_jit_insn *ji;
+	struct bpf_jit_ctx ctx;
+	u_int32_t A = 0, X = 0;
+	int32_t mem[BPF_MEMWORDS];
+	u_int pc = 0;
+	int merr;
+
+	if (prog->bjp_flags & BJP_USES_MEM) {
+		bzero(mem, sizeof(mem));
+	}
+	bpf_jit_ctx_init(&ctx, bp);
+
+	for (;;) {
+		ji = &prog->bjp_insns[pc++];
+
+		switch (ji->bji_op) {
+		case BJ_RET_K:
+			return (u_int)ji->bji_k;
+
+		case BJ_RET_A:
+			return (u_int)A;
+
+		case BJ_LD_W_ABS:
+			A = bpf_jit_ldw(&ctx, bp, ji->bji_k, &merr);
+			if (merr != 0) {
+				return 0;
+			}
+			continue;
+
+		case BJ_LD_H_ABS:
+			A = bpf_jit_ldh(&ctx, bp, ji->bji_k, &merr);
+			if (merr != 0) {
+				return 0;
+			}
+			continue;
+
+		case BJ_LD_B_ABS:
+			A = bpf_jit_ldb(&ctx, bp, ji->bji_k, &merr);
+			if (merr != 0) {
+				return 0;
+			}
+			continue;
+
+		case BJ_LD_W_ABS_JEQ:
+			A = bpf_jit_ldw(&ctx, bp, ji->bji_k, &merr);
+			if (merr != 0) {
+				return 0;
+			}
+			pc = (A == ji->bji_k2) ? ji->bji_jt : ji->bji_jf;
+			continue;
+
+		case BJ_LD_H_ABS_JEQ:
+			A = bpf_jit_ldh(&ctx, bp, ji->bji_k, &merr);
+			if (merr != 0) {
+				return 0;
+			}
+			pc = (A == ji->bji_k2) ? ji->bji_jt : ji->bji_jf;
+			continue;
+
+		case BJ_LD_B_ABS_JEQ:
+			A = bpf_jit_ldb(&ctx, bp, ji->bji_k, &merr);
+			if (merr != 0) {
+				return 0;
+			}
+			pc = (A == ji->bji_k2) ? ji->bji_jt : ji->bji_jf;
+			continue;
+
+		case BJ_LD_W_IND:
+			A = bpf_jit_ldw(&ctx, bp, X + ji->bji_k, &merr);
+			if (merr != 0) {
+				return 0;
+			}
+			continue;
+
+		case BJ_LD_H_IND:
+			A = bpf_jit_ldh(&ctx, bp, X + ji->bji_k, &merr);
+			if (merr != 0) {
+				return 0;
+			}
+			continue;
+
+		case BJ_LD_B_IND:
+			A = bpf_jit_ldb(&ctx, bp, X + ji->bji_k, &merr);
+			if (merr != 0) {
+				return 0;
+			}
+			continue;
+
+		case BJ_LD_LEN:
+			A = wirelen;
+			continue;
+
+		case BJ_LDX_LEN:
+			X = wirelen;
+			continue;
+
+		case BJ_LDX_MSH:
+			X = bpf_jit_ldb(&ctx, bp, ji->bji_k, &merr);
+			if (merr != 0) {
+				return 0;
+			}
+			X = (X & 0xf) << 2;
+			continue;
+
+		case BJ_LD_IMM:
+			A = ji->bji_k;
+			continue;
+
+		case BJ_LDX_IMM:
+			X = ji->bji_k;
+			continue;
+
+		/* bpf_validate() checked k < BPF_MEMWORDS for all of these */
+		case BJ_LD_MEM:
+			A = mem[ji->bji_k];
+			continue;
+
+		case BJ_LDX_MEM:
+			X = mem[ji->bji_k];
+			continue;
+
+		case BJ_ST:
+			mem[ji->bji_k] = A;
+			continue;
+
+		case BJ_STX:
+			mem[ji->bji_k] = X;
+			continue;
+
+		case BJ_JA:
+			pc = ji->bji_jt;
+			continue;
+
+		case BJ_JGT_K:
+			pc = (A > ji->bji_k) ? ji->bji_jt : ji->bji_jf;
+			continue;
+
+		case BJ_JGE_K:
+			pc = (A >= ji->bji_k) ? ji->bji_jt : ji->bji_jf;
+			continue;
+
+		case BJ_JEQ_K:
+			pc = (A == ji->bji_k) ? ji->bji_jt : ji->bji_jf;
+			continue;
+
+		case BJ_JSET_K:
+			pc = (A & ji->bji_k) ? ji->bji_jt : ji->bji_jf;
+			continue;
+
+		case BJ_JGT_X:
+			pc = (A > X) ? ji->bji_jt : ji->bji_jf;
+			continue;
+
+		case BJ_JGE_X:
+			pc = (A >= X) ? ji->bji_jt : ji->bji_jf;
+			continue;
+
+		case BJ_JEQ_X:
+			pc = (A == X) ? ji->bji_jt : ji->bji_jf;
+			continue;
+
+		case BJ_JSET_X:
+			pc = (A & X) ? ji->bji_jt : ji->bji_jf;
+			continue;
+
+		case BJ_ADD_X:
+			A += X;
+			continue;
+
+		case BJ_SUB_X:
+			A -= X;
+			continue;
+
+		case BJ_MUL_X:
+			A *= X;
+			continue;
+
+		case BJ_DIV_X:
+			if (X == 0) {
+				return 0;
+			}
+			A /= X;
+			continue;
+
+		case BJ_AND_X:
+			A &= X;
+			continue;
+
+		case BJ_OR_X:
+			A |= X;
+			continue;
+
+		case BJ_LSH_X:
+			A <<= X;
+			continue;
+
+		case BJ_RSH_X:
+			A >>= X;
+			continue;
+
+		case BJ_ADD_K:
+			A += ji->bji_k;
+			continue;
+
+		case BJ_SUB_K:
+			A -= ji->bji_k;
+			continue;
+
+		case BJ_MUL_K:
+			A *= ji->bji_k;
+			continue;
+
+		case BJ_DIV_K:
+			A /= ji->bji_k;
+			continue;
+
+		case BJ_AND_K:
+			A &= ji->bji_k;
+			continue;
+
+		case BJ_OR_K:
+			A |= ji->bji_k;
+			continue;
+
+		case BJ_LSH_K:
+			A <<= ji->bji_k;
+			continue;
+
+		case BJ_RSH_K:
+			A >>= ji->bji_k;
+			continue;
+
+		case BJ_NEG:
+			A = -A;
+			continue;
+
+		case BJ_TAX:
+			X = A;
+			continue;
+
+		case BJ_TXA:
+			A = X;
+			continue;
+
+		default:
+			return 0;
+		}
+	}
+}
+#endif /* KERNEL */
@@ -324,6 +324,12 @@ extern void     bpfdetach(struct ifnet *);
 extern void     bpfilterattach(int);
 extern u_int    bpf_filter(const struct bpf_insn *__counted_by(pc_len), u_int pc_len,
     u_char *__sized_by(sizeof(struct bpf_packet)), u_int wirelen, u_int);
+
+struct bpf_jit_program;
+extern struct bpf_jit_program *bpf_jit_compile(const struct bpf_insn *__counted_by(len), u_int len);
+extern void     bpf_jit_free(struct bpf_jit_program *);
+extern u_int    bpf_jit_filter(const struct bpf_jit_program *,
+    u_char *__sized_by(sizeof(struct bpf_packet)), u_int wirelen);
 #endif /* KERNEL_PRIVATE */
 
 #endif /* !defined(DRIVERKIT) */
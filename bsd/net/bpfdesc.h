@@ -124,6 +124,7 @@ struct bpf_d {
 	struct bpf_if   *bd_bif;        /* interface descriptor */
 	struct bpf_insn *__counted_by(bd_filter_len) bd_filter; /* filter code */
 	uint32_t        bd_filter_len;  /* filter code length  */
+	struct bpf_jit_program *bd_filter_jit; /* compiled filter code */
 	uint64_t        bd_rcount;      /* number of packets received */
 	uint64_t        bd_dcount;      /* number of received packets dropped */
 	uint64_t        bd_fcount;      /* number of received packets which matched filter */
@@ -82,6 +82,8 @@
 #include <net/dlil.h>
 
 #include <libkern/OSAtomic.h>
+#include <kern/counter.h>
+#include <kern/cpu_number.h>
 #include <kern/locks.h>
 
 #include <machine/limits.h>
@@ -107,6 +109,7 @@
 
 #include <netinet/ip6.h>
 #include <netinet6/ip6_var.h>
+#include <netinet6/scope6_var.h>
 
 #include <sys/kdebug.h>
 #include <sys/random.h>
@@ -159,6 +162,7 @@ static void inpcb_sched_timeout(void);
 static void inpcb_sched_lazy_timeout(void);
 static void _inpcb_sched_timeout(unsigned int);
 static void inpcb_timeout(void *, void *);
+static void in_pcblbgroup_remove(struct inpcb *);
 const int inpcb_timeout_lazy = 10;      /* 10 seconds leeway for lazy timers */
 extern int tvtohz(struct timeval *);
 
@@ -262,6 +266,55 @@ SYSCTL_PROC(_net_inet_ip_portrange, OID_AUTO, hilast,
 SYSCTL_INT(_net_inet_ip_portrange, OID_AUTO, ipport_allow_udp_port_exhaustion,
     CTLFLAG_LOCKED | CTLFLAG_RW, &allow_udp_port_exhaustion, 0, "");
 
+/*
+ * SMR protected pcb hash lookups.
+ *
+ * in_pcblookup_hash() first walks the pcb hash under the inpcb SMR domain
+ * without taking ipi_lock, and only falls back to the locked lookup when
+ * it can't conclude safely (misses, concurrent modifications of the hash,
+ * ambiguous wildcard matches, or pcbs going away).
+ *
+ * inpcbs are always freed through SMR, so that the lookup mode can be
+ * changed at any time with the net.inet.ip.pcb_smr.enabled sysctl.
+ */
+TUNABLE_WRITEABLE(int, inp_smr_lookup_enabled, "inp_smr_lookup", 1);
+
+SCALABLE_COUNTER_DEFINE(inp_smr_hits);
+SCALABLE_COUNTER_DEFINE(inp_smr_wild_hits);
+SCALABLE_COUNTER_DEFINE(inp_smr_miss);
+SCALABLE_COUNTER_DEFINE(inp_smr_fallback);
+
+SYSCTL_NODE(_net_inet_ip, OID_AUTO, pcb_smr,
+    CTLFLAG_RW | CTLFLAG_LOCKED, 0, "SMR pcb hash lookups");
+SYSCTL_INT(_net_inet_ip_pcb_smr, OID_AUTO, enabled,
+    CTLFLAG_RW | CTLFLAG_LOCKED, &inp_smr_lookup_enabled, 0, "");
+SYSCTL_SCALABLE_COUNTER(_net_inet_ip_pcb_smr, hits,
+    inp_smr_hits, "");
+SYSCTL_SCALABLE_COUNTER(_net_inet_ip_pcb_smr, wild_hits,
+    inp_smr_wild_hits, "");
+SYSCTL_SCALABLE_COUNTER(_net_inet_ip_pcb_smr, misses,
+    inp_smr_miss, "");
+SYSCTL_SCALABLE_COUNTER(_net_inet_ip_pcb_smr, fallback,
+    inp_smr_fallback, "");
+
+/*
+ * SO_REUSEPORT_LB listen groups.
+ *
+ * By default a member is chosen by hashing the 4-tuple of the incoming
+ * connection, so that all segments of a given connection keep reaching
+ * the same listener. When net.inet.ip.lbgroup_cpu_select is set, the
+ * member is chosen based on the CPU processing the connection request
+ * instead, which keeps accept() local to that CPU for applications
+ * running one listener thread per CPU.
+ */
+#define INPCBLBGROUP_SIZMIN     8
+#define INPCBLBGROUP_SIZMAX     256
+
+static int inp_lbgroup_cpu_select = 0;
+SYSCTL_INT(_net_inet_ip, OID_AUTO, lbgroup_cpu_select,
+    CTLFLAG_RW | CTLFLAG_LOCKED, &inp_lbgroup_cpu_select, 0,
+    "Select SO_REUSEPORT_LB listeners by CPU rather than by 4-tuple hash");
+
 static uint32_t apn_fallbk_debug = 0;
 #define apn_fallbk_log(x)       do { if (apn_fallbk_debug >= 1) log x; } while (0)
 
@@ -1998,6 +2051,9 @@ in_pcbdetach(struct inpcb *inp)
 		kfree_data_counted_by(inp->inp_keepalive_data, inp->inp_keepalive_datalen);
 	}
 
+	/* stop being selected for new connections */
+	in_pcblbgroup_leave(inp);
+
 	/* mark socket state as dead */
 	if (in_pcb_checkstate(inp, WNT_STOPUSING, 1) != WNT_STOPUSING) {
 		panic("%s: so=%p proto=%d couldn't set to STOPUSING",
@@ -2065,6 +2121,8 @@ in_pcbdetach(struct inpcb *inp)
 }
 
 
+static void in_pcb_smr_free(smr_node_t node);
+
 void
 in_pcbdispose(struct inpcb *inp)
 {
@@ -2135,13 +2193,26 @@ in_pcbdispose(struct inpcb *inp)
 		 * we deallocate the structure.
 		 */
 		ROUTE_RELEASE(&inp->inp_route);
-		zfree(ipi->ipi_zone, inp);
 		proto_memacct_sub(so->so_proto, kalloc_type_size(ipi->ipi_zone));
+		/*
+		 * in_pcblookup_hash_smr() might still be looking at this pcb,
+		 * defer freeing it until all SMR readers are done with it.
+		 */
+		inp_smr_call(&inp->inp_smr_node,
+		    kalloc_type_size(ipi->ipi_zone), in_pcb_smr_free);
 
 		sodealloc(so);
 	}
 }
 
+static void
+in_pcb_smr_free(smr_node_t node)
+{
+	struct inpcb *inp = __container_of(node, struct inpcb, inp_smr_node);
+
+	zfree(inp->inp_pcbinfo->ipi_zone, inp);
+}
+
 /*
  * The calling convention of in_getsockaddr() and in_getpeeraddr() was
  * modified to match the pru_sockaddr() and pru_peeraddr() entry points
@@ -2339,14 +2410,14 @@ in_pcblookup_local(struct inpcbinfo *pcbinfo, struct in_addr laddr,
 	KERNEL_DEBUG(DBG_FNC_PCB_LOOKUP | DBG_FUNC_START, 0, 0, 0, 0, 0);
 
 	if (!wild_okay) {
-		struct inpcbhead *head;
+		struct smrq_list_head *head;
 		/*
 		 * Look for an unconnected (wildcard foreign addr) PCB that
 		 * matches the local address and port we're looking for.
 		 */
 		head = &pcbinfo->ipi_hashbase[INP_PCBHASH(INADDR_ANY, lport, 0,
 		    pcbinfo->ipi_hashmask)];
-		LIST_FOREACH(inp, head, inp_hash) {
+		smrq_serialized_foreach(inp, head, inp_hash) {
 			if (!(inp->inp_vflag & INP_IPV4)) {
 				continue;
 			}
@@ -2429,7 +2500,7 @@ in_pcblookup_hash_exists(struct inpcbinfo *pcbinfo, struct in_addr faddr,
     u_int fport_arg, struct in_addr laddr, u_int lport_arg, int wildcard,
     uid_t *uid, gid_t *gid, struct ifnet *ifp)
 {
-	struct inpcbhead *head;
+	struct smrq_list_head *head;
 	struct inpcb *inp;
 	u_short fport = (u_short)fport_arg, lport = (u_short)lport_arg;
 	int found = 0;
@@ -2450,7 +2521,7 @@ in_pcblookup_hash_exists(struct inpcbinfo *pcbinfo, struct in_addr faddr,
 	 */
 	head = &pcbinfo->ipi_hashbase[INP_PCBHASH(faddr.s_addr, lport, fport,
 	    pcbinfo->ipi_hashmask)];
-	LIST_FOREACH(inp, head, inp_hash) {
+	smrq_serialized_foreach(inp, head, inp_hash) {
 		if (!(inp->inp_vflag & INP_IPV4)) {
 			continue;
 		}
@@ -2492,7 +2563,7 @@ in_pcblookup_hash_exists(struct inpcbinfo *pcbinfo, struct in_addr faddr,
 
 	head = &pcbinfo->ipi_hashbase[INP_PCBHASH(INADDR_ANY, lport, 0,
 	    pcbinfo->ipi_hashmask)];
-	LIST_FOREACH(inp, head, inp_hash) {
+	smrq_serialized_foreach(inp, head, inp_hash) {
 		if (!(inp->inp_vflag & INP_IPV4)) {
 			continue;
 		}
@@ -2559,7 +2630,7 @@ in_pcblookup_hash_locked(struct inpcbinfo *pcbinfo, struct in_addr faddr,
     u_int fport_arg, struct in_addr laddr, u_int lport_arg, int wildcard,
     struct ifnet *ifp)
 {
-	struct inpcbhead *head;
+	struct smrq_list_head *head;
 	struct inpcb *inp;
 	u_short fport = (u_short)fport_arg, lport = (u_short)lport_arg;
 	struct inpcb *local_wild = NULL;
@@ -2570,7 +2641,7 @@ in_pcblookup_hash_locked(struct inpcbinfo *pcbinfo, struct in_addr faddr,
 	 */
 	head = &pcbinfo->ipi_hashbase[INP_PCBHASH(faddr.s_addr, lport, fport,
 	    pcbinfo->ipi_hashmask)];
-	LIST_FOREACH(inp, head, inp_hash) {
+	smrq_serialized_foreach(inp, head, inp_hash) {
 		if (!(inp->inp_vflag & INP_IPV4)) {
 			continue;
 		}
@@ -2608,9 +2679,23 @@ in_pcblookup_hash_locked(struct inpcbinfo *pcbinfo, struct in_addr faddr,
 		return NULL;
 	}
 
+	/*
+	 * Then for a SO_REUSEPORT_LB listen group.
+	 */
+	if (pcbinfo->ipi_lbgrouphashbase != NULL) {
+		inp = in_pcblbgroup_lookup(pcbinfo, faddr, fport, laddr, lport);
+		if (inp != NULL && !inp_restricted_recv(inp, ifp) &&
+#if NECP
+		    necp_socket_is_allowed_to_recv_on_interface(inp, ifp) &&
+#endif /* NECP */
+		    in_pcb_checkstate(inp, WNT_ACQUIRE, 0) != WNT_STOPUSING) {
+			return inp;
+		}
+	}
+
 	head = &pcbinfo->ipi_hashbase[INP_PCBHASH(INADDR_ANY, lport, 0,
 	    pcbinfo->ipi_hashmask)];
-	LIST_FOREACH(inp, head, inp_hash) {
+	smrq_serialized_foreach(inp, head, inp_hash) {
 		if (!(inp->inp_vflag & INP_IPV4)) {
 			continue;
 		}
@@ -2664,6 +2749,156 @@ in_pcblookup_hash_locked(struct inpcbinfo *pcbinfo, struct in_addr faddr,
 	return NULL;
 }
 
+/*
+ * Returned by in_pcblookup_hash_smr() when the lookup must be redone
+ * under ipi_lock.
+ */
+#define INP_SMR_FALLBACK        ((struct inpcb *)-1)
+
+/*
+ * Lookup PCB in hash list under SMR, without taking ipi_lock.
+ *
+ * This mirrors in_pcblookup_hash_locked(), but only returns conclusive
+ * answers: any miss, or any situation where the locked lookup could have
+ * made a different choice, results in INP_SMR_FALLBACK.
+ *
+ * Since sockets aren't SMR protected, inp_socket and anything that might
+ * block (NECP) are only looked at after a want count has been taken.
+ */
+static struct inpcb *
+in_pcblookup_hash_smr(struct inpcbinfo *pcbinfo, struct in_addr faddr,
+    u_int fport_arg, struct in_addr laddr, u_int lport_arg, int wildcard,
+    struct ifnet *ifp)
+{
+	struct smrq_list_head *head;
+	struct inpcb *inp, *match = NULL, *local_wild = NULL;
+	u_short fport = (u_short)fport_arg, lport = (u_short)lport_arg;
+	uint32_t seq;
+	bool exact = false, lbgroup = false;
+
+	seq = os_atomic_load(&pcbinfo->ipi_hash_seq, acquire);
+	if (seq & 1) {
+		return INP_SMR_FALLBACK;
+	}
+
+	inp_smr_enter();
+
+	/*
+	 * First look for an exact match.
+	 */
+	head = &pcbinfo->ipi_hashbase[INP_PCBHASH(faddr.s_addr, lport, fport,
+	    pcbinfo->ipi_hashmask)];
+	smrq_entered_foreach(inp, head, inp_hash) {
+		if ((inp->inp_vflag & INP_IPV4) &&
+		    inp->inp_faddr.s_addr == faddr.s_addr &&
+		    inp->inp_laddr.s_addr == laddr.s_addr &&
+		    inp->inp_fport == fport &&
+		    inp->inp_lport == lport) {
+			match = inp;
+			exact = true;
+			break;
+		}
+	}
+
+	/*
+	 * Group members are validated by INP2_IN_LBGROUP once held,
+	 * which doesn't require ipi_hash_seq to be stable.
+	 */
+	if (match == NULL && wildcard &&
+	    pcbinfo->ipi_lbgrouphashbase != NULL) {
+		match = in_pcblbgroup_lookup(pcbinfo, faddr, fport,
+		    laddr, lport);
+		lbgroup = (match != NULL);
+	}
+
+	if (match == NULL && wildcard) {
+		head = &pcbinfo->ipi_hashbase[INP_PCBHASH(INADDR_ANY, lport, 0,
+		    pcbinfo->ipi_hashmask)];
+		smrq_entered_foreach(inp, head, inp_hash) {
+			if (!(inp->inp_vflag & INP_IPV4) ||
+			    inp->inp_faddr.s_addr != INADDR_ANY ||
+			    inp->inp_lport != lport) {
+				continue;
+			}
+			if (inp->inp_laddr.s_addr == laddr.s_addr) {
+				match = inp;
+				break;
+			}
+			if (inp->inp_laddr.s_addr == INADDR_ANY) {
+				if (local_wild != NULL) {
+					/*
+					 * Choosing between several wildcard
+					 * pcbs requires looking at sockets.
+					 */
+					match = INP_SMR_FALLBACK;
+					break;
+				}
+				local_wild = inp;
+			}
+		}
+		if (match == NULL) {
+			match = local_wild;
+		}
+
+		/*
+		 * Non exact matches are only valid if the hash
+		 * wasn't modified while we were looking at it.
+		 */
+		os_atomic_thread_fence(acquire);
+		if (os_atomic_load(&pcbinfo->ipi_hash_seq, relaxed) != seq) {
+			match = INP_SMR_FALLBACK;
+		}
+	}
+
+	if (match == NULL) {
+		inp_smr_leave();
+		counter_inc(&inp_smr_miss);
+		return INP_SMR_FALLBACK;
+	}
+
+	if (match != INP_SMR_FALLBACK &&
+	    in_pcb_checkstate(match, WNT_ACQUIRE, 0) == WNT_STOPUSING) {
+		match = INP_SMR_FALLBACK;
+	}
+
+	inp_smr_leave();
+
+	if (match == INP_SMR_FALLBACK) {
+		counter_inc(&inp_smr_fallback);
+		return INP_SMR_FALLBACK;
+	}
+
+	/*
+	 * Now that the pcb can't be disposed of, make sure it is still
+	 * the one we were looking for, and that it can receive on ifp:
+	 * it may have been disconnected and reconnected (or rebound)
+	 * since, which ipi_hash_seq doesn't catch for exact matches.
+	 */
+	inp = match;
+	if (!(inp->inp_flags2 & INP2_INHASHLIST) ||
+	    !(inp->inp_vflag & INP_IPV4) ||
+	    (lbgroup && !(inp->inp_flags2 & INP2_IN_LBGROUP)) ||
+	    inp->inp_lport != lport ||
+	    (exact && (inp->inp_faddr.s_addr != faddr.s_addr ||
+	    inp->inp_laddr.s_addr != laddr.s_addr ||
+	    inp->inp_fport != fport)) ||
+	    (!exact && !lbgroup && (inp->inp_faddr.s_addr != INADDR_ANY ||
+	    (inp->inp_laddr.s_addr != laddr.s_addr &&
+	    inp->inp_laddr.s_addr != INADDR_ANY))) ||
+	    inp_restricted_recv(inp, ifp)
+#if NECP
+	    || !necp_socket_is_allowed_to_recv_on_interface(inp, ifp)
+#endif /* NECP */
+	    ) {
+		in_pcb_checkstate(inp, WNT_RELEASE, 0);
+		counter_inc(&inp_smr_fallback);
+		return INP_SMR_FALLBACK;
+	}
+
+	counter_inc(exact ? &inp_smr_hits : &inp_smr_wild_hits);
+	return inp;
+}
+
 struct inpcb *
 in_pcblookup_hash(struct inpcbinfo *pcbinfo, struct in_addr faddr,
     u_int fport_arg, struct in_addr laddr, u_int lport_arg, int wildcard,
@@ -2671,6 +2906,14 @@ in_pcblookup_hash(struct inpcbinfo *pcbinfo, struct in_addr faddr,
 {
 	struct inpcb *inp;
 
+	if (inp_smr_lookup_enabled) {
+		inp = in_pcblookup_hash_smr(pcbinfo, faddr, fport_arg, laddr,
+		    lport_arg, wildcard, ifp);
+		if (inp != INP_SMR_FALLBACK) {
+			return inp;
+		}
+	}
+
 	lck_rw_lock_shared(&pcbinfo->ipi_lock);
 
 	inp = in_pcblookup_hash_locked(pcbinfo, faddr, fport_arg, laddr,
@@ -2701,6 +2944,26 @@ in_pcblookup_hash_try(struct inpcbinfo *pcbinfo, struct in_addr faddr,
 	return inp;
 }
 
+/*
+ * Modifications of the pcb hash are bracketed by these so that
+ * in_pcblookup_hash_smr() can detect them, ipi_hash_seq is odd
+ * while the hash is being modified.
+ *
+ * Must be called with ipi_lock held exclusive.
+ */
+static inline void
+in_pcbhash_modify_begin(struct inpcbinfo *pcbinfo)
+{
+	os_atomic_inc(&pcbinfo->ipi_hash_seq, relaxed);
+	os_atomic_thread_fence(release);
+}
+
+static inline void
+in_pcbhash_modify_end(struct inpcbinfo *pcbinfo)
+{
+	os_atomic_inc(&pcbinfo->ipi_hash_seq, release);
+}
+
 /*
  * @brief	Insert PCB onto various hash lists.
  *
@@ -2714,7 +2977,7 @@ in_pcblookup_hash_try(struct inpcbinfo *pcbinfo, struct in_addr faddr,
 int
 in_pcbinshash(struct inpcb *inp, struct sockaddr *remote, int locked)
 {
-	struct inpcbhead *pcbhash;
+	struct smrq_list_head *pcbhash;
 	struct inpcbporthead *pcbporthash;
 	struct inpcbinfo *pcbinfo = inp->inp_pcbinfo;
 	struct inpcbport *phd;
@@ -2808,7 +3071,9 @@ in_pcbinshash(struct inpcb *inp, struct sockaddr *remote, int locked)
 
 	inp->inp_phd = phd;
 	LIST_INSERT_HEAD(&phd->phd_pcblist, inp, inp_portlist);
-	LIST_INSERT_HEAD(pcbhash, inp, inp_hash);
+	in_pcbhash_modify_begin(pcbinfo);
+	smrq_serialized_insert_head(pcbhash, &inp->inp_hash);
+	in_pcbhash_modify_end(pcbinfo);
 	inp->inp_flags2 |= INP2_INHASHLIST;
 
 	if (!locked) {
@@ -2832,7 +3097,8 @@ in_pcbinshash(struct inpcb *inp, struct sockaddr *remote, int locked)
 void
 in_pcbrehash(struct inpcb *inp)
 {
-	struct inpcbhead *head;
+	struct inpcbinfo *pcbinfo = inp->inp_pcbinfo;
+	struct smrq_list_head *head;
 	u_int32_t hashkey_faddr;
 
 #if SKYWALK
@@ -2878,19 +3144,24 @@ in_pcbrehash(struct inpcb *inp)
 		hashkey_faddr = inp->inp_faddr.s_addr;
 	}
 
-	inp->inp_hash_element = INP_PCBHASH(hashkey_faddr, inp->inp_lport,
-	    inp->inp_fport, inp->inp_pcbinfo->ipi_hashmask);
-	head = &inp->inp_pcbinfo->ipi_hashbase[inp->inp_hash_element];
+	in_pcbhash_modify_begin(pcbinfo);
 
 	if (inp->inp_flags2 & INP2_INHASHLIST) {
-		LIST_REMOVE(inp, inp_hash);
+		head = &pcbinfo->ipi_hashbase[inp->inp_hash_element];
+		smrq_serialized_remove(head, &inp->inp_hash);
 		inp->inp_flags2 &= ~INP2_INHASHLIST;
 	}
 
+	inp->inp_hash_element = INP_PCBHASH(hashkey_faddr, inp->inp_lport,
+	    inp->inp_fport, pcbinfo->ipi_hashmask);
+	head = &pcbinfo->ipi_hashbase[inp->inp_hash_element];
+
 	VERIFY(!(inp->inp_flags2 & INP2_INHASHLIST));
-	LIST_INSERT_HEAD(head, inp, inp_hash);
+	smrq_serialized_insert_head(head, &inp->inp_hash);
 	inp->inp_flags2 |= INP2_INHASHLIST;
 
+	in_pcbhash_modify_end(pcbinfo);
+
 #if NECP
 	// This call catches updates to the remote addresses
 	inp_update_necp_policy(inp, NULL, NULL, 0);
@@ -2906,6 +3177,10 @@ in_pcbremlists(struct inpcb *inp)
 {
 	inp->inp_gencnt = ++inp->inp_pcbinfo->ipi_gencnt;
 
+	if (inp->inp_flags2 & INP2_IN_LBGROUP) {
+		in_pcblbgroup_remove(inp);
+	}
+
 	/*
 	 * Check if it's in hashlist -- an inp is placed in hashlist when
 	 * it's local port gets assigned. So it should also be present
@@ -2916,9 +3191,15 @@ in_pcbremlists(struct inpcb *inp)
 
 		VERIFY(phd != NULL && inp->inp_lport > 0);
 
-		LIST_REMOVE(inp, inp_hash);
-		inp->inp_hash.le_next = NULL;
-		inp->inp_hash.le_prev = NULL;
+		/*
+		 * Leave inp_hash.next alone,
+		 * SMR readers might still be walking through it.
+		 */
+		in_pcbhash_modify_begin(inp->inp_pcbinfo);
+		smrq_serialized_remove(
+			&inp->inp_pcbinfo->ipi_hashbase[inp->inp_hash_element],
+			&inp->inp_hash);
+		in_pcbhash_modify_end(inp->inp_pcbinfo);
 
 		LIST_REMOVE(inp, inp_portlist);
 		inp->inp_portlist.le_next = NULL;
@@ -2956,6 +3237,304 @@ in_pcbremlists(struct inpcb *inp)
 	inp->inp_pcbinfo->ipi_count--;
 }
 
+#pragma mark - SO_REUSEPORT_LB listen groups
+
+static struct smrq_list_head *
+in_pcblbgroup_head(struct inpcbinfo *pcbinfo, u_short lport)
+{
+	return &pcbinfo->ipi_lbgrouphashbase[INP_PCBPORTHASH(lport,
+	           pcbinfo->ipi_lbgrouphashmask)];
+}
+
+static struct inpcblbgroup *
+in_pcblbgroup_alloc(struct inpcb *inp, uint32_t size)
+{
+	struct inpcblbgroup *grp;
+
+	grp = kalloc_type(struct inpcblbgroup, struct inpcb *, size,
+	    Z_WAITOK | Z_ZERO | Z_NOFAIL);
+	grp->il_inpsiz = size;
+	grp->il_lport = inp->inp_lport;
+	grp->il_vflag = inp->inp_vflag;
+	grp->il_lifscope = inp->inp_lifscope;
+	grp->il_laddr6 = inp->in6p_laddr;
+	return grp;
+}
+
+static void
+in_pcblbgroup_free_smr(smr_node_t node)
+{
+	struct inpcblbgroup *grp;
+	uint32_t size;
+
+	grp = __container_of(node, struct inpcblbgroup, il_smr_node);
+	size = grp->il_inpsiz;
+	kfree_type(struct inpcblbgroup, struct inpcb *, size, grp);
+}
+
+static void
+in_pcblbgroup_free(struct inpcblbgroup *grp)
+{
+	inp_smr_call(&grp->il_smr_node, sizeof(*grp) +
+	    grp->il_inpsiz * sizeof(struct inpcb *), in_pcblbgroup_free_smr);
+}
+
+static bool
+in_pcblbgroup_matches(struct inpcblbgroup *grp, struct inpcb *inp)
+{
+	return grp->il_lport == inp->inp_lport &&
+	       grp->il_vflag == inp->inp_vflag &&
+	       grp->il_lifscope == inp->inp_lifscope &&
+	       IN6_ARE_ADDR_EQUAL(&grp->il_laddr6, &inp->in6p_laddr);
+}
+
+/*
+ * Must be called with ipi_lock held exclusive.
+ */
+static int
+in_pcblbgroup_insert(struct inpcb *inp)
+{
+	struct inpcbinfo *pcbinfo = inp->inp_pcbinfo;
+	struct smrq_list_head *head;
+	struct inpcblbgroup *grp, *ngrp;
+	uint32_t cnt;
+
+	head = in_pcblbgroup_head(pcbinfo, inp->inp_lport);
+	smrq_serialized_foreach(grp, head, il_link) {
+		if (in_pcblbgroup_matches(grp, inp)) {
+			break;
+		}
+	}
+
+	if (grp == NULL) {
+		grp = in_pcblbgroup_alloc(inp, INPCBLBGROUP_SIZMIN);
+		smrq_serialized_insert_head(head, &grp->il_link);
+	} else if (grp->il_inpcnt == grp->il_inpsiz) {
+		if (grp->il_inpsiz >= INPCBLBGROUP_SIZMAX) {
+			return ENOBUFS;
+		}
+
+		/*
+		 * Readers might still be looking at the old array,
+		 * publish a copy and retire the old group through SMR.
+		 */
+		ngrp = in_pcblbgroup_alloc(inp, 2 * grp->il_inpsiz);
+		for (cnt = 0; cnt < grp->il_inpcnt; cnt++) {
+			ngrp->il_inp[cnt] = grp->il_inp[cnt];
+		}
+		ngrp->il_inpcnt = grp->il_inpcnt;
+		smrq_serialized_replace(head, &grp->il_link, &ngrp->il_link);
+		in_pcblbgroup_free(grp);
+		grp = ngrp;
+	}
+
+	cnt = grp->il_inpcnt;
+	grp->il_inp[cnt] = inp;
+	os_atomic_store(&grp->il_inpcnt, cnt + 1, release);
+	inp->inp_flags2 |= INP2_IN_LBGROUP;
+	return 0;
+}
+
+/*
+ * Must be called with ipi_lock held exclusive.
+ *
+ * Groups are looked up by port and membership rather than by address,
+ * as in_pcbdetach() might have cleared inp_vflag already.
+ */
+static void
+in_pcblbgroup_remove(struct inpcb *inp)
+{
+	struct smrq_list_head *head;
+	struct inpcblbgroup *grp;
+	uint32_t i, cnt;
+
+	head = in_pcblbgroup_head(inp->inp_pcbinfo, inp->inp_lport);
+	smrq_serialized_foreach(grp, head, il_link) {
+		if (grp->il_lport != inp->inp_lport) {
+			continue;
+		}
+		cnt = grp->il_inpcnt;
+		for (i = 0; i < cnt; i++) {
+			if (grp->il_inp[i] != inp) {
+				continue;
+			}
+
+			/*
+			 * Readers that still see the old count may return
+			 * the slot we're vacating, they will notice that
+			 * INP2_IN_LBGROUP is cleared once they hold the pcb.
+			 */
+			grp->il_inp[i] = grp->il_inp[cnt - 1];
+			os_atomic_store(&grp->il_inpcnt, cnt - 1, release);
+			if (cnt == 1) {
+				smrq_serialized_remove(head, &grp->il_link);
+				in_pcblbgroup_free(grp);
+			}
+			inp->inp_flags2 &= ~INP2_IN_LBGROUP;
+			return;
+		}
+	}
+
+	inp->inp_flags2 &= ~INP2_IN_LBGROUP;
+}
+
+/*
+ * @brief	Add a listening PCB with SO_REUSEPORT_LB set to the
+ *		load balancing group of its local address and port.
+ *
+ * @param	inp Pointer to internet protocol control block, with its
+ *		socket locked.
+ *
+ * @return	int error on failure and 0 on success
+ */
+int
+in_pcblbgroup_join(struct inpcb *inp)
+{
+	struct inpcbinfo *pcbinfo = inp->inp_pcbinfo;
+	int error = 0;
+
+	if (pcbinfo->ipi_lbgrouphashbase == NULL ||
+	    !(inp->inp_flags2 & INP2_REUSEPORT_LB) ||
+	    (inp->inp_flags2 & INP2_IN_LBGROUP)) {
+		return 0;
+	}
+
+	if (!lck_rw_try_lock_exclusive(&pcbinfo->ipi_lock)) {
+		socket_unlock(inp->inp_socket, 0);
+		lck_rw_lock_exclusive(&pcbinfo->ipi_lock);
+		socket_lock(inp->inp_socket, 0);
+	}
+
+	if (inp->inp_state == INPCB_STATE_DEAD) {
+		error = ECONNABORTED;
+	} else if (!(inp->inp_flags2 & INP2_INHASHLIST)) {
+		error = EINVAL;
+	} else if (!(inp->inp_flags2 & INP2_IN_LBGROUP)) {
+		error = in_pcblbgroup_insert(inp);
+	}
+
+	lck_rw_done(&pcbinfo->ipi_lock);
+	return error;
+}
+
+/*
+ * @brief	Remove a PCB from its load balancing group, so that it
+ *		stops being selected for incoming connections.
+ *
+ * @param	inp Pointer to internet protocol control block, with its
+ *		socket locked.
+ */
+void
+in_pcblbgroup_leave(struct inpcb *inp)
+{
+	struct inpcbinfo *pcbinfo = inp->inp_pcbinfo;
+
+	if (!(inp->inp_flags2 & INP2_IN_LBGROUP)) {
+		return;
+	}
+
+	if (!lck_rw_try_lock_exclusive(&pcbinfo->ipi_lock)) {
+		socket_unlock(inp->inp_socket, 0);
+		lck_rw_lock_exclusive(&pcbinfo->ipi_lock);
+		socket_lock(inp->inp_socket, 0);
+	}
+
+	if (inp->inp_flags2 & INP2_IN_LBGROUP) {
+		in_pcblbgroup_remove(inp);
+	}
+
+	lck_rw_done(&pcbinfo->ipi_lock);
+}
+
+static struct inpcb *
+in_pcblbgroup_select(struct inpcblbgroup *grp, uint32_t hash)
+{
+	uint32_t cnt = os_atomic_load(&grp->il_inpcnt, acquire);
+
+	if (cnt == 0) {
+		return NULL;
+	}
+	if (inp_lbgroup_cpu_select) {
+		hash = (uint32_t)cpu_number();
+	}
+	return grp->il_inp[hash % MIN(cnt, grp->il_inpsiz)];
+}
+
+/*
+ * @brief	Select a member of the IPv4 load balancing group for a
+ *		connection request, preferring a group bound to laddr,
+ *		then a wildcard IPv4 group, then a wildcard dual-stack one.
+ *
+ * Must be called either with ipi_lock held or inside an inpcb SMR
+ * read section. The returned pcb doesn't hold a want count.
+ */
+struct inpcb *
+in_pcblbgroup_lookup(struct inpcbinfo *pcbinfo, struct in_addr faddr,
+    u_short fport, struct in_addr laddr, u_short lport)
+{
+	struct inpcblbgroup *grp, *match = NULL;
+	struct inpcblbgroup *local_wild = NULL, *local_wild_mapped = NULL;
+
+	smrq_entered_foreach(grp, in_pcblbgroup_head(pcbinfo, lport), il_link) {
+		if (grp->il_lport != lport || !(grp->il_vflag & INP_IPV4)) {
+			continue;
+		}
+		if (grp->il_laddr6.s6_addr32[3] == laddr.s_addr) {
+			match = grp;
+			break;
+		}
+		if (grp->il_laddr6.s6_addr32[3] == INADDR_ANY) {
+			if (grp->il_vflag & INP_IPV6) {
+				local_wild_mapped = grp;
+			} else {
+				local_wild = grp;
+			}
+		}
+	}
+
+	if (match == NULL) {
+		match = local_wild != NULL ? local_wild : local_wild_mapped;
+	}
+	if (match == NULL) {
+		return NULL;
+	}
+
+	return in_pcblbgroup_select(match,
+	           INP_PCBLBGROUP_PKTHASH(faddr.s_addr, lport, fport));
+}
+
+/*
+ * @brief	IPv6 variant of in_pcblbgroup_lookup().
+ */
+struct inpcb *
+in6_pcblbgroup_lookup(struct inpcbinfo *pcbinfo, const struct in6_addr *faddr,
+    u_short fport, const struct in6_addr *laddr, u_short lport,
+    uint32_t lifscope)
+{
+	struct inpcblbgroup *grp, *local_wild = NULL;
+
+	smrq_entered_foreach(grp, in_pcblbgroup_head(pcbinfo, lport), il_link) {
+		if (grp->il_lport != lport || !(grp->il_vflag & INP_IPV6)) {
+			continue;
+		}
+		if (in6_are_addr_equal_scoped(&grp->il_laddr6, laddr,
+		    grp->il_lifscope, lifscope)) {
+			local_wild = grp;
+			break;
+		}
+		if (IN6_IS_ADDR_UNSPECIFIED(&grp->il_laddr6)) {
+			local_wild = grp;
+		}
+	}
+
+	if (local_wild == NULL) {
+		return NULL;
+	}
+
+	return in_pcblbgroup_select(local_wild,
+	           INP_PCBLBGROUP_PKTHASH(faddr->s6_addr32[3], lport, fport));
+}
+
 /*
  * Mechanism used to defer the memory release of PCBs
  * The pcb list will contain the pcb until the reaper can clean it up if
@@ -79,6 +79,7 @@
 #include <sys/bitstring.h>
 #include <sys/tree.h>
 #include <kern/locks.h>
+#include <kern/smr.h>
 #include <kern/uipc_domain.h>
 #include <kern/zalloc.h>
 #include <netinet/in_stat.h>
@@ -159,7 +160,7 @@ struct inp_necp_attributes {
  */
 struct inpcb {
 	decl_lck_mtx_data(, inpcb_mtx); /* inpcb per-socket mutex */
-	LIST_ENTRY(inpcb) inp_hash;     /* hash list */
+	struct smrq_link inp_hash;      /* hash list (SMR protected) */
 	LIST_ENTRY(inpcb) inp_list;     /* list for all PCBs of this proto */
 	void    *inp_ppcb;              /* pointer to per-protocol pcb */
 	struct inpcbinfo *inp_pcbinfo;  /* PCB list info */
@@ -268,6 +269,8 @@ struct inpcb {
 	char inp_e_proc_name[MAXCOMLEN + 1];
 
 	uint64_t inp_max_pacing_rate; /* Per-connection maximumg pacing rate to be enforced (Bytes/second) */
+
+	struct smr_node inp_smr_node;   /* deferred free, see in_pcbdispose() */
 };
 
 #define IFNET_COUNT_TYPE(_ifp)                                              \
@@ -702,10 +705,16 @@ struct inpcbinfo {
 	/*
 	 * Per-protocol hash of pcbs, hashed by local and foreign
 	 * addresses and port numbers.
+	 *
+	 * Modifications are serialized by ipi_lock held exclusive,
+	 * lookups can also be performed under the inpcb SMR domain
+	 * (see in_pcblookup_hash_smr()), in which case ipi_hash_seq
+	 * is used to detect concurrent modifications of the hash.
 	 */
-	struct inpcbhead        *__counted_by(ipi_hashbase_count) ipi_hashbase;
+	struct smrq_list_head   *__counted_by(ipi_hashbase_count) ipi_hashbase;
 	size_t                  ipi_hashbase_count;
 	u_long                  ipi_hashmask;
+	uint32_t                ipi_hash_seq;
 
 	/*
 	 * Per-protocol hash of pcbs, hashed by only local port number.
@@ -714,6 +723,18 @@ struct inpcbinfo {
 	size_t                  ipi_porthashbase_count;
 	u_long                  ipi_porthashmask;
 
+	/*
+	 * Per-protocol hash of SO_REUSEPORT_LB listen groups, hashed by
+	 * local port number, NULL for protocols that don't support them.
+	 *
+	 * Modifications are serialized by ipi_lock held exclusive,
+	 * lookups are performed either under ipi_lock or under
+	 * the inpcb SMR domain.
+	 */
+	struct smrq_list_head   *__counted_by(ipi_lbgrouphashbase_count) ipi_lbgrouphashbase;
+	size_t                  ipi_lbgrouphashbase_count;
+	u_long                  ipi_lbgrouphashmask;
+
 	/*
 	 * Misc.
 	 */
@@ -725,10 +746,41 @@ struct inpcbinfo {
 	u_int32_t               ipi_flags;
 };
 
+/*
+ * The SMR domain protecting inpcb hash lookups, inpcbs are only freed
+ * once all readers are guaranteed to have left their critical section.
+ */
+#define inp_smr                 smr_system
+#define inp_smr_enter()         smr_enter(&inp_smr)
+#define inp_smr_leave()         smr_leave(&inp_smr)
+#define inp_smr_call(n, sz, cb) smr_call(&inp_smr, n, sz, cb)
+
 #define INP_PCBHASH(faddr, lport, fport, mask) \
 	(((faddr) ^ ((faddr) >> 16) ^ ntohs((lport) ^ (fport))) & (mask))
 #define INP_PCBPORTHASH(lport, mask) \
 	(ntohs((lport)) & (mask))
+#define INP_PCBLBGROUP_PKTHASH(faddr, lport, fport) \
+	((faddr) ^ ((faddr) >> 16) ^ ntohs((lport) ^ (fport)))
+
+/*
+ * A group of listening pcbs sharing the same local address and port
+ * through SO_REUSEPORT_LB, incoming connections are spread among
+ * the members (see in_pcblbgroup_select()).
+ *
+ * The member array is published with a release store of il_inpcnt,
+ * and groups are freed through the inpcb SMR domain.
+ */
+struct inpcblbgroup {
+	struct smrq_link        il_link;
+	struct smr_node         il_smr_node;
+	u_short                 il_lport;
+	u_char                  il_vflag;
+	uint32_t                il_lifscope;
+	struct in6_addr         il_laddr6;
+	uint32_t                il_inpcnt;
+	uint32_t                il_inpsiz;
+	struct inpcb           *il_inp[] __counted_by(il_inpsiz);
+};
 
 /*
  * The following macro need to return a bool value
@@ -851,6 +903,8 @@ struct inpcbinfo {
 #define INP2_ULTRA_CONSTRAINED_CHECKED  0x00200000 /* Checked entitlements for ultra-constrained interfaces */
 #define INP2_RECV_LINK_ADDR_TYPE        0x00400000 /* receive the type of the link level address */
 #define INP2_CONNECTION_IDLE            0x00800000 /* Connection is idle */
+#define INP2_REUSEPORT_LB               0x01000000 /* SO_REUSEPORT_LB is set */
+#define INP2_IN_LBGROUP                 0x02000000 /* pcb is in a SO_REUSEPORT_LB group */
 
 /*
  * Flags passed to in_pcblookup*() functions.
@@ -929,6 +983,13 @@ extern int in_getsockaddr(struct socket *, struct sockaddr **);
 extern int in_getsockaddr_s(struct socket *, struct sockaddr_in *);
 extern int in_pcb_checkstate(struct inpcb *, int, int);
 extern void in_pcbremlists(struct inpcb *);
+extern int in_pcblbgroup_join(struct inpcb *);
+extern void in_pcblbgroup_leave(struct inpcb *);
+extern struct inpcb *in_pcblbgroup_lookup(struct inpcbinfo *,
+    struct in_addr, u_short, struct in_addr, u_short);
+extern struct inpcb *in6_pcblbgroup_lookup(struct inpcbinfo *,
+    const struct in6_addr *, u_short, const struct in6_addr *, u_short,
+    uint32_t);
 extern void inpcb_to_compat(struct inpcb *, struct inpcb_compat *);
 #if XNU_TARGET_OS_OSX
 extern void inpcb_to_xinpcb64(struct inpcb *, struct xinpcb64 *);
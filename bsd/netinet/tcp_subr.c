@@ -585,6 +585,9 @@ tcp_init(struct protosw *pp, struct domain *dp)
 	hashinit_counted_by(tcp_tcbhashsize, tcbinfo.ipi_porthashbase,
 	    tcbinfo.ipi_porthashbase_count);
 	tcbinfo.ipi_porthashmask = tcbinfo.ipi_porthashbase_count - 1;
+	hashinit_counted_by(tcp_tcbhashsize, tcbinfo.ipi_lbgrouphashbase,
+	    tcbinfo.ipi_lbgrouphashbase_count);
+	tcbinfo.ipi_lbgrouphashmask = tcbinfo.ipi_lbgrouphashbase_count - 1;
 	tcbinfo.ipi_zone = tcpcbzone;
 
 	tcbinfo.ipi_gc = tcp_gc;
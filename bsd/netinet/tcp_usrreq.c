@@ -393,6 +393,9 @@ tcp_usr_listen(struct socket *so, struct proc *p)
 
 		inp_exit_bind_in_progress(so);
 	}
+	if (error == 0) {
+		error = in_pcblbgroup_join(inp);
+	}
 	if (error == 0) {
 		TCP_LOG_STATE(tp, TCPS_LISTEN);
 		tp->t_state = TCPS_LISTEN;
@@ -423,6 +426,9 @@ tcp6_usr_listen(struct socket *so, struct proc *p)
 
 		inp_exit_bind_in_progress(so);
 	}
+	if (error == 0) {
+		error = in_pcblbgroup_join(inp);
+	}
 	if (error == 0) {
 		TCP_LOG_STATE(tp, TCPS_LISTEN);
 		tp->t_state = TCPS_LISTEN;
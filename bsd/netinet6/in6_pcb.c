@@ -1240,14 +1240,14 @@ in6_pcblookup_local(struct inpcbinfo *pcbinfo, struct in6_addr *laddr,
 	struct inpcbport *__single phd;
 
 	if (!wild_okay) {
-		struct inpcbhead *__single head;
+		struct smrq_list_head *__single head;
 		/*
 		 * Look for an unconnected (wildcard foreign addr) PCB that
 		 * matches the local address and port we're looking for.
 		 */
 		head = &pcbinfo->ipi_hashbase[INP_PCBHASH(INADDR_ANY, lport, 0,
 		    pcbinfo->ipi_hashmask)];
-		LIST_FOREACH(inp, head, inp_hash) {
+		smrq_serialized_foreach(inp, head, inp_hash) {
 			if (!(inp->inp_vflag & INP_IPV6)) {
 				continue;
 			}
@@ -1373,7 +1373,7 @@ in6_pcblookup_hash_exists(struct inpcbinfo *pcbinfo, struct in6_addr *faddr,
     u_int fport_arg, uint32_t fifscope, struct in6_addr *laddr, u_int lport_arg, uint32_t lifscope, int wildcard,
     uid_t *uid, gid_t *gid, struct ifnet *ifp, bool relaxed)
 {
-	struct inpcbhead *__single head;
+	struct smrq_list_head *__single head;
 	struct inpcb *__single inp;
 	uint16_t fport = (uint16_t)fport_arg, lport = (uint16_t)lport_arg;
 	int found;
@@ -1388,7 +1388,7 @@ in6_pcblookup_hash_exists(struct inpcbinfo *pcbinfo, struct in6_addr *faddr,
 	 */
 	head = &pcbinfo->ipi_hashbase[INP_PCBHASH(faddr->s6_addr32[3] /* XXX */,
 	    lport, fport, pcbinfo->ipi_hashmask)];
-	LIST_FOREACH(inp, head, inp_hash) {
+	smrq_serialized_foreach(inp, head, inp_hash) {
 		if (!(inp->inp_vflag & INP_IPV6)) {
 			continue;
 		}
@@ -1428,7 +1428,7 @@ in6_pcblookup_hash_exists(struct inpcbinfo *pcbinfo, struct in6_addr *faddr,
 
 		head = &pcbinfo->ipi_hashbase[INP_PCBHASH(INADDR_ANY, lport, 0,
 		    pcbinfo->ipi_hashmask)];
-		LIST_FOREACH(inp, head, inp_hash) {
+		smrq_serialized_foreach(inp, head, inp_hash) {
 			if (!(inp->inp_vflag & INP_IPV6)) {
 				continue;
 			}
@@ -1490,7 +1490,7 @@ in6_pcblookup_hash_locked(struct inpcbinfo *pcbinfo, struct in6_addr *faddr,
     u_int fport_arg, uint32_t fifscope, struct in6_addr *laddr, u_int lport_arg,
     uint32_t lifscope, int wildcard, struct ifnet *ifp)
 {
-	struct inpcbhead *__single head;
+	struct smrq_list_head *__single head;
 	struct inpcb *__single inp;
 	uint16_t fport = (uint16_t)fport_arg, lport = (uint16_t)lport_arg;
 
@@ -1499,7 +1499,7 @@ in6_pcblookup_hash_locked(struct inpcbinfo *pcbinfo, struct in6_addr *faddr,
 	 */
 	head = &pcbinfo->ipi_hashbase[INP_PCBHASH(faddr->s6_addr32[3] /* XXX */,
 	    lport, fport, pcbinfo->ipi_hashmask)];
-	LIST_FOREACH(inp, head, inp_hash) {
+	smrq_serialized_foreach(inp, head, inp_hash) {
 		if (!(inp->inp_vflag & INP_IPV6)) {
 			continue;
 		}
@@ -1533,9 +1533,24 @@ in6_pcblookup_hash_locked(struct inpcbinfo *pcbinfo, struct in6_addr *faddr,
 	if (wildcard) {
 		struct inpcb *__single local_wild = NULL;
 
+		/*
+		 * Then for a SO_REUSEPORT_LB listen group.
+		 */
+		if (pcbinfo->ipi_lbgrouphashbase != NULL) {
+			inp = in6_pcblbgroup_lookup(pcbinfo, faddr, fport,
+			    laddr, lport, lifscope);
+			if (inp != NULL && !inp_restricted_recv(inp, ifp) &&
+#if NECP
+			    necp_socket_is_allowed_to_recv_on_interface(inp, ifp) &&
+#endif /* NECP */
+			    in_pcb_checkstate(inp, WNT_ACQUIRE, 0) != WNT_STOPUSING) {
+				return inp;
+			}
+		}
+
 		head = &pcbinfo->ipi_hashbase[INP_PCBHASH(INADDR_ANY, lport, 0,
 		    pcbinfo->ipi_hashmask)];
-		LIST_FOREACH(inp, head, inp_hash) {
+		smrq_serialized_foreach(inp, head, inp_hash) {
 			if (!(inp->inp_vflag & INP_IPV6)) {
 				continue;
 			}
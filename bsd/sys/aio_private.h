@@ -0,0 +1,158 @@
+/*
+ * Copyright (c) 2025 Apple Inc. All rights reserved.
+ *
+ * @APPLE_OSREFERENCE_LICENSE_HEADER_START@
+ *
+ * This file contains Original Code and/or Modifications of Original Code
+ * as defined in and that are subject to the Apple Public Source License
+ * Version 2.0 (the 'License'). You may not use this file except in
+ * compliance with the License. The rights granted to you under the License
+ * may not be used to create, or enable the creation or redistribution of,
+ * unlawful or unlicensed copies of an Apple operating system, or to
+ * circumvent, violate, or enable the circumvention or violation of, any
+ * terms of an Apple operating system software license agreement.
+ *
+ * Please obtain a copy of the License at
+ * http://www.opensource.apple.com/apsl/ and read it before using this file.
+ *
+ * The Original Code and all software distributed under the License are
+ * distributed on an 'AS IS' basis, WITHOUT WARRANTY OF ANY KIND, EITHER
+ * EXPRESS OR IMPLIED, AND APPLE HEREBY DISCLAIMS ALL SUCH WARRANTIES,
+ * INCLUDING WITHOUT LIMITATION, ANY WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE, QUIET ENJOYMENT OR NON-INFRINGEMENT.
+ * Please see the License for the specific language governing rights and
+ * limitations under the License.
+ *
+ * @APPLE_OSREFERENCE_LICENSE_HEADER_END@
+ */
+
+#ifndef _SYS_AIO_PRIVATE_H_
+#define _SYS_AIO_PRIVATE_H_
+
+#include <stdint.h>
+#include <sys/cdefs.h>
+#include <sys/types.h>
+
+__BEGIN_DECLS
+
+/*
+ * aio rings
+ *
+ * A process registers one page aligned region of its own memory with
+ * aio_ring_setup().  The region starts with a struct aio_ring_shared header,
+ * followed by the submission queue (SQ) at AIO_RING_SQ_OFFSET and the
+ * completion queue (CQ) at AIO_RING_CQ_OFFSET(sq_entries).
+ *
+ * The process produces struct aio_ring_sqe entries and publishes them by
+ * advancing sq_tail, the kernel consumes them by advancing sq_head.
+ * The kernel produces struct aio_ring_cqe entries and publishes them by
+ * advancing cq_tail, the process consumes them by advancing cq_head.
+ * Indices are free running and are masked by (entries - 1) to find a slot.
+ *
+ * The kernel rescans the SQ every time it completes a request, so while I/O
+ * is in flight no system call is needed to submit more.  When the kernel
+ * goes idle it sets AIO_RING_SQ_NEED_WAKEUP in sq_flags: after publishing
+ * sq_tail, or after consuming CQEs while SQEs are still pending, the process
+ * must check that flag (with a full barrier in between) and call
+ * aio_ring_enter() if it is set.
+ *
+ * SQEs carrying AIO_RING_SQE_LINK form a chain with the SQE that follows.
+ * A chain executes in order, and the first SQE that fails or transfers
+ * fewer bytes than requested cancels the rest of the chain (ECANCELED).
+ * A chain must be published with a single sq_tail update, and can't be
+ * longer than AIO_RING_LINK_MAX entries (longer chains fail with E2BIG).
+ *
+ * When a kqueue is registered, the kernel triggers the EVFILT_USER knote
+ * with ident kq_ident (NOTE_TRIGGER) every time it posts completions.
+ * The knote must have been added by the process beforehand. *
+ * Unregistering the ring (AIO_RING_ENTER_UNREGISTER) cancels its chains:
+ * the ones that didn't start and the rest of the ones in flight complete
+ * with ECANCELED, and a RECV or READ blocked in the kernel is interrupted.
+ * The call returns once every chain completed, or EINTR if a signal
+ * interrupts the wait, in which case the remaining completions are still
+ * posted to the CQ later.
+ */
+
+#define AIO_RING_MAX_ENTRIES            4096
+#define AIO_RING_LINK_MAX               16
+
+/* sq_flags */
+#define AIO_RING_SQ_NEED_WAKEUP         0x00000001
+
+struct aio_ring_shared {
+	uint32_t        sq_head;        /* kernel */
+	uint32_t        sq_tail;        /* process */
+	uint32_t        sq_flags;       /* kernel */
+	uint32_t        __sq_reserved;
+	uint32_t        cq_head;        /* process */
+	uint32_t        cq_tail;        /* kernel */
+	uint32_t        cq_overflow;    /* kernel */
+	uint32_t        __cq_reserved;
+};
+
+/* opcodes */
+#define AIO_RING_OP_NOP                 0
+#define AIO_RING_OP_READ                1       /* pread(2), or read(2) at AIO_RING_OFFSET_CURRENT */
+#define AIO_RING_OP_WRITE               2       /* pwrite(2), or write(2) at AIO_RING_OFFSET_CURRENT */
+#define AIO_RING_OP_FSYNC               3       /* fsync(2), fdatasync(2) with AIO_RING_FSYNC_DATASYNC */
+#define AIO_RING_OP_RECV                4       /* read(2) on a socket */
+#define AIO_RING_OP_SEND                5       /* write(2) on a socket */
+
+/* aio_ring_sqe::flags */
+#define AIO_RING_SQE_LINK               0x01
+
+/* aio_ring_sqe::op_flags for AIO_RING_OP_FSYNC */
+#define AIO_RING_FSYNC_DATASYNC         0x00000001
+
+#define AIO_RING_OFFSET_CURRENT         ((int64_t)-1)
+
+struct aio_ring_sqe {
+	uint8_t         opcode;
+	uint8_t         flags;
+	uint16_t        __reserved0;
+	int32_t         fd;
+	uint32_t        op_flags;
+	uint32_t        __reserved1;
+	int64_t         offset;
+	uint64_t        buf;
+	uint64_t        nbytes;
+	uint64_t        user_data;
+};
+
+struct aio_ring_cqe {
+	uint64_t        user_data;
+	int64_t         result;         /* bytes transferred, or -errno */
+	uint32_t        flags;
+	uint32_t        __reserved;
+};
+
+#define AIO_RING_SQ_OFFSET \
+	((sizeof(struct aio_ring_shared) + 63) & ~(size_t)63)
+#define AIO_RING_CQ_OFFSET(sq_entries) \
+	(AIO_RING_SQ_OFFSET + (size_t)(sq_entries) * sizeof(struct aio_ring_sqe))
+#define AIO_RING_SIZE(sq_entries, cq_entries) \
+	(AIO_RING_CQ_OFFSET(sq_entries) + \
+	(size_t)(cq_entries) * sizeof(struct aio_ring_cqe))
+
+struct aio_ring_params {
+	uint64_t        ring_addr;      /* page aligned */
+	uint64_t        ring_size;      /* at least AIO_RING_SIZE(sq_entries, cq_entries) */
+	uint32_t        sq_entries;     /* power of 2, at most AIO_RING_MAX_ENTRIES */
+	uint32_t        cq_entries;     /* power of 2, at least sq_entries and AIO_RING_LINK_MAX */
+	uint32_t        flags;          /* must be 0 */
+	int32_t         kq_fd;          /* kqueue to notify, or -1 */
+	uint64_t        kq_ident;       /* EVFILT_USER ident triggered on completion */
+};
+
+/* aio_ring_enter() flags */
+#define AIO_RING_ENTER_GETEVENTS        0x00000001      /* wait for min_complete CQEs */
+#define AIO_RING_ENTER_UNREGISTER       0x00000002      /* cancel and unregister the ring */
+
+#ifndef KERNEL
+int aio_ring_setup(const struct aio_ring_params *params);
+int aio_ring_enter(uint32_t to_submit, uint32_t min_complete, uint32_t flags);
+#endif /* KERNEL */
+
+__END_DECLS
+
+#endif /* _SYS_AIO_PRIVATE_H_ */
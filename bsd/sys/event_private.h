@@ -551,6 +551,8 @@ struct kevent_ctx_s {
 	int              kec_process_noutputs;      /* number of events output */
 	unsigned int     kec_process_flags;         /* kevent flags, only set for process  */
 	user_addr_t      kec_process_eventlist;     /* user-level event list address */
+	union kevent_batch *kec_process_batch;      /* events not copied out yet */
+	int              kec_process_nbatched;      /* number of events in kec_process_batch */
 };
 typedef struct kevent_ctx_s *kevent_ctx_t;
 
@@ -94,7 +94,7 @@ typedef int (*kevent_callback_t)(struct kevent_qos_s *, struct kevent_ctx_s *);
  *     XXX lock -> kq lock -> workq lock -> thread lock
  */
 
-#define KQEXTENT        256             /* linear growth by this amount */
+#define KQEXTENT        256             /* minimum growth of the knote lists */
 
 struct knote_lock_ctx {
 	struct knote               *knlc_knote;
@@ -94,7 +94,16 @@ struct kd_region {
 
 #define KDS_PTR_NULL 0xffffffff
 
+/*
+ * kd_list_lock protects the head of the CPU's list of storage units and its
+ * reserve of free units.  It's taken with interrupts disabled, after
+ * kdc_storage_lock when both are needed.  It must stay the first field so
+ * it remains aligned in this packed structure.
+ */
 struct kd_bufinfo {
+	lck_spin_t kd_list_lock;
+	union  kds_ptr kd_reserve;
+	uint32_t kd_reserve_count;
 	union  kds_ptr kd_list_head;
 	union  kds_ptr kd_list_tail;
 	bool kd_lostevents;
@@ -163,6 +172,8 @@ uint32_t kdbg_cpu_count(void);
 void kdebug_lck_init(void);
 int kdebug_storage_lock(struct kd_control *ctl);
 void kdebug_storage_unlock(struct kd_control *ctl, int intrs_en);
+int kdebug_list_lock(struct kd_bufinfo *kdbp);
+void kdebug_list_unlock(struct kd_bufinfo *kdbp, int intrs_en);
 
 bool kdebug_storage_alloc(
 	struct kd_control *kd_ctrl_page,
@@ -222,6 +222,7 @@
 #define MADV_CAN_REUSE          9
 #define MADV_PAGEOUT            10      /* page out now (internal only) */
 #define MADV_ZERO               11      /* zero pages without faulting in additional pages */
+#define MADV_FAULT_AROUND       12      /* map adjacent resident pages when faulting */
 
 /*
  * Return bits from mincore
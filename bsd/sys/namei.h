@@ -154,6 +154,7 @@ struct nameidata {
 #define NAMEI_NOXATTRS          0x80000 /* prevent a path lookup on named streams */
 
 #define NAMEI_UNIQUE            0x100000 /* prevent a path lookup from succeeding on a vnode with multiple links */
+#define NAMEI_NEGATIVE_HIT      0x200000 /* cache_lookup_path found a negative entry for the current component */
 
 #ifdef KERNEL
 /*
@@ -434,6 +434,7 @@ struct proc {
 	struct  timeval p_start;                /* starting time */
 	void *  p_rcall;
 	void *  p_pthhash;                      /* pthread waitqueue hash */
+	struct ull_bucket *p_ulock_hash;        /* per-process ulock hash */
 	volatile uint64_t was_throttled __attribute__((aligned(8))); /* Counter for number of throttled I/Os */
 	volatile uint64_t did_throttle __attribute__((aligned(8)));  /* Counter for number of I/Os this proc throttled */
 
@@ -260,6 +260,7 @@
 #define SO_MARK_DOMAIN_INFO_SILENT 0x1135  /* Domain information should be silently withheld */
 #define SO_MAX_PACING_RATE         0x1136  /* Define per-socket maximum pacing rate in bytes/sec */
 #define SO_CONNECTION_IDLE         0x1137  /* Connection is idle (int) */
+#define SO_REUSEPORT_LB            0x1138  /* Load balance connections among SO_REUSEPORT listeners (int) */
 
 struct so_mark_cellfallback_uuid_args {
 	uuid_t flow_uuid;
@@ -81,11 +81,26 @@ struct cl_wextent {
 	int             io_flags;
 };
 
-struct cl_readahead {
-	lck_mtx_t       cl_lockr;
+#define CL_RA_MAX_STREAMS       4
+
+struct cl_rastream {
 	daddr64_t       cl_lastr;                       /* last block read by client */
 	daddr64_t       cl_maxra;                       /* last block prefetched by the read ahead */
 	int             cl_ralen;                       /* length of last prefetch */
+	uint32_t        cl_rate;                        /* blocks consumed per second */
+	daddr64_t       cl_lastb;                       /* first block of the last read */
+	daddr64_t       cl_stride;                      /* distance between strided reads, 0 if not strided */
+	daddr64_t       cl_delta;                       /* distance between the last two reads */
+	uint64_t        cl_stamp;                       /* time of the last read */
+	uint64_t        cl_born;                        /* value of cl_nreads when the stream started */
+	uint32_t        cl_hits;                        /* reads that matched the stream */
+};
+
+struct cl_readahead {
+	lck_mtx_t       cl_lockr;
+	uint64_t        cl_iolat;                       /* average latency of reads missing the cache */
+	uint64_t        cl_nreads;                      /* reads matched against the streams */
+	struct cl_rastream cl_streams[CL_RA_MAX_STREAMS]; /* concurrent read streams */
 };
 
 struct cl_writebehind {
@@ -96,6 +111,7 @@ struct cl_writebehind {
 	int             cl_sparse_pushes;               /* number of pushes outside of the cl_lockw in progress */
 	int             cl_sparse_wait;                 /* synchronous push is in progress */
 	int             cl_number;                      /* number of packed write behind clusters currently valid */
+	int             cl_coalescing;                  /* queued for a coalesced push, see cluster_coalesce_defer() */
 	struct cl_wextent cl_clusters[MAX_CLUSTERS];    /* packed write behind clusters */
 };
 
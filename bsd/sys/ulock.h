@@ -54,6 +54,10 @@ ulock_owner_value_to_port_name(uint32_t uval)
 
 extern int ulock_wake(struct task *task, uint32_t operation, user_addr_t addr, uint64_t wake_value);
 
+struct proc;
+extern void ulock_proc_init(struct proc *p);
+extern void ulock_proc_destroy(struct proc *p);
+
 #else
 static __inline mach_port_name_t
 ulock_owner_value_to_port_name(uint32_t uval)
@@ -0,0 +1,485 @@
+/*
+ * Copyright (c) 2025 Apple Inc. All rights reserved.
+ *
+ * @APPLE_OSREFERENCE_LICENSE_HEADER_START@
+ *
+ * This file contains Original Code and/or Modifications of Original Code
+ * as defined in and that are subject to the Apple Public Source License
+ * Version 2.0 (the 'License'). You may not use this file except in
+ * compliance with the License. The rights granted to you under the License
+ * may not be used to create, or enable the creation or redistribution of,
+ * unlawful or unlicensed copies of an Apple operating system, or to
+ * circumvent, violate, or enable the circumvention or violation of, any
+ * terms of an Apple operating system software license agreement.
+ *
+ * Please obtain a copy of the License at
+ * http://www.opensource.apple.com/apsl/ and read it before using this file.
+ *
+ * The Original Code and all software distributed under the License are
+ * distributed on an 'AS IS' basis, WITHOUT WARRANTY OF ANY KIND, EITHER
+ * EXPRESS OR IMPLIED, AND APPLE HEREBY DISCLAIMS ALL SUCH WARRANTIES,
+ * INCLUDING WITHOUT LIMITATION, ANY WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE, QUIET ENJOYMENT OR NON-INFRINGEMENT.
+ * Please see the License for the specific language governing rights and
+ * limitations under the License.
+ *
+ * @APPLE_OSREFERENCE_LICENSE_HEADER_END@
+ */
+
+#if DEVELOPMENT || DEBUG
+
+#include <sys/param.h>
+#include <sys/mbuf.h>
+#include <sys/sysctl.h>
+
+#include <kern/kalloc.h>
+
+#include <net/bpf.h>
+#include <net/bpf_private.h>
+
+#include <tests/ktest.h>
+
+/*
+ * Differential test of the compiled BPF filters: every program is run
+ * through both bpf_filter() and bpf_jit_filter() on a corpus of packets,
+ * laid out as a single mbuf, split across mbuf chains at every offset,
+ * and behind a pktap-style header, and the results must be identical.
+ */
+
+#define BPF_JIT_TEST_PKT_MAX    128
+#define BPF_JIT_TEST_HDR_LEN    20
+#define BPF_JIT_TEST_RANDOM_PROGS       1000
+#define BPF_JIT_TEST_RANDOM_PKTS        32
+
+struct bpf_jit_test_prog {
+	const char              *name;
+	const struct bpf_insn   *insns;
+	u_int                   len;
+};
+
+#define BPF_JIT_TEST_PROG(n, ...) \
+	static const struct bpf_insn bpf_jit_test_##n[] = { __VA_ARGS__ }
+
+/* tcpdump -d ip */
+BPF_JIT_TEST_PROG(ip,
+    BPF_STMT(BPF_LD | BPF_H | BPF_ABS, 12),
+    BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, 0x0800, 0, 1),
+    BPF_STMT(BPF_RET | BPF_K, 262144),
+    BPF_STMT(BPF_RET | BPF_K, 0),
+    );
+
+/* tcpdump -d tcp port 80 */
+BPF_JIT_TEST_PROG(tcp_port_80,
+    BPF_STMT(BPF_LD | BPF_H | BPF_ABS, 12),
+    BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, 0x86dd, 0, 7),
+    BPF_STMT(BPF_LD | BPF_B | BPF_ABS, 20),
+    BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, 6, 0, 17),
+    BPF_STMT(BPF_LD | BPF_H | BPF_ABS, 54),
+    BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, 80, 14, 0),
+    BPF_STMT(BPF_LD | BPF_H | BPF_ABS, 56),
+    BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, 80, 12, 13),
+    BPF_STMT(BPF_LD | BPF_H | BPF_ABS, 0),  /* filler, unreachable */
+    BPF_STMT(BPF_LD | BPF_H | BPF_ABS, 12),
+    BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, 0x0800, 0, 10),
+    BPF_STMT(BPF_LD | BPF_B | BPF_ABS, 23),
+    BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, 6, 0, 8),
+    BPF_STMT(BPF_LD | BPF_H | BPF_ABS, 20),
+    BPF_JUMP(BPF_JMP | BPF_JSET | BPF_K, 0x1fff, 6, 0),
+    BPF_STMT(BPF_LDX | BPF_B | BPF_MSH, 14),
+    BPF_STMT(BPF_LD | BPF_H | BPF_IND, 14),
+    BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, 80, 2, 0),
+    BPF_STMT(BPF_LD | BPF_H | BPF_IND, 16),
+    BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, 80, 0, 1),
+    BPF_STMT(BPF_RET | BPF_K, 262144),
+    BPF_STMT(BPF_RET | BPF_K, 0),
+    );
+
+/* tcpdump -d 'tcp[tcpflags] & tcp-syn != 0' */
+BPF_JIT_TEST_PROG(tcp_syn,
+    BPF_STMT(BPF_LD | BPF_H | BPF_ABS, 12),
+    BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, 0x0800, 0, 8),
+    BPF_STMT(BPF_LD | BPF_B | BPF_ABS, 23),
+    BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, 6, 0, 6),
+    BPF_STMT(BPF_LD | BPF_H | BPF_ABS, 20),
+    BPF_JUMP(BPF_JMP | BPF_JSET | BPF_K, 0x1fff, 4, 0),
+    BPF_STMT(BPF_LDX | BPF_B | BPF_MSH, 14),
+    BPF_STMT(BPF_LD | BPF_B | BPF_IND, 27),
+    BPF_JUMP(BPF_JMP | BPF_JSET | BPF_K, 0x02, 0, 1),
+    BPF_STMT(BPF_RET | BPF_K, 262144),
+    BPF_STMT(BPF_RET | BPF_K, 0),
+    );
+
+/* scratch memory, ALU and X register operations */
+BPF_JIT_TEST_PROG(alu_mem,
+    BPF_STMT(BPF_LD | BPF_W | BPF_ABS, 26),
+    BPF_STMT(BPF_ST, 3),
+    BPF_STMT(BPF_LD | BPF_W | BPF_ABS, 30),
+    BPF_STMT(BPF_ALU | BPF_RSH | BPF_K, 8),
+    BPF_STMT(BPF_MISC | BPF_TAX, 0),
+    BPF_STMT(BPF_LD | BPF_MEM, 3),
+    BPF_STMT(BPF_ALU | BPF_ADD | BPF_X, 0),
+    BPF_STMT(BPF_ALU | BPF_MUL | BPF_K, 2654435761u),
+    BPF_STMT(BPF_ALU | BPF_DIV | BPF_K, 7),
+    BPF_STMT(BPF_STX, 5),
+    BPF_STMT(BPF_LDX | BPF_MEM, 9),         /* never stored, reads 0 */
+    BPF_STMT(BPF_ALU | BPF_OR | BPF_X, 0),
+    BPF_STMT(BPF_ALU | BPF_NEG, 0),
+    BPF_STMT(BPF_ALU | BPF_AND | BPF_K, 0xffff),
+    BPF_STMT(BPF_RET | BPF_A, 0),
+    );
+
+/* division by a zero X register rejects the packet */
+BPF_JIT_TEST_PROG(div_x_zero,
+    BPF_STMT(BPF_LD | BPF_B | BPF_ABS, 0),
+    BPF_STMT(BPF_MISC | BPF_TAX, 0),
+    BPF_STMT(BPF_LD | BPF_IMM, 1000),
+    BPF_STMT(BPF_ALU | BPF_DIV | BPF_X, 0),
+    BPF_STMT(BPF_RET | BPF_A, 0),
+    );
+
+/* length based and out of range loads */
+BPF_JIT_TEST_PROG(len_oob,
+    BPF_STMT(BPF_LD | BPF_W | BPF_LEN, 0),
+    BPF_JUMP(BPF_JMP | BPF_JGT | BPF_K, 64, 0, 2),
+    BPF_STMT(BPF_LD | BPF_W | BPF_ABS, 100),
+    BPF_STMT(BPF_RET | BPF_A, 0),
+    BPF_STMT(BPF_LDX | BPF_IMM, 0xfffffff8u),
+    BPF_STMT(BPF_LD | BPF_B | BPF_IND, 10),  /* X + k wraps around to 2 */
+    BPF_STMT(BPF_RET | BPF_A, 0),
+    );
+
+/* codes bpf_validate() accepts but bpf_filter() rejects at run time */
+BPF_JIT_TEST_PROG(bad_codes,
+    BPF_STMT(BPF_LD | BPF_B | BPF_ABS, 14),
+    BPF_JUMP(BPF_JMP | BPF_JGE | BPF_K, 0x45, 0, 1),
+    BPF_STMT(BPF_LD | BPF_H | BPF_IMM, 1),
+    BPF_STMT(BPF_MISC | 0x10, 0),
+    BPF_STMT(BPF_RET | BPF_X, 7),
+    );
+
+static const struct bpf_jit_test_prog bpf_jit_test_progs[] = {
+#define P(n) { #n, bpf_jit_test_##n, sizeof(bpf_jit_test_##n) / sizeof(struct bpf_insn) }
+	P(ip),
+	P(tcp_port_80),
+	P(tcp_syn),
+	P(alu_mem),
+	P(div_x_zero),
+	P(len_oob),
+	P(bad_codes),
+#undef P
+};
+
+static uint32_t
+bpf_jit_test_random(uint32_t *state)
+{
+	uint32_t x = *state;
+
+	x ^= x << 13;
+	x ^= x >> 17;
+	x ^= x << 5;
+	return *state = x;
+}
+
+static u_int
+bpf_jit_test_corpus(uint8_t *__counted_by(BPF_JIT_TEST_PKT_MAX) pkt, u_int idx, uint32_t *seed)
+{
+	static const uint8_t eth_ip_tcp[] = {
+		0x00, 0x11, 0x22, 0x33, 0x44, 0x55, 0x66, 0x77, 0x88, 0x99, 0xaa, 0xbb,
+		0x08, 0x00,
+		0x45, 0x00, 0x00, 0x28, 0x12, 0x34, 0x40, 0x00, 0x40, 0x06, 0x00, 0x00,
+		0x0a, 0x00, 0x00, 0x01, 0x0a, 0x00, 0x00, 0x02,
+		0xc0, 0x01, 0x00, 0x50, 0x00, 0x00, 0x00, 0x01, 0x00, 0x00, 0x00, 0x00,
+		0x50, 0x02, 0xff, 0xff, 0x00, 0x00, 0x00, 0x00,
+	};
+	static const uint8_t eth_ip6_tcp[] = {
+		0x00, 0x11, 0x22, 0x33, 0x44, 0x55, 0x66, 0x77, 0x88, 0x99, 0xaa, 0xbb,
+		0x86, 0xdd,
+		0x60, 0x00, 0x00, 0x00, 0x00, 0x14, 0x06, 0x40,
+		0xfe, 0x80, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 1,
+		0xfe, 0x80, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 2,
+		0x00, 0x50, 0xc0, 0x01, 0x00, 0x00, 0x00, 0x01, 0x00, 0x00, 0x00, 0x00,
+		0x50, 0x12, 0xff, 0xff, 0x00, 0x00, 0x00, 0x00,
+	};
+	static const uint8_t eth_ip_frag[] = {
+		0x00, 0x11, 0x22, 0x33, 0x44, 0x55, 0x66, 0x77, 0x88, 0x99, 0xaa, 0xbb,
+		0x08, 0x00,
+		0x46, 0x00, 0x00, 0x2c, 0x12, 0x34, 0x20, 0x10, 0x40, 0x06, 0x00, 0x00,
+		0x0a, 0x00, 0x00, 0x01, 0x0a, 0x00, 0x00, 0x02, 0x01, 0x01, 0x01, 0x01,
+		0x00, 0x50, 0xc0, 0x01,
+	};
+	const uint8_t *src;
+	u_int len;
+
+	switch (idx) {
+	case 0:
+		src = eth_ip_tcp;
+		len = sizeof(eth_ip_tcp);
+		break;
+	case 1:
+		src = eth_ip6_tcp;
+		len = sizeof(eth_ip6_tcp);
+		break;
+	case 2:
+		src = eth_ip_frag;
+		len = sizeof(eth_ip_frag);
+		break;
+	case 3:
+		/* runt */
+		src = eth_ip_tcp;
+		len = 13;
+		break;
+	default:
+		len = 1 + bpf_jit_test_random(seed) % BPF_JIT_TEST_PKT_MAX;
+		for (u_int i = 0; i < len; i++) {
+			pkt[i] = (uint8_t)bpf_jit_test_random(seed);
+		}
+		/* keep enough ethertypes plausible to exercise the branches */
+		if (len > 13 && (idx & 1)) {
+			memcpy(pkt + 12, eth_ip_tcp + 12, MIN(len, sizeof(eth_ip_tcp)) - 12);
+		}
+		return len;
+	}
+	memcpy(pkt, src, len);
+	return len;
+}
+
+static struct mbuf *
+bpf_jit_test_chain(const uint8_t *__counted_by(len) pkt, u_int len, u_int split1, u_int split2)
+{
+	u_int bounds[3] = { split1, split2, len };
+	struct mbuf *top = NULL, **mp = &top;
+	u_int off = 0;
+
+	for (int i = 0; i < 3; i++) {
+		struct mbuf *m;
+		u_int n;
+
+		if (bounds[i] <= off) {
+			continue;
+		}
+		n = MIN(bounds[i], len) - off;
+		if (top == NULL) {
+			m = m_gethdr(M_WAITOK, MT_DATA);
+		} else {
+			m = m_get(M_WAITOK, MT_DATA);
+		}
+		memcpy(mtod(m, uint8_t *), pkt + off, n);
+		m->m_len = n;
+		*mp = m;
+		mp = &m->m_next;
+		off += n;
+	}
+	top->m_pkthdr.len = len;
+	return top;
+}
+
+static uint64_t
+bpf_jit_test_one(const struct bpf_insn *__counted_by(plen) insns, u_int plen,
+    struct bpf_jit_program *jit, const char *name,
+    const uint8_t *__counted_by(len) pkt, u_int len)
+{
+	uint8_t hdr[BPF_JIT_TEST_HDR_LEN];
+	uint64_t mismatches = 0;
+
+	for (u_int i = 0; i < sizeof(hdr); i++) {
+		hdr[i] = (uint8_t)(0xa5 ^ i);
+	}
+
+	/*
+	 * split the packet in two at every offset, and in three
+	 * with a tiny mbuf in the middle so that loads straddle
+	 * more than one boundary
+	 */
+	for (u_int split1 = 0; split1 <= len; split1++) {
+		u_int split2s[] = { len, split1 + 1, split1 + 2, split1 + 3 };
+
+		for (u_int s = 0; s < sizeof(split2s) / sizeof(split2s[0]); s++) {
+			u_int split2 = MIN(split2s[s], len);
+			struct mbuf *m;
+
+			if (s > 0 && split2 == len) {
+				break;
+			}
+			m = bpf_jit_test_chain(pkt, len, split1, split2);
+
+			for (int with_hdr = 0; with_hdr < 2; with_hdr++) {
+				struct bpf_packet bp = {
+					.bpfp_type = BPF_PACKET_TYPE_MBUF,
+					.bpfp_mbuf = m,
+				};
+				u_int wirelen = len;
+				u_int r1, r2;
+
+				if (with_hdr) {
+					bp.bpfp_header = hdr;
+					bp.bpfp_header_length = sizeof(hdr);
+					wirelen += sizeof(hdr);
+				}
+				bp.bpfp_total_length = wirelen;
+
+				r1 = bpf_filter(insns, plen, (u_char *)&bp, wirelen, 0);
+				r2 = bpf_jit_filter(jit, (u_char *)&bp, wirelen);
+				if (r1 != r2) {
+					if (mismatches++ == 0) {
+						T_LOG("bpf_jit: %s: len %u split %u/%u hdr %d: "
+						    "interpreter %u != compiled %u",
+						    name, len, split1, split2, with_hdr, r1, r2);
+					}
+				}
+			}
+			m_freem(m);
+		}
+	}
+	return mismatches;
+}
+
+/*
+ * Generate a random program that passes bpf_validate(): the
+ * loads and jumps are kept mostly in range so that programs
+ * get far enough to be interesting.
+ */
+static u_int
+bpf_jit_test_random_prog(struct bpf_insn *__counted_by(BPF_MAXINSNS) insns, uint32_t *seed)
+{
+	static const u_short codes[] = {
+		BPF_LD | BPF_W | BPF_ABS, BPF_LD | BPF_H | BPF_ABS, BPF_LD | BPF_B | BPF_ABS,
+		BPF_LD | BPF_W | BPF_IND, BPF_LD | BPF_H | BPF_IND, BPF_LD | BPF_B | BPF_IND,
+		BPF_LD | BPF_W | BPF_LEN, BPF_LDX | BPF_W | BPF_LEN, BPF_LDX | BPF_B | BPF_MSH,
+		BPF_LD | BPF_IMM, BPF_LDX | BPF_IMM, BPF_LD | BPF_MEM, BPF_LDX | BPF_MEM,
+		BPF_ST, BPF_STX, BPF_JMP | BPF_JA,
+		BPF_JMP | BPF_JGT | BPF_K, BPF_JMP | BPF_JGE | BPF_K,
+		BPF_JMP | BPF_JEQ | BPF_K, BPF_JMP | BPF_JSET | BPF_K,
+		BPF_JMP | BPF_JGT | BPF_X, BPF_JMP | BPF_JGE | BPF_X,
+		BPF_JMP | BPF_JEQ | BPF_X, BPF_JMP | BPF_JSET | BPF_X,
+		BPF_ALU | BPF_ADD | BPF_X, BPF_ALU | BPF_SUB | BPF_X, BPF_ALU | BPF_MUL | BPF_X,
+		BPF_ALU | BPF_DIV | BPF_X, BPF_ALU | BPF_AND | BPF_X, BPF_ALU | BPF_OR | BPF_X,
+		BPF_ALU | BPF_LSH | BPF_X, BPF_ALU | BPF_RSH | BPF_X,
+		BPF_ALU | BPF_ADD | BPF_K, BPF_ALU | BPF_SUB | BPF_K, BPF_ALU | BPF_MUL | BPF_K,
+		BPF_ALU | BPF_DIV | BPF_K, BPF_ALU | BPF_AND | BPF_K, BPF_ALU | BPF_OR | BPF_K,
+		BPF_ALU | BPF_LSH | BPF_K, BPF_ALU | BPF_RSH | BPF_K, BPF_ALU | BPF_NEG,
+		BPF_MISC | BPF_TAX, BPF_MISC | BPF_TXA, BPF_RET | BPF_A, BPF_RET | BPF_K,
+	};
+	u_int len = 2 + bpf_jit_test_random(seed) % 48;
+
+	for (u_int i = 0; i < len; i++) {
+		struct bpf_insn *p = &insns[i];
+		u_int left = len - i - 1;
+
+		p->code = codes[bpf_jit_test_random(seed) % (sizeof(codes) / sizeof(codes[0]))];
+		p->k = bpf_jit_test_random(seed);
+		p->jt = p->jf = 0;
+
+		switch (BPF_CLASS(p->code)) {
+		case BPF_LD:
+		case BPF_LDX:
+			if (BPF_MODE(p->code) == BPF_MEM) {
+				p->k %= BPF_MEMWORDS;
+			} else if (BPF_MODE(p->code) != BPF_IMM) {
+				p->k %= BPF_JIT_TEST_PKT_MAX + 8;
+			}
+			break;
+		case BPF_ST:
+		case BPF_STX:
+			p->k %= BPF_MEMWORDS;
+			break;
+		case BPF_ALU:
+			if (BPF_OP(p->code) == BPF_DIV && BPF_SRC(p->code) == BPF_K && p->k == 0) {
+				p->k = 3;
+			}
+			if (BPF_OP(p->code) == BPF_LSH || BPF_OP(p->code) == BPF_RSH) {
+				p->k %= 32;
+			}
+			if ((p->k & 3) == 0) {
+				p->k &= 0xff;
+			}
+			break;
+		case BPF_JMP:
+			if (left == 0) {
+				p->code = BPF_RET | BPF_A;
+				break;
+			}
+			if ((p->k & 1) == 0) {
+				p->k &= 0xff;
+			}
+			if (BPF_OP(p->code) == BPF_JA) {
+				p->k = bpf_jit_test_random(seed) % left;
+			} else {
+				p->jt = (u_char)(bpf_jit_test_random(seed) % MIN(left, 256));
+				p->jf = (u_char)(bpf_jit_test_random(seed) % MIN(left, 256));
+			}
+			break;
+		default:
+			break;
+		}
+	}
+	insns[len - 1].code = BPF_RET | BPF_A;
+	return len;
+}
+
+static int
+bpf_jit_test_run(__unused int64_t in, int64_t *out)
+{
+	struct bpf_insn *insns;
+	struct bpf_jit_program *jit;
+	uint8_t *pkt;
+	uint64_t mismatches = 0;
+	uint32_t seed = 0x2545f491;
+	u_int len;
+
+	pkt = kalloc_data(BPF_JIT_TEST_PKT_MAX, Z_WAITOK | Z_ZERO | Z_NOFAIL);
+	insns = kalloc_data(BPF_MAXINSNS * sizeof(struct bpf_insn), Z_WAITOK | Z_ZERO | Z_NOFAIL);
+
+	for (u_int p = 0; p < sizeof(bpf_jit_test_progs) / sizeof(bpf_jit_test_progs[0]); p++) {
+		const struct bpf_jit_test_prog *prog = &bpf_jit_test_progs[p];
+
+		T_QUIET;
+		T_EXPECT_EQ_INT(bpf_validate(prog->insns, (int)prog->len), 1, "%s validates", prog->name);
+		jit = bpf_jit_compile(prog->insns, prog->len);
+		T_QUIET;
+		T_EXPECT_NOTNULL(jit, "%s compiles", prog->name);
+		if (jit == NULL) {
+			mismatches++;
+			continue;
+		}
+
+		for (u_int i = 0; i < 4 + BPF_JIT_TEST_RANDOM_PKTS; i++) {
+			len = bpf_jit_test_corpus(pkt, i, &seed);
+			mismatches += bpf_jit_test_one(prog->insns, prog->len, jit,
+			    prog->name, pkt, len);
+		}
+		bpf_jit_free(jit);
+	}
+
+	for (u_int p = 0; p < BPF_JIT_TEST_RANDOM_PROGS; p++) {
+		u_int plen = bpf_jit_test_random_prog(insns, &seed);
+
+		if (!bpf_validate(insns, (int)plen)) {
+			continue;
+		}
+		jit = bpf_jit_compile(insns, plen);
+		T_QUIET;
+		T_EXPECT_NOTNULL(jit, "random program %u compiles", p);
+		if (jit == NULL) {
+			mismatches++;
+			continue;
+		}
+
+		for (u_int i = 0; i < 2; i++) {
+			len = bpf_jit_test_corpus(pkt, (p + i) % (4 + BPF_JIT_TEST_RANDOM_PKTS), &seed);
+			mismatches += bpf_jit_test_one(insns, plen, jit, "random", pkt, len);
+		}
+		bpf_jit_free(jit);
+	}
+
+	kfree_data(insns, BPF_MAXINSNS * sizeof(struct bpf_insn));
+	kfree_data(pkt, BPF_JIT_TEST_PKT_MAX);
+
+	T_EXPECT_EQ_ULLONG(mismatches, 0ULL, "compiled filters match the interpreter");
+
+	*out = (int64_t)mismatches;
+	return 0;
+}
+
+SYSCTL_TEST_REGISTER(bpf_jit_test, bpf_jit_test_run);
+
+#endif /* DEVELOPMENT || DEBUG */
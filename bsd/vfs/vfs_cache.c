@@ -124,6 +124,12 @@ __options_decl(nc_smr_level_t, uint32_t, {
 	NC_SMR_LOOKUP = 1
 });
 TUNABLE(nc_smr_level_t, nc_smr_enabled, "ncsmr", NC_SMR_LOOKUP);
+/*
+ * Room for negative entries, in percent of desiredvnodes.  With SMR lookups
+ * a negative entry lets cache_lookup_path() fail a lookup without calling
+ * into the filesystem, so they're worth keeping longer (0 picks the default).
+ */
+TUNABLE(uint32_t, nc_negative_pct, "ncnegpct", 0);
 TAILQ_HEAD(, namecache) nchead;         /* chain of all name cache entries */
 TAILQ_HEAD(, namecache) neghead;        /* chain of only negative cache entries */
 
@@ -191,6 +197,7 @@ struct ncstats {
 	uint64_t clp_smr_next;
 	uint64_t clp_smr_next_fail;
 	uint64_t clp_smr_fallback;
+	uint64_t clp_negative_hits;
 	uint64_t nc_lock_shared;
 	uint64_t nc_lock;
 } ncstats = {0};
@@ -222,6 +229,9 @@ SYSCTL_LONG(_vfs_ncstats, OID_AUTO, clp_smr_next,
 SYSCTL_LONG(_vfs_ncstats, OID_AUTO, clp_smr_next_fail,
     CTLFLAG_RD | CTLFLAG_LOCKED,
     &ncstats.clp_smr_next_fail, "");
+SYSCTL_LONG(_vfs_ncstats, OID_AUTO, clp_negative_hits,
+    CTLFLAG_RD | CTLFLAG_LOCKED,
+    &ncstats.clp_negative_hits, "");
 SYSCTL_LONG(_vfs_ncstats, OID_AUTO, nc_lock_shared,
     CTLFLAG_RD | CTLFLAG_LOCKED,
     &ncstats.nc_lock_shared, "");
@@ -234,8 +244,8 @@ SYSCTL_LONG(_vfs_ncstats, OID_AUTO, nc_lock,
 #define NC_SMR_STATS(v)
 #endif /* COLLECT_NC_SMR_STATS */
 
-static vnode_t cache_lookup_locked(vnode_t dvp, struct componentname *cnp, uint32_t *vidp);
-static vnode_t cache_lookup_smr(vnode_t dvp, struct componentname *cnp, uint32_t *vidp);
+static vnode_t cache_lookup_locked(vnode_t dvp, struct componentname *cnp, uint32_t *vidp, bool *negativep);
+static vnode_t cache_lookup_smr(vnode_t dvp, struct componentname *cnp, uint32_t *vidp, bool *negativep);
 static const char *add_name_internal(const char *, uint32_t, u_int, boolean_t, u_int);
 static void init_string_table(void);
 static void cache_delete(struct namecache *, int);
@@ -1748,6 +1758,33 @@ can_check_v_mountedhere(vnode_t vp)
 	       (vp->v_type == VDIR));
 }
 
+/*
+ * A negative entry found by cache_lookup_path() is as good as an ENOENT from
+ * VNOP_LOOKUP for a plain lookup on a local filesystem.  Network filesystems
+ * revalidate their negative entries, union mounts search the covered
+ * directory, and triggers may still have to be resolved, so those go through
+ * the filesystem.
+ */
+static inline bool
+cache_negative_is_final(vnode_t dp, mount_t dmp, struct componentname *cnp,
+    boolean_t ttl_enabled)
+{
+	if (cnp->cn_nameiop != LOOKUP || ttl_enabled || dmp == NULL) {
+		return false;
+	}
+	if ((dmp->mnt_flag & (MNT_LOCAL | MNT_UNION)) != MNT_LOCAL) {
+		return false;
+	}
+#if CONFIG_TRIGGERS
+	if (dp->v_resolve) {
+		return false;
+	}
+#else
+	(void)dp;
+#endif /* CONFIG_TRIGGERS */
+	return true;
+}
+
 /*
  * Returns:	0			Success
  *		ERECYCLE		vnode was recycled from underneath us.  Force lookup to be re-driven from namei.
@@ -1775,6 +1812,7 @@ cache_lookup_path(struct nameidata *ndp, struct componentname *cnp, vnode_t dp,
 	bool            locked = false;
 	bool            needs_lock = false;
 	bool            dp_iocount_taken = false;
+	bool            negative = false;
 
 #if CONFIG_TRIGGERS
 	vnode_t         trigger_vp;
@@ -1782,6 +1820,8 @@ cache_lookup_path(struct nameidata *ndp, struct componentname *cnp, vnode_t dp,
 
 	ucred = vfs_context_ucred(ctx);
 retry:
+	/* a negative hit of an abandoned SMR pass must not outlive it */
+	ndp->ni_flag &= ~NAMEI_NEGATIVE_HIT;
 	if (nc_smr_enabled && !needs_lock) {
 		save_ndp_state(ndp, cnp, &saved_state);
 		vfs_smr_enter();
@@ -2059,7 +2099,7 @@ skiprsrcfork:
 			vvid = vp->v_id;
 		} else {
 			if (!locked) {
-				vp = cache_lookup_smr(dp, cnp, &vvid);
+				vp = cache_lookup_smr(dp, cnp, &vvid, &negative);
 				if (!vid_is_same(dp, vid)) {
 					vp = NULLVP;
 					needs_lock = true;
@@ -2067,11 +2107,19 @@ skiprsrcfork:
 					goto prep_lock_retry;
 				}
 			} else {
-				vp = cache_lookup_locked(dp, cnp, &vvid);
+				vp = cache_lookup_locked(dp, cnp, &vvid, &negative);
 			}
 
 
 			if (!vp) {
+				/*
+				 * dp has been authorized above, lookup() can
+				 * fail with ENOENT right away.
+				 */
+				if (negative && cache_negative_is_final(dp, dmp, cnp, ttl_enabled)) {
+					ndp->ni_flag |= NAMEI_NEGATIVE_HIT;
+					NC_SMR_STATS(clp_negative_hits);
+				}
 				break;
 			}
 
@@ -2414,12 +2462,14 @@ prep_lock_retry:
 
 
 static vnode_t
-cache_lookup_locked(vnode_t dvp, struct componentname *cnp, uint32_t *vidp)
+cache_lookup_locked(vnode_t dvp, struct componentname *cnp, uint32_t *vidp, bool *negativep)
 {
 	struct namecache *ncp;
 	long namelen = cnp->cn_namelen;
 	unsigned int hashval = cnp->cn_hash;
 
+	*negativep = false;
+
 	if (nc_disabled) {
 		return NULL;
 	}
@@ -2442,6 +2492,7 @@ cache_lookup_locked(vnode_t dvp, struct componentname *cnp, uint32_t *vidp)
 	NCHSTAT(ncs_goodhits);
 
 	if (!ncp->nc_vp) {
+		*negativep = true;
 		return NULL;
 	}
 
@@ -2452,7 +2503,7 @@ cache_lookup_locked(vnode_t dvp, struct componentname *cnp, uint32_t *vidp)
 }
 
 static vnode_t
-cache_lookup_smr(vnode_t dvp, struct componentname *cnp, uint32_t *vidp)
+cache_lookup_smr(vnode_t dvp, struct componentname *cnp, uint32_t *vidp, bool *negativep)
 {
 	struct namecache *ncp;
 	long namelen = cnp->cn_namelen;
@@ -2461,6 +2512,8 @@ cache_lookup_smr(vnode_t dvp, struct componentname *cnp, uint32_t *vidp)
 	uint32_t vid = 0;
 	uint32_t counter = 1;
 
+	*negativep = false;
+
 	if (nc_disabled) {
 		return NULL;
 	}
@@ -2506,6 +2559,7 @@ cache_lookup_smr(vnode_t dvp, struct componentname *cnp, uint32_t *vidp)
 	}
 
 	*vidp = vid;
+	*negativep = (vp == NULLVP);
 	NC_SMR_STATS(clp_smr_next);
 
 	return vp;
@@ -3072,13 +3126,24 @@ init_crc32(void)
 }
 
 
+static int
+cache_negative_nodes(int nodes)
+{
+	uint32_t pct = nc_negative_pct;
+
+	if (pct == 0) {
+		pct = nc_smr_enabled ? 25 : 10;
+	}
+	return (int)(((int64_t)nodes * MIN(pct, 100)) / 100);
+}
+
 /*
  * Name cache initialization, from vfs_init() when we are booting
  */
 void
 nchinit(void)
 {
-	desiredNegNodes = (desiredvnodes / 10);
+	desiredNegNodes = cache_negative_nodes(desiredvnodes);
 	desiredNodes = desiredvnodes + desiredNegNodes;
 
 	if (nc_smr_enabled) {
@@ -3143,7 +3208,7 @@ resize_namecache(int newsize)
 		return EINVAL;
 	}
 
-	dNegNodes = (newsize / 10);
+	dNegNodes = cache_negative_nodes(newsize);
 	dNodes = newsize + dNegNodes;
 	// we don't support shrinking yet
 	if (dNodes <= desiredNodes) {
@@ -87,8 +87,10 @@
 #include <mach/upl.h>
 #include <mach/thread_info.h>
 #include <kern/task.h>
+#include <kern/counter.h>
 #include <kern/policy_internal.h>
 #include <kern/thread.h>
+#include <kern/thread_call.h>
 
 #include <vm/vm_kern_xnu.h>
 #include <vm/vm_map_xnu.h>
@@ -224,7 +226,21 @@ static int cluster_align_phys_io(vnode_t vp, struct uio *uio, addr64_t usr_paddr
 
 static int      cluster_read_prefetch(vnode_t vp, off_t f_offset, u_int size, off_t filesize, int (*callback)(buf_t, void *), void *callback_arg, int bflag);
 static void     cluster_read_ahead(vnode_t vp, struct cl_extent *extent, off_t filesize, struct cl_readahead *ra,
-    int (*callback)(buf_t, void *), void *callback_arg, int bflag);
+    struct cl_rastream *ras, int (*callback)(buf_t, void *), void *callback_arg, int bflag);
+static void     cluster_read_ahead_strided(vnode_t vp, struct cl_extent *extent, off_t filesize, struct cl_rastream *ras,
+    int max_ralen, int (*callback)(buf_t, void *), void *callback_arg, int bflag);
+static struct cl_rastream *cluster_ra_stream(struct cl_readahead *rap, struct cl_extent *extent);
+static void     cluster_ra_stream_update(struct cl_rastream *ras, struct cl_extent *extent);
+static void     cluster_ra_stream_discard(struct cl_rastream *ras);
+
+static void     cluster_coalesce_flush(thread_call_param_t, thread_call_param_t);
+
+/* XXX next prototytype should be from libsa/stdlib.h> but conflicts libkern */
+__private_extern__ void qsort(
+	void * array,
+	size_t nmembers,
+	size_t member_size,
+	int (*)(const void *, const void *));
 
 static int      cluster_push_now(vnode_t vp, struct cl_extent *, off_t EOF, int flags, int (*)(buf_t, void *), void *callback_arg, boolean_t vm_ioitiated);
 
@@ -310,6 +326,104 @@ uint32_t overlapping_write_max = (1024 * 1024 * 1024);
 
 int     speculative_reads_disabled = 0;
 
+/*
+ * read-ahead streams (see cluster_ra_stream())
+ */
+#define CL_RA_MIN_WINDOW        4               /* smallest sequential read-ahead window, in pages */
+#define CL_RA_STRIDE_MAX        2048            /* largest stride detected, in pages */
+#define CL_RA_STRIDE_MAX_READS  16              /* most strided reads prefetched ahead */
+
+static TUNABLE_WRITEABLE(uint32_t, cluster_ra_streams, "cluster_ra_streams", CL_RA_MAX_STREAMS);
+
+SCALABLE_COUNTER_DEFINE(cluster_ra_useful_pages);
+SCALABLE_COUNTER_DEFINE(cluster_ra_wasted_pages);
+
+SYSCTL_DECL(_vfs_generic);
+SYSCTL_NODE(_vfs_generic, OID_AUTO, readahead, CTLFLAG_RW | CTLFLAG_LOCKED, 0,
+    "cluster read-ahead");
+SYSCTL_UINT(_vfs_generic_readahead, OID_AUTO, streams, CTLFLAG_RW | CTLFLAG_LOCKED,
+    &cluster_ra_streams, 0, "read streams tracked per vnode");
+SYSCTL_SCALABLE_COUNTER(_vfs_generic_readahead, useful_pages, cluster_ra_useful_pages,
+    "prefetched pages that were read");
+SYSCTL_SCALABLE_COUNTER(_vfs_generic_readahead, wasted_pages, cluster_ra_wasted_pages,
+    "prefetched pages that were given up on");
+
+/*
+ * write coalescing (see cluster_coalesce_defer())
+ */
+#define CL_COALESCE_MAX         128             /* most vnodes queued for a coalesced push */
+#define CL_IOSIZE_BUCKETS       10              /* 4k, 8k, ... 1m, and larger */
+
+struct cl_coalesce_entry {
+	vnode_t         cce_vp;
+	mount_t         cce_mp;
+	daddr64_t       cce_blkno;
+	uint32_t        cce_vid;
+	uint32_t        cce_seq;
+};
+
+static TUNABLE_WRITEABLE(uint32_t, cluster_coalesce_batch, "cluster_coalesce_batch", 64);
+static TUNABLE_WRITEABLE(uint32_t, cluster_coalesce_max_pages, "cluster_coalesce_max_pages", 16);
+static TUNABLE_WRITEABLE(uint32_t, cluster_coalesce_delay_ms, "cluster_coalesce_delay_ms", 10);
+
+static LCK_MTX_DECLARE(cl_coalesce_mtx, &cl_mtx_grp);
+static struct cl_coalesce_entry cl_coalesce_queue[CL_COALESCE_MAX];
+static struct cl_coalesce_entry cl_coalesce_drain[CL_COALESCE_MAX];
+static uint32_t cl_coalesce_count;
+static thread_call_t cl_coalesce_call;
+
+SCALABLE_COUNTER_DEFINE(cluster_coalesce_deferred);
+SCALABLE_COUNTER_DEFINE(cluster_write_iosize_4k);
+SCALABLE_COUNTER_DEFINE(cluster_write_iosize_8k);
+SCALABLE_COUNTER_DEFINE(cluster_write_iosize_16k);
+SCALABLE_COUNTER_DEFINE(cluster_write_iosize_32k);
+SCALABLE_COUNTER_DEFINE(cluster_write_iosize_64k);
+SCALABLE_COUNTER_DEFINE(cluster_write_iosize_128k);
+SCALABLE_COUNTER_DEFINE(cluster_write_iosize_256k);
+SCALABLE_COUNTER_DEFINE(cluster_write_iosize_512k);
+SCALABLE_COUNTER_DEFINE(cluster_write_iosize_1m);
+SCALABLE_COUNTER_DEFINE(cluster_write_iosize_large);
+
+static scalable_counter_t *const cluster_write_iosizes[CL_IOSIZE_BUCKETS] = {
+	&cluster_write_iosize_4k,
+	&cluster_write_iosize_8k,
+	&cluster_write_iosize_16k,
+	&cluster_write_iosize_32k,
+	&cluster_write_iosize_64k,
+	&cluster_write_iosize_128k,
+	&cluster_write_iosize_256k,
+	&cluster_write_iosize_512k,
+	&cluster_write_iosize_1m,
+	&cluster_write_iosize_large,
+};
+
+static int
+sysctl_cluster_write_iosizes SYSCTL_HANDLER_ARGS
+{
+#pragma unused(oidp, arg1, arg2)
+	uint64_t sizes[CL_IOSIZE_BUCKETS];
+
+	for (int i = 0; i < CL_IOSIZE_BUCKETS; i++) {
+		sizes[i] = counter_load(cluster_write_iosizes[i]);
+	}
+	return SYSCTL_OUT(req, sizes, sizeof(sizes));
+}
+
+SYSCTL_NODE(_vfs_generic, OID_AUTO, writecoalesce, CTLFLAG_RW | CTLFLAG_LOCKED, 0,
+    "cluster write coalescing");
+SYSCTL_UINT(_vfs_generic_writecoalesce, OID_AUTO, batch, CTLFLAG_RW | CTLFLAG_LOCKED,
+    &cluster_coalesce_batch, 0, "vnodes pushed together, 0 to disable");
+SYSCTL_UINT(_vfs_generic_writecoalesce, OID_AUTO, max_pages, CTLFLAG_RW | CTLFLAG_LOCKED,
+    &cluster_coalesce_max_pages, 0, "largest push deferred, in pages");
+SYSCTL_UINT(_vfs_generic_writecoalesce, OID_AUTO, delay_ms, CTLFLAG_RW | CTLFLAG_LOCKED,
+    &cluster_coalesce_delay_ms, 0, "longest a push is deferred");
+SYSCTL_SCALABLE_COUNTER(_vfs_generic_writecoalesce, deferred, cluster_coalesce_deferred,
+    "pushes deferred");
+SYSCTL_PROC(_vfs_generic_writecoalesce, OID_AUTO, iosizes,
+    CTLTYPE_OPAQUE | CTLFLAG_RD | CTLFLAG_LOCKED,
+    0, 0, sysctl_cluster_write_iosizes, "Q",
+    "write I/Os issued by size: 4k, 8k, ... 1m, larger");
+
 /*
  * throttle the number of async writes that
  * can be outstanding on a single vnode
@@ -395,6 +509,9 @@ cluster_init(void)
 	}
 
 	cluster_verify_init();
+
+	cl_coalesce_call = thread_call_allocate_with_options(cluster_coalesce_flush,
+	    NULL, THREAD_CALL_PRIORITY_KERNEL, THREAD_CALL_OPTIONS_ONCE);
 }
 
 uint32_t
@@ -509,7 +626,9 @@ cluster_get_rap(vnode_t vp)
 
 	if ((rap = ubc->cl_rahead) == NULL) {
 		rap = zalloc_flags(cl_rd_zone, Z_WAITOK | Z_ZERO);
-		rap->cl_lastr = -1;
+		for (int i = 0; i < CL_RA_MAX_STREAMS; i++) {
+			rap->cl_streams[i].cl_lastr = -1;
+		}
 		lck_mtx_init(&rap->cl_lockr, &cl_mtx_grp, LCK_ATTR_NULL);
 
 		vnode_lock(vp);
@@ -531,6 +650,175 @@ cluster_get_rap(vnode_t vp)
 }
 
 
+/*
+ * Read-ahead streams
+ *
+ * The read ahead context of a vnode tracks up to cluster_ra_streams
+ * independent readers, so that several cursors interleaving their reads
+ * over the same file (database scans, media demuxers...) each get their
+ * own read-ahead instead of constantly resetting a single one.
+ *
+ * A stream is sequential when a read starts where its last one ended,
+ * or strided once two consecutive reads were issued the same distance
+ * after the previous ones.  A read that doesn't belong to a stream starts
+ * a new one, which remembers its distance to the closest stream behind it
+ * that hasn't started reading ahead yet: if the next read is issued at
+ * that same distance, the new stream becomes strided.
+ *
+ * New streams take a free slot, or recycle the least recently used stream
+ * that is old enough: it must have hit at least once, or been created
+ * at least as many reads ago as there are streams.  Otherwise, a burst of
+ * unrelated reads would recycle the streams of interleaved cursors before
+ * their second read had a chance to match.  When no stream can be recycled,
+ * the read isn't tracked and doesn't get any read ahead.
+ */
+static struct cl_rastream *
+cluster_ra_stream(struct cl_readahead *rap, struct cl_extent *extent)
+{
+	struct cl_rastream *ras, *cand = NULL, *lru = NULL;
+	daddr64_t b_addr = extent->b_addr;
+	daddr64_t first;
+	uint32_t nstreams = MAX(1, MIN(cluster_ra_streams, CL_RA_MAX_STREAMS));
+
+	rap->cl_nreads++;
+
+	for (uint32_t i = 0; i < nstreams; i++) {
+		ras = &rap->cl_streams[i];
+
+		if ((ras->cl_lastr == -1 || ras->cl_hits ||
+		    rap->cl_nreads - ras->cl_born > nstreams) &&
+		    (lru == NULL || ras->cl_stamp < lru->cl_stamp)) {
+			lru = ras;
+		}
+		if (ras->cl_lastr == -1) {
+			continue;
+		}
+		if (b_addr == ras->cl_lastr || b_addr == ras->cl_lastr + 1) {
+			goto found;
+		}
+		if (b_addr <= ras->cl_lastr + 1 || b_addr - ras->cl_lastb > CL_RA_STRIDE_MAX) {
+			continue;
+		}
+		if (ras->cl_stride) {
+			if (b_addr == ras->cl_lastb + ras->cl_stride) {
+				goto found;
+			}
+		} else if (ras->cl_ralen == 0) {
+			if (ras->cl_delta && b_addr - ras->cl_lastb == ras->cl_delta) {
+				ras->cl_stride = ras->cl_delta;
+				goto found;
+			}
+			if (cand == NULL || ras->cl_lastb > cand->cl_lastb) {
+				cand = ras;
+			}
+		}
+	}
+
+	if (lru == NULL) {
+		return NULL;
+	}
+
+	cluster_ra_stream_discard(lru);
+	*lru = (struct cl_rastream){
+		.cl_lastr = -1,
+		.cl_delta = cand ? b_addr - cand->cl_lastb : 0,
+		.cl_born  = rap->cl_nreads,
+	};
+	return lru;
+
+found:
+	/* count the pages the read ahead of this stream brought in */
+	first = MAX(b_addr, ras->cl_lastr + 1);
+	if (ras->cl_maxra >= first) {
+		counter_add(&cluster_ra_useful_pages,
+		    MIN(extent->e_addr, ras->cl_maxra) - first + 1);
+	}
+	ras->cl_hits++;
+	return ras;
+}
+
+/*
+ * Record a read in its stream, once the read ahead for it was issued.
+ */
+static void
+cluster_ra_stream_update(struct cl_rastream *ras, struct cl_extent *extent)
+{
+	uint64_t now = mach_absolute_time();
+	uint64_t pages = (uint64_t)(extent->e_addr - extent->b_addr) + 1;
+	uint64_t ns;
+
+	if (ras->cl_stamp) {
+		absolutetime_to_nanoseconds(now - ras->cl_stamp, &ns);
+		if (ns) {
+			uint64_t rate = MIN(pages * NSEC_PER_SEC / ns, UINT32_MAX);
+
+			ras->cl_rate = ras->cl_rate ?
+			    (uint32_t)((3 * (uint64_t)ras->cl_rate + rate) / 4) : (uint32_t)rate;
+		}
+	}
+	if (extent->e_addr < ras->cl_lastr) {
+		cluster_ra_stream_discard(ras);
+	}
+	ras->cl_lastb = extent->b_addr;
+	ras->cl_lastr = extent->e_addr;
+	ras->cl_stamp = now;
+}
+
+/*
+ * Give up on the pages a stream read ahead and didn't read yet.
+ */
+static void
+cluster_ra_stream_discard(struct cl_rastream *ras)
+{
+	daddr64_t wasted = ras->cl_maxra - ras->cl_lastr;
+
+	if (ras->cl_lastr != -1 && wasted > 0) {
+		if (ras->cl_stride) {
+			/* only the strided reads were prefetched, not the gaps */
+			wasted = wasted * (ras->cl_lastr - ras->cl_lastb + 1) / ras->cl_stride;
+		}
+		counter_add(&cluster_ra_wasted_pages, (uint64_t)wasted);
+	}
+	ras->cl_maxra = 0;
+}
+
+/*
+ * Size the read ahead of a stream so that it covers what the stream
+ * consumes while a read is in flight: the stream's consumption rate
+ * times the latency of the reads missing the cache on this vnode.
+ *
+ * That is scaled by 4 since a new read ahead is only issued when a
+ * quarter of the window is left.  Without history, the full window
+ * allowed for the device (max_prefetch) is used.
+ */
+static int
+cluster_ra_window(struct cl_readahead *rap, struct cl_rastream *ras, u_int max_prefetch)
+{
+	int max_ralen = max_prefetch / PAGE_SIZE;
+	uint64_t lat_ns, pages;
+
+	if (ras->cl_rate == 0 || rap->cl_iolat == 0) {
+		return max_ralen;
+	}
+	absolutetime_to_nanoseconds(rap->cl_iolat, &lat_ns);
+	lat_ns = MIN(lat_ns, NSEC_PER_SEC);
+	pages = 4 * (uint64_t)ras->cl_rate * lat_ns / NSEC_PER_SEC;
+
+	return (int)MIN(MAX(pages, CL_RA_MIN_WINDOW), (uint64_t)max_ralen);
+}
+
+/*
+ * Fold the latency of a read that missed the cache into the average.
+ */
+static void
+cluster_ra_update_latency(struct cl_readahead *rap, uint64_t issued)
+{
+	uint64_t lat = mach_absolute_time() - issued;
+
+	rap->cl_iolat = rap->cl_iolat ? (7 * rap->cl_iolat + lat) / 8 : lat;
+}
+
+
 /*
  * if the write behind context doesn't yet exist,
  * and CLW_ALLOCATE is specified, allocate and initialize it...
@@ -2299,6 +2587,15 @@ create_cached_upl:
 		cbp->b_blkno  = blkno;
 		cbp->b_bcount = io_size;
 
+		if (!(io_flags & B_READ)) {
+			u_int bucket = 0;
+
+			while (bucket < CL_IOSIZE_BUCKETS - 1 && (4096u << bucket) < io_size) {
+				bucket++;
+			}
+			counter_inc(cluster_write_iosizes[bucket]);
+		}
+
 		if (buf_setupl(cbp, upl, (uint32_t)upl_offset)) {
 			panic("buf_setupl failed");
 		}
@@ -2565,29 +2862,31 @@ cluster_read_prefetch(vnode_t vp, off_t f_offset, u_int size, off_t filesize, in
 
 
 static void
-cluster_read_ahead(vnode_t vp, struct cl_extent *extent, off_t filesize, struct cl_readahead *rap, int (*callback)(buf_t, void *), void *callback_arg,
-    int bflag)
+cluster_read_ahead(vnode_t vp, struct cl_extent *extent, off_t filesize, struct cl_readahead *rap, struct cl_rastream *ras,
+    int (*callback)(buf_t, void *), void *callback_arg, int bflag)
 {
 	daddr64_t       r_addr;
 	off_t           f_offset;
 	int             size_of_prefetch;
 	u_int           max_prefetch;
+	int             max_ralen;
 
 
 	KERNEL_DEBUG((FSDBG_CODE(DBG_FSRW, 48)) | DBG_FUNC_START,
-	    (int)extent->b_addr, (int)extent->e_addr, (int)rap->cl_lastr, 0, 0);
+	    (int)extent->b_addr, (int)extent->e_addr, (int)ras->cl_lastr, 0, 0);
 
-	if (extent->b_addr == rap->cl_lastr && extent->b_addr == extent->e_addr) {
+	if (extent->b_addr == ras->cl_lastr && extent->b_addr == extent->e_addr) {
 		KERNEL_DEBUG((FSDBG_CODE(DBG_FSRW, 48)) | DBG_FUNC_END,
-		    rap->cl_ralen, (int)rap->cl_maxra, (int)rap->cl_lastr, 0, 0);
+		    ras->cl_ralen, (int)ras->cl_maxra, (int)ras->cl_lastr, 0, 0);
 		return;
 	}
-	if (rap->cl_lastr == -1 || (extent->b_addr != rap->cl_lastr && extent->b_addr != (rap->cl_lastr + 1))) {
-		rap->cl_ralen = 0;
-		rap->cl_maxra = 0;
+	if (ras->cl_lastr == -1 || (extent->b_addr != ras->cl_lastr && extent->b_addr != (ras->cl_lastr + 1) &&
+	    (ras->cl_stride == 0 || extent->b_addr != ras->cl_lastb + ras->cl_stride))) {
+		cluster_ra_stream_discard(ras);
+		ras->cl_ralen = 0;
 
 		KERNEL_DEBUG((FSDBG_CODE(DBG_FSRW, 48)) | DBG_FUNC_END,
-		    rap->cl_ralen, (int)rap->cl_maxra, (int)rap->cl_lastr, 1, 0);
+		    ras->cl_ralen, (int)ras->cl_maxra, (int)ras->cl_lastr, 1, 0);
 
 		return;
 	}
@@ -2597,17 +2896,27 @@ cluster_read_ahead(vnode_t vp, struct cl_extent *extent, off_t filesize, struct
 
 	if (max_prefetch <= PAGE_SIZE) {
 		KERNEL_DEBUG((FSDBG_CODE(DBG_FSRW, 48)) | DBG_FUNC_END,
-		    rap->cl_ralen, (int)rap->cl_maxra, (int)rap->cl_lastr, 6, 0);
+		    ras->cl_ralen, (int)ras->cl_maxra, (int)ras->cl_lastr, 6, 0);
 		return;
 	}
-	if (extent->e_addr < rap->cl_maxra && rap->cl_ralen >= 4) {
-		if ((rap->cl_maxra - extent->e_addr) > (rap->cl_ralen / 4)) {
+	max_ralen = cluster_ra_window(rap, ras, max_prefetch);
+
+	if (extent->b_addr > ras->cl_lastr + 1) {
+		cluster_read_ahead_strided(vp, extent, filesize, ras, max_ralen,
+		    callback, callback_arg, bflag);
+
+		KERNEL_DEBUG((FSDBG_CODE(DBG_FSRW, 48)) | DBG_FUNC_END,
+		    ras->cl_ralen, (int)ras->cl_maxra, (int)ras->cl_lastr, 5, 0);
+		return;
+	}
+	if (extent->e_addr < ras->cl_maxra && ras->cl_ralen >= 4) {
+		if ((ras->cl_maxra - extent->e_addr) > (ras->cl_ralen / 4)) {
 			KERNEL_DEBUG((FSDBG_CODE(DBG_FSRW, 48)) | DBG_FUNC_END,
-			    rap->cl_ralen, (int)rap->cl_maxra, (int)rap->cl_lastr, 2, 0);
+			    ras->cl_ralen, (int)ras->cl_maxra, (int)ras->cl_lastr, 2, 0);
 			return;
 		}
 	}
-	r_addr = MAX(extent->e_addr, rap->cl_maxra) + 1;
+	r_addr = MAX(extent->e_addr, ras->cl_maxra) + 1;
 	f_offset = (off_t)(r_addr * PAGE_SIZE_64);
 
 	size_of_prefetch = 0;
@@ -2616,31 +2925,72 @@ cluster_read_ahead(vnode_t vp, struct cl_extent *extent, off_t filesize, struct
 
 	if (size_of_prefetch) {
 		KERNEL_DEBUG((FSDBG_CODE(DBG_FSRW, 48)) | DBG_FUNC_END,
-		    rap->cl_ralen, (int)rap->cl_maxra, (int)rap->cl_lastr, 3, 0);
+		    ras->cl_ralen, (int)ras->cl_maxra, (int)ras->cl_lastr, 3, 0);
 		return;
 	}
 	if (f_offset < filesize) {
 		daddr64_t read_size;
 
-		rap->cl_ralen = rap->cl_ralen ? min(max_prefetch / PAGE_SIZE, rap->cl_ralen << 1) : 1;
+		ras->cl_ralen = ras->cl_ralen ? min(max_ralen, ras->cl_ralen << 1) : 1;
 
 		read_size = (extent->e_addr + 1) - extent->b_addr;
 
-		if (read_size > rap->cl_ralen) {
+		if (read_size > ras->cl_ralen) {
 			if (read_size > max_prefetch / PAGE_SIZE) {
-				rap->cl_ralen = max_prefetch / PAGE_SIZE;
+				ras->cl_ralen = max_prefetch / PAGE_SIZE;
 			} else {
-				rap->cl_ralen = (int)read_size;
+				ras->cl_ralen = (int)read_size;
 			}
 		}
-		size_of_prefetch = cluster_read_prefetch(vp, f_offset, rap->cl_ralen * PAGE_SIZE, filesize, callback, callback_arg, bflag);
+		size_of_prefetch = cluster_read_prefetch(vp, f_offset, ras->cl_ralen * PAGE_SIZE, filesize, callback, callback_arg, bflag);
 
 		if (size_of_prefetch) {
-			rap->cl_maxra = (r_addr + size_of_prefetch) - 1;
+			ras->cl_maxra = (r_addr + size_of_prefetch) - 1;
 		}
 	}
 	KERNEL_DEBUG((FSDBG_CODE(DBG_FSRW, 48)) | DBG_FUNC_END,
-	    rap->cl_ralen, (int)rap->cl_maxra, (int)rap->cl_lastr, 4, 0);
+	    ras->cl_ralen, (int)ras->cl_maxra, (int)ras->cl_lastr, 4, 0);
+}
+
+
+/*
+ * Read ahead for a strided stream: prefetch the next reads of the stream,
+ * assuming they are the same size as this one.  cl_ralen counts reads
+ * rather than pages, and doubles every time the stream hits, as long as
+ * the prefetched pages fit in the stream window.
+ */
+static void
+cluster_read_ahead_strided(vnode_t vp, struct cl_extent *extent, off_t filesize, struct cl_rastream *ras,
+    int max_ralen, int (*callback)(buf_t, void *), void *callback_arg, int bflag)
+{
+	daddr64_t       read_size = (extent->e_addr + 1) - extent->b_addr;
+	daddr64_t       stride = ras->cl_stride;
+	daddr64_t       r_addr, l_addr;
+	int             nreads, size_of_prefetch;
+
+	nreads = ras->cl_ralen ? ras->cl_ralen << 1 : 1;
+	nreads = (int)MIN(nreads, MAX(1, max_ralen / read_size));
+	nreads = MIN(nreads, CL_RA_STRIDE_MAX_READS);
+	ras->cl_ralen = nreads;
+
+	/* don't issue again the reads the last read ahead covered */
+	r_addr = extent->b_addr + stride;
+	if (ras->cl_maxra >= r_addr) {
+		r_addr += ((ras->cl_maxra - r_addr) / stride + 1) * stride;
+	}
+	l_addr = extent->b_addr + nreads * stride;
+
+	for (; r_addr <= l_addr; r_addr += stride) {
+		if ((off_t)(r_addr * PAGE_SIZE_64) >= filesize) {
+			break;
+		}
+		size_of_prefetch = cluster_read_prefetch(vp, (off_t)(r_addr * PAGE_SIZE_64),
+		    (u_int)(read_size * PAGE_SIZE), filesize, callback, callback_arg, bflag);
+		if (size_of_prefetch == 0) {
+			break;
+		}
+		ras->cl_maxra = (r_addr + size_of_prefetch) - 1;
+	}
 }
 
 
@@ -4718,12 +5068,14 @@ cluster_read_copy(vnode_t vp, struct uio *uio, u_int32_t io_req_size, off_t file
 	u_int            rd_ahead_enabled = 1;
 	u_int            prefetch_enabled = 1;
 	struct cl_readahead *   rap;
+	struct cl_rastream *    ras = NULL;
 	struct clios            iostate;
 	struct cl_extent        extent;
 	int              bflag;
 	int              take_reference = 1;
 	int              policy = IOPOL_DEFAULT;
 	boolean_t        iolock_inited = FALSE;
+	uint64_t         io_issued = 0;
 
 	KERNEL_DEBUG((FSDBG_CODE(DBG_FSRW, 32)) | DBG_FUNC_START,
 	    (int)uio->uio_offset, io_req_size, (int)filesize, flags, 0);
@@ -4782,9 +5134,13 @@ cluster_read_copy(vnode_t vp, struct uio *uio, u_int32_t io_req_size, off_t file
 		} else {
 			extent.b_addr = uio->uio_offset / PAGE_SIZE_64;
 			extent.e_addr = (last_request_offset - 1) / PAGE_SIZE_64;
+			ras = cluster_ra_stream(rap, &extent);
+			if (ras == NULL) {
+				rd_ahead_enabled = 0;
+			}
 		}
 	}
-	if (rap != NULL && rap->cl_ralen && (rap->cl_lastr == extent.b_addr || (rap->cl_lastr + 1) == extent.b_addr)) {
+	if (ras != NULL && ras->cl_ralen && (ras->cl_lastr == extent.b_addr || (ras->cl_lastr + 1) == extent.b_addr)) {
 		/*
 		 * determine if we already have a read-ahead in the pipe courtesy of the
 		 * last read systemcall that was issued...
@@ -4792,7 +5148,7 @@ cluster_read_copy(vnode_t vp, struct uio *uio, u_int32_t io_req_size, off_t file
 		 * with respect to any read-ahead that might be necessary to
 		 * garner all the data needed to complete this read systemcall
 		 */
-		last_ioread_offset = (rap->cl_maxra * PAGE_SIZE_64) + PAGE_SIZE_64;
+		last_ioread_offset = (ras->cl_maxra * PAGE_SIZE_64) + PAGE_SIZE_64;
 
 		if (last_ioread_offset < uio->uio_offset) {
 			last_ioread_offset = (off_t)0;
@@ -4881,18 +5237,15 @@ cluster_read_copy(vnode_t vp, struct uio *uio, u_int32_t io_req_size, off_t file
 					 * we're already finished the I/O for this read request
 					 * let's see if we should do a read-ahead
 					 */
-					cluster_read_ahead(vp, &extent, filesize, rap, callback, callback_arg, bflag);
+					cluster_read_ahead(vp, &extent, filesize, rap, ras, callback, callback_arg, bflag);
 				}
 			}
 			if (retval) {
 				break;
 			}
 			if (io_size == 0) {
-				if (rap != NULL) {
-					if (extent.e_addr < rap->cl_lastr) {
-						rap->cl_maxra = 0;
-					}
-					rap->cl_lastr = extent.e_addr;
+				if (ras != NULL) {
+					cluster_ra_stream_update(ras, &extent);
 				}
 				break;
 			}
@@ -5049,18 +5402,21 @@ cluster_read_copy(vnode_t vp, struct uio *uio, u_int32_t io_req_size, off_t file
 			 * issue an asynchronous read to cluster_io
 			 */
 
+			if (rap) {
+				io_issued = mach_absolute_time();
+			}
 			error = cluster_io(vp, upl, upl_offset, upl_f_offset + upl_offset,
 			    io_size, CL_READ | CL_ASYNC | bflag, (buf_t)NULL, &iostate, callback, callback_arg);
 
-			if (rap) {
-				if (extent.e_addr < rap->cl_maxra) {
+			if (ras) {
+				if (extent.e_addr < ras->cl_maxra) {
 					/*
 					 * we've just issued a read for a block that should have been
 					 * in the cache courtesy of the read-ahead engine... something
 					 * has gone wrong with the pipeline, so reset the read-ahead
 					 * logic which will cause us to restart from scratch
 					 */
-					rap->cl_maxra = 0;
+					cluster_ra_stream_discard(ras);
 				}
 			}
 		}
@@ -5139,19 +5495,20 @@ cluster_read_copy(vnode_t vp, struct uio *uio, u_int32_t io_req_size, off_t file
 				 * explicitly disabled it
 				 */
 				if (rd_ahead_enabled) {
-					cluster_read_ahead(vp, &extent, filesize, rap, callback, callback_arg, bflag);
+					cluster_read_ahead(vp, &extent, filesize, rap, ras, callback, callback_arg, bflag);
 				}
 
-				if (rap != NULL) {
-					if (extent.e_addr < rap->cl_lastr) {
-						rap->cl_maxra = 0;
-					}
-					rap->cl_lastr = extent.e_addr;
+				if (ras != NULL) {
+					cluster_ra_stream_update(ras, &extent);
 				}
 			}
 			if (iolock_inited == TRUE) {
 				cluster_iostate_wait(&iostate, 0, "cluster_read_copy");
 			}
+			if (io_issued) {
+				cluster_ra_update_latency(rap, io_issued);
+				io_issued = 0;
+			}
 
 			if (iostate.io_error) {
 				error = iostate.io_error;
@@ -5276,7 +5633,7 @@ cluster_read_copy(vnode_t vp, struct uio *uio, u_int32_t io_req_size, off_t file
 	}
 	if (rap != NULL) {
 		KERNEL_DEBUG((FSDBG_CODE(DBG_FSRW, 32)) | DBG_FUNC_END,
-		    (int)uio->uio_offset, io_req_size, rap->cl_lastr, retval, 0);
+		    (int)uio->uio_offset, io_req_size, ras ? (int)ras->cl_lastr : 0, retval, 0);
 
 		lck_mtx_unlock(&rap->cl_lockr);
 	} else {
@@ -6490,6 +6847,181 @@ advisory_read_ext(vnode_t vp, off_t filesize, off_t f_offset, int resid, int (*c
 }
 
 
+/*
+ * Closing a small file that was just written pushes its few dirty pages in
+ * I/Os of their own, so a burst of small file creations turns into as many
+ * small writes scattered over the device.  Instead, asynchronous pushes from
+ * close are queued for a little while and issued together, sorted by mount
+ * and by device block, so that the device sees them in ascending order and
+ * the layers below can merge the adjacent ones.
+ *
+ * The dirty pages stay in the write behind clusters of the vnode while it's
+ * queued: an fsync, a sync or a reclaim pushes them as usual, the queue only
+ * keeps a hold on the vnode and its vid.
+ *
+ * Called with the write behind lock held, returns true if the push can be
+ * skipped.
+ */
+static bool
+cluster_coalesce_defer(vnode_t vp, struct cl_writebehind *wbp, int flags,
+    int (*callback)(buf_t, void *))
+{
+	struct cl_coalesce_entry *cce;
+	uint32_t batch = MIN(cluster_coalesce_batch, CL_COALESCE_MAX);
+	uint32_t pages = 0;
+	uint32_t count;
+
+	if (batch == 0 || callback != NULL ||
+	    (flags & (IO_CLOSE | IO_SYNC | IO_NOCACHE)) != IO_CLOSE ||
+	    wbp->cl_scmap != NULL || wbp->cl_number == 0 ||
+	    !(vp->v_mount->mnt_flag & MNT_LOCAL)) {
+		return false;
+	}
+	if (wbp->cl_coalescing) {
+		return true;
+	}
+	for (int cl_index = 0; cl_index < wbp->cl_number; cl_index++) {
+		pages += (uint32_t)(wbp->cl_clusters[cl_index].e_addr - wbp->cl_clusters[cl_index].b_addr);
+	}
+	if (pages > cluster_coalesce_max_pages) {
+		return false;
+	}
+
+	vnode_hold(vp);
+
+	lck_mtx_lock(&cl_coalesce_mtx);
+	if ((count = cl_coalesce_count) >= batch) {
+		lck_mtx_unlock(&cl_coalesce_mtx);
+		vnode_drop(vp);
+		return false;
+	}
+	cce = &cl_coalesce_queue[count];
+	cce->cce_vp = vp;
+	cce->cce_mp = vp->v_mount;
+	cce->cce_vid = vnode_vid(vp);
+	cl_coalesce_count = ++count;
+	lck_mtx_unlock(&cl_coalesce_mtx);
+
+	wbp->cl_coalescing = 1;
+	counter_inc(&cluster_coalesce_deferred);
+
+	if (count >= batch) {
+		thread_call_enter(cl_coalesce_call);
+	} else if (count == 1) {
+		uint64_t deadline;
+
+		clock_interval_to_deadline(cluster_coalesce_delay_ms, NSEC_PER_MSEC, &deadline);
+		thread_call_enter_delayed(cl_coalesce_call, deadline);
+	}
+	return true;
+}
+
+static int
+cluster_coalesce_cmp(const void *a, const void *b)
+{
+	const struct cl_coalesce_entry *ca = a;
+	const struct cl_coalesce_entry *cb = b;
+
+	if (ca->cce_mp != cb->cce_mp) {
+		return (uintptr_t)ca->cce_mp < (uintptr_t)cb->cce_mp ? -1 : 1;
+	}
+	/* unmapped ranges (-1) go last */
+	if (ca->cce_blkno != cb->cce_blkno) {
+		return (uint64_t)ca->cce_blkno < (uint64_t)cb->cce_blkno ? -1 : 1;
+	}
+	return ca->cce_seq < cb->cce_seq ? -1 : 1;
+}
+
+static void
+cluster_coalesce_flush(__unused thread_call_param_t p0, __unused thread_call_param_t p1)
+{
+	struct cl_coalesce_entry *cce;
+	struct cl_writebehind *wbp;
+	uint32_t count;
+	off_t f_offset;
+	vnode_t vp;
+
+	lck_mtx_lock(&cl_coalesce_mtx);
+	count = cl_coalesce_count;
+	memcpy(cl_coalesce_drain, cl_coalesce_queue, count * sizeof(cl_coalesce_queue[0]));
+	cl_coalesce_count = 0;
+	lck_mtx_unlock(&cl_coalesce_mtx);
+
+	KERNEL_DEBUG((FSDBG_CODE(DBG_FSRW, 54)) | DBG_FUNC_START, count, 0, 0, 0, 0);
+
+	for (uint32_t i = 0; i < count; i++) {
+		cce = &cl_coalesce_drain[i];
+		cce->cce_seq = i;
+		cce->cce_blkno = -1;
+
+		/*
+		 * a vnode that was recycled meanwhile had its dirty pages
+		 * pushed when it was cleaned
+		 */
+		if (vnode_getwithvid(cce->cce_vp, cce->cce_vid)) {
+			vp = cce->cce_vp;
+
+			/*
+			 * a vnode that's being drained or reclaimed may still
+			 * have its write behind clusters: don't leave it marked
+			 * as queued, or its next close-time push would be
+			 * skipped.  The vnode lock keeps the ubc_info around,
+			 * cl_lockw can't be taken under it.
+			 */
+			vnode_lock_spin(vp);
+			if (UBCINFOEXISTS(vp) && (wbp = cluster_get_wbp(vp, 0)) != NULL) {
+				os_atomic_store(&wbp->cl_coalescing, 0, relaxed);
+			}
+			vnode_unlock(vp);
+
+			vnode_drop(vp);
+			cce->cce_vp = NULLVP;
+			cce->cce_mp = NULL;
+			continue;
+		}
+		if (!UBCINFOEXISTS(cce->cce_vp) ||
+		    (wbp = cluster_get_wbp(cce->cce_vp, CLW_RETURNLOCKED)) == NULL) {
+			continue;
+		}
+		f_offset = -1;
+		for (int cl_index = 0; cl_index < wbp->cl_number; cl_index++) {
+			off_t b_offset = (off_t)(wbp->cl_clusters[cl_index].b_addr * PAGE_SIZE_64);
+
+			if (f_offset == -1 || b_offset < f_offset) {
+				f_offset = b_offset;
+			}
+		}
+		lck_mtx_unlock(&wbp->cl_lockw);
+
+		if (f_offset != -1 && f_offset < ubc_getsize(cce->cce_vp)) {
+			(void)VNOP_BLOCKMAP(cce->cce_vp, f_offset, PAGE_SIZE, &cce->cce_blkno,
+			    NULL, NULL, VNODE_READ, NULL);
+		}
+	}
+
+	qsort(cl_coalesce_drain, count, sizeof(cl_coalesce_drain[0]), cluster_coalesce_cmp);
+
+	for (uint32_t i = 0; i < count; i++) {
+		vp = cl_coalesce_drain[i].cce_vp;
+
+		if (vp == NULLVP) {
+			continue;
+		}
+		if (UBCINFOEXISTS(vp) &&
+		    (wbp = cluster_get_wbp(vp, CLW_RETURNLOCKED)) != NULL) {
+			wbp->cl_coalescing = 0;
+			lck_mtx_unlock(&wbp->cl_lockw);
+
+			cluster_push_err(vp, IO_PASSIVE, NULL, NULL, NULL);
+		}
+		vnode_put(vp);
+		vnode_drop(vp);
+	}
+
+	KERNEL_DEBUG((FSDBG_CODE(DBG_FSRW, 54)) | DBG_FUNC_END, count, 0, 0, 0, 0);
+}
+
+
 int
 cluster_push(vnode_t vp, int flags)
 {
@@ -6571,6 +7103,13 @@ cluster_push_err(vnode_t vp, int flags, int (*callback)(buf_t, void *), void *ca
 			KERNEL_DEBUG((FSDBG_CODE(DBG_FSRW, 98)) | DBG_FUNC_END, kdebug_vnode(vp), 0, 0, 0, 0);
 		}
 	}
+	if (cluster_coalesce_defer(vp, wbp, flags, callback)) {
+		lck_mtx_unlock(&wbp->cl_lockw);
+
+		KERNEL_DEBUG((FSDBG_CODE(DBG_FSRW, 53)) | DBG_FUNC_END,
+		    wbp->cl_scmap, wbp->cl_number, 0, 0, 0);
+		return 0;
+	}
 	if (wbp->cl_scmap) {
 		void    *scmap;
 
@@ -1380,6 +1380,17 @@ dirloop:
 	}
 #endif /* NAMEDRSRCFORK */
 
+	/*
+	 * cache_lookup_path found a negative entry for this component after
+	 * authorizing the search of dp: the name doesn't exist, there's no
+	 * need to ask the filesystem again.
+	 */
+	if (ndp->ni_flag & NAMEI_NEGATIVE_HIT) {
+		ndp->ni_flag &= ~NAMEI_NEGATIVE_HIT;
+		error = ENOENT;
+		goto bad;
+	}
+
 	/*
 	 * Handle "..": three special cases.
 	 * 1. if at starting directory (e.g. the cwd/usedvp)
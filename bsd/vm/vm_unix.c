@@ -107,6 +107,7 @@
 #include <vm/vm_protos_internal.h>
 #include <vm/vm_compressor_info.h>         /* for c_segment_info */
 #include <vm/vm_compressor_xnu.h>          /* for vm_compressor_serialize_segment_debug_info() */
+#include <vm/vm_compressor_backing_store_xnu.h> /* for VM_SWAPOUT_IO_DEPTH_MAX */
 #include <vm/vm_object_xnu.h>              /* for vm_chead_select_t */
 #include <vm/vm_memory_entry_xnu.h>
 #include <vm/vm_iokit.h>
@@ -289,6 +290,47 @@ sysctl_vm_self_region_info_flags SYSCTL_HANDLER_ARGS
 }
 SYSCTL_PROC(_vm, OID_AUTO, self_region_info_flags, CTLTYPE_INT | CTLFLAG_RW | CTLFLAG_ANYBODY | CTLFLAG_LOCKED | CTLFLAG_MASKED, 0, 0, &sysctl_vm_self_region_info_flags, "I", "");
 
+/*
+ * Opt the calling process in to range locks for vm_map_protect() and
+ * vm_map_remove(). This can't be undone.
+ */
+static int
+sysctl_vm_self_range_locks SYSCTL_HANDLER_ARGS
+{
+#pragma unused(arg1, arg2, oidp)
+	int     error = 0;
+	int     value;
+
+	value = vm_map_has_range_locks(current_map());
+	error = SYSCTL_OUT(req, &value, sizeof(int));
+	if (error) {
+		return error;
+	}
+
+	if (!req->newptr) {
+		return 0;
+	}
+
+	error = SYSCTL_IN(req, &value, sizeof(int));
+	if (error) {
+		return error;
+	}
+	if (value == 0) {
+		return vm_map_has_range_locks(current_map()) ? EINVAL : 0;
+	}
+	if (vm_map_enable_range_locks(current_map()) != KERN_SUCCESS) {
+		return EINVAL;
+	}
+	return 0;
+}
+SYSCTL_PROC(_vm, OID_AUTO, self_range_locks, CTLTYPE_INT | CTLFLAG_RW | CTLFLAG_ANYBODY | CTLFLAG_LOCKED | CTLFLAG_MASKED, 0, 0, &sysctl_vm_self_range_locks, "I", "");
+SCALABLE_COUNTER_DECLARE(vm_map_range_lock_count);
+SYSCTL_SCALABLE_COUNTER(_vm, map_range_lock_count, vm_map_range_lock_count, "Address ranges locked in maps with range locks");
+SCALABLE_COUNTER_DECLARE(vm_map_range_lock_contended);
+SYSCTL_SCALABLE_COUNTER(_vm, map_range_lock_contended, vm_map_range_lock_contended, "Range locks that had to wait for an overlapping range");
+SCALABLE_COUNTER_DECLARE(vm_map_range_lock_wait_us);
+SYSCTL_SCALABLE_COUNTER(_vm, map_range_lock_wait_us, vm_map_range_lock_wait_us, "Time spent waiting for range locks (us)");
+
 
 #if DEVELOPMENT || DEBUG
 extern int panic_on_unsigned_execute;
@@ -2481,6 +2523,97 @@ SYSCTL_SCALABLE_COUNTER(_vm, pages_grabbed_iopl, vm_page_grab_count_iopl, "Total
 SCALABLE_COUNTER_DECLARE(vm_page_grab_count_upl);
 SYSCTL_SCALABLE_COUNTER(_vm, pages_grabbed_upl, vm_page_grab_count_upl, "Total pages grabbed (upl)");
 
+extern uint32_t vm_page_zero_pool_size;
+
+static int
+sysctl_vm_page_zero_pool_size SYSCTL_HANDLER_ARGS
+{
+#pragma unused(oidp, arg1, arg2)
+	uint32_t value = vm_page_zero_pool_size;
+	int changed = 0;
+	int error;
+
+	error = sysctl_io_number(req, value, sizeof(value), &value, &changed);
+	if (error || !changed) {
+		return error;
+	}
+	if (value > VM_PAGE_ZERO_POOL_SIZE_MAX) {
+		return EINVAL;
+	}
+	vm_page_zero_pool_size = value;
+	return 0;
+}
+SYSCTL_PROC(_vm, OID_AUTO, page_zero_pool_size, CTLTYPE_INT | CTLFLAG_RW | CTLFLAG_LOCKED,
+    0, 0, sysctl_vm_page_zero_pool_size, "IU", "Pre-zeroed pages kept per CPU for zero-fill faults (at most 256)");
+SCALABLE_COUNTER_DECLARE(vm_page_zero_pool_hits);
+SYSCTL_SCALABLE_COUNTER(_vm, page_zero_pool_hits, vm_page_zero_pool_hits, "Zero-fill faults given a pre-zeroed page");
+SCALABLE_COUNTER_DECLARE(vm_page_zero_pool_misses);
+SYSCTL_SCALABLE_COUNTER(_vm, page_zero_pool_misses, vm_page_zero_pool_misses, "Zero-fill faults that had to zero their page");
+SCALABLE_COUNTER_DECLARE(vm_page_zero_pool_zeroed);
+SYSCTL_SCALABLE_COUNTER(_vm, page_zero_pool_zeroed, vm_page_zero_pool_zeroed, "Pages zeroed ahead of time");
+
+extern uint32_t vm_fault_around_pages;
+SYSCTL_UINT(_vm, OID_AUTO, fault_around_pages, CTLFLAG_RW | CTLFLAG_LOCKED,
+    &vm_fault_around_pages, 0, "Pages considered around a fault for fault-around (at most 64)");
+extern bool vm_fault_around_default;
+SYSCTL_COMPAT_UINT(_vm, OID_AUTO, fault_around_default, CTLFLAG_RW | CTLFLAG_LOCKED,
+    &vm_fault_around_default, 0, "Fault-around for all mappings, not just the ones advised MADV_FAULT_AROUND");
+SCALABLE_COUNTER_DECLARE(vm_fault_around_mapped);
+SYSCTL_SCALABLE_COUNTER(_vm, fault_around_mapped, vm_fault_around_mapped, "Pages mapped ahead by fault-around");
+SCALABLE_COUNTER_DECLARE(vm_fault_around_sampled);
+SYSCTL_SCALABLE_COUNTER(_vm, fault_around_sampled, vm_fault_around_sampled, "Unreferenced pages mapped ahead and checked again later");
+SCALABLE_COUNTER_DECLARE(vm_fault_around_touched);
+SYSCTL_SCALABLE_COUNTER(_vm, fault_around_touched, vm_fault_around_touched, "Sampled pages mapped ahead that were touched since");
+extern bool vm_fault_speculative;
+SYSCTL_COMPAT_UINT(_vm, OID_AUTO, fault_speculative, CTLFLAG_RW | CTLFLAG_LOCKED,
+    &vm_fault_speculative, 0, "Resolve simple faults without taking the map lock");
+SCALABLE_COUNTER_DECLARE(vm_fault_speculative_hits);
+SYSCTL_SCALABLE_COUNTER(_vm, fault_speculative_hits, vm_fault_speculative_hits, "Faults resolved without taking the map lock");
+SCALABLE_COUNTER_DECLARE(vm_fault_speculative_fallbacks);
+SYSCTL_SCALABLE_COUNTER(_vm, fault_speculative_fallbacks, vm_fault_speculative_fallbacks, "Speculative faults that fell back to taking the map lock");
+extern uint32_t vm_swapout_io_depth;
+
+static int
+sysctl_vm_swapout_io_depth SYSCTL_HANDLER_ARGS
+{
+#pragma unused(oidp, arg1, arg2)
+	uint32_t value = vm_swapout_io_depth;
+	int changed = 0;
+	int error;
+
+	error = sysctl_io_number(req, value, sizeof(value), &value, &changed);
+	if (error || !changed) {
+		return error;
+	}
+	if (value < 1 || value > VM_SWAPOUT_IO_DEPTH_MAX) {
+		return EINVAL;
+	}
+	os_atomic_store(&vm_swapout_io_depth, value, relaxed);
+	return 0;
+}
+SYSCTL_PROC(_vm, OID_AUTO, swapout_io_depth, CTLTYPE_INT | CTLFLAG_RW | CTLFLAG_LOCKED,
+    0, 0, sysctl_vm_swapout_io_depth, "IU", "Swapouts that may be outstanding when unthrottled (1 to 64)");
+extern uint64_t vm_swapout_sequential;
+SYSCTL_QUAD(_vm, OID_AUTO, swapout_sequential, CTLFLAG_RD | CTLFLAG_LOCKED,
+    &vm_swapout_sequential, "Swapouts written right after the previous one in their swapfile");
+extern uint32_t vm_swapin_prefetch_segs;
+SYSCTL_UINT(_vm, OID_AUTO, swapin_prefetch_segs, CTLFLAG_RW | CTLFLAG_LOCKED,
+    &vm_swapin_prefetch_segs, 0, "Segments of its swapout group prefetched when one is swapped in (at most 16)");
+extern uint32_t vm_swapin_prefetch_waste_max;
+SYSCTL_UINT(_vm, OID_AUTO, swapin_prefetch_waste_max, CTLFLAG_RW | CTLFLAG_LOCKED,
+    &vm_swapin_prefetch_waste_max, 0, "Prefetched segments that may be left unused before prefetching stops");
+extern uint32_t vm_swapin_prefetch_outstanding;
+SYSCTL_UINT(_vm, OID_AUTO, swapin_prefetch_outstanding, CTLFLAG_RD | CTLFLAG_LOCKED,
+    &vm_swapin_prefetch_outstanding, 0, "Prefetched segments not used yet");
+SCALABLE_COUNTER_DECLARE(vm_swapin_prefetch_issued);
+SYSCTL_SCALABLE_COUNTER(_vm, swapin_prefetch_issued, vm_swapin_prefetch_issued, "Segments swapped in ahead of a fault");
+SCALABLE_COUNTER_DECLARE(vm_swapin_prefetch_used);
+SYSCTL_SCALABLE_COUNTER(_vm, swapin_prefetch_used, vm_swapin_prefetch_used, "Prefetched segments a page was then decompressed from");
+SCALABLE_COUNTER_DECLARE(vm_swapin_prefetch_wasted);
+SYSCTL_SCALABLE_COUNTER(_vm, swapin_prefetch_wasted, vm_swapin_prefetch_wasted, "Prefetched segments swapped out again or freed unused");
+SCALABLE_COUNTER_DECLARE(vm_swapin_prefetch_throttled);
+SYSCTL_SCALABLE_COUNTER(_vm, swapin_prefetch_throttled, vm_swapin_prefetch_throttled, "Prefetches not issued because too many were unused or memory was short");
+
 
 #if DEVELOPMENT || DEBUG
 SCALABLE_COUNTER_DECLARE(vm_page_deactivate_behind_count);
@@ -2810,6 +2943,27 @@ SYSCTL_QUAD(_vm_reclaim, OID_AUTO, reclaim_gc_reclaim_count,
 SYSCTL_COMPAT_UINT(_vm_reclaim, OID_AUTO, debug,
     CTLFLAG_RW | CTLFLAG_LOCKED, &vm_reclaim_debug, 0,
     "Debug logs for vm.reclaim");
+extern bool vm_reclaim_async_drain;
+
+static int
+sysctl_vm_reclaim_async_drain SYSCTL_HANDLER_ARGS
+{
+#pragma unused(oidp, arg1, arg2)
+	int value = vm_reclaim_async_drain ? 1 : 0;
+	int changed = 0;
+	int error;
+
+	error = sysctl_io_number(req, value, sizeof(value), &value, &changed);
+	if (error || !changed) {
+		return error;
+	}
+	vm_reclaim_async_drain = (value != 0);
+	return 0;
+}
+SYSCTL_PROC(_vm_reclaim, OID_AUTO, async_drain,
+    CTLTYPE_INT | CTLFLAG_RW | CTLFLAG_LOCKED, 0, 0, sysctl_vm_reclaim_async_drain, "I",
+    "Whether the buffers of suspended tasks are drained from thread calls "
+    "rather than by the scavenger thread (0 or 1)");
 #if XNU_TARGET_OS_IOS
 SYSCTL_QUAD(_vm_reclaim, OID_AUTO, max_threshold,
     CTLFLAG_RW | CTLFLAG_LOCKED, &vm_reclaim_max_threshold,
@@ -2868,6 +3022,62 @@ SYSCTL_PROC(_vm_reclaim, OID_AUTO, sampling_period_ns,
     "Interval (nanoseconds) at which to sample the minimum buffer size and "
     "consider trimming excess");
 #endif /* DEVELOPMENT || DEBUG */
+
+SCALABLE_COUNTER_DECLARE(vm_reclaim_bytes_reclaimed);
+SYSCTL_SCALABLE_COUNTER(_vm_reclaim, bytes_reclaimed, vm_reclaim_bytes_reclaimed,
+    "Bytes reclaimed from every deferred reclamation buffer");
+SCALABLE_COUNTER_DECLARE(vm_reclaim_entries_coalesced);
+SYSCTL_SCALABLE_COUNTER(_vm_reclaim, entries_coalesced, vm_reclaim_entries_coalesced,
+    "Entries deallocated together with an adjacent entry");
+SCALABLE_COUNTER_DECLARE(vm_reclaim_async_drains);
+SYSCTL_SCALABLE_COUNTER(_vm_reclaim, async_drains, vm_reclaim_async_drains,
+    "Buffers drained asynchronously after their task was suspended");
+
+static int
+sysctl_vm_reclaim_bytes_per_sec SYSCTL_HANDLER_ARGS
+{
+#pragma unused(arg1, arg2)
+	uint64_t value = vm_deferred_reclamation_bytes_per_sec();
+
+	return SYSCTL_OUT(req, &value, sizeof(value));
+}
+
+SYSCTL_PROC(_vm_reclaim, OID_AUTO, bytes_per_sec,
+    CTLTYPE_QUAD | CTLFLAG_RD | CTLFLAG_LOCKED, NULL, 0,
+    &sysctl_vm_reclaim_bytes_per_sec, "QU",
+    "Bytes reclaimed per second from every deferred reclamation buffer");
+
+static int
+sysctl_vm_reclaim_task_stats SYSCTL_HANDLER_ARGS
+{
+#pragma unused(oidp, arg1, arg2)
+	struct vm_reclaim_task_stats *vrts;
+	uint32_t n, max;
+	size_t size;
+	int error;
+
+	n = vm_deferred_reclamation_stats_snapshot(NULL, 0);
+	if (req->oldptr == USER_ADDR_NULL) {
+		req->oldidx = (size_t)(n + n / 8) * sizeof(*vrts);
+		return 0;
+	}
+
+	max = (uint32_t)MIN(n + n / 8, req->oldlen / sizeof(*vrts));
+	if (max == 0) {
+		return n == 0 ? 0 : ENOMEM;
+	}
+	size = max * sizeof(*vrts);
+	vrts = kalloc_data(size, Z_WAITOK | Z_ZERO);
+	n = vm_deferred_reclamation_stats_snapshot(vrts, max);
+	error = SYSCTL_OUT(req, vrts, MIN(n, max) * sizeof(*vrts));
+	kfree_data(vrts, size);
+	return error;
+}
+
+SYSCTL_PROC(_vm_reclaim, OID_AUTO, task_stats,
+    CTLTYPE_OPAQUE | CTLFLAG_RD | CTLFLAG_LOCKED, NULL, 0,
+    &sysctl_vm_reclaim_task_stats, "-",
+    "Reclamation statistics of each task with a deferred reclamation buffer");
 #endif /* CONFIG_DEFERRED_RECLAIM */
 
 #include <kern/thread.h>
@@ -1218,6 +1218,15 @@ kcdata_get_typedescription(unsigned type_id, uint8_t * buffer, uint32_t buffer_s
 		setup_type_definition(retval, type_id, i, "stackshot_latency_buffer");
 		break;
 	}
+	case STACKSHOT_KCTYPE_THREAD_GROUP_LATENCY: {
+		i = 0;
+		_SUBTYPE(KC_ST_UINT64, struct thread_group_latency_snapshot, tgls_id);
+		_SUBTYPE(KC_ST_UINT32, struct thread_group_latency_snapshot, tgls_sched_bucket);
+		_SUBTYPE_ARRAY(KC_ST_UINT64, struct thread_group_latency_snapshot, tgls_runnable, THREAD_GROUP_LATENCY_BUCKETS);
+		_SUBTYPE_ARRAY(KC_ST_UINT64, struct thread_group_latency_snapshot, tgls_preempted, THREAD_GROUP_LATENCY_BUCKETS);
+		setup_type_definition(retval, type_id, i, "thread_group_latency_snapshot");
+		break;
+	}
 	case TASK_CRASHINFO_KERNEL_TRIAGE_INFO_V1: {
 		i = 0;
 		_SUBTYPE_ARRAY(KC_ST_CHAR, struct kernel_triage_info_v1, triage_string1, MAX_TRIAGE_STRING_LEN);
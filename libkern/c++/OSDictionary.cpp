@@ -39,6 +39,7 @@
 #include <libkern/c++/OSSharedPtr.h>
 #include <libkern/c++/OSSymbol.h>
 #include <os/cpp_util.h>
+#include <os/hash.h>
 
 #define super OSCollection
 
@@ -78,11 +79,109 @@ OSDictionary::sortBySymbol(void)
 {
 	qsort(dictionary, count, sizeof(OSDictionary::dictEntry),
 	    &OSDictionary::dictEntry::compare);
+	if (hashSlotCount(capacity)) {
+		hashRebuild();
+	}
+}
+
+/*
+ * Hashed storage mode
+ *
+ * Dictionaries with a capacity of at least osdict_hash_threshold entries
+ * maintain an open addressing index of their keys, hashed by OSSymbol
+ * pointer, so that lookups and inserts don't need to scan (or, with kSort,
+ * bsearch) the entries.
+ *
+ * The index lives in the same allocation as the entries, right past
+ * `capacity` of them, which keeps the layout of OSDictionary unchanged.
+ * Entries keep their order (insertion order, or pointer order with kSort)
+ * so iteration and updateStamp semantics are unaffected.
+ *
+ * Each slot holds the position of an entry plus one, 0 being empty.
+ * Appends update the index in place, any operation moving entries
+ * around rebuilds it.
+ */
+#define OSDICT_HASH_THRESHOLD   32
+
+/* osdict_hash_threshold=0 disables hashed storage */
+static TUNABLE(unsigned int, osdict_hash_threshold,
+    "osdict_hash_threshold", OSDICT_HASH_THRESHOLD);
+
+unsigned int
+OSDictionary::hashSlotCount(unsigned int inCapacity)
+{
+	if (osdict_hash_threshold == 0 ||
+	    inCapacity < MAX(osdict_hash_threshold, 4u)) {
+		return 0;
+	}
+
+	// keep the load factor under 2/3 so that probing always terminates
+	return 1u << (32 - __builtin_clz(inCapacity + inCapacity / 2 - 1));
+}
+
+unsigned int
+OSDictionary::storageCount(unsigned int inCapacity)
+{
+	size_t indexSize = hashSlotCount(inCapacity) * sizeof(uint32_t);
+
+	return inCapacity + (unsigned int)((indexSize + sizeof(dictEntry) - 1) / sizeof(dictEntry));
+}
+
+/*
+ * The allocator might have rounded up the storage we asked for,
+ * only unhashed dictionaries can use the extra room as entries.
+ */
+unsigned int
+OSDictionary::fitCapacity(unsigned int inCapacity, unsigned int storage)
+{
+	return hashSlotCount(storage) ? inCapacity : storage;
+}
+
+unsigned int
+OSDictionary::hashFind(const OSSymbol *aKey) const
+{
+	const uint32_t *slots = (const uint32_t *)(const void *)&dictionary[capacity];
+	uint32_t mask = hashSlotCount(capacity) - 1;
+	uint32_t i = os_hash_kernel_pointer(aKey) & mask;
+	uint32_t e;
+
+	while ((e = slots[i]) != 0) {
+		if (aKey == dictionary[e - 1].key) {
+			return e - 1;
+		}
+		i = (i + 1) & mask;
+	}
+
+	return count;
+}
+
+void
+OSDictionary::hashInsert(unsigned int index)
+{
+	uint32_t *slots = (uint32_t *)(void *)&dictionary[capacity];
+	uint32_t mask = hashSlotCount(capacity) - 1;
+	uint32_t i = os_hash_kernel_pointer(dictionary[index].key.get()) & mask;
+
+	while (slots[i] != 0) {
+		i = (i + 1) & mask;
+	}
+	slots[i] = index + 1;
+}
+
+void
+OSDictionary::hashRebuild(void)
+{
+	bzero(&dictionary[capacity], hashSlotCount(capacity) * sizeof(uint32_t));
+	for (unsigned int i = 0; i < count; i++) {
+		hashInsert(i);
+	}
 }
 
 bool
 OSDictionary::initWithCapacity(unsigned int inCapacity)
 {
+	unsigned int storage;
+
 	if (!super::init()) {
 		return false;
 	}
@@ -93,12 +192,14 @@ OSDictionary::initWithCapacity(unsigned int inCapacity)
 
 //fOptions |= kSort;
 
-	dictionary = kallocp_type_container(dictEntry, &inCapacity, Z_WAITOK_ZERO);
+	storage = storageCount(inCapacity);
+	dictionary = kallocp_type_container(dictEntry, &storage, Z_WAITOK_ZERO);
 	if (!dictionary) {
 		return false;
 	}
 
-	OSCONTAINER_ACCUMSIZE(inCapacity * sizeof(dictEntry));
+	inCapacity = fitCapacity(inCapacity, storage);
+	OSCONTAINER_ACCUMSIZE(storageCount(inCapacity) * sizeof(dictEntry));
 
 	count = 0;
 	capacity = inCapacity;
@@ -214,6 +315,8 @@ OSDictionary::initWithDictionary(const OSDictionary *dict,
 
 	if ((kSort & fOptions) && !(kSort & dict->fOptions)) {
 		sortBySymbol();
+	} else if (hashSlotCount(capacity)) {
+		hashRebuild();
 	}
 
 	return true;
@@ -280,8 +383,10 @@ OSDictionary::free()
 	(void) super::setOptions(0, kImmutable);
 	flushCollection();
 	if (dictionary) {
-		kfree_type(dictEntry, capacity, dictionary);
-		OSCONTAINER_ACCUMSIZE( -(capacity * sizeof(dictEntry)));
+		unsigned int storage = storageCount(capacity);
+
+		kfree_type(dictEntry, storage, dictionary);
+		OSCONTAINER_ACCUMSIZE( -(storage * sizeof(dictEntry)));
 	}
 
 	super::free();
@@ -316,7 +421,7 @@ unsigned int
 OSDictionary::ensureCapacity(unsigned int newCapacity)
 {
 	dictEntry *newDict;
-	unsigned int finalCapacity;
+	unsigned int finalCapacity, oldStorage, newStorage;
 
 	if (newCapacity <= capacity) {
 		return capacity;
@@ -331,12 +436,26 @@ OSDictionary::ensureCapacity(unsigned int newCapacity)
 		return capacity;
 	}
 
+	oldStorage = storageCount(capacity);
+	newStorage = storageCount(finalCapacity);
+	if (newStorage < finalCapacity) {
+		return capacity;
+	}
+
 	newDict = kreallocp_type_container(dictEntry, dictionary,
-	    capacity, &finalCapacity, Z_WAITOK_ZERO);
+	    oldStorage, &newStorage, Z_WAITOK_ZERO);
 	if (newDict) {
-		OSCONTAINER_ACCUMSIZE(sizeof(dictEntry) * (finalCapacity - capacity));
+		finalCapacity = fitCapacity(finalCapacity, newStorage);
+		newStorage = storageCount(finalCapacity);
+		OSCONTAINER_ACCUMSIZE(sizeof(dictEntry) * (newStorage - oldStorage));
 		dictionary = newDict;
 		capacity = finalCapacity;
+
+		if (hashSlotCount(capacity)) {
+			// the old index was copied over entries, clear it
+			bzero(&dictionary[count], (newStorage - count) * sizeof(dictEntry));
+			hashRebuild();
+		}
 	}
 
 	return capacity;
@@ -352,6 +471,10 @@ OSDictionary::flushCollection()
 		dictionary[i].value.reset();
 	}
 	count = 0;
+
+	if (hashSlotCount(capacity)) {
+		hashRebuild();
+	}
 }
 
 bool
@@ -367,7 +490,13 @@ setObject(const OSSymbol *aKey, const OSMetaClassBase *anObject, bool onlyAdd)
 
 	// if the key exists, replace the object
 
-	if (fOptions & kSort) {
+	if (hashSlotCount(capacity)) {
+		i = hashFind(aKey);
+		exists = (i < count);
+		if (!exists && (fOptions & kSort)) {
+			i = OSSymbol::bsearch(aKey, &dictionary[0], count, sizeof(dictionary[0]));
+		}
+	} else if (fOptions & kSort) {
 		i = OSSymbol::bsearch(aKey, &dictionary[0], count, sizeof(dictionary[0]));
 		exists = (i < count) && (aKey == dictionary[i].key);
 	} else {
@@ -405,6 +534,14 @@ setObject(const OSSymbol *aKey, const OSMetaClassBase *anObject, bool onlyAdd)
 	dictionary[i].value.reset(anObject, OSRetain);
 	count++;
 
+	if (hashSlotCount(capacity)) {
+		if (i == count - 1) {
+			hashInsert(i);
+		} else {
+			hashRebuild();
+		}
+	}
+
 	return true;
 }
 
@@ -445,7 +582,10 @@ OSDictionary::removeObject(const OSSymbol *aKey)
 
 	// if the key exists, remove the object
 
-	if (fOptions & kSort) {
+	if (hashSlotCount(capacity)) {
+		i = hashFind(aKey);
+		exists = (i < count);
+	} else if (fOptions & kSort) {
 		i = OSSymbol::bsearch(aKey, &dictionary[0], count, sizeof(dictionary[0]));
 		exists = (i < count) && (aKey == dictionary[i].key);
 	} else {
@@ -463,6 +603,9 @@ OSDictionary::removeObject(const OSSymbol *aKey)
 
 		count--;
 		bcopy(&dictionary[i + 1], &dictionary[i], (count - i) * sizeof(dictionary[0]));
+		if (hashSlotCount(capacity)) {
+			hashRebuild();
+		}
 
 		oldEntry.key->taggedRelease(OSTypeID(OSCollection));
 		oldEntry.value->taggedRelease(OSTypeID(OSCollection));
@@ -515,7 +658,12 @@ OSDictionary::getObject(const OSSymbol *aKey) const
 	// of OSSymbol::bsearch
 	//
 	// If we have less than 4 objects, scanning is faster.
-	if (count > 4 && (fOptions & kSort)) {
+	if (hashSlotCount(capacity)) {
+		i = hashFind(aKey);
+		if (i < count) {
+			return const_cast<OSObject *> ((const OSObject *)dictionary[i].value.get());
+		}
+	} else if (count > 4 && (fOptions & kSort)) {
 		while (l < r) {
 			i = (l + r) / 2;
 			if (aKey == dictionary[i].key) {
@@ -875,3 +1023,149 @@ OSDictionary::iterateObjects(bool (^block)(const OSSymbol * key, OSObject * obje
 {
 	return iterateObjects((void *)block, &OSDictionaryIterateObjectsBlock);
 }
+
+#if DEBUG || DEVELOPMENT
+extern "C" {
+#include <kern/clock.h>
+}
+
+static OSSharedPtr<OSArray>
+OSDictionaryTestKeys(unsigned int n)
+{
+	OSSharedPtr<OSArray> keys = OSArray::withCapacity(n);
+	char buf[32];
+
+	for (unsigned int i = 0; keys && i < n; i++) {
+		snprintf(buf, sizeof(buf), "osdict.test.%u", i);
+		OSSharedPtr<const OSSymbol> sym = OSSymbol::withCString(buf);
+		if (!sym || !keys->setObject(sym.get())) {
+			return nullptr;
+		}
+	}
+	return keys;
+}
+
+#define KEY(i)  ((const OSSymbol *)keys->getObject((i) % n))
+#define OSDICT_CHECK(e) do { \
+	if (!(e)) { \
+	        printf("%s:%d: check failed: %s\n", __func__, __LINE__, #e); \
+	        return EINVAL; \
+	} \
+} while (0)
+
+static int
+iokit_dictionary_test(int64_t in, int64_t *out)
+{
+	OSSharedPtr<OSArray> keys;
+	OSSharedPtr<OSDictionary> dict, copy;
+	OSSharedPtr<OSCollectionIterator> iter;
+	const OSSymbol *sym;
+	unsigned int i, n = (unsigned int)in;
+
+	if (in <= 0 || in > 100000) {
+		return EINVAL;
+	}
+
+	keys = OSDictionaryTestKeys(n);
+	if (!keys) {
+		return ENOMEM;
+	}
+
+	// grow from a small capacity to cross the hashing threshold
+	dict = OSDictionary::withCapacity(1);
+	OSDICT_CHECK(dict);
+	for (i = 0; i < n; i++) {
+		iter = OSCollectionIterator::withCollection(dict.get());
+		OSDICT_CHECK(dict->setObject(KEY(i), KEY(i + 1)));
+		OSDICT_CHECK(!iter->isValid());
+	}
+	OSDICT_CHECK(dict->getCount() == n);
+
+	// insertion order is preserved
+	iter = OSCollectionIterator::withCollection(dict.get());
+	OSDICT_CHECK(iter);
+	for (i = 0; (sym = (const OSSymbol *)iter->getNextObject()); i++) {
+		OSDICT_CHECK(sym == KEY(i));
+	}
+	OSDICT_CHECK(i == n);
+	OSDICT_CHECK(iter->isValid());
+	iter.reset();
+
+	for (i = 0; i < n; i++) {
+		OSDICT_CHECK(dict->getObject(KEY(i)) == KEY(i + 1));
+	}
+
+	// replacing doesn't add, onlyAdd doesn't replace
+	OSDICT_CHECK(dict->setObject(KEY(0), KEY(0)));
+	OSDICT_CHECK(dict->getCount() == n);
+	OSDICT_CHECK(dict->getObject(KEY(0)) == KEY(0));
+	OSDICT_CHECK(!dict->setObject(KEY(0), KEY(1), true));
+
+	// remove every other key
+	for (i = 0; i < n; i += 2) {
+		dict->removeObject(KEY(i));
+	}
+	for (i = 0; i < n; i++) {
+		OSDICT_CHECK((dict->getObject(KEY(i)) != NULL) == (i % 2 == 1));
+	}
+
+	// copies and sorted dictionaries keep working
+	copy = OSDictionary::withDictionary(dict.get());
+	OSDICT_CHECK(copy && copy->isEqualTo(dict.get()));
+	dict->setOptions(OSCollection::kSort, OSCollection::kSort);
+	for (i = 0; i < n; i += 2) {
+		OSDICT_CHECK(dict->setObject(KEY(i), KEY(i)));
+	}
+	for (i = 0; i < n; i++) {
+		OSDICT_CHECK(dict->getObject(KEY(i)) != NULL);
+	}
+
+	dict->flushCollection();
+	OSDICT_CHECK(dict->getCount() == 0);
+	OSDICT_CHECK(dict->getObject(KEY(1)) == NULL);
+
+	*out = 1;
+	return 0;
+}
+SYSCTL_TEST_REGISTER(iokit_dictionary, iokit_dictionary_test);
+
+/*
+ * Inserts then looks up `in` keys, and returns how long this took in ns.
+ */
+static int
+iokit_dictionary_bench(int64_t in, int64_t *out)
+{
+	OSSharedPtr<OSArray> keys;
+	OSSharedPtr<OSDictionary> dict;
+	unsigned int n = (unsigned int)in;
+	uint64_t start, ns;
+
+	if (in <= 0 || in > 100000) {
+		return EINVAL;
+	}
+
+	keys = OSDictionaryTestKeys(n);
+	if (!keys) {
+		return ENOMEM;
+	}
+
+	start = mach_absolute_time();
+	dict = OSDictionary::withCapacity(16);
+	for (unsigned int i = 0; i < n; i++) {
+		dict->setObject(KEY(i), KEY(i));
+	}
+	for (unsigned int i = 0; i < n; i++) {
+		if (dict->getObject(KEY(i)) != KEY(i)) {
+			panic("OSDictionary: lookup of key %u failed", i);
+		}
+	}
+	absolutetime_to_nanoseconds(mach_absolute_time() - start, &ns);
+
+	*out = (int64_t)ns;
+	return 0;
+}
+SYSCTL_TEST_REGISTER(iokit_dictionary_bench, iokit_dictionary_bench);
+
+#undef OSDICT_CHECK
+#undef KEY
+#endif /* DEBUG || DEVELOPMENT */
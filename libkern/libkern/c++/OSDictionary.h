@@ -164,6 +164,16 @@ protected:
 	virtual bool initIterator(void * iterator) const APPLE_KEXT_OVERRIDE;
 	virtual bool getNextObjectForIterator(void * iterator, OSObject ** ret) const APPLE_KEXT_OVERRIDE;
 
+#if XNU_KERNEL_PRIVATE
+// Hash index of large dictionaries, stored past the capacity entries.
+	static unsigned int hashSlotCount(unsigned int capacity);
+	static unsigned int storageCount(unsigned int capacity);
+	static unsigned int fitCapacity(unsigned int capacity, unsigned int storage);
+	unsigned int hashFind(const OSSymbol * aKey) const;
+	void hashInsert(unsigned int index);
+	void hashRebuild(void);
+#endif /* XNU_KERNEL_PRIVATE */
+
 public:
 
 /*!
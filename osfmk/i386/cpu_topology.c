@@ -197,6 +197,7 @@ cpu_topology_sort(int ncpus)
 					panic("cpu_topology_start: pset_create");
 				}
 			}
+			aset->pset->pset_die_id = lcpup->die->pdie_num;
 			TOPO_DBG("\tnew set %p(%d) pset %p for cache %p\n",
 			    aset, aset->num, aset->pset, aset->cache);
 		}
@@ -172,6 +172,43 @@ mach_validate_desc_type(mach_msg_guarded_port_descriptor_t, KERNEL_DESC_SIZE);
 extern vm_map_t         ipc_kernel_copy_map;
 extern const vm_size_t  msg_ool_size_small;
 
+/*
+ * Out-of-line memory sent with MACH_MSG_PHYSICAL_COPY and without
+ * deallocation is copied into the ipc_kernel_copy_map at send time,
+ * and then copied again into the receiver at receive time.
+ *
+ * Above ipc_kmsg_ool_remap_threshold bytes, it is instead sent
+ * as a copy-on-write virtual copy of the sender's pages, like
+ * a MACH_MSG_VIRTUAL_COPY. This provides the same snapshot semantics
+ * as a physical copy, for a cost that doesn't grow with the size of
+ * the data (but the sender might take copy-on-write faults later).
+ *
+ * A threshold of 0 disables this policy. It can't change after boot,
+ * because the same decision is made when sizing the kernel copy space
+ * in ipc_kmsg_inflate_ool_descriptor(), and when copying the data in
+ * ipc_kmsg_copyin_ool_descriptor().
+ */
+TUNABLE(uint32_t, ipc_kmsg_ool_remap_threshold,
+    "ipc_ool_remap_threshold", 128 << 10);
+
+/*
+ * Returns whether OOL memory of this size and options is copied
+ * through the ipc_kernel_copy_map when sent.
+ */
+static inline bool
+ipc_kmsg_ool_uses_copy_map(
+	mach_msg_size_t         size,
+	mach_msg_copy_options_t copy,
+	boolean_t               deallocate)
+{
+	if (size <= msg_ool_size_small ||
+	    copy != MACH_MSG_PHYSICAL_COPY || deallocate) {
+		return false;
+	}
+	return ipc_kmsg_ool_remap_threshold == 0 ||
+	       size < ipc_kmsg_ool_remap_threshold;
+}
+
 /* zone for cached ipc_kmsg_t structures */
 ZONE_DEFINE_ID(ZONE_ID_IPC_KMSG, "ipc kmsgs", struct ipc_kmsg,
     ZC_CACHING | ZC_ZFREE_CLEARMEM);
@@ -2290,9 +2327,7 @@ ipc_kmsg_inflate_ool_descriptor(
 		return MACH_SEND_INVALID_TYPE;
 	}
 
-	if (udesc.size > msg_ool_size_small &&
-	    udesc.copy == MACH_MSG_PHYSICAL_COPY &&
-	    !udesc.deallocate) {
+	if (ipc_kmsg_ool_uses_copy_map(udesc.size, udesc.copy, udesc.deallocate)) {
 		vm_size_t size;
 
 		if (round_page_overflow(udesc.size, &size) ||
@@ -2323,8 +2358,7 @@ ipc_kmsg_copyin_ool_descriptor(
 
 	if (length == 0) {
 		/* nothing to do */
-	} else if (length > msg_ool_size_small &&
-	    (dsc->copy == MACH_MSG_PHYSICAL_COPY) && !dsc->deallocate) {
+	} else if (ipc_kmsg_ool_uses_copy_map(dsc->size, dsc->copy, dsc->deallocate)) {
 		mach_vm_size_t    length_aligned = round_page(length);
 		mach_vm_address_t addr = *paddr;
 
@@ -2365,7 +2399,8 @@ ipc_kmsg_copyin_ool_descriptor(
 		 * copy.  Otherwise, it will do a virtual copy.
 		 *
 		 * NOTE: A virtual copy is OK if the original is being
-		 * deallocted, even if a physical copy was requested.
+		 * deallocted, even if a physical copy was requested,
+		 * or if it is larger than ipc_kmsg_ool_remap_threshold.
 		 */
 		switch (vm_map_copyin(map, dsc->u_address, length,
 		    dsc->deallocate, &copy)) {
@@ -3799,10 +3834,97 @@ ipc_kmsg_deflate_port_descriptor(
 	return ipc_kmsg_deflate_put(udesc_end, &udesc);
 }
 
+/*
+ *	Routine:	ipc_kmsg_ool_rcv_region_reserve
+ *	Purpose:
+ *		Reserves space for OOL memory of the given size
+ *		in the receive region the task registered with
+ *		task_set_info(TASK_OOL_RCV_REGION_INFO), if any.
+ *
+ *		The region is used as a ring: when the data doesn't
+ *		fit at the head, it is delivered at the start of
+ *		the region, and the end of the region is skipped.
+ *		Space is only reused once the task acknowledged it
+ *		with TASK_OOL_RCV_REGION_ACK_INFO.
+ *	Returns:
+ *		TRUE if space was reserved at *addrp.
+ *		FALSE if there is no region, or not enough free space.
+ */
+static bool
+ipc_kmsg_ool_rcv_region_reserve(
+	task_t                      task,
+	vm_map_t                    map,
+	vm_map_size_t               size,
+	vm_map_address_t           *addrp)
+{
+	mach_vm_size_t len, pos, skip = 0;
+	bool reserved = false;
+
+	/* unlocked check: registering a region isn't ordered with receives */
+	if (task == TASK_NULL || task->ool_rcv_region_size == 0 ||
+	    task->map != map) {
+		return false;
+	}
+
+	len = vm_map_round_page(size, VM_MAP_PAGE_MASK(map));
+
+	task_lock(task);
+	pos = task->ool_rcv_region_head;
+	if (task->ool_rcv_region_size - pos < len) {
+		skip = task->ool_rcv_region_size - pos;
+		pos = 0;
+	}
+	if (task->ool_rcv_region_used + skip + len <= task->ool_rcv_region_size) {
+		*addrp = task->ool_rcv_region_addr + pos;
+		task->ool_rcv_region_head = (pos + len) % task->ool_rcv_region_size;
+		task->ool_rcv_region_used += skip + len;
+		reserved = true;
+	}
+	task_unlock(task);
+
+	return reserved;
+}
+
+/*
+ *	Routine:	ipc_kmsg_ool_rcv_region_cancel
+ *	Purpose:
+ *		Gives back space reserved with ipc_kmsg_ool_rcv_region_reserve()
+ *		that couldn't be used, if no other space was reserved since.
+ *
+ *		Otherwise, the space stays in use until the task acknowledges
+ *		memory delivered after it.
+ */
+static void
+ipc_kmsg_ool_rcv_region_cancel(
+	task_t                      task,
+	vm_map_t                    map,
+	vm_map_address_t            addr,
+	vm_map_size_t               size)
+{
+	mach_vm_size_t len, pos;
+
+	len = vm_map_round_page(size, VM_MAP_PAGE_MASK(map));
+
+	task_lock(task);
+	if (addr >= task->ool_rcv_region_addr &&
+	    addr - task->ool_rcv_region_addr < task->ool_rcv_region_size &&
+	    task->ool_rcv_region_used >= len) {
+		pos = addr - task->ool_rcv_region_addr;
+		if ((pos + len) % task->ool_rcv_region_size ==
+		    task->ool_rcv_region_head) {
+			task->ool_rcv_region_head = pos;
+			task->ool_rcv_region_used -= len;
+		}
+	}
+	task_unlock(task);
+}
+
 static mach_msg_return_t
 ipc_kmsg_copyout_ool_descriptor(
 	mach_msg_ool_descriptor_t  *dsc,
-	vm_map_t                    map)
+	ipc_space_t                 space,
+	vm_map_t                    map,
+	bool                        use_rcv_region)
 {
 	vm_map_copy_t               copy = dsc->address;
 	vm_map_size_t               size = dsc->size;
@@ -3825,7 +3947,26 @@ ipc_kmsg_copyout_ool_descriptor(
 			misaligned = TRUE;
 		}
 
-		if (misaligned) {
+		if (use_rcv_region && ipc_kmsg_ool_rcv_region_reserve(space->is_task,
+		    map, size, &rcv_addr)) {
+			/*
+			 * Deliver the data in the pre-registered receive
+			 * region: page aligned copies are remapped over
+			 * the existing entries, which avoids creating
+			 * (and later deallocating) a new mapping.
+			 *
+			 * vm_map_copy_overwrite() leaves the copy intact
+			 * when it fails, so fall back to a new mapping.
+			 */
+			kr = vm_map_copy_overwrite(map, rcv_addr, copy, size,
+			    FALSE);
+			if (kr != KERN_SUCCESS) {
+				ipc_kmsg_ool_rcv_region_cancel(space->is_task,
+				    map, rcv_addr, size);
+				rcv_addr = 0;
+				kr = vm_map_copyout_size(map, &rcv_addr, copy, size);
+			}
+		} else if (misaligned) {
 			mach_vm_offset_t rounded_addr;
 			vm_map_size_t   rounded_size;
 			vm_map_offset_t effective_page_mask, effective_page_size;
@@ -4108,7 +4249,8 @@ ipc_kmsg_copyout_descriptors(
 	mach_msg_size_t         dsc_count,
 	ipc_space_t             space,
 	vm_map_t                map,
-	mach_msg_option64_t     option)
+	mach_msg_option64_t     option,
+	bool                    use_rcv_region)
 {
 	mach_msg_return_t mr = MACH_MSG_SUCCESS;
 
@@ -4123,7 +4265,7 @@ ipc_kmsg_copyout_descriptors(
 		case MACH_MSG_OOL_VOLATILE_DESCRIPTOR:
 		case MACH_MSG_OOL_DESCRIPTOR:
 			mr |= ipc_kmsg_copyout_ool_descriptor(&kdesc->kdesc_memory,
-			    map);
+			    space, map, use_rcv_region);
 			break;
 		case MACH_MSG_OOL_PORTS_DESCRIPTOR:
 			mr |= ipc_kmsg_copyout_ool_ports_descriptor(kdesc,
@@ -4263,9 +4405,15 @@ ipc_kmsg_copyout(
 	mach_msg_header_t *hdr = ikm_header(kmsg);
 	mach_msg_size_t    dsc_count;
 	mach_msg_return_t  mr;
+	bool               use_rcv_region;
 
 	dsc_count = ipc_kmsg_validate_signature(kmsg);
 
+	/* unlocked check: the attribute isn't ordered with receives */
+	use_rcv_region = dsc_count &&
+	    IP_VALID(hdr->msgh_remote_port) &&
+	    hdr->msgh_remote_port->ip_ool_rcv_region;
+
 	mr = ipc_kmsg_copyout_header(kmsg, hdr, space, option);
 	if (mr != MACH_MSG_SUCCESS) {
 		return mr;
@@ -4275,7 +4423,7 @@ ipc_kmsg_copyout(
 		mach_msg_kbase_t *kbase = mach_msg_header_to_kbase(hdr);
 
 		mr = ipc_kmsg_copyout_descriptors(kbase->msgb_dsc_array,
-		    dsc_count, space, map, option);
+		    dsc_count, space, map, option, use_rcv_region);
 	}
 
 	return mr;
@@ -4383,7 +4531,7 @@ ipc_kmsg_copyout_pseudo(
 
 		/* rdar://120614480 this MACH64_MSG_OPTION_NONE is wrong */
 		mr |= ipc_kmsg_copyout_descriptors(kbase->msgb_dsc_array,
-		    dsc_count, space, map, MACH64_MSG_OPTION_NONE);
+		    dsc_count, space, map, MACH64_MSG_OPTION_NONE, false);
 	}
 
 	current_thread()->ith_knote = ITH_KNOTE_NULL;
@@ -5636,9 +5784,8 @@ ipc_kmsg_trace_send(ipc_kmsg_t kmsg, mach_msg_option64_t option)
 
 				msg_flags |= KMSG_TRACE_FLAG_OOLMEM;
 				msg_size += dsc->size;
-				if (dsc->size > msg_ool_size_small &&
-				    (dsc->copy == MACH_MSG_PHYSICAL_COPY) &&
-				    !dsc->deallocate) {
+				if (ipc_kmsg_ool_uses_copy_map(dsc->size,
+				    dsc->copy, dsc->deallocate)) {
 					msg_flags |= KMSG_TRACE_FLAG_PCPY;
 				} else if (dsc->size <= msg_ool_size_small) {
 					msg_flags |= KMSG_TRACE_FLAG_PCPY;
@@ -139,11 +139,12 @@ struct ipc_port {
 		    , ip_has_watchport:1          /* port has an exec watchport */
 		    , ip_kernel_iotier_override:2 /* kernel iotier override */
 		    , ip_kernel_qos_override:3    /* kernel qos override */
+		    , ip_ool_rcv_region:1         /* OOL memory is received in the task receive region */
 		    /* development bits only */
 		    , ip_srp_lost_link:1          /* special reply port turnstile link chain broken */
 		    , ip_srp_msg_sent:1           /* special reply port msg sent */
 		    , ip_bootstrap:1              /* whether it is a bootstrap port */
-		    , __ip_unused:6               /* reserve of bits */
+		    , __ip_unused:5               /* reserve of bits */
 		    );
 		struct waitq            ip_waitq;
 	};
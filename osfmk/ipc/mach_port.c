@@ -1913,6 +1913,27 @@ mach_port_get_attributes(
 		return kr;
 	}
 
+	case MACH_PORT_OOL_RCV_REGION: {
+		if (*count < MACH_PORT_OOL_RCV_REGION_COUNT) {
+			return KERN_FAILURE;
+		}
+
+		if (!MACH_PORT_VALID(name)) {
+			return KERN_INVALID_RIGHT;
+		}
+
+		kr = ipc_port_translate_receive(space, name, &port);
+		if (kr != KERN_SUCCESS) {
+			return kr;
+		}
+		/* port is locked and active */
+
+		*(int *)info = port->ip_ool_rcv_region;
+		*count = MACH_PORT_OOL_RCV_REGION_COUNT;
+		ip_mq_unlock(port);
+		break;
+	}
+
 	default:
 		return KERN_INVALID_ARGUMENT;
 		/*NOTREACHED*/
@@ -2116,6 +2137,35 @@ mach_port_set_attributes(
 		return kr;
 	}
 
+	case MACH_PORT_OOL_RCV_REGION: {
+		if (count < MACH_PORT_OOL_RCV_REGION_COUNT) {
+			return KERN_FAILURE;
+		}
+
+		if (!MACH_PORT_VALID(name)) {
+			return KERN_INVALID_RIGHT;
+		}
+
+		kr = ipc_port_translate_receive(space, name, &port);
+		if (kr != KERN_SUCCESS) {
+			return kr;
+		}
+		/* port is locked and active */
+
+		/*
+		 * Kernel objects and special reply ports receive replies
+		 * whose memory the receiver is expected to deallocate.
+		 */
+		if (ip_is_kobject(port) || ip_is_special_reply_port(port)) {
+			ip_mq_unlock(port);
+			return KERN_INVALID_ARGUMENT;
+		}
+
+		port->ip_ool_rcv_region = (*info != 0);
+		ip_mq_unlock(port);
+		break;
+	}
+
 	default:
 		return KERN_INVALID_ARGUMENT;
 		/*NOTREACHED*/
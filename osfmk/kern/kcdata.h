@@ -570,6 +570,7 @@ struct kcdata_type_definition {
 #define STACKSHOT_KCTYPE_TASK_EXEC_META              0x957u /* struct task_exec_meta */
 #define STACKSHOT_KCTYPE_TASK_MEMORYSTATUS           0x958u /* struct task_memorystatus_snapshot */
 #define STACKSHOT_KCTYPE_LATENCY_INFO_BUFFER         0x95au /* struct stackshot_latency_buffer */
+#define STACKSHOT_KCTYPE_THREAD_GROUP_LATENCY        0x95bu /* struct thread_group_latency_snapshot */
 
 
 struct stack_snapshot_frame32 {
@@ -890,6 +891,22 @@ struct thread_group_snapshot_v3 {
 	char tgs_name_cont[16];
 } __attribute__((packed));
 
+/*
+ * Scheduling latency of the threads of a thread group at one QoS (scheduler
+ * bucket), only reported for the buckets the group has run threads in.
+ * Histogram buckets are log-linear in microseconds: bucket 0 is 0us, 1 is
+ * 1us, then bucket 2n counts [2^n, 2^n + 2^(n-1)) and bucket 2n+1 counts
+ * [2^n + 2^(n-1), 2^(n+1)). The last bucket also counts all longer waits.
+ */
+#define THREAD_GROUP_LATENCY_BUCKETS 32
+
+struct thread_group_latency_snapshot {
+	uint64_t tgls_id;
+	uint32_t tgls_sched_bucket;
+	uint64_t tgls_runnable[THREAD_GROUP_LATENCY_BUCKETS];  /* made runnable until on core */
+	uint64_t tgls_preempted[THREAD_GROUP_LATENCY_BUCKETS]; /* preempted until back on core */
+} __attribute__((packed));
+
 enum coalition_flags {
 	kCoalitionTermRequested = 0x1,
 	kCoalitionTerminated    = 0x2,
@@ -68,6 +68,7 @@
 #include <kern/counter.h>
 #include <kern/thread.h>
 #include <kern/thread_group.h>
+#include <kern/sched_prim.h>
 #include <kern/task.h>
 #include <kern/telemetry.h>
 #include <kern/clock.h>
@@ -196,6 +197,15 @@ struct _stackshot_validation_state {
 	size_t last_valid_size;
 };
 
+#if CONFIG_THREAD_GROUPS
+/* Thread group latency histograms being counted, then filled in */
+struct stackshot_tg_latency_ctx {
+	struct thread_group_latency_snapshot *snapshots;
+	uint32_t count;
+	uint32_t max;
+};
+#endif /* CONFIG_THREAD_GROUPS */
+
 /* CPU-local generation counts for PLH */
 struct _stackshot_plh_gen_state {
 	uint8_t                *pgs_gen;       /* last 'gen #' seen in */
@@ -460,6 +470,8 @@ static void             stackshot_coalition_jetsam_snapshot(void *arg, int i, co
 #if CONFIG_THREAD_GROUPS
 static void             stackshot_thread_group_count(void *arg, int i, struct thread_group *tg);
 static void             stackshot_thread_group_snapshot(void *arg, int i, struct thread_group *tg);
+static void             stackshot_thread_group_latency_count(void *arg, int i, struct thread_group *tg);
+static void             stackshot_thread_group_latency_snapshot(void *arg, int i, struct thread_group *tg);
 #endif /* CONFIG_THREAD_GROUPS */
 
 extern uint64_t         workqueue_get_task_ss_flags_from_pwq_state_kdp(void *proc);
@@ -5365,6 +5377,33 @@ kdp_stackshot_kcdata_format(void)
 		kcd_exit_on_error(kcdata_compression_window_close(stackshot_kcdata_p));
 	}
 
+	/* Scheduling latency of the thread groups, for the QoS they have run at */
+	if (stackshot_flags & STACKSHOT_THREAD_GROUP) {
+		struct stackshot_tg_latency_ctx tg_latency = { };
+
+		kcdata_compression_window_open(stackshot_kcdata_p);
+
+		if (thread_group_iterate_stackshot(stackshot_thread_group_latency_count, &tg_latency) != KERN_SUCCESS) {
+			error = KERN_FAILURE;
+			goto error_exit;
+		}
+
+		if (tg_latency.count > 0) {
+			kcd_exit_on_error(kcdata_get_memory_addr_for_array(stackshot_kcdata_p, STACKSHOT_KCTYPE_THREAD_GROUP_LATENCY,
+			    sizeof(struct thread_group_latency_snapshot), tg_latency.count, &out_addr));
+			tg_latency.snapshots = (struct thread_group_latency_snapshot *)out_addr;
+			tg_latency.max = tg_latency.count;
+			tg_latency.count = 0;
+
+			if (thread_group_iterate_stackshot(stackshot_thread_group_latency_snapshot, &tg_latency) != KERN_SUCCESS) {
+				error = KERN_FAILURE;
+				goto error_exit;
+			}
+		}
+
+		kcd_exit_on_error(kcdata_compression_window_close(stackshot_kcdata_p));
+	}
+
 #if SCHED_HYGIENE_DEBUG && CONFIG_PERVASIVE_CPI
 	if (!stackshot_ctx.sc_panic_stackshot && (thread_group_begin_cpu_cycle_count != 0)) {
 		kcd_exit_on_error(kcdata_add_uint64_with_description(stackshot_kcdata_p, (mt_cur_cpu_cycles() - thread_group_begin_cpu_cycle_count),
@@ -6214,6 +6253,44 @@ stackshot_thread_group_snapshot(void *arg, int i, struct thread_group *tg)
 	    ((flags & THREAD_GROUP_FLAGS_STRICT_TIMERS) ? kThreadGroupStrictTimers  : 0) |
 	    0;
 }
+
+static void
+stackshot_thread_group_latency_count(void *arg, int i, struct thread_group *tg)
+{
+#pragma unused(i)
+	struct stackshot_tg_latency_ctx *ctx = arg;
+	uint64_t runnable[THREAD_GROUP_LATENCY_BUCKETS];
+	uint64_t preempted[THREAD_GROUP_LATENCY_BUCKETS];
+
+	for (uint32_t b = 0; b < TH_BUCKET_SCHED_MAX; b++) {
+		if (thread_group_get_sched_latency(tg, b, runnable, preempted)) {
+			ctx->count++;
+		}
+	}
+}
+
+static void
+stackshot_thread_group_latency_snapshot(void *arg, int i, struct thread_group *tg)
+{
+#pragma unused(i)
+	struct stackshot_tg_latency_ctx *ctx = arg;
+	uint64_t runnable[THREAD_GROUP_LATENCY_BUCKETS];
+	uint64_t preempted[THREAD_GROUP_LATENCY_BUCKETS];
+
+	static_assert(SCHED_LATENCY_BUCKETS == THREAD_GROUP_LATENCY_BUCKETS);
+	for (uint32_t b = 0; b < TH_BUCKET_SCHED_MAX && ctx->count < ctx->max; b++) {
+		struct thread_group_latency_snapshot *tgls;
+
+		if (!thread_group_get_sched_latency(tg, b, runnable, preempted)) {
+			continue;
+		}
+		tgls = &ctx->snapshots[ctx->count++];
+		tgls->tgls_id = thread_group_get_id(tg);
+		tgls->tgls_sched_bucket = b;
+		kdp_memcpy(tgls->tgls_runnable, runnable, sizeof(tgls->tgls_runnable));
+		kdp_memcpy(tgls->tgls_preempted, preempted, sizeof(tgls->tgls_preempted));
+	}
+}
 #endif /* CONFIG_THREAD_GROUPS */
 
 /* Determine if a thread has waitinfo that stackshot can provide */
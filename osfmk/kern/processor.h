@@ -283,6 +283,7 @@ struct processor_set {
 	processor_set_t         pset_list;              /* chain of associated psets */
 	pset_node_t             node;
 	uint32_t                pset_cluster_id;
+	uint32_t                pset_die_id;            /* die of the pset's processors, for steal distance */
 
 	/*
 	 * Currently the scheduler uses a mix of pset_cluster_type_t & cluster_type_t
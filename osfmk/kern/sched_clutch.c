@@ -3292,6 +3292,19 @@ sched_clutch_pset_init(processor_set_t pset)
 	sched_clutch_root_init(&pset->pset_clutch_root, pset);
 }
 
+/*
+ * Clutch work stealing tunables; see sched_clutch_steal_thread().
+ * The thresholds are expressed in runnable threads.
+ */
+#define SCHED_CLUTCH_STEAL_THRESHOLD_DEFAULT            (1)
+#define SCHED_CLUTCH_STEAL_REMOTE_THRESHOLD_DEFAULT     (2)
+#define SCHED_CLUTCH_STEAL_WARM_US_DEFAULT              (1000)
+
+static uint32_t sched_clutch_steal_threshold = SCHED_CLUTCH_STEAL_THRESHOLD_DEFAULT;
+static uint32_t sched_clutch_steal_remote_threshold = SCHED_CLUTCH_STEAL_REMOTE_THRESHOLD_DEFAULT;
+static uint32_t sched_clutch_steal_warm_us = SCHED_CLUTCH_STEAL_WARM_US_DEFAULT;
+static uint64_t sched_clutch_steal_warm = 0;
+
 static void
 sched_clutch_tunables_init(void)
 {
@@ -3302,6 +3315,7 @@ sched_clutch_tunables_init(void)
 	    NSEC_PER_USEC, &sched_clutch_bucket_group_adjust_threshold);
 	assert(sched_clutch_bucket_group_adjust_threshold <= CLUTCH_CPU_DATA_MAX);
 	sched_clutch_us_to_abstime(sched_clutch_bucket_group_pending_delta_us, sched_clutch_bucket_group_pending_delta);
+	clock_interval_to_absolutetime_interval(sched_clutch_steal_warm_us, NSEC_PER_USEC, &sched_clutch_steal_warm);
 }
 
 static void
@@ -3310,6 +3324,15 @@ sched_clutch_init(void)
 	if (!PE_parse_boot_argn("sched_clutch_bucket_group_interactive_pri", &sched_clutch_bucket_group_interactive_pri, sizeof(sched_clutch_bucket_group_interactive_pri))) {
 		sched_clutch_bucket_group_interactive_pri = SCHED_CLUTCH_BUCKET_GROUP_INTERACTIVE_PRI_DEFAULT;
 	}
+	if (!PE_parse_boot_argn("sched_clutch_steal_threshold", &sched_clutch_steal_threshold, sizeof(sched_clutch_steal_threshold))) {
+		sched_clutch_steal_threshold = SCHED_CLUTCH_STEAL_THRESHOLD_DEFAULT;
+	}
+	if (!PE_parse_boot_argn("sched_clutch_steal_remote_threshold", &sched_clutch_steal_remote_threshold, sizeof(sched_clutch_steal_remote_threshold))) {
+		sched_clutch_steal_remote_threshold = SCHED_CLUTCH_STEAL_REMOTE_THRESHOLD_DEFAULT;
+	}
+	if (!PE_parse_boot_argn("sched_clutch_steal_warm_us", &sched_clutch_steal_warm_us, sizeof(sched_clutch_steal_warm_us))) {
+		sched_clutch_steal_warm_us = SCHED_CLUTCH_STEAL_WARM_US_DEFAULT;
+	}
 	sched_timeshare_init();
 	sched_clutch_tunables_init();
 }
@@ -3552,11 +3575,184 @@ sched_clutch_processor_queue_remove(
 	return processor != PROCESSOR_NULL;
 }
 
+/*
+ * Clutch Work Stealing
+ *
+ * Each pset has its own clutch hierarchy, so a processor going idle only
+ * finds the threads enqueued on its own pset. On platforms with several
+ * psets in a node (one pset per LLC on x86), the idle processor steals a
+ * timeshare thread from another pset of the node when that pset has more
+ * runnable threads than it can run soon.
+ *
+ * Moving a thread away from its pset is charged a cost, counted in
+ * runnable threads, and a thread is only stolen when the excess of the
+ * candidate pset (its runnable threads beyond its idle processors) covers
+ * that cost:
+ * - a base threshold, higher when the candidate pset is on another die
+ *   (sched_clutch_steal_threshold / sched_clutch_steal_remote_threshold);
+ * - one more when the thread ran less than sched_clutch_steal_warm_us ago,
+ *   since its cache footprint is still warm on the candidate pset;
+ * - one more when its thread group is running on the candidate pset but
+ *   not on the stealing pset, to avoid splitting the thread group.
+ *
+ * Candidates are tried in order of decreasing excess over their base
+ * threshold, psets on the same die first.
+ */
+
+static uint32_t
+sched_clutch_steal_excess(processor_set_t candidate_pset)
+{
+	uint32_t runnable = sched_clutch_root_count(&candidate_pset->pset_clutch_root);
+	uint32_t idle = bit_count(candidate_pset->cpu_state_map[PROCESSOR_IDLE] & pset_available_cpumap(candidate_pset));
+	return (runnable > idle) ? (runnable - idle) : 0;
+}
+
+static uint32_t
+sched_clutch_steal_base_threshold(processor_set_t pset, processor_set_t candidate_pset)
+{
+	return (candidate_pset->pset_die_id == pset->pset_die_id) ? sched_clutch_steal_threshold : sched_clutch_steal_remote_threshold;
+}
+
+/*
+ * sched_clutch_pset_running_thread_group()
+ *
+ * Returns whether a processor of the pset is running a thread of the thread
+ * group. Called without the pset lock, so the answer is only a hint.
+ */
+static bool
+sched_clutch_pset_running_thread_group(processor_set_t pset, struct thread_group *tg)
+{
+	cpumap_t cpu_map = pset->cpu_bitmask;
+	for (int cpuid = lsb_first(cpu_map); cpuid >= 0; cpuid = lsb_next(cpu_map, cpuid)) {
+		if (processor_array[cpuid]->current_thread_group == tg) {
+			return true;
+		}
+	}
+	return false;
+}
+
+/*
+ * sched_clutch_steal_cost()
+ *
+ * Returns the excess the candidate pset needs for the thread to be
+ * stolen from it by the stealing pset.
+ *
+ * Always called with the pset lock for candidate_pset held.
+ */
+static uint32_t
+sched_clutch_steal_cost(processor_set_t pset, processor_set_t candidate_pset, thread_t thread, uint64_t current_timestamp)
+{
+	uint32_t cost = sched_clutch_steal_base_threshold(pset, candidate_pset);
+
+	if (thread->last_run_time != 0 && current_timestamp < thread->last_run_time + sched_clutch_steal_warm) {
+		cost++;
+	}
+	if (sched_clutch_pset_running_thread_group(candidate_pset, thread->thread_group) &&
+	    !sched_clutch_pset_running_thread_group(pset, thread->thread_group)) {
+		cost++;
+	}
+	return cost;
+}
+
+/*
+ * sched_clutch_steal_lookup()
+ *
+ * Finds the highest thread in the highest runnable timeshare root bucket of
+ * the hierarchy, without removing it. Fixed priority threads are left to
+ * their pset.
+ *
+ * Always called with the pset lock for the hierarchy held.
+ */
+static thread_t
+sched_clutch_steal_lookup(sched_clutch_root_t root_clutch, sched_bucket_t *bucket_for_steal)
+{
+	int bucket = sched_clutch_root_highest_runnable_qos(root_clutch, SCHED_CLUTCH_HIGHEST_ROOT_BUCKET_UNBOUND_ONLY);
+	if (bucket == TH_BUCKET_FIXPRI) {
+		bucket = bitmap_lsb_next(root_clutch->scr_unbound_runnable_bitmap, TH_BUCKET_SCHED_MAX, TH_BUCKET_FIXPRI);
+	}
+	if (bucket == -1) {
+		return THREAD_NULL;
+	}
+	*bucket_for_steal = (sched_bucket_t)bucket;
+	return sched_clutch_thread_unbound_lookup(root_clutch, &root_clutch->scr_unbound_buckets[bucket], NULL, NULL);
+}
+
+/*
+ * sched_clutch_steal_thread()
+ *
+ * Called with the pset lock of the idle processor held, and returns with
+ * it dropped; the candidate psets are locked one at a time.
+ */
 static thread_t
-sched_clutch_steal_thread(__unused processor_set_t pset)
+sched_clutch_steal_thread(processor_set_t pset)
 {
-	/* Thread stealing is not enabled for single cluster clutch scheduler platforms */
-	return THREAD_NULL;
+	pset_map_t candidate_map = pset->node->pset_map;
+	uint32_t candidate_slack[MAX_PSETS];
+	thread_t stolen_thread = THREAD_NULL;
+
+	bit_clear(candidate_map, pset->pset_id);
+	pset_unlock(pset);
+
+	/* Cheap unlocked pass to keep the psets whose excess covers their base threshold */
+	for (int pset_id = lsb_first(candidate_map); pset_id >= 0; pset_id = lsb_next(candidate_map, pset_id)) {
+		processor_set_t candidate_pset = pset_array[pset_id];
+		if (candidate_pset == PROCESSOR_SET_NULL) {
+			bit_clear(candidate_map, pset_id);
+			continue;
+		}
+		uint32_t threshold = sched_clutch_steal_base_threshold(pset, candidate_pset);
+		uint32_t excess = sched_clutch_steal_excess(candidate_pset);
+		if (excess == 0 || excess < threshold) {
+			bit_clear(candidate_map, pset_id);
+			continue;
+		}
+		candidate_slack[pset_id] = excess - threshold;
+	}
+
+	while (candidate_map != 0) {
+		int steal_pset_id = -1;
+		bool steal_pset_local = false;
+		for (int pset_id = lsb_first(candidate_map); pset_id >= 0; pset_id = lsb_next(candidate_map, pset_id)) {
+			bool local = (pset_array[pset_id]->pset_die_id == pset->pset_die_id);
+			if (steal_pset_id == -1 || candidate_slack[pset_id] > candidate_slack[steal_pset_id] ||
+			    (candidate_slack[pset_id] == candidate_slack[steal_pset_id] && local && !steal_pset_local)) {
+				steal_pset_id = pset_id;
+				steal_pset_local = local;
+			}
+		}
+		bit_clear(candidate_map, steal_pset_id);
+
+		processor_set_t steal_from_pset = pset_array[steal_pset_id];
+		sched_clutch_root_t clutch_root_for_steal = &steal_from_pset->pset_clutch_root;
+		pset_lock(steal_from_pset);
+
+		uint64_t current_timestamp = mach_absolute_time();
+		sched_bucket_t bucket_for_steal;
+		thread_t thread = sched_clutch_steal_lookup(clutch_root_for_steal, &bucket_for_steal);
+		if (thread != THREAD_NULL) {
+			uint32_t cost = sched_clutch_steal_cost(pset, steal_from_pset, thread, current_timestamp);
+			if (sched_clutch_steal_excess(steal_from_pset) >= cost) {
+				sched_clutch_thread_remove(clutch_root_for_steal, thread, current_timestamp, SCHED_CLUTCH_BUCKET_OPTIONS_SAMEPRI_RR);
+
+				sched_clutch_dbg_thread_select_packed_t debug_info = {0};
+				debug_info.trace_data.version = SCHED_CLUTCH_DBG_THREAD_SELECT_PACKED_VERSION;
+				debug_info.trace_data.traverse_mode = SCHED_CLUTCH_TRAVERSE_REMOVE_HIERARCHY_ONLY;
+				debug_info.trace_data.cluster_id = steal_from_pset->pset_cluster_id;
+				debug_info.trace_data.selection_was_cluster_bound = false;
+				KERNEL_DEBUG_CONSTANT_IST(KDEBUG_TRACE, MACHDBG_CODE(DBG_MACH_SCHED_CLUTCH, MACH_SCHED_CLUTCH_THREAD_SELECT) | DBG_FUNC_NONE,
+				    thread_tid(thread), thread_group_get_id(thread->thread_group), bucket_for_steal, debug_info.scdts_trace_data_packed, 0);
+				KDBG(MACHDBG_CODE(DBG_MACH_SCHED_CLUTCH, MACH_SCHED_EDGE_STEAL) | DBG_FUNC_NONE, thread_tid(thread), pset->pset_cluster_id, steal_from_pset->pset_cluster_id, cost);
+
+				sched_update_pset_load_average(steal_from_pset, current_timestamp);
+				stolen_thread = thread;
+			}
+		}
+		pset_unlock(steal_from_pset);
+		if (stolen_thread != THREAD_NULL) {
+			break;
+		}
+	}
+	return stolen_thread;
 }
 
 #if !SCHED_TEST_HARNESS
@@ -138,6 +138,11 @@
 struct sched_statistics PERCPU_DATA(sched_stats);
 bool sched_stats_active;
 
+struct sched_latency_hist PERCPU_DATA(sched_latency_hist);
+static uint32_t sched_latency_abs_per_us = 1;
+
+static void sched_latency_record(processor_t processor, thread_t thread, uint64_t latency);
+
 TUNABLE(bool, cpulimit_affects_quantum, "cpulimit_affects_quantum", true);
 
 TUNABLE(uint32_t, nonurgent_preemption_timer_us, "nonurgent_preemption_timer", 50); /* microseconds */
@@ -482,6 +487,9 @@ sched_timebase_init(void)
 	clock_interval_to_absolutetime_interval(1, NSEC_PER_SEC, &abstime);
 	sched_one_second_interval = abstime;
 
+	clock_interval_to_absolutetime_interval(1, NSEC_PER_USEC, &abstime);
+	sched_latency_abs_per_us = (uint32_t)MAX(abstime, 1);
+
 	SCHED(timebase_init)();
 	sched_realtime_timebase_init();
 }
@@ -3662,6 +3670,7 @@ thread_dispatch(
 
 		latency = processor->last_dispatch - self->last_made_runnable_time;
 		assert(latency >= self->same_pri_latency);
+		sched_latency_record(processor, self, latency);
 
 		urgency = thread_get_urgency(self, &arg1, &arg2);
 
@@ -7071,6 +7080,79 @@ sched_stats_handle_runq_change(struct runq_stats *stats, int old_count)
 	stats->last_change_timestamp = timestamp;
 }
 
+/*
+ * Scheduling latency histograms
+ */
+uint32_t
+sched_latency_bucket(uint64_t latency)
+{
+	uint64_t us = latency / sched_latency_abs_per_us;
+	uint32_t msb;
+
+	if (us < 2) {
+		return (uint32_t)us;
+	}
+	msb = 63 - __builtin_clzll(us);
+	return MIN(2 * msb + (uint32_t)((us >> (msb - 1)) & 1), SCHED_LATENCY_BUCKETS - 1);
+}
+
+/*
+ * Called from thread_dispatch() with the thread locked and interrupts
+ * disabled: a thread whose last trip off core was a preemption counts
+ * towards the preemption delay, any other towards the wakeup latency.
+ */
+static void
+sched_latency_record(processor_t processor, thread_t thread, uint64_t latency)
+{
+	sched_latency_kind_t kind = SCHED_LATENCY_RUNNABLE;
+	sched_bucket_t bucket = thread->th_sched_bucket;
+	uint32_t index;
+
+	if (__improbable(bucket >= TH_BUCKET_SCHED_MAX)) {
+		return;
+	}
+	if (thread->reason & AST_PREEMPT) {
+		kind = SCHED_LATENCY_PREEMPTED;
+	}
+	index = sched_latency_bucket(latency);
+
+	PERCPU_GET_RELATIVE(sched_latency_hist, processor, processor)->slh_count[kind][bucket][index]++;
+#if CONFIG_THREAD_GROUPS
+	thread_group_record_sched_latency(thread_group_get(thread), kind, bucket, index);
+#endif /* CONFIG_THREAD_GROUPS */
+}
+
+void
+sched_latency_hist_snapshot(struct sched_latency_hist *out)
+{
+	bzero(out, sizeof(*out));
+	percpu_foreach(hist, sched_latency_hist) {
+		for (uint32_t k = 0; k < SCHED_LATENCY_KINDS; k++) {
+			for (uint32_t b = 0; b < TH_BUCKET_SCHED_MAX; b++) {
+				for (uint32_t i = 0; i < SCHED_LATENCY_BUCKETS; i++) {
+					out->slh_count[k][b][i] += os_atomic_load(&hist->slh_count[k][b][i], relaxed);
+				}
+			}
+		}
+	}
+}
+
+/*
+ * For sysctl: fills in up to size bytes of the system-wide histograms and
+ * returns their full size.
+ */
+size_t
+sysctl_sched_latency_hist(uint64_t *hist, size_t size)
+{
+	struct sched_latency_hist snapshot;
+
+	if (hist != NULL) {
+		sched_latency_hist_snapshot(&snapshot);
+		memcpy(hist, &snapshot, MIN(size, sizeof(snapshot)));
+	}
+	return sizeof(snapshot);
+}
+
 /*
  *     For calls from assembly code
  */
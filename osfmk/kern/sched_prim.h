@@ -519,6 +519,29 @@ MACRO_END
 
 #endif /* DEBUG */
 
+/*
+ * Histograms of the time threads wait to get on core, always collected.
+ * Buckets are log-linear in microseconds: 0us and 1us, then two buckets
+ * per power of two, the last one also counting everything above 49ms.
+ */
+#define SCHED_LATENCY_BUCKETS           32
+
+__enum_decl(sched_latency_kind_t, uint32_t, {
+	SCHED_LATENCY_RUNNABLE          = 0,    /* made runnable until on core */
+	SCHED_LATENCY_PREEMPTED         = 1,    /* preempted until back on core */
+	SCHED_LATENCY_KINDS             = 2,
+});
+
+struct sched_latency_hist {
+	uint64_t        slh_count[SCHED_LATENCY_KINDS][TH_BUCKET_SCHED_MAX][SCHED_LATENCY_BUCKETS];
+};
+PERCPU_DECL(struct sched_latency_hist, sched_latency_hist);
+
+extern uint32_t sched_latency_bucket(uint64_t latency);
+
+extern void sched_latency_hist_snapshot(
+	struct sched_latency_hist *out);
+
 extern uint32_t sched_debug_flags;
 #define SCHED_DEBUG_FLAG_PLATFORM_TRACEPOINTS           0x00000001
 #define SCHED_DEBUG_FLAG_CHOOSE_PROCESSOR_TRACEPOINTS   0x00000002
@@ -5357,8 +5357,8 @@ kern_return_t
 task_set_info(
 	task_t          task,
 	task_flavor_t   flavor,
-	__unused task_info_t    task_info_in,           /* pointer to IN array */
-	__unused mach_msg_type_number_t task_info_count)
+	task_info_t     task_info_in,           /* pointer to IN array */
+	mach_msg_type_number_t task_info_count)
 {
 	if (task == TASK_NULL) {
 		return KERN_INVALID_ARGUMENT;
@@ -5368,6 +5368,85 @@ task_set_info(
 	case TASK_TRACE_MEMORY_INFO:
 		return KERN_NOT_SUPPORTED;
 #endif // CONFIG_ATM
+	case TASK_OOL_RCV_REGION_INFO:
+	{
+		task_ool_rcv_region_info_t region;
+		vm_map_offset_t mask;
+		mach_vm_address_t end;
+
+		if (task_info_count < TASK_OOL_RCV_REGION_INFO_COUNT) {
+			return KERN_INVALID_ARGUMENT;
+		}
+
+		region = (task_ool_rcv_region_info_t)task_info_in;
+		if (region->size == 0) {
+			region->address = 0;
+		} else {
+			mask = VM_MAP_PAGE_MASK(task->map);
+			if ((region->address & mask) || (region->size & mask) ||
+			    os_add_overflow(region->address, region->size, &end) ||
+			    region->address < vm_map_min(task->map) ||
+			    end > vm_map_max(task->map)) {
+				return KERN_INVALID_ARGUMENT;
+			}
+		}
+
+		task_lock(task);
+		if (!task->active) {
+			task_unlock(task);
+			return KERN_INVALID_ARGUMENT;
+		}
+		task->ool_rcv_region_addr = region->address;
+		task->ool_rcv_region_size = region->size;
+		task->ool_rcv_region_head = 0;
+		task->ool_rcv_region_used = 0;
+		task_unlock(task);
+		return KERN_SUCCESS;
+	}
+	case TASK_OOL_RCV_REGION_ACK_INFO:
+	{
+		task_ool_rcv_region_ack_info_t ack;
+		mach_vm_size_t offset, tail, released;
+		kern_return_t kr = KERN_INVALID_ARGUMENT;
+
+		if (task_info_count < TASK_OOL_RCV_REGION_ACK_INFO_COUNT) {
+			return KERN_INVALID_ARGUMENT;
+		}
+
+		ack = (task_ool_rcv_region_ack_info_t)task_info_in;
+
+		task_lock(task);
+		if (task->ool_rcv_region_size == 0 ||
+		    ack->consumed < task->ool_rcv_region_addr ||
+		    ack->consumed - task->ool_rcv_region_addr > task->ool_rcv_region_size) {
+			goto ack_out;
+		}
+
+		/*
+		 * Everything between the oldest data not acknowledged yet
+		 * (the tail) and the consumed offset is released.
+		 * When the region is full, the head and the tail are equal,
+		 * and acknowledging up to the head releases everything.
+		 */
+		offset = (ack->consumed - task->ool_rcv_region_addr) %
+		    task->ool_rcv_region_size;
+		tail = (task->ool_rcv_region_head + task->ool_rcv_region_size -
+		    task->ool_rcv_region_used) % task->ool_rcv_region_size;
+		released = (offset + task->ool_rcv_region_size - tail) %
+		    task->ool_rcv_region_size;
+		if (released == 0 && offset == task->ool_rcv_region_head) {
+			released = task->ool_rcv_region_used;
+		}
+		if (released > task->ool_rcv_region_used) {
+			goto ack_out;
+		}
+
+		task->ool_rcv_region_used -= released;
+		kr = KERN_SUCCESS;
+ack_out:
+		task_unlock(task);
+		return kr;
+	}
 	default:
 		return KERN_INVALID_ARGUMENT;
 	}
@@ -6433,6 +6512,23 @@ task_info(
 		}
 		break;
 	}
+	case TASK_OOL_RCV_REGION_INFO:
+	{
+		task_ool_rcv_region_info_t region;
+
+		if (*task_info_count < TASK_OOL_RCV_REGION_INFO_COUNT) {
+			error = KERN_INVALID_ARGUMENT;
+			break;
+		}
+
+		region = (task_ool_rcv_region_info_t)task_info_out;
+		region->address = task->ool_rcv_region_addr;
+		region->size = task->ool_rcv_region_size;
+		region->used = task->ool_rcv_region_used;
+
+		*task_info_count = TASK_OOL_RCV_REGION_INFO_COUNT;
+		break;
+	}
 	default:
 		error = KERN_INVALID_ARGUMENT;
 	}
@@ -6464,7 +6560,7 @@ task_info_from_user(
 	task_t task;
 	kern_return_t ret;
 
-	if (flavor == TASK_DYLD_INFO) {
+	if (flavor == TASK_DYLD_INFO || flavor == TASK_OOL_RCV_REGION_INFO) {
 		task = convert_port_to_task_read(task_port);
 	} else {
 		task = convert_port_to_task_name(task_port);
@@ -277,6 +277,12 @@ struct task {
 
 	struct recount_task     tk_recount;
 
+	/* Receive region for out-of-line memory, see TASK_OOL_RCV_REGION_INFO (protected by task lock) */
+	mach_vm_address_t       ool_rcv_region_addr;
+	mach_vm_size_t          ool_rcv_region_size;
+	mach_vm_size_t          ool_rcv_region_head;    /* offset of the next delivery */
+	mach_vm_size_t          ool_rcv_region_used;    /* bytes not acknowledged yet */
+
 	/* IPC structures */
 	decl_lck_mtx_data(, itk_lock_data);
 	/*
@@ -40,6 +40,8 @@
 #include <kern/thread_group.h>
 #include <kern/sched_clutch.h>
 #include <kern/sched_rt.h>
+#include <kern/sched_prim.h>
+#include <kern/kcdata.h>
 
 #if CONFIG_THREAD_GROUPS
 
@@ -65,10 +67,22 @@ struct thread_group {
 #if CONFIG_SCHED_CLUTCH
 	struct sched_clutch     tg_sched_clutch;
 #endif /* CONFIG_SCHED_CLUTCH */
+	struct thread_group_sched_latency *__zpercpu tg_sched_latency;
 	uint8_t                 tg_machine_data[] __attribute__((aligned(TG_MACHINE_DATA_ALIGN_SIZE)));
 } __attribute__((aligned(8)));
 
 static SECURITY_READ_ONLY_LATE(zone_t) tg_zone;
+
+/*
+ * Scheduling latency histograms of a thread group, bumped on the local CPU
+ * from thread_dispatch() and summed when read.
+ */
+struct thread_group_sched_latency {
+	uint64_t                tgsl_count[SCHED_LATENCY_KINDS][TH_BUCKET_SCHED_MAX][SCHED_LATENCY_BUCKETS];
+};
+
+static ZONE_DEFINE(tg_sched_latency_zone, "thread_groups.sched_latency",
+    sizeof(struct thread_group_sched_latency), ZC_PERCPU);
 static uint32_t tg_count;
 static queue_head_t tg_queue;
 static LCK_GRP_DECLARE(tg_lck_grp, "thread_group");
@@ -266,6 +280,7 @@ thread_group_create_and_retain(uint32_t flags)
 	assert((uintptr_t)tg % TG_MACHINE_DATA_ALIGN_SIZE == 0);
 
 	tg->tg_flags = flags;
+	tg->tg_sched_latency = zalloc_percpu(tg_sched_latency_zone, Z_WAITOK | Z_ZERO | Z_NOFAIL);
 
 #if CONFIG_SCHED_CLUTCH
 	/*
@@ -587,6 +602,7 @@ thread_group_deallocate_complete(struct thread_group *tg)
 	sched_clutch_destroy(&(tg->tg_sched_clutch));
 #endif /* CONFIG_SCHED_CLUTCH */
 	KDBG_RELEASE(MACHDBG_CODE(DBG_MACH_THREAD_GROUP, MACH_THREAD_GROUP_FREE), tg->tg_id);
+	zfree_percpu(tg_sched_latency_zone, tg->tg_sched_latency);
 	zfree(tg_zone, tg);
 }
 
@@ -1199,6 +1215,78 @@ thread_group_get_name(struct thread_group *tg)
 	return tg->tg_name;
 }
 
+/*
+ * Called from thread_dispatch() with interrupts disabled.
+ */
+void
+thread_group_record_sched_latency(struct thread_group *tg, uint32_t kind, uint32_t bucket, uint32_t index)
+{
+	zpercpu_get(tg->tg_sched_latency)->tgsl_count[kind][bucket][index]++;
+}
+
+/*
+ * Sums the histograms of all CPUs for one scheduler bucket, and returns
+ * whether threads of the group have run at that bucket.
+ *
+ * Can only be called while tg cannot be destroyed
+ */
+bool
+thread_group_get_sched_latency(struct thread_group *tg, uint32_t bucket,
+    uint64_t *runnable, uint64_t *preempted)
+{
+	uint64_t total = 0;
+
+	for (uint32_t i = 0; i < SCHED_LATENCY_BUCKETS; i++) {
+		runnable[i] = 0;
+		preempted[i] = 0;
+	}
+	zpercpu_foreach(tgsl, tg->tg_sched_latency) {
+		for (uint32_t i = 0; i < SCHED_LATENCY_BUCKETS; i++) {
+			runnable[i] += tgsl->tgsl_count[SCHED_LATENCY_RUNNABLE][bucket][i];
+			preempted[i] += tgsl->tgsl_count[SCHED_LATENCY_PREEMPTED][bucket][i];
+		}
+	}
+	for (uint32_t i = 0; i < SCHED_LATENCY_BUCKETS; i++) {
+		total += runnable[i] + preempted[i];
+	}
+	return total != 0;
+}
+
+/*
+ * Fills in up to max entries, one per thread group and scheduler bucket
+ * threads have run at, and returns how many such entries there are.
+ */
+uint32_t
+thread_group_sched_latency_snapshot(struct thread_group_latency_snapshot *out, uint32_t max)
+{
+	static_assert(SCHED_LATENCY_BUCKETS == THREAD_GROUP_LATENCY_BUCKETS);
+	uint64_t runnable[SCHED_LATENCY_BUCKETS];
+	uint64_t preempted[SCHED_LATENCY_BUCKETS];
+	struct thread_group *tg;
+	uint32_t n = 0;
+
+	lck_mtx_lock(&tg_lock);
+	qe_foreach_element(tg, &tg_queue, tg_queue_chain) {
+		for (uint32_t b = 0; b < TH_BUCKET_SCHED_MAX; b++) {
+			if (!thread_group_get_sched_latency(tg, b, runnable, preempted)) {
+				continue;
+			}
+			if (n < max) {
+				struct thread_group_latency_snapshot *tgls = &out[n];
+
+				tgls->tgls_id = tg->tg_id;
+				tgls->tgls_sched_bucket = b;
+				memcpy(tgls->tgls_runnable, runnable, sizeof(tgls->tgls_runnable));
+				memcpy(tgls->tgls_preempted, preempted, sizeof(tgls->tgls_preempted));
+			}
+			n++;
+		}
+	}
+	lck_mtx_unlock(&tg_lock);
+
+	return n;
+}
+
 inline void *
 thread_group_get_machine_data(struct thread_group *tg)
 {
@@ -146,6 +146,10 @@ const char *    thread_group_get_name(struct thread_group *tg);
 void *          thread_group_get_machine_data(struct thread_group *tg);
 uint32_t        thread_group_machine_data_size(void);
 boolean_t       thread_group_uses_immediate_ipi(struct thread_group *tg);
+void            thread_group_record_sched_latency(struct thread_group *tg, uint32_t kind, uint32_t bucket, uint32_t index);
+bool            thread_group_get_sched_latency(struct thread_group *tg, uint32_t bucket, uint64_t *runnable, uint64_t *preempted);
+struct thread_group_latency_snapshot;
+uint32_t        thread_group_sched_latency_snapshot(struct thread_group_latency_snapshot *out, uint32_t max);
 cluster_type_t  thread_group_recommendation(struct thread_group *tg);
 
 typedef         void (*thread_group_iterate_fn_t)(void*, int, struct thread_group *);
@@ -253,11 +253,19 @@ static_assert(sizeof(struct zone_page_metadata) == 16, "validate packing");
  * Magazine of cached allocations.
  *
  * @field zm_next       linkage used by magazine depots.
- * @field zm_elems      an array of @c zc_mag_size() elements.
+ * @field zm_seq        the SMR sequence the magazine was retired at
+ *                      (zones using SMR only).
+ * @field zm_count      the number of elements held when the magazine is full,
+ *                      set when the magazine is pushed to a depot (zones not
+ *                      using SMR only, see @c zone_magazine_count()).
+ * @field zm_elems      an array of @c zc_mag_capacity() elements.
  */
 struct zone_magazine {
 	zone_magazine_t         zm_next;
-	smr_seq_t               zm_seq;
+	union {
+		smr_seq_t       zm_seq;
+		uint16_t        zm_count;
+	};
 	vm_offset_t             zm_elems[0];
 };
 
@@ -279,7 +287,7 @@ struct zone_magazine {
  * - the Zone Allocator.
  *
  * The per-cpu and recirculation depot layer use magazines (@c zone_magazine_t),
- * which are stacks of up to @c zc_mag_size() elements.
+ * which are stacks of up to @c zone_mag_size() elements.
  *
  * <h2>CPU layer</h2>
  *
@@ -341,6 +349,27 @@ struct zone_magazine {
  * @c compute_zone_working_set_size() to return memory to the system when a zone
  * stops being used as much.
  *
+ * <h2>Adaptive magazine sizing</h2>
+ *
+ * When @c zc_mag_adaptive() is set, magazines are allocated to hold up to
+ * @c zc_mag_capacity() elements, and each zone uses @c zone_mag_size() of them.
+ *
+ * Once a zone's depot has grown to @c z_depot_limit and it is still contended,
+ * @c compute_zone_working_set_size() grows the magazine size instead, which
+ * amortizes recirculation over more elements. The depot limit is recomputed
+ * so that the memory allowed per CPU (@c zc_pcpu_max) stays the same.
+ *
+ * Conversely, when a zone has no per-cpu depot, is uncontended, and rarely
+ * recirculates (as measured by @c z_recirc_ops_wma), its magazine size shrinks
+ * down to @c zc_mag_size_min(), reducing how many elements idle CPUs hoard.
+ *
+ * Magazines remember how many elements they held when they were pushed
+ * to a depot (@c zm_count), so that resizing is safe without draining.
+ * Zones using SMR are never resized as their magazines are tagged with
+ * a sequence number exactly when they become full: @c zm_seq shares its
+ * storage with @c zm_count, and their magazines always hold
+ * @c zc_mag_size() elements.
+ *
  * <h2>Security considerations</h2>
  *
  * The zone caching layer has been designed to avoid returning elements in
@@ -571,6 +600,18 @@ static int zalloc_simulate_vm_pressure;
  * zc_mag_size():
  *   size of magazines, larger to reduce contention at the expense of memory
  *
+ * zc_mag_adaptive
+ *   whether magazine sizes adapt per zone to contention and recirculation
+ *   (see "Adaptive magazine sizing" above).
+ *
+ * zc_mag_size_min, zc_mag_size_max
+ *   the bounds of adaptive magazine sizes (0 for zc_mag_size_max means
+ *   4 times zc_mag_size()).
+ *
+ * zc_mag_idle_level
+ *   number of recirculations per second x cpu below which the magazine
+ *   size of an uncontended zone will shrink. (in "Z_WMA_UNIT" units).
+ *
  * zc_enable_level
  *   number of contentions per second after which zone caching engages
  *   automatically.
@@ -611,6 +652,10 @@ static int zalloc_simulate_vm_pressure;
  *   reaquire the zone lock.
  */
 Z_TUNABLE(uint16_t, zc_mag_size, 8);
+static Z_TUNABLE(bool, zc_mag_adaptive, false);
+static Z_TUNABLE(uint16_t, zc_mag_size_min, 4);
+static Z_TUNABLE(uint16_t, zc_mag_size_max, 0);
+static Z_TUNABLE(uint32_t, zc_mag_idle_level, Z_WMA_UNIT);
 static Z_TUNABLE(uint32_t, zc_enable_level, 10);
 static Z_TUNABLE(uint32_t, zc_grow_level, 5 * Z_WMA_UNIT);
 static Z_TUNABLE(uint32_t, zc_shrink_level, Z_WMA_UNIT / 2);
@@ -620,6 +665,16 @@ static Z_TUNABLE(uint32_t, zc_autotrim_buckets, 8);
 static Z_TUNABLE(uint32_t, zc_free_batch_size, 64);
 static Z_TUNABLE(uint64_t, zc_free_batch_timeout, 9600);  // 400us
 
+/*
+ * How many elements magazines (allocated from @c zc_magazine_zone) can hold.
+ */
+__pure2
+static inline uint16_t
+zc_mag_capacity(void)
+{
+	return zc_mag_adaptive() ? zc_mag_size_max() : zc_mag_size();
+}
+
 static SECURITY_READ_ONLY_LATE(size_t)    zone_pages_wired_max;
 static SECURITY_READ_ONLY_LATE(vm_map_t)  zone_submaps[Z_SUBMAP_IDX_COUNT];
 static SECURITY_READ_ONLY_LATE(vm_map_t)  zone_meta_map;
@@ -2302,10 +2357,12 @@ zone_recirc_lock_nopreempt_check_contention(zone_t zone)
 
 	if (__probable(hw_lck_ticket_reserve_nopreempt(&zone->z_recirc_lock,
 	    &ticket, &zone_locks_grp))) {
+		zone->z_recirc_ops_cur++;
 		return;
 	}
 
 	hw_lck_ticket_wait(&zone->z_recirc_lock, ticket, NULL, &zone_locks_grp);
+	zone->z_recirc_ops_cur++;
 
 	/*
 	 * If zone caching has been disabled due to memory pressure,
@@ -2630,6 +2687,19 @@ zone_depot_poll(struct zone_depot *depot, smr_t smr)
 	return smr == NULL || smr_poll(smr, depot->zd_head->zm_seq);
 }
 
+/*!
+ * @function zone_magazine_count
+ *
+ * @brief
+ * Returns how many elements a full magazine of this zone holds.
+ */
+static inline uint16_t
+zone_magazine_count(zone_t z, zone_magazine_t mag)
+{
+	/* SMR zones are never resized, and zm_count holds their zm_seq */
+	return z->z_smr ? zc_mag_size() : mag->zm_count;
+}
+
 static void
 zone_cache_swap_magazines(zone_cache_t cache)
 {
@@ -2638,8 +2708,8 @@ zone_cache_swap_magazines(zone_cache_t cache)
 	vm_offset_t *elems_a = cache->zc_alloc_elems;
 	vm_offset_t *elems_f = cache->zc_free_elems;
 
-	z_debug_assert(count_a <= zc_mag_size());
-	z_debug_assert(count_f <= zc_mag_size());
+	z_debug_assert(count_a <= zc_mag_capacity());
+	z_debug_assert(count_f <= zc_mag_capacity());
 
 	cache->zc_alloc_cur = count_f;
 	cache->zc_free_cur = count_a;
@@ -2666,17 +2736,23 @@ zone_magazine_replace(zone_cache_t zc, zone_magazine_t mag, bool empty)
 	zone_magazine_t old;
 	vm_offset_t **elems;
 
-	mag->zm_seq = SMR_SEQ_INVALID;
-
 	if (empty) {
 		elems = &zc->zc_free_elems;
+		old = (zone_magazine_t)((uintptr_t)*elems -
+		    offsetof(struct zone_magazine, zm_elems));
+		if (!zone_cache_smr(zc)) {
+			old->zm_count = zc->zc_free_cur;
+		}
 		zc->zc_free_cur = 0;
 	} else {
 		elems = &zc->zc_alloc_elems;
-		zc->zc_alloc_cur = zc_mag_size();
+		old = (zone_magazine_t)((uintptr_t)*elems -
+		    offsetof(struct zone_magazine, zm_elems));
+		zc->zc_alloc_cur = zone_cache_smr(zc) ? zc_mag_size() : mag->zm_count;
+	}
+	if (zone_cache_smr(zc)) {
+		mag->zm_seq = SMR_SEQ_INVALID;
 	}
-	old = (zone_magazine_t)((uintptr_t)*elems -
-	    offsetof(struct zone_magazine, zm_elems));
 	*elems = mag->zm_elems;
 
 	return old;
@@ -2712,7 +2788,7 @@ zone_magazine_free_list(struct zone_depot *zd)
 __mockable void
 zone_enable_caching(zone_t zone)
 {
-	size_t size_per_mag = zone_elem_inner_size(zone) * zc_mag_size();
+	size_t size_per_mag = zone_elem_inner_size(zone) * zone_mag_size(zone);
 	zone_cache_t caches;
 	size_t depot_limit;
 
@@ -4608,7 +4684,7 @@ zalloc_expand_drain_exhausted_caches_locked(zone_t z)
 	zone_recirc_unlock_nopreempt(z);
 
 	if (mag) {
-		zone_reclaim_elements(z, zc_mag_size(), mag->zm_elems);
+		zone_reclaim_elements(z, zone_magazine_count(z, mag), mag->zm_elems);
 		zone_magazine_free(mag);
 	}
 
@@ -5271,12 +5347,13 @@ static inline zone_cache_t
 zfree_cached_get_pcpu_cache(zone_t zone, int cpu)
 {
 	zone_cache_t cache = zpercpu_get_cpu(zone->z_pcpu_cache, cpu);
+	uint16_t mag_size = zone_mag_size(zone);
 
-	if (__probable(cache->zc_free_cur < zc_mag_size())) {
+	if (__probable(cache->zc_free_cur < mag_size)) {
 		return cache;
 	}
 
-	if (__probable(cache->zc_alloc_cur < zc_mag_size())) {
+	if (__probable(cache->zc_alloc_cur < mag_size)) {
 		zone_cache_swap_magazines(cache);
 		return cache;
 	}
@@ -5291,7 +5368,7 @@ zfree_cached_get_pcpu_cache_smr(zone_t zone, int cpu)
 	zone_cache_t cache = zpercpu_get_cpu(zone->z_pcpu_cache, cpu);
 	size_t idx = cache->zc_free_cur;
 
-	if (__probable(idx + 1 < zc_mag_size())) {
+	if (__probable(idx + 1 < zone_mag_size(zone))) {
 		return cache;
 	}
 
@@ -5308,7 +5385,7 @@ zfree_cached_get_pcpu_cache_smr(zone_t zone, int cpu)
 	 * mechanically reduces the pace of these commits as usage increases.
 	 */
 
-	if (__probable(idx + 1 == zc_mag_size())) {
+	if (__probable(idx + 1 == zone_mag_size(zone))) {
 		zone_magazine_t mag;
 
 		mag = (zone_magazine_t)((uintptr_t)cache->zc_free_elems -
@@ -5425,24 +5502,18 @@ zfree_ext(zone_t zone, zone_stats_t zstats, void *addr, uint64_t combined_size)
 }
 
 __attribute__((always_inline))
-static inline zstack_t
-zcache_free_stack_to_cpu(
+static inline void
+zcache_free_stack_to_elems(
 	zone_id_t               zid,
-	zone_cache_t            cache,
-	zstack_t                stack,
+	zstack_t               *stack,
+	vm_offset_t            *p,
+	size_t                  n,
 	vm_size_t               esize,
 	zone_cache_ops_t        ops,
 	bool                    zero)
 {
-	size_t       n = MIN(zc_mag_size() - cache->zc_free_cur, stack.z_count);
-	vm_offset_t *p;
-
-	stack.z_count -= n;
-	cache->zc_free_cur += n;
-	p = cache->zc_free_elems + cache->zc_free_cur;
-
 	do {
-		void *o = zstack_pop_no_delta(&stack);
+		void *o = zstack_pop_no_delta(stack);
 
 		if (ops) {
 			o = ops->zc_op_mark_invalid(zid, o);
@@ -5455,6 +5526,80 @@ zcache_free_stack_to_cpu(
 		}
 		*--p  = (vm_offset_t)o;
 	} while (--n > 0);
+}
+
+__attribute__((always_inline))
+static inline zstack_t
+zcache_free_stack_to_cpu(
+	zone_id_t               zid,
+	zone_cache_t            cache,
+	zstack_t                stack,
+	vm_size_t               esize,
+	zone_cache_ops_t        ops,
+	bool                    zero)
+{
+	size_t       n = zone_mag_size(zone_by_id(zid));
+
+	/* the magazine size can shrink concurrently, always make progress */
+	n = MIN(n > cache->zc_free_cur ? n - cache->zc_free_cur : 1,
+	    stack.z_count);
+
+	stack.z_count -= n;
+	cache->zc_free_cur += n;
+	zcache_free_stack_to_elems(zid, &stack,
+	    cache->zc_free_elems + cache->zc_free_cur, n, esize, ops, zero);
+
+	return stack;
+}
+
+/*!
+ * @function zcache_free_stack_to_depot
+ *
+ * @brief
+ * Frees whole magazines worth of elements directly into the per-cpu depot.
+ *
+ * @discussion
+ * This is used by the batched free paths once the per-cpu (a) and (f)
+ * magazines are full: instead of rotating magazines one at a time through
+ * @c zfree_cached_trim(), empty magazines from the depot are filled in place
+ * and pushed back as full, under a single hold of the depot lock.
+ *
+ * This never lets the depot grow past @c z_depot_size full magazines,
+ * the regular path is used to recirculate the excess.
+ */
+__attribute__((noinline))
+static zstack_t
+zcache_free_stack_to_depot(
+	zone_id_t               zid,
+	zone_cache_t            cache,
+	zstack_t                stack,
+	vm_size_t               esize,
+	zone_cache_ops_t        ops,
+	bool                    zero)
+{
+	zone_t zone = zone_by_id(zid);
+	uint32_t depot_max = os_atomic_load(&zone->z_depot_size, relaxed);
+	uint16_t mag_size = zone_mag_size(zone);
+	zone_magazine_t mag;
+
+	if (cache->zc_smr || depot_max == 0) {
+		return stack;
+	}
+
+	zone_depot_lock_nopreempt(cache);
+
+	while (stack.z_count >= mag_size &&
+	    cache->zc_depot.zd_empty &&
+	    cache->zc_depot.zd_full < depot_max) {
+		mag = zone_depot_pop_head_empty(&cache->zc_depot, NULL);
+		stack.z_count -= mag_size;
+		zcache_free_stack_to_elems(zid, &stack,
+		    mag->zm_elems + mag_size, mag_size, esize, ops, zero);
+		mag->zm_count = mag_size;
+		zone_depot_insert_tail_full(&cache->zc_depot, mag);
+	}
+
+	zone_depot_unlock_nopreempt(cache);
 
 	return stack;
 }
@@ -5517,6 +5662,10 @@ zcache_free_n_ext(zone_id_t zid, zstack_t stack, zone_cache_ops_t ops, bool zero
 		if (__probable(cache)) {
 			stack = zcache_free_stack_to_cpu(zid, cache,
 			    stack, esize, ops, zero);
+			if (stack.z_count >= zone_mag_size(zone)) {
+				stack = zcache_free_stack_to_depot(zid, cache,
+				    stack, esize, ops, zero);
+			}
 			enable_preemption();
 		} else if (ops) {
 			enable_preemption();
@@ -5974,7 +6123,7 @@ zalloc_cached_import(
 	zalloc_flags_t          flags,
 	zone_cache_t            cache)
 {
-	uint16_t n_elems = zc_mag_size();
+	uint16_t n_elems = zone_mag_size(zone);
 
 	zone_lock_nopreempt(zone);
 
@@ -6265,6 +6414,63 @@ zcache_alloc_stack_from_cpu(
 	return stack;
 }
 
+/*!
+ * @function zcache_alloc_stack_from_depot
+ *
+ * @brief
+ * Allocates whole magazines worth of elements directly from the per-cpu depot.
+ *
+ * @discussion
+ * This is used by the batched allocation paths once the per-cpu (a) magazine
+ * is exhausted: instead of loading full magazines one at a time through
+ * @c zalloc_cached_prime(), full magazines are drained in place and pushed
+ * back as empty, under a single hold of the depot lock.
+ *
+ * Only magazines that fit entirely in the remaining request are consumed,
+ * the tail of the request is served by the regular path.
+ */
+__attribute__((noinline))
+static zstack_t
+zcache_alloc_stack_from_depot(
+	zone_id_t               zid,
+	zone_cache_t            cache,
+	zstack_t                stack,
+	uint32_t                count,
+	zone_cache_ops_t        ops)
+{
+	zone_magazine_t mag;
+	vm_offset_t e;
+
+	if (cache->zc_smr) {
+		return stack;
+	}
+
+	zone_depot_lock_nopreempt(cache);
+
+	while (cache->zc_depot.zd_full &&
+	    count - stack.z_count >= cache->zc_depot.zd_head->zm_count) {
+		mag = zone_depot_pop_head_full(&cache->zc_depot, NULL);
+
+		for (uint16_t i = mag->zm_count; i-- > 0;) {
+			e = mag->zm_elems[i];
+			mag->zm_elems[i] = 0;
+			if (ops) {
+				e = (vm_offset_t)ops->zc_op_mark_valid(zid, (void *)e);
+			} else {
+				e = __zcache_mark_valid(zone_by_id(zid), e, 0);
+			}
+			zstack_push_no_delta(&stack, (void *)e);
+		}
+		stack.z_count += mag->zm_count;
+
+		zone_depot_insert_head_empty(&cache->zc_depot, mag);
+	}
+
+	zone_depot_unlock_nopreempt(cache);
+
+	return stack;
+}
+
 __attribute__((noinline))
 static zstack_t
 zcache_alloc_fail(zone_id_t zid, zstack_t stack, uint32_t count)
@@ -6330,6 +6536,47 @@ zcache_alloc_one(
 	return o;
 }
 
+/*!
+ * @function zcache_alloc_build_n
+ *
+ * @brief
+ * Builds a batch of composite objects from scratch when the cache is empty.
+ *
+ * @discussion
+ * Must be called with preemption disabled, returns with preemption enabled
+ * if objects were built, or still disabled otherwise (in which case callers
+ * fall back to @c zcache_alloc_one()).
+ */
+__attribute__((noinline))
+static bool
+zcache_alloc_build_n(
+	zone_id_t               zid,
+	zstack_t               *stack,
+	uint32_t                count,
+	zalloc_flags_t          flags,
+	zone_cache_ops_t        ops)
+{
+	zstack_t built;
+
+	enable_preemption();
+
+	/*
+	 * Like zcache_alloc_one(), first try without ever going into
+	 * __ZONE_EXHAUSTED_AND_WAITING_HARD__() by clearing Z_NOFAIL.
+	 */
+	built = ops->zc_op_alloc_n(zid, count - stack->z_count, flags & ~Z_NOFAIL);
+	if (zstack_empty(built)) {
+		disable_preemption();
+		return false;
+	}
+
+	os_atomic_add(&zone_by_id(zid)->z_elems_avail, built.z_count, relaxed);
+	while (!zstack_empty(built)) {
+		zstack_push(stack, zstack_pop(&built));
+	}
+	return true;
+}
+
 __attribute__((always_inline))
 static zstack_t
 zcache_alloc_n_ext(
@@ -6354,7 +6601,15 @@ zcache_alloc_n_ext(
 		if (__probable(cache)) {
 			stack = zcache_alloc_stack_from_cpu(zid, cache, stack,
 			    count - stack.z_count, ops);
+			if (count - stack.z_count >= zone_mag_size(zone)) {
+				stack = zcache_alloc_stack_from_depot(zid, cache,
+				    stack, count, ops);
+			}
 			enable_preemption();
+		} else if (ops && ops->zc_op_alloc_n &&
+		    count - stack.z_count > 1 &&
+		    zcache_alloc_build_n(zid, &stack, count, flags, ops)) {
+			/* a batch of objects was built from scratch */
 		} else {
 			void *o;
 
@@ -6900,7 +7155,7 @@ zone_reclaim_chunk(
 static void
 zone_reclaim_elements(zone_t z, uint16_t n, vm_offset_t *elems)
 {
-	z_debug_assert(n <= zc_mag_size());
+	z_debug_assert(n <= zc_mag_capacity());
 
 	for (uint16_t i = 0; i < n; i++) {
 		vm_offset_t addr = elems[i];
@@ -6914,7 +7169,7 @@ zone_reclaim_elements(zone_t z, uint16_t n, vm_offset_t *elems)
 static void
 zcache_reclaim_elements(zone_id_t zid, uint16_t n, vm_offset_t *elems)
 {
-	z_debug_assert(n <= zc_mag_size());
+	z_debug_assert(n <= zc_mag_capacity());
 	zone_cache_ops_t ops = zcache_ops[zid];
 
 	for (uint16_t i = 0; i < n; i++) {
@@ -6984,6 +7239,9 @@ zone_reclaim_pcpu(zone_t z, zone_reclaim_mode_t mode, struct zone_depot *zd)
 		z->z_recirc_full_wma = 0;
 		z->z_recirc_cont_cur = 0;
 		z->z_recirc_cont_wma = 0;
+		z->z_recirc_ops_cur = 0;
+		z->z_recirc_ops_wma = 0;
+		z->z_mag_size = 0;
 	}
 }
 
@@ -7129,6 +7387,7 @@ zone_reclaim(zone_t z, zone_reclaim_mode_t mode)
 	if (z->z_pcpu_cache) {
 		zone_magazine_t mag;
 		uint32_t freed = 0;
+		uint16_t count;
 
 		/*
 		 * This is all done with the zone lock held on purpose.
@@ -7155,16 +7414,16 @@ zone_reclaim(zone_t z, zone_reclaim_mode_t mode)
 
 			while (zd.zd_full) {
 				mag = zone_depot_pop_head_full(&zd, NULL);
+				count = zone_magazine_count(z, mag);
 				if (smr) {
 					smr_wait(smr, mag->zm_seq);
 					zalloc_cached_reuse_smr(z, cache, mag);
-					freed += zc_mag_size();
+					freed += count;
 				}
-				zone_reclaim_elements(z, zc_mag_size(),
-				    mag->zm_elems);
+				freed += count;
+				zone_reclaim_elements(z, count, mag->zm_elems);
 				zone_depot_insert_head_empty(&zd, mag);
 
-				freed += zc_mag_size();
 				if (freed >= zc_free_batch_size() ||
 				    mach_continuous_speculative_time() >= maxtime) {
 #if SCHED_HYGIENE_DEBUG
@@ -7188,8 +7447,8 @@ zone_reclaim(zone_t z, zone_reclaim_mode_t mode)
 
 			while (zd.zd_full) {
 				mag = zone_depot_pop_head_full(&zd, NULL);
-				zcache_reclaim_elements(zid, zc_mag_size(),
-				    mag->zm_elems);
+				zcache_reclaim_elements(zid,
+				    zone_magazine_count(z, mag), mag->zm_elems);
 				zone_magazine_free(mag);
 			}
 
@@ -7363,8 +7622,8 @@ zone_trim_needed(zone_t z)
 			return true;
 		}
 
-		if (f_n * zc_mag_size() > z->z_elems_rsv * Z_WMA_UNIT &&
-		    f_n * zc_mag_size() * zone_elem_inner_size(z) >
+		if (f_n * zone_mag_size(z) > z->z_elems_rsv * Z_WMA_UNIT &&
+		    f_n * zone_mag_size(z) * zone_elem_inner_size(z) >
 		    zc_autotrim_size() * Z_WMA_UNIT) {
 			return true;
 		}
@@ -7409,6 +7668,39 @@ zone_trim_async(__unused thread_call_param_t p0, __unused thread_call_param_t p1
 	current_thread()->options &= ~TH_OPT_ZONE_PRIV;
 }
 
+/*!
+ * @function zone_mag_resize
+ *
+ * @brief
+ * Adjusts the magazine size of a zone, and the depot limit accordingly.
+ *
+ * @discussion
+ * The depot limit is recomputed so that the amount of memory allowed
+ * to hang from a CPU (@c zc_pcpu_max()) stays the same.
+ *
+ * Magazines already filled keep their element count (@c zm_count),
+ * the per-cpu layer naturally converges to the new size as magazines
+ * are recirculated, and the depot cleanup trims the excess.
+ *
+ * Must be called with the zone lock held.
+ */
+static void
+zone_mag_resize(zone_t z, uint16_t mag_size)
+{
+	size_t depot_limit;
+
+	depot_limit = zc_pcpu_max() / (zone_elem_inner_size(z) * mag_size);
+	depot_limit = MIN(depot_limit, INT16_MAX);
+
+	if (mag_size < zone_mag_size(z) || z->z_depot_size > depot_limit) {
+		z->z_depot_cleanup = true;
+	}
+	z->z_mag_size = mag_size;
+	z->z_depot_limit = (uint16_t)depot_limit;
+	z->z_depot_size = (uint16_t)MIN(z->z_depot_size, depot_limit);
+	z->z_mag_resizes++;
+}
+
 void
 compute_zone_working_set_size(__unused void *param)
 {
@@ -7429,7 +7721,7 @@ compute_zone_working_set_size(__unused void *param)
 	}
 
 	zone_foreach(z) {
-		uint32_t old, wma, cur;
+		uint32_t old, wma, cur, ops;
 		bool needs_caching = false;
 
 		if (z->z_self != z) {
@@ -7459,10 +7751,19 @@ compute_zone_working_set_size(__unused void *param)
 		cur = z->z_recirc_cont_cur * Z_WMA_UNIT /
 		    (zpercpu_count() * ZONE_WSS_UPDATE_PERIOD);
 		cur = (3 * old + cur) / 4;
+
+		/* fixed point decimal of recirculations per second */
+		ops = z->z_recirc_ops_cur * Z_WMA_UNIT /
+		    (zpercpu_count() * ZONE_WSS_UPDATE_PERIOD);
+		ops = (3 * z->z_recirc_ops_wma + ops) / 4;
+		z->z_recirc_ops_wma = ops;
+		z->z_recirc_ops_cur = 0;
 		zone_recirc_unlock_nopreempt(z);
 
 		if (z->z_pcpu_cache) {
 			uint16_t size = z->z_depot_size;
+			uint16_t mag_size = zone_mag_size(z);
+			bool mag_adaptive = zc_mag_adaptive() && !z->z_smr;
 
 			if (zone_exhausted(z)) {
 				if (z->z_depot_size) {
@@ -7478,6 +7779,16 @@ compute_zone_working_set_size(__unused void *param)
 				cur  = (zc_grow_level() + zc_shrink_level()) / 2;
 				size = size ? (3 * size + 2) / 2 : 2;
 				z->z_depot_size = MIN(z->z_depot_limit, size);
+			} else if (mag_adaptive && cur > zc_grow_level() &&
+			    mag_size < zc_mag_size_max()) {
+				/*
+				 * The depot is as large as it can be and
+				 * the zone is still contended: make each
+				 * recirculation move more elements.
+				 */
+				cur  = (zc_grow_level() + zc_shrink_level()) / 2;
+				mag_size = (3 * mag_size + 1) / 2;
+				zone_mag_resize(z, (uint16_t)MIN(mag_size, zc_mag_size_max()));
 			} else if (size > 0 && cur <= zc_shrink_level()) {
 				/*
 				 * lose history on purpose now
@@ -7487,6 +7798,16 @@ compute_zone_working_set_size(__unused void *param)
 				cur = (zc_grow_level() + zc_shrink_level()) / 2;
 				z->z_depot_size = size - 1;
 				z->z_depot_cleanup = true;
+			} else if (mag_adaptive && size == 0 &&
+			    cur <= zc_shrink_level() &&
+			    ops <= zc_mag_idle_level() &&
+			    mag_size > zc_mag_size_min()) {
+				/*
+				 * The zone barely uses its per-cpu layer,
+				 * stop hoarding elements in it.
+				 */
+				mag_size -= (mag_size + 3) / 4;
+				zone_mag_resize(z, (uint16_t)MAX(mag_size, zc_mag_size_min()));
 			}
 		} else if (!z->z_nocaching && !zone_exhaustible(z) && zc_auto &&
 		    old >= zc_auto && cur >= zc_auto) {
@@ -7846,7 +8167,7 @@ get_zone_info(
 	if (z->z_pcpu_cache) {
 		zpercpu_foreach(zc, z->z_pcpu_cache) {
 			cached += zc->zc_alloc_cur + zc->zc_free_cur;
-			cached += zc->zc_depot.zd_full * zc_mag_size();
+			cached += zc->zc_depot.zd_full * zone_mag_size(z);
 		}
 	}
 	zone_unlock(z);
@@ -8566,10 +8887,16 @@ zone_get_stats(
 		zpercpu_foreach(zc, zone->z_pcpu_cache) {
 			stats->zbs_cached += zc->zc_alloc_cur +
 			    zc->zc_free_cur +
-			    zc->zc_depot.zd_full * zc_mag_size();
+			    zc->zc_depot.zd_full * zone_mag_size(zone);
 		}
 	}
 
+	stats->zbs_mag_size = zone_mag_size(zone);
+	stats->zbs_depot_size = zone->z_depot_size;
+	stats->zbs_contention = zone->z_recirc_cont_wma * 1000 / Z_WMA_UNIT;
+	stats->zbs_recirculations = zone->z_recirc_ops_wma * 1000 / Z_WMA_UNIT;
+	stats->zbs_mag_resizes = zone->z_mag_resizes;
+
 	stats->zbs_free = zone_count_free(zone) + stats->zbs_cached;
 
 	/*
@@ -9372,6 +9699,18 @@ zone_bootstrap(void)
 			_zc_mag_size = 10;
 		}
 	}
+	if (zc_mag_adaptive()) {
+		/*
+		 * zone_mag_size() must fit in the z_mag_size bitfield.
+		 */
+		if (_zc_mag_size_max == 0) {
+			_zc_mag_size_max = 4 * _zc_mag_size;
+		}
+		_zc_mag_size_max = (uint16_t)MIN(MAX(_zc_mag_size_max,
+		    _zc_mag_size), UINT8_MAX);
+		_zc_mag_size_min = (uint16_t)MIN(MAX(_zc_mag_size_min, 1),
+		    _zc_mag_size);
+	}
 
 	/*
 	 * Initialize random used to scramble early allocations
@@ -9958,7 +10297,7 @@ zone_init(void)
 	});
 
 	zc_magazine_zone = zone_create("zcc_magazine_zone", sizeof(struct zone_magazine) +
-	    zc_mag_size() * sizeof(vm_offset_t),
+	    zc_mag_capacity() * sizeof(vm_offset_t),
 	    ZC_VM | ZC_NOCACHING | ZC_ZFREE_CLEARMEM);
 	zone_raise_reserve(zc_magazine_zone, (uint16_t)(2 * zpercpu_count()));
 
@@ -10687,6 +11026,138 @@ zone_stress_test_run(__unused int64_t in, int64_t *out)
 }
 SYSCTL_TEST_REGISTER(zone_stress_test, zone_stress_test_run);
 
+static int
+zone_mag_resize_test_run(__unused int64_t in, int64_t *out)
+{
+	static zone_t test_zone;
+	const uint32_t n_elems = 4096;
+	uint16_t sizes[] = {
+		1, zc_mag_size(), zc_mag_capacity(), 2, zc_mag_size(),
+	};
+	struct zone_basic_stats stats;
+	uint64_t **elems;
+	int rc = 0;
+
+	if (os_atomic_xchg(&any_zone_test_running, true, relaxed)) {
+		printf("zone_mag_resize_test: Test already running.\n");
+		return EALREADY;
+	}
+
+	if (test_zone == NULL) {
+		test_zone = zone_create("test_zone_mag_resize",
+		    sizeof(uint64_t), ZC_CACHING);
+	}
+	elems = kalloc_type(uint64_t *, n_elems, Z_WAITOK | Z_ZERO | Z_NOFAIL);
+
+	for (uint32_t s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++) {
+		/*
+		 * Without adaptive magazines, zone_mag_resize() only ever
+		 * uses the default size, skip the other ones.
+		 */
+		if (!zc_mag_adaptive() && sizes[s] != zc_mag_size()) {
+			continue;
+		}
+
+		zone_lock(test_zone);
+		zone_mag_resize(test_zone, sizes[s]);
+		test_zone->z_depot_size = test_zone->z_depot_limit;
+		zone_unlock(test_zone);
+
+		/*
+		 * Elements cached with the previous size must come back intact,
+		 * and no element should be handed out twice.
+		 */
+		for (uint32_t round = 0; round < 4; round++) {
+			for (uint32_t i = 0; i < n_elems; i++) {
+				elems[i] = zalloc_flags(test_zone, Z_WAITOK | Z_NOFAIL);
+				*elems[i] = i;
+			}
+			for (uint32_t i = 0; i < n_elems; i++) {
+				if (*elems[i] != i) {
+					printf("zone_mag_resize_test: element %d "
+					    "was corrupted (mag size %d)\n", i, sizes[s]);
+					rc = EIO;
+					goto out;
+				}
+				zfree(test_zone, elems[i]);
+			}
+		}
+
+		zone_get_stats(test_zone, &stats);
+		if (stats.zbs_mag_size != sizes[s] ||
+		    stats.zbs_cached > stats.zbs_free) {
+			printf("zone_mag_resize_test: inconsistent stats "
+			    "(mag size %d/%d)\n", stats.zbs_mag_size, sizes[s]);
+			rc = EIO;
+			goto out;
+		}
+
+		lck_mtx_lock(&zone_gc_lock);
+		zone_reclaim(test_zone, ZONE_RECLAIM_DRAIN);
+		lck_mtx_unlock(&zone_gc_lock);
+	}
+
+	printf("zone_mag_resize_test: Test passed\n");
+	*out = 1;
+out:
+	kfree_type(uint64_t *, n_elems, elems);
+	os_atomic_store(&any_zone_test_running, false, relaxed);
+	return rc;
+}
+SYSCTL_TEST_REGISTER(zone_mag_resize_test, zone_mag_resize_test_run);
+
+/*
+ * Microbenchmark for the batched allocation interfaces:
+ * allocates and frees ZALLOC_N_BENCH_ELEMS elements ZALLOC_N_BENCH_ROUNDS
+ * times, either one at a time (in == 0), or with zalloc_n()/zfree_n()
+ * (in != 0). Timing is done by the caller.
+ */
+#define ZALLOC_N_BENCH_ELEMS    256
+#define ZALLOC_N_BENCH_ROUNDS   64
+
+static int
+zalloc_n_bench_run(int64_t in, int64_t *out)
+{
+	static zone_t test_zone;
+	const bool batched = (in != 0);
+	void **elems;
+	zstack_t stack;
+
+	if (test_zone == NULL) {
+		test_zone = zone_create("test_zalloc_n_bench", 64, ZC_CACHING);
+	}
+	elems = kalloc_type(void *, ZALLOC_N_BENCH_ELEMS,
+	    Z_WAITOK | Z_ZERO | Z_NOFAIL);
+
+	for (uint32_t round = 0; round < ZALLOC_N_BENCH_ROUNDS; round++) {
+		if (batched) {
+			stack = zalloc_n(zone_index(test_zone),
+			    ZALLOC_N_BENCH_ELEMS, Z_WAITOK | Z_NOFAIL);
+			if (zstack_count(stack) != ZALLOC_N_BENCH_ELEMS) {
+				printf("zalloc_n_bench: short allocation (%d)\n",
+				    zstack_count(stack));
+				zfree_n(zone_index(test_zone), stack);
+				kfree_type(void *, ZALLOC_N_BENCH_ELEMS, elems);
+				return EIO;
+			}
+			zfree_n(zone_index(test_zone), stack);
+		} else {
+			for (uint32_t i = 0; i < ZALLOC_N_BENCH_ELEMS; i++) {
+				elems[i] = zalloc_flags(test_zone,
+				    Z_WAITOK | Z_NOFAIL);
+			}
+			for (uint32_t i = 0; i < ZALLOC_N_BENCH_ELEMS; i++) {
+				zfree(test_zone, elems[i]);
+			}
+		}
+	}
+
+	kfree_type(void *, ZALLOC_N_BENCH_ELEMS, elems);
+	*out = 1;
+	return 0;
+}
+SYSCTL_TEST_REGISTER(zalloc_n_bench, zalloc_n_bench_run);
+
 struct zone_gc_stress_obj {
 	STAILQ_ENTRY(zone_gc_stress_obj) zgso_link;
 	uintptr_t                        zgso_pad[63];
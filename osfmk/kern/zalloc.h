@@ -1644,6 +1644,7 @@ __enum_decl(zone_reserved_id_t, zone_id_t, {
 	ZONE_ID_SEMAPHORE,
 	ZONE_ID_SELECT_SET,
 	ZONE_ID_FILEPROC,
+	ZONE_ID_KNOTE,
 
 #if !CONFIG_MBUF_MCACHE
 	ZONE_ID_MBUF_REF,
@@ -1928,6 +1929,18 @@ extern void zone_drain(
  *                      (included in zbs_free).
  * @field zbs_alloc_fail
  *                      the number of allocation failures.
+ * @field zbs_mag_size  the number of elements per magazine of the per-CPU
+ *                      caches for this zone.
+ * @field zbs_depot_size
+ *                      the number of magazines allowed in per-CPU depots.
+ * @field zbs_contention
+ *                      the moving average of contentions per second per CPU
+ *                      on the zone recirculation layer (in 1/1000th).
+ * @field zbs_recirculations
+ *                      the moving average of recirculations per second per
+ *                      CPU (in 1/1000th).
+ * @field zbs_mag_resizes
+ *                      the number of times the magazine size was adjusted.
  */
 struct zone_basic_stats {
 	uint64_t        zbs_avail;
@@ -1935,6 +1948,11 @@ struct zone_basic_stats {
 	uint64_t        zbs_free;
 	uint64_t        zbs_cached;
 	uint64_t        zbs_alloc_fail;
+	uint32_t        zbs_mag_size;
+	uint32_t        zbs_depot_size;
+	uint64_t        zbs_contention;
+	uint64_t        zbs_recirculations;
+	uint64_t        zbs_mag_resizes;
 };
 
 /*!
@@ -2171,7 +2189,13 @@ extern void zfree_nozero(
  * Allocates a batch of elements from the specified zone.
  *
  * @discussion
- * This is for the sake of networking only, no one else should use this.
+ * The zone must have caching enabled (@c ZC_CACHING). Batches are served
+ * from the per-CPU layer, whole magazines at a time when possible.
+ *
+ * @c Z_ZERO is only honored for elements that aren't already cached:
+ * this is meant for zones whose elements are always freed with
+ * @c zfree() or @c zfree_n() which clear them, or for callers that don't
+ * need zeroed memory.
  *
  * @param zone_id       the zone id to allocate the element from.
  * @param count         how many elements to allocate (less might be returned)
@@ -2231,6 +2255,12 @@ extern void zfree_nozero_n(
  * @field zc_op_alloc
  * The callback to "allocate" a cached object from scratch.
  *
+ * @field zc_op_alloc_n
+ * Optional batched variant of @c zc_op_alloc, used by @c zcache_alloc_n()
+ * when the cache can't satisfy more than one object. It can return less
+ * objects than requested (including none), and must not block if
+ * @c zc_op_alloc wouldn't.
+ *
  * @field zc_op_mark_valid
  * The callback that is called when a cached object is being reused,
  * will typically call @c zcache_mark_valid() on the various
@@ -2246,6 +2276,7 @@ extern void zfree_nozero_n(
  */
 typedef const struct zone_cache_ops {
 	void         *(*zc_op_alloc)(zone_id_t, zalloc_flags_t);
+	zstack_t      (*zc_op_alloc_n)(zone_id_t, uint32_t, zalloc_flags_t);
 	void         *(*zc_op_mark_valid)(zone_id_t, void *);
 	void         *(*zc_op_mark_invalid)(zone_id_t, void *);
 	void          (*zc_op_free)(zone_id_t, void *);
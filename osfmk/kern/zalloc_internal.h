@@ -270,8 +270,7 @@ struct zone {
 	    collectable        :1,  /* garbage collect empty pages */
 	    no_callout         :1,
 	    z_destructible     :1,  /* zone can be zdestroy()ed  */
-
-	    _reserved          :8,
+	    z_mag_size         :8,  /* adaptive magazine size (0: zc_mag_size()) */
 
 	/*
 	 * Debugging features
@@ -380,6 +379,22 @@ struct zone {
 
 	uint8_t             z_cacheline3[0] __attribute__((aligned(64)));
 
+	/*
+	 * Adaptive magazine sizing telemetry
+	 *
+	 * z_recirc_ops_{cur,wma}:
+	 *   number of times the per-cpu layer had to go to the recirculation
+	 *   depot, with "cur" the count for the current period (protected by
+	 *   the recirculation lock), and "wma" the weighted moving average of
+	 *   recirculations per second x cpu, in Z_WMA_UNIT units.
+	 *
+	 * z_mag_resizes:
+	 *   number of times z_mag_size was adjusted.
+	 */
+	uint32_t            z_recirc_ops_cur;
+	uint32_t            z_recirc_ops_wma;
+	uint32_t            z_mag_resizes;
+
 #if KASAN_CLASSIC
 	uint16_t            z_kasan_redzone;
 	spl_t               z_kasan_spl;
@@ -690,10 +705,23 @@ zone_security_config(zone_t z)
 	return zone_security_array[zid];
 }
 
+/*
+ * Returns the number of elements a full magazine holds for this zone.
+ *
+ * This is only a hint for magazines that were filled before the last
+ * adjustment of the magazine size (see compute_zone_working_set_size()),
+ * which know their real count.
+ */
+static inline uint16_t
+zone_mag_size(zone_t zone)
+{
+	return zone->z_mag_size ?: _zc_mag_size;
+}
+
 static inline uint32_t
 zone_count_free(zone_t zone)
 {
-	return zone->z_elems_free + zone->z_recirc.zd_full * _zc_mag_size;
+	return zone->z_elems_free + zone->z_recirc.zd_full * zone_mag_size(zone);
 }
 
 static inline uint32_t
@@ -404,6 +404,7 @@ typedef int     mach_port_flavor_t;
 #define MACH_PORT_INFO_EXT              7       /* uses mach_port_info_ext_t */
 #define MACH_PORT_GUARD_INFO            8       /* asserts if the strict guard value is correct */
 #define MACH_PORT_SERVICE_THROTTLED     9       /* info is an integer that indicates if service port is throttled or not */
+#define MACH_PORT_OOL_RCV_REGION        10      /* info is an integer that indicates if OOL memory received from the port uses the task receive region */
 
 #define MACH_PORT_LIMITS_INFO_COUNT     ((natural_t) \
 	(sizeof(mach_port_limits_t)/sizeof(natural_t)))
@@ -415,6 +416,7 @@ typedef int     mach_port_flavor_t;
 #define MACH_PORT_GUARD_INFO_COUNT      ((natural_t) \
 	(sizeof(mach_port_guard_info_t)/sizeof(natural_t)))
 #define MACH_PORT_SERVICE_THROTTLED_COUNT 1
+#define MACH_PORT_OOL_RCV_REGION_COUNT  1
 
 /*
  * Structure used to pass information about port allocation requests.
@@ -595,6 +595,60 @@ typedef struct task_ipc_space_policy_info * task_ipc_space_policy_info_t;
 #define TASK_IPC_SPACE_POLICY_INFO_COUNT  ((mach_msg_type_number_t) \
 	        (sizeof(struct task_ipc_space_policy_info) / sizeof(natural_t)))
 
+#ifdef PRIVATE
+
+/*
+ * Registers a region of the task's address space in which out-of-line
+ * memory received by the task is delivered, instead of in new mappings.
+ *
+ * Only messages received from ports that opted in with the
+ * MACH_PORT_OOL_RCV_REGION attribute use the region, other messages
+ * (e.g. MIG replies) are unaffected.
+ *
+ * The region is used as a ring: descriptors are placed one after the other
+ * (rounded to a page), wrapping around to the start of the region when the
+ * next one doesn't fit at the end. Delivered memory stays in use until the
+ * task acknowledges it with TASK_OOL_RCV_REGION_ACK_INFO, and descriptors
+ * that don't fit in the free space of the region (or that can't be copied
+ * into it) are delivered in new mappings, like without a region. Memory
+ * received in the region must not be deallocated, and the region must
+ * remain mapped and writable for as long as it is registered.
+ *
+ * The address and size must be page aligned. A size of 0 unregisters
+ * the region. The used field is ignored by task_set_info(), and returns
+ * how many bytes of the region haven't been acknowledged yet.
+ */
+#define TASK_OOL_RCV_REGION_INFO  34
+struct task_ool_rcv_region_info {
+	mach_vm_address_t address;
+	mach_vm_size_t    size;
+	mach_vm_size_t    used;
+};
+
+typedef struct task_ool_rcv_region_info * task_ool_rcv_region_info_t;
+typedef struct task_ool_rcv_region_info task_ool_rcv_region_info_data_t;
+#define TASK_OOL_RCV_REGION_INFO_COUNT  ((mach_msg_type_number_t) \
+	        (sizeof(task_ool_rcv_region_info_data_t) / sizeof(natural_t)))
+
+/*
+ * Acknowledges out-of-line memory delivered in the receive region,
+ * in the order it was delivered: all the memory from the oldest data not
+ * acknowledged yet, up to the consumed address (which is the end of
+ * the last descriptor the task is done with, rounded up to a page),
+ * can be reused for later messages.
+ */
+#define TASK_OOL_RCV_REGION_ACK_INFO  35
+struct task_ool_rcv_region_ack_info {
+	mach_vm_address_t consumed;
+};
+
+typedef struct task_ool_rcv_region_ack_info * task_ool_rcv_region_ack_info_t;
+typedef struct task_ool_rcv_region_ack_info task_ool_rcv_region_ack_info_data_t;
+#define TASK_OOL_RCV_REGION_ACK_INFO_COUNT  ((mach_msg_type_number_t) \
+	        (sizeof(task_ool_rcv_region_ack_info_data_t) / sizeof(natural_t)))
+
+#endif /* PRIVATE */
+
 /*
  * Type to control EXC_GUARD delivery options for a task
  * via task_get/set_exc_guard_behavior interface(s).
@@ -80,7 +80,8 @@ typedef int             vm_behavior_t;
 #define VM_BEHAVIOR_CAN_REUSE   ((vm_behavior_t) 10)
 #define VM_BEHAVIOR_PAGEOUT     ((vm_behavior_t) 11)   /* force page-out of the pages in range (development only) */
 #define VM_BEHAVIOR_ZERO        ((vm_behavior_t) 12)   /* zero pages without faulting in additional pages */
+#define VM_BEHAVIOR_FAULT_AROUND ((vm_behavior_t) 13)  /* map adjacent resident pages when faulting */
 
-#define VM_BEHAVIOR_LAST_VALID (VM_BEHAVIOR_ZERO)
+#define VM_BEHAVIOR_LAST_VALID (VM_BEHAVIOR_FAULT_AROUND)
 
 #endif  /*_MACH_VM_BEHAVIOR_H_*/
@@ -1019,6 +1019,7 @@ static vm_behavior_trial_t vm_behavior_trials_values[] = {
 	VM_BEHAVIOR_TRIAL(VM_BEHAVIOR_CAN_REUSE),
 	VM_BEHAVIOR_TRIAL(VM_BEHAVIOR_PAGEOUT),
 	VM_BEHAVIOR_TRIAL(VM_BEHAVIOR_ZERO),
+	VM_BEHAVIOR_TRIAL(VM_BEHAVIOR_FAULT_AROUND),
 	// end valid ones
 	VM_BEHAVIOR_TRIAL(VM_BEHAVIOR_LAST_VALID + 1),
 	VM_BEHAVIOR_TRIAL(VM_BEHAVIOR_LAST_VALID + 2),
@@ -1215,9 +1216,10 @@ static vm_advise_trial_t vm_advise_trials_values[] = {
 	ADVISE_TRIAL(MADV_CAN_REUSE),
 	ADVISE_TRIAL(MADV_PAGEOUT),
 	ADVISE_TRIAL(MADV_ZERO),
+	ADVISE_TRIAL(MADV_FAULT_AROUND),
 	// end valid ones
-	ADVISE_TRIAL(MADV_ZERO + 1),
-	ADVISE_TRIAL(MADV_ZERO + 2),
+	ADVISE_TRIAL(MADV_FAULT_AROUND + 1),
+	ADVISE_TRIAL(MADV_FAULT_AROUND + 2),
 	ADVISE_TRIAL(0xffffffff),
 };
 
@@ -392,6 +392,7 @@ static void vm_compressor_do_delayed_compactions(boolean_t);
 static void vm_compressor_compact_and_swap(boolean_t);
 static void vm_compressor_process_regular_swapped_in_segments(boolean_t);
 static void vm_compressor_process_special_swapped_in_segments_locked(void);
+static void vm_compressor_major_compact_helpers_init(void);
 
 struct vm_compressor_swapper_stats vmcs_stats;
 
@@ -1214,6 +1215,8 @@ vm_compressor_init(void)
 	}
 	thread_deallocate(thread);
 
+	vm_compressor_major_compact_helpers_init();
+
 	if (vm_pageout_internal_start() != KERN_SUCCESS) {
 		panic("vm_compressor_init: Failed to start the internal pageout thread.");
 	}
@@ -2058,6 +2061,9 @@ c_seg_free_locked(c_segment_t c_seg)
 		c_swap_handle = c_seg->c_store.c_swap_handle;
 	}
 
+	if (c_seg->c_prefetched) {
+		vm_swapin_prefetch_retire(c_seg, false);
+	}
 	c_seg_switch_state(c_seg, C_IS_FREE, FALSE);
 
 	if (c_buffer) {
@@ -2375,6 +2381,8 @@ c_seg_major_compact(
 	c_slot_t        c_dst;
 	c_slot_t        c_src;
 	boolean_t       keep_compacting = TRUE;
+	uint64_t        moved_slots = 0;
+	uint64_t        moved_bytes = 0;
 
 	/*
 	 * segments are not locked but they are both marked c_busy
@@ -2392,7 +2400,6 @@ c_seg_major_compact(
 	c_seg_src->c_was_major_donor++;
 #endif
 	assertf(c_seg_dst->c_has_donated_pages == c_seg_src->c_has_donated_pages, "Mismatched donation status Dst: %p, Src: %p\n", c_seg_dst, c_seg_src);
-	c_seg_major_compact_stats[c_seg_major_compact_stats_now].compactions++;
 
 	dst_slot = c_seg_dst->c_nextslot;
 
@@ -2456,8 +2463,8 @@ c_seg_major_compact(
 		memcpy(&c_seg_dst->c_store.c_buffer[c_seg_dst->c_nextoffset], &c_seg_src->c_store.c_buffer[c_src->c_offset], combined_size);
 		PAGE_REPLACEMENT_DISALLOWED(FALSE);
 
-		c_seg_major_compact_stats[c_seg_major_compact_stats_now].moved_slots++;
-		c_seg_major_compact_stats[c_seg_major_compact_stats_now].moved_bytes += combined_size;
+		moved_slots++;
+		moved_bytes += combined_size;
 
 		cslot_copy(c_dst, c_src);
 		c_dst->c_offset = c_seg_dst->c_nextoffset;
@@ -2493,6 +2500,16 @@ c_seg_major_compact(
 #if DEVELOPMENT || DEBUG
 	C_SEG_WRITE_PROTECT(c_seg_dst);
 #endif
+	/*
+	 * the parallel major compaction helpers can run this
+	 * concurrently on disjoint segment pairs, so the
+	 * shared statistics are updated atomically
+	 */
+	os_atomic_inc(&c_seg_major_compact_stats[c_seg_major_compact_stats_now].compactions, relaxed);
+	os_atomic_add(&c_seg_major_compact_stats[c_seg_major_compact_stats_now].moved_slots, moved_slots, relaxed);
+	os_atomic_add(&c_seg_major_compact_stats[c_seg_major_compact_stats_now].moved_bytes, moved_bytes, relaxed);
+	os_atomic_inc(&vmcs_stats.major_compactions, relaxed);
+
 	if (dst_slot < c_seg_dst->c_nextslot) {
 		PAGE_REPLACEMENT_ALLOWED(TRUE);
 		/*
@@ -3808,6 +3825,393 @@ do_fastwake_warmup(queue_head_t *c_queue, boolean_t consider_all_cseg)
 extern bool     vm_swapout_thread_running;
 extern boolean_t        compressor_store_stop_compaction;
 
+/*
+ * Called on a c_seg that has been fully major compacted, with
+ * both the c_list_lock and the c_seg's lock held, to move it off
+ * the age queue... either onto a swapout queue or out of the way
+ * onto the majorcompact queue.
+ */
+static void
+vm_compressor_major_compact_done(c_segment_t c_seg, boolean_t flush_all, clock_sec_t now)
+{
+#if !(XNU_TARGET_OS_OSX && __arm64__)
+#pragma unused(flush_all)
+#endif /* !(XNU_TARGET_OS_OSX && __arm64__) */
+
+	if (VM_CONFIG_SWAP_IS_ACTIVE) {
+		int new_state = C_ON_SWAPOUT_Q;
+#if (XNU_TARGET_OS_OSX && __arm64__)
+		if (flush_all == false && compressor_swapout_conditions_met() == false) {
+			new_state = C_ON_MAJORCOMPACT_Q;
+		}
+#endif /* (XNU_TARGET_OS_OSX && __arm64__) */
+
+		if (new_state == C_ON_SWAPOUT_Q) {
+			/*
+			 * This mode of putting a generic c_seg on the swapout list is
+			 * only supported when we have general swapping enabled
+			 */
+			clock_sec_t lnow;
+			clock_nsec_t lnsec;
+			clock_get_system_nanotime(&lnow, &lnsec);
+			if (c_seg->c_agedin_ts && (lnow - c_seg->c_agedin_ts) < 30) {
+				vmcs_stats.unripe_under_30s++;
+			} else if (c_seg->c_agedin_ts && (lnow - c_seg->c_agedin_ts) < 60) {
+				vmcs_stats.unripe_under_60s++;
+			} else if (c_seg->c_agedin_ts && (lnow - c_seg->c_agedin_ts) < 300) {
+				vmcs_stats.unripe_under_300s++;
+			}
+		}
+
+		c_seg_switch_state(c_seg, new_state, FALSE);
+	} else {
+		if ((vm_swapout_ripe_segments == TRUE && c_overage_swapped_count < c_overage_swapped_limit)) {
+			assert(VM_CONFIG_SWAP_IS_PRESENT);
+			/*
+			 * we are running compressor sweeps with swap-behind
+			 * make sure the c_seg has aged enough before swapping it
+			 * out...
+			 */
+			if ((now - c_seg->c_creation_ts) >= vm_ripe_target_age) {
+				c_seg->c_overage_swap = TRUE;
+				c_overage_swapped_count++;
+				c_seg_switch_state(c_seg, C_ON_SWAPOUT_Q, FALSE);
+			}
+		}
+	}
+	if (c_seg->c_state == C_ON_AGE_Q) {
+		/*
+		 * this c_seg didn't get moved to the swapout queue
+		 * so we need to move it out of the way...
+		 * we just did a major compaction on it so put it
+		 * on that queue
+		 */
+		c_seg_switch_state(c_seg, C_ON_MAJORCOMPACT_Q, FALSE);
+	} else {
+		c_seg_major_compact_stats[c_seg_major_compact_stats_now].wasted_space_in_swapouts += c_seg_bufsize - c_seg->c_bytes_used;
+		c_seg_major_compact_stats[c_seg_major_compact_stats_now].count_of_swapouts++;
+	}
+}
+
+
+/*
+ * Parallel major compaction
+ *
+ * The expensive part of a major compaction is copying the compressed
+ * data of a donor segment into its destination, which happens with
+ * the c_list_lock dropped and both segments marked c_busy.  When
+ * vm_compressor_major_compact_threads is greater than 1, the swap
+ * trigger thread claims several disjoint <dst, src> pairs of neighbors
+ * from the head of the age queue at once and hands the copies out to
+ * a pool of helper threads.  All queue manipulation and state changes
+ * stay on the swap trigger thread, under the c_list_lock, exactly as
+ * in the serial case.
+ */
+#define C_SEG_MAJOR_COMPACT_THREADS_MAX 8
+
+static TUNABLE(uint32_t, c_major_compact_threads_boot,
+    "vm_compressor_major_compact_threads", 1);
+uint32_t        vm_compressor_major_compact_threads = 1;
+uint32_t        vm_compressor_major_compact_threads_max = 1;
+
+static uint32_t c_major_compact_helper_count = 0;
+
+LCK_MTX_DECLARE(c_major_compact_lock, &vm_compressor_lck_grp);
+
+static struct c_major_compact_work {
+	c_segment_t     cmw_dst;
+	c_segment_t     cmw_src;
+	boolean_t       cmw_keep_compacting;
+} c_major_compact_work[C_SEG_MAJOR_COMPACT_THREADS_MAX];
+
+/* protected by the c_major_compact_lock */
+static uint32_t c_major_compact_work_count;
+static uint32_t c_major_compact_work_next;
+static uint32_t c_major_compact_work_done;
+
+/*
+ * Called and returns with the c_major_compact_lock held.
+ *
+ * There are at most a handful of work items per pass and each
+ * of them is a segment worth of copying, so they're simply
+ * handed out under the lock.
+ */
+static void
+vm_compressor_major_compact_run_work(void)
+{
+	struct c_major_compact_work *work;
+
+	LCK_MTX_ASSERT(&c_major_compact_lock, LCK_MTX_ASSERT_OWNED);
+
+	while (c_major_compact_work_next < c_major_compact_work_count) {
+		work = &c_major_compact_work[c_major_compact_work_next++];
+
+		lck_mtx_unlock(&c_major_compact_lock);
+
+		if (work->cmw_src) {
+			work->cmw_keep_compacting = c_seg_major_compact(work->cmw_dst, work->cmw_src);
+
+			VM_DEBUG_CONSTANT_EVENT(vm_compressor_compact_and_swap, DBG_VM_COMPRESSOR_COMPACT_AND_SWAP, DBG_FUNC_NONE, 9, work->cmw_keep_compacting, 0, 0);
+		}
+
+		lck_mtx_lock(&c_major_compact_lock);
+
+		if (++c_major_compact_work_done == c_major_compact_work_count) {
+			thread_wakeup((event_t)&c_major_compact_work_done);
+		}
+	}
+}
+
+static void
+vm_compressor_major_compact_helper_thread(void)
+{
+	current_thread()->options |= TH_OPT_VMPRIV;
+
+	lck_mtx_lock(&c_major_compact_lock);
+
+	for (;;) {
+		vm_compressor_major_compact_run_work();
+
+		assert_wait((event_t)&c_major_compact_work_count, THREAD_UNINT);
+		lck_mtx_unlock(&c_major_compact_lock);
+		thread_block(THREAD_CONTINUE_NULL);
+		lck_mtx_lock(&c_major_compact_lock);
+	}
+	/* NOTREACHED */
+}
+
+static void
+vm_compressor_major_compact_helpers_init(void)
+{
+	thread_t        thread;
+	uint32_t        nthreads;
+
+	nthreads = MIN(c_major_compact_threads_boot, C_SEG_MAJOR_COMPACT_THREADS_MAX);
+	nthreads = MIN(nthreads, compressor_cpus);
+	nthreads = MAX(nthreads, 1);
+
+	vm_compressor_major_compact_threads_max = nthreads;
+	vm_compressor_major_compact_threads = nthreads;
+
+	for (uint32_t i = 1; i < nthreads; i++) {
+		if (kernel_thread_start_priority((thread_continue_t)vm_compressor_major_compact_helper_thread, NULL,
+		    BASEPRI_VM, &thread) != KERN_SUCCESS) {
+			panic("vm_compressor_major_compact_helper_thread: create failed");
+		}
+		thread_set_thread_name(thread, "VM_cseg_compact");
+		thread_deallocate(thread);
+		c_major_compact_helper_count++;
+	}
+}
+
+/*
+ * Hand out the claimed pairs to the helper threads, take our
+ * share of the work and wait for all of it to be done.
+ */
+static void
+vm_compressor_major_compact_dispatch(uint32_t count)
+{
+	lck_mtx_lock(&c_major_compact_lock);
+
+	c_major_compact_work_count = count;
+	c_major_compact_work_next = 0;
+	c_major_compact_work_done = 0;
+	thread_wakeup((event_t)&c_major_compact_work_count);
+
+	vm_compressor_major_compact_run_work();
+
+	while (c_major_compact_work_done < count) {
+		assert_wait((event_t)&c_major_compact_work_done, THREAD_UNINT);
+		lck_mtx_unlock(&c_major_compact_lock);
+		thread_block(THREAD_CONTINUE_NULL);
+		lck_mtx_lock(&c_major_compact_lock);
+	}
+	lck_mtx_unlock(&c_major_compact_lock);
+}
+
+/*
+ * returns the segment following the last one claimed so far,
+ * which is stable across drops of the c_list_lock since the
+ * claimed segments are c_busy and stay on the age queue
+ */
+static c_segment_t
+vm_compressor_major_compact_next(uint32_t count)
+{
+	struct c_major_compact_work *work;
+
+	if (count == 0) {
+		return (c_segment_t)queue_first(&c_age_list_head);
+	}
+	work = &c_major_compact_work[count - 1];
+
+	if (work->cmw_src) {
+		return (c_segment_t)queue_next(&work->cmw_src->c_age_list);
+	}
+	return (c_segment_t)queue_next(&work->cmw_dst->c_age_list);
+}
+
+/*
+ * Called with the c_list_lock held, returns with it held.
+ *
+ * Returns the number of destination segments that were processed,
+ * 0 meaning the caller should fall back to the serial path for the
+ * segment at the head of the age queue (e.g. it or its neighbor is
+ * busy and needs to be waited on).
+ */
+static uint32_t
+vm_compressor_major_compact_parallel(boolean_t flush_all, clock_sec_t now,
+    unsigned int *c_seg_considered, unsigned int *wanted_cseg_found, uint64_t *total_bytes_freed)
+{
+	struct c_major_compact_work *work;
+	c_segment_t     c_seg, c_seg_next;
+	uint32_t        nthreads, count = 0;
+	uint64_t        bytes_to_free, bytes_freed = 0;
+	bool            stop = false;
+
+	LCK_MTX_ASSERT(c_list_lock, LCK_MTX_ASSERT_OWNED);
+
+	nthreads = MIN(vm_compressor_major_compact_threads, c_major_compact_helper_count + 1);
+
+	while (count < nthreads && !stop) {
+		c_seg = vm_compressor_major_compact_next(count);
+
+		if (queue_end(&c_age_list_head, (queue_entry_t)c_seg)) {
+			break;
+		}
+		assert(c_seg->c_state == C_ON_AGE_Q);
+
+		if (flush_all == TRUE && c_seg->c_generation_id > c_generation_id_flush_barrier) {
+			break;
+		}
+		lck_mtx_lock_spin_always(&c_seg->c_lock);
+
+		if (c_seg->c_busy) {
+			lck_mtx_unlock_always(&c_seg->c_lock);
+			break;
+		}
+		C_SEG_BUSY(c_seg);
+
+		if (c_seg_do_minor_compaction_and_unlock(c_seg, FALSE, TRUE, TRUE)) {
+			c_seg_major_compact_stats[c_seg_major_compact_stats_now].count_of_freed_segs++;
+			continue;
+		}
+		work = &c_major_compact_work[count];
+		work->cmw_dst = c_seg;
+		work->cmw_src = NULL;
+		work->cmw_keep_compacting = FALSE;
+
+		for (;;) {
+			c_seg_next = (c_segment_t)queue_next(&c_seg->c_age_list);
+
+			if (queue_end(&c_age_list_head, (queue_entry_t)c_seg_next)) {
+				break;
+			}
+			(*c_seg_considered)++;
+
+			if (c_seg_major_compact_ok(c_seg, c_seg_next) == FALSE) {
+				break;
+			}
+			lck_mtx_lock_spin_always(&c_seg_next->c_lock);
+
+			if (c_seg_next->c_busy) {
+				/*
+				 * the serial path knows how to wait for
+				 * our neighbor... release our c_seg and
+				 * stop claiming more work for this pass
+				 */
+				lck_mtx_unlock_always(&c_seg_next->c_lock);
+
+				lck_mtx_lock_spin_always(&c_seg->c_lock);
+				C_SEG_WAKEUP_DONE(c_seg);
+				lck_mtx_unlock_always(&c_seg->c_lock);
+
+				work->cmw_dst = NULL;
+				stop = true;
+				break;
+			}
+			C_SEG_BUSY(c_seg_next);
+
+			bytes_to_free = C_SEG_OFFSET_TO_BYTES(c_seg_next->c_populated_offset);
+			if (c_seg_do_minor_compaction_and_unlock(c_seg_next, FALSE, TRUE, TRUE)) {
+				bytes_freed += bytes_to_free;
+				c_seg_major_compact_stats[c_seg_major_compact_stats_now].count_of_freed_segs++;
+				continue;
+			}
+			work->cmw_src = c_seg_next;
+			break;
+		}
+		if (work->cmw_dst) {
+			count++;
+		}
+	}
+	if (count == 0) {
+		*total_bytes_freed += bytes_freed;
+		return 0;
+	}
+
+	lck_mtx_unlock_always(c_list_lock);
+
+	vm_compressor_major_compact_dispatch(count);
+
+	for (uint32_t i = 0; i < count; i++) {
+		work = &c_major_compact_work[i];
+
+		if (work->cmw_src == NULL) {
+			continue;
+		}
+		os_atomic_inc(&vmcs_stats.major_compactions_parallel, relaxed);
+
+		PAGE_REPLACEMENT_DISALLOWED(TRUE);
+
+		lck_mtx_lock_spin_always(&work->cmw_src->c_lock);
+		/*
+		 * run a minor compaction on the donor segment and free
+		 * it if it's now empty, clearing c_busy in the process
+		 */
+		bytes_to_free = C_SEG_OFFSET_TO_BYTES(work->cmw_src->c_populated_offset);
+		if (c_seg_minor_compaction_and_unlock(work->cmw_src, TRUE)) {
+			bytes_freed += bytes_to_free;
+			c_seg_major_compact_stats[c_seg_major_compact_stats_now].count_of_freed_segs++;
+		} else {
+			bytes_to_free -= C_SEG_OFFSET_TO_BYTES(work->cmw_src->c_populated_offset);
+			bytes_freed += bytes_to_free;
+		}
+
+		PAGE_REPLACEMENT_DISALLOWED(FALSE);
+	}
+
+	lck_mtx_lock_spin_always(c_list_lock);
+
+	for (uint32_t i = 0; i < count; i++) {
+		work = &c_major_compact_work[i];
+		c_seg = work->cmw_dst;
+
+		lck_mtx_lock_spin_always(&c_seg->c_lock);
+
+		assert(c_seg->c_busy);
+		assert(!c_seg->c_on_minorcompact_q);
+
+		if (c_seg->c_wanted) {
+			(*wanted_cseg_found)++;
+			c_seg_major_compact_stats[c_seg_major_compact_stats_now].bailed_compactions++;
+		} else if (work->cmw_src == NULL || work->cmw_keep_compacting == FALSE) {
+			/*
+			 * either there was no donor left for this c_seg
+			 * or it is full: it's done, move it out of the way.
+			 * Otherwise it stays at the head of the age queue
+			 * and gets another donor in the next pass.
+			 */
+			vm_compressor_major_compact_done(c_seg, flush_all, now);
+		}
+		C_SEG_WAKEUP_DONE(c_seg);
+
+		lck_mtx_unlock_always(&c_seg->c_lock);
+	}
+	*total_bytes_freed += bytes_freed;
+
+	return count;
+}
+
 void
 vm_compressor_compact_and_swap(boolean_t flush_all)
 {
@@ -3817,7 +4221,7 @@ vm_compressor_compact_and_swap(boolean_t flush_all)
 	clock_nsec_t    nsec;
 	mach_timespec_t start_ts, end_ts;
 	unsigned int    number_considered, wanted_cseg_found, yield_after_considered_per_pass, number_yields;
-	uint64_t        bytes_freed, delta_usec;
+	uint64_t        bytes_freed, delta_usec, major_compactions;
 	uint32_t        c_swapout_count = 0;
 
 	VM_DEBUG_CONSTANT_EVENT(vm_compressor_compact_and_swap, DBG_VM_COMPRESSOR_COMPACT_AND_SWAP, DBG_FUNC_START, c_age_count, c_minor_count, c_major_count, vm_page_free_count);
@@ -3874,6 +4278,7 @@ vm_compressor_compact_and_swap(boolean_t flush_all)
 	wanted_cseg_found = 0;
 	number_yields = 0;
 	bytes_freed = 0;
+	major_compactions = os_atomic_load(&vmcs_stats.major_compactions, relaxed);
 	yield_after_considered_per_pass = MAX(min_csegs_per_major_compaction, DELAYED_COMPACTIONS_PER_PASS);
 
 	/**
@@ -3976,6 +4381,10 @@ vm_compressor_compact_and_swap(boolean_t flush_all)
 			VM_DEBUG_CONSTANT_EVENT(vm_compressor_compact_and_swap, DBG_VM_COMPRESSOR_COMPACT_AND_SWAP, DBG_FUNC_NONE, 4, c_age_count, 0, 0);
 			break;
 		}
+		if (vm_compressor_major_compact_threads > 1 &&
+		    vm_compressor_major_compact_parallel(flush_all, now, &number_considered, &wanted_cseg_found, &bytes_freed)) {
+			goto compacted;
+		}
 		c_seg = (c_segment_t) queue_first(&c_age_list_head);
 
 		assert(c_seg->c_state == C_ON_AGE_Q);
@@ -4018,65 +4427,14 @@ vm_compressor_compact_and_swap(boolean_t flush_all)
 		assert(!c_seg->c_on_minorcompact_q);
 
 		if (switch_state) {
-			if (VM_CONFIG_SWAP_IS_ACTIVE) {
-				int new_state = C_ON_SWAPOUT_Q;
-#if (XNU_TARGET_OS_OSX && __arm64__)
-				if (flush_all == false && compressor_swapout_conditions_met() == false) {
-					new_state = C_ON_MAJORCOMPACT_Q;
-				}
-#endif /* (XNU_TARGET_OS_OSX && __arm64__) */
-
-				if (new_state == C_ON_SWAPOUT_Q) {
-					/*
-					 * This mode of putting a generic c_seg on the swapout list is
-					 * only supported when we have general swapping enabled
-					 */
-					clock_sec_t lnow;
-					clock_nsec_t lnsec;
-					clock_get_system_nanotime(&lnow, &lnsec);
-					if (c_seg->c_agedin_ts && (lnow - c_seg->c_agedin_ts) < 30) {
-						vmcs_stats.unripe_under_30s++;
-					} else if (c_seg->c_agedin_ts && (lnow - c_seg->c_agedin_ts) < 60) {
-						vmcs_stats.unripe_under_60s++;
-					} else if (c_seg->c_agedin_ts && (lnow - c_seg->c_agedin_ts) < 300) {
-						vmcs_stats.unripe_under_300s++;
-					}
-				}
-
-				c_seg_switch_state(c_seg, new_state, FALSE);
-			} else {
-				if ((vm_swapout_ripe_segments == TRUE && c_overage_swapped_count < c_overage_swapped_limit)) {
-					assert(VM_CONFIG_SWAP_IS_PRESENT);
-					/*
-					 * we are running compressor sweeps with swap-behind
-					 * make sure the c_seg has aged enough before swapping it
-					 * out...
-					 */
-					if ((now - c_seg->c_creation_ts) >= vm_ripe_target_age) {
-						c_seg->c_overage_swap = TRUE;
-						c_overage_swapped_count++;
-						c_seg_switch_state(c_seg, C_ON_SWAPOUT_Q, FALSE);
-					}
-				}
-			}
-			if (c_seg->c_state == C_ON_AGE_Q) {
-				/*
-				 * this c_seg didn't get moved to the swapout queue
-				 * so we need to move it out of the way...
-				 * we just did a major compaction on it so put it
-				 * on that queue
-				 */
-				c_seg_switch_state(c_seg, C_ON_MAJORCOMPACT_Q, FALSE);
-			} else {
-				c_seg_major_compact_stats[c_seg_major_compact_stats_now].wasted_space_in_swapouts += c_seg_bufsize - c_seg->c_bytes_used;
-				c_seg_major_compact_stats[c_seg_major_compact_stats_now].count_of_swapouts++;
-			}
+			vm_compressor_major_compact_done(c_seg, flush_all, now);
 		}
 
 		C_SEG_WAKEUP_DONE(c_seg);
 
 		lck_mtx_unlock_always(&c_seg->c_lock);
 
+compacted:
 		/*
 		 * On systems _with_ general swap, regardless of jetsam, we wake up the swapout thread here.
 		 * On systems _without_ general swap, it's the responsibility of the memorystatus
@@ -4134,6 +4492,11 @@ vm_compressor_compact_and_swap(boolean_t flush_all)
 
 	c_seg_major_compact_stats[c_seg_major_compact_stats_now].bytes_freed_rate_us = (bytes_freed / delta_usec);
 
+	major_compactions = os_atomic_load(&vmcs_stats.major_compactions, relaxed) - major_compactions;
+	if (major_compactions) {
+		vmcs_stats.major_compactions_per_sec = (major_compactions * USEC_PER_SEC) / delta_usec;
+	}
+
 	if ((c_seg_major_compact_stats_now + 1) == C_SEG_MAJOR_COMPACT_STATS_MAX) {
 		c_seg_major_compact_stats_now = 0;
 	} else {
@@ -4571,6 +4934,8 @@ c_seg_swapin_requeue(c_segment_t c_seg, boolean_t has_data, boolean_t minor_comp
  * c_seg has to be locked and is returned locked if the c_seg isn't freed
  * PAGE_REPLACMENT_DISALLOWED has to be TRUE on entry and is returned TRUE
  * c_seg_swapin returns 1 if the c_seg was freed, 0 otherwise
+ * age_on_swapin_q is set for swapins done on behalf of a fault, which
+ * also get the rest of the segment's swapout group prefetched
  */
 
 int
@@ -4579,6 +4944,7 @@ c_seg_swapin(c_segment_t c_seg, boolean_t force_minor_compaction, boolean_t age_
 	vm_offset_t     addr = 0;
 	uint32_t        io_size = 0;
 	uint64_t        f_offset;
+	uint32_t        group = 0;
 	thread_pri_floor_t token;
 
 	assert(C_SEG_IS_ONDISK(c_seg));
@@ -4609,7 +4975,7 @@ c_seg_swapin(c_segment_t c_seg, boolean_t force_minor_compaction, boolean_t age_
 	kernel_memory_populate(addr, io_size, KMA_NOFAIL | KMA_COMPRESSOR,
 	    VM_KERN_MEMORY_COMPRESSOR);
 
-	if (vm_swap_get(c_seg, f_offset, io_size) != KERN_SUCCESS) {
+	if (vm_swap_get(c_seg, f_offset, io_size, &group) != KERN_SUCCESS) {
 		PAGE_REPLACEMENT_DISALLOWED(TRUE);
 
 		kernel_memory_depopulate(addr, io_size, KMA_COMPRESSOR,
@@ -4664,6 +5030,10 @@ c_seg_swapin(c_segment_t c_seg, boolean_t force_minor_compaction, boolean_t age_
 		assert3u(prev_swapped_count, >=, c_seg->c_slots_used);
 		os_atomic_add(&compressor_bytes_used, c_seg->c_bytes_used, relaxed);
 
+		if (age_on_swapin_q == TRUE && c_seg->c_state != C_ON_BAD_Q) {
+			vm_swapin_prefetch_note(f_offset, group);
+		}
+
 		if (force_minor_compaction == TRUE) {
 			if (c_seg_minor_compaction_and_unlock(c_seg, FALSE)) {
 				/*
@@ -5279,6 +5649,9 @@ bypass_busy_check:
 			retval = DECOMPRESS_FAILED_BAD_Q;
 			goto done;
 		}
+		if (c_seg->c_prefetched && !kdp_mode) {
+			vm_swapin_prefetch_retire(c_seg, true);
+		}
 
 #if POPCOUNT_THE_COMPRESSED_DATA
 		unsigned csvpop;
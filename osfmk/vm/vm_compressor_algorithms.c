@@ -77,6 +77,9 @@ compressor_tuneables_t vmctune = {
 	.lz4_run_preselection_threshold = ~0U,
 	.lz4_run_continue_bytes = 0,
 	.lz4_profitable_bytes = 0,
+	.prescreen_enabled = 1,
+	.prescreen_raw_collisions = 20,
+	.prescreen_lz4_collisions = 192,
 };
 
 compressor_state_t vmcstate = {
@@ -99,6 +102,14 @@ enum compressor_preselect_t {
 	CPRESELWK = 2,
 };
 
+enum compressor_prescreen_t {
+	CSCREEN_NONE = 0,       /* no opinion, use the running selector */
+	CSCREEN_SV = 1,         /* single 32 bit value (incl. zero-fill) */
+	CSCREEN_RAW = 2,        /* looks incompressible, store as is */
+	CSCREEN_WK = 3,         /* zero or similar words, WKdm territory */
+	CSCREEN_LZ4 = 4,        /* skewed bytes without word structure */
+};
+
 /* changeable via sysctl */
 vm_compressor_mode_t vm_compressor_current_codec = VM_COMPRESSOR_DEFAULT_CODEC;
 
@@ -213,6 +224,95 @@ compressor_selector_update(int lz4sz, int didwk, int wksz)
 }
 
 
+/*
+ * Page pre-screen
+ *
+ * A single read-only pass over the page, 64 bits at a time, that gathers
+ * enough statistics to route it without a failed compression attempt:
+ *
+ * - whether all 32 bit words hold the same value,
+ *
+ * - how many 32 bit words WKdm would encode cheaply: zeroes, or words
+ *   whose upper 22 bits match one of the 2 preceding words (a tiny
+ *   window approximating WKdm's dictionary),
+ *
+ * - the collision probability of the bytes (sum of squared byte
+ *   frequencies) over a sample of one 64 bit word in 8, which estimates
+ *   byte entropy without floating point. It is expressed in 1/16th of
+ *   the collision probability of uniformly random bytes (1/256),
+ *   so random data scores about 16 and ASCII text above 200.
+ *
+ * Pages without word structure and close to uniform byte collisions are
+ * stored raw, pages without word structure but with skewed bytes go to
+ * LZ4 in hybrid mode, and the rest is left to the running selector.
+ *
+ * Kernel code is built without implicit SIMD, so this processes
+ * two 32 bit words per iteration in general purpose registers.
+ */
+#define CSCREEN_SAMPLE_SHIFT    3
+#define CSCREEN_WK_SIMILAR(w, p) (((w) >> 10) == ((p) >> 10))
+
+static enum compressor_prescreen_t
+compressor_prescreen(const uint8_t *in, uint32_t *collisionsp)
+{
+	const uint64_t *w = (const uint64_t *)(const void *)in;
+	const uint32_t nwords = PAGE_SIZE / sizeof(uint64_t);
+	const uint64_t n = (uint64_t)(nwords >> CSCREEN_SAMPLE_SHIFT) * sizeof(uint64_t);
+	uint16_t hist[256] = { };
+	uint32_t lo, hi, plo = 0, phi = 0, friendly = 0, collisions;
+	uint64_t sv, diff = 0, sumsq = 0;
+
+	sv = (w[0] & 0xffffffffull) | (w[0] << 32);
+
+	for (uint32_t i = 0; i < nwords; i++) {
+		uint64_t x = w[i];
+
+		diff |= x ^ sv;
+
+		lo = (uint32_t)x;
+		hi = (uint32_t)(x >> 32);
+		friendly += (lo == 0) || CSCREEN_WK_SIMILAR(lo, phi) ||
+		    CSCREEN_WK_SIMILAR(lo, plo);
+		friendly += (hi == 0) || CSCREEN_WK_SIMILAR(hi, lo) ||
+		    CSCREEN_WK_SIMILAR(hi, phi);
+		plo = lo;
+		phi = hi;
+
+		if ((i & ((1u << CSCREEN_SAMPLE_SHIFT) - 1)) == 0) {
+			for (int b = 0; b < 64; b += 8) {
+				hist[(x >> b) & 0xff]++;
+			}
+		}
+	}
+
+	if (diff == 0) {
+		return CSCREEN_SV;
+	}
+
+	for (int i = 0; i < 256; i++) {
+		sumsq += (uint64_t)hist[i] * hist[i];
+	}
+	/* unbiased estimate of the collision probability, times 256 * 16 */
+	collisions = (uint32_t)((sumsq - n) * 4096 / (n * (n - 1)));
+	if (collisionsp) {
+		*collisionsp = collisions;
+	}
+
+	if (friendly >= nwords / 2) {
+		/* at least a quarter of the 32 bit words */
+		return CSCREEN_WK;
+	}
+	if (friendly < nwords / 8) {
+		if (collisions < vmctune.prescreen_raw_collisions) {
+			return CSCREEN_RAW;
+		}
+		if (collisions >= vmctune.prescreen_lz4_collisions) {
+			return CSCREEN_LZ4;
+		}
+	}
+	return CSCREEN_NONE;
+}
+
 static inline void
 WKdm_hv(uint32_t *wkbuf)
 {
@@ -306,11 +406,37 @@ metacompressor(const uint8_t *in, uint8_t *cdst, int32_t outbufsz, uint16_t *cod
 	compressor_encode_scratch_t *cscratch = cscratchin;
 	/* Not all paths lead to an inline population count. */
 	uint32_t pop_count = C_SLOT_NO_POPCOUNT;
+	enum compressor_prescreen_t screen = CSCREEN_NONE;
+
+	if (vmctune.prescreen_enabled) {
+		screen = compressor_prescreen(in, NULL);
+		if (screen == CSCREEN_SV) {
+			/* same encoding as a WKdm single value page */
+			VM_COMPRESSOR_STAT(compressor_stats.prescreen_sv++);
+			*codec = CCWK;
+			sz = 0;
+			goto cexit;
+		}
+		if (screen == CSCREEN_RAW) {
+			/* the caller stores pages that failed to compress as is */
+			VM_COMPRESSOR_STAT(compressor_stats.prescreen_raw++);
+			*codec = CCWK;
+			sz = -1;
+			goto cexit;
+		}
+	}
 
 	if (vm_compressor_current_codec == CMODE_WK) {
 		dowk = TRUE;
 	} else if (vm_compressor_current_codec == CMODE_LZ4) {
 		dolz4 = TRUE;
+	} else if (vm_compressor_current_codec == CMODE_HYB && screen == CSCREEN_LZ4) {
+		VM_COMPRESSOR_STAT(compressor_stats.prescreen_lz4++);
+		dolz4 = TRUE;
+		goto lz4compress;
+	} else if (vm_compressor_current_codec == CMODE_HYB && screen == CSCREEN_WK) {
+		VM_COMPRESSOR_STAT(compressor_stats.prescreen_wk++);
+		dowk = TRUE;
 	} else if (vm_compressor_current_codec == CMODE_HYB) {
 		enum compressor_preselect_t presel = compressor_preselect();
 		if (presel == CPRESELLZ4) {
@@ -473,3 +599,77 @@ vm_compressor_algorithm_init(void)
 	vm_compressor_current_codec = new_codec;
 #endif /* arm/arm64 */
 }
+
+#if DEVELOPMENT || DEBUG
+static int
+vm_compressor_prescreen_test(__unused int64_t in, int64_t *out)
+{
+	static const char text[] = "The pre-screen routes pages without "
+	    "word structure, like this text, to LZ4.\n";
+	enum compressor_prescreen_t screen;
+	uint32_t *page, collisions = 0;
+	uint64_t x = 0x9e3779b97f4a7c15ull;
+	const uint32_t nwords = PAGE_SIZE / sizeof(uint32_t);
+	int rc = EINVAL;
+
+	page = kalloc_data(PAGE_SIZE, Z_WAITOK | Z_ZERO | Z_NOFAIL);
+
+	/* zero-fill */
+	if (compressor_prescreen((const uint8_t *)page, NULL) != CSCREEN_SV) {
+		printf("%s: zero-fill page not detected\n", __func__);
+		goto out;
+	}
+
+	/* single value */
+	for (uint32_t i = 0; i < nwords; i++) {
+		page[i] = 0xdeadbeef;
+	}
+	if (compressor_prescreen((const uint8_t *)page, NULL) != CSCREEN_SV) {
+		printf("%s: single value page not detected\n", __func__);
+		goto out;
+	}
+
+	/* mostly zeroes with a few small values */
+	bzero(page, PAGE_SIZE);
+	for (uint32_t i = 0; i < nwords; i += 7) {
+		page[i] = i;
+	}
+	screen = compressor_prescreen((const uint8_t *)page, NULL);
+	if (screen != CSCREEN_WK) {
+		printf("%s: sparse page routed to %d\n", __func__, screen);
+		goto out;
+	}
+
+	/* text */
+	for (uint32_t i = 0; i < PAGE_SIZE; i++) {
+		((char *)page)[i] = text[i % (sizeof(text) - 1)];
+	}
+	screen = compressor_prescreen((const uint8_t *)page, &collisions);
+	if (screen != CSCREEN_LZ4) {
+		printf("%s: text page routed to %d (collisions %d)\n",
+		    __func__, screen, collisions);
+		goto out;
+	}
+
+	/* random (xorshift64) */
+	for (uint32_t i = 0; i < nwords; i += 2) {
+		x ^= x << 13;
+		x ^= x >> 7;
+		x ^= x << 17;
+		*(uint64_t *)(void *)&page[i] = x;
+	}
+	screen = compressor_prescreen((const uint8_t *)page, &collisions);
+	if (screen != CSCREEN_RAW) {
+		printf("%s: random page routed to %d (collisions %d)\n",
+		    __func__, screen, collisions);
+		goto out;
+	}
+
+	*out = 1;
+	rc = 0;
+out:
+	kfree_data(page, PAGE_SIZE);
+	return rc;
+}
+SYSCTL_TEST_REGISTER(vm_compressor_prescreen, vm_compressor_prescreen_test);
+#endif /* DEVELOPMENT || DEBUG */
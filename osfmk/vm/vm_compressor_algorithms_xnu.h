@@ -72,6 +72,11 @@ typedef struct {
 
 	uint64_t wk_decompressed_bytes;
 	uint64_t wk_sv_decompressions;
+
+	uint64_t prescreen_sv;
+	uint64_t prescreen_raw;
+	uint64_t prescreen_wk;
+	uint64_t prescreen_lz4;
 } compressor_stats_t;
 
 extern compressor_stats_t compressor_stats;
@@ -86,6 +91,9 @@ typedef struct {
 	uint32_t lz4_run_preselection_threshold;
 	uint32_t lz4_run_continue_bytes;
 	uint32_t lz4_profitable_bytes;
+	uint32_t prescreen_enabled;
+	uint32_t prescreen_raw_collisions;
+	uint32_t prescreen_lz4_collisions;
 } compressor_tuneables_t;
 
 extern compressor_tuneables_t vmctune;
@@ -105,10 +105,20 @@ struct swapfile {
 	unsigned int            swp_flags;      /* state of swap file */
 	unsigned int            swp_free_hint;  /* offset of 1st free chunk */
 	unsigned int            swp_io_count;   /* count of outstanding I/Os */
+	unsigned int            swp_next_seg;   /* slot following the last swapout */
 	c_segment_t             *swp_csegs;     /* back pointers to the c_segments. Used during swap reclaim. */
+	uint32_t                *swp_groups;    /* swapout group of each slot. Used by swapin prefetch. */
 
 	struct trim_list        *swp_delayed_trim_list_head;
 	unsigned int            swp_delayed_trim_count;
+
+	/* I/O statistics, updated atomically; times are in mach absolute time */
+	uint64_t                swp_write_bytes;
+	uint64_t                swp_write_count;
+	uint64_t                swp_write_time;
+	uint64_t                swp_read_bytes;
+	uint64_t                swp_read_count;
+	uint64_t                swp_read_time;
 };
 
 queue_head_t    swf_global_queue;
@@ -131,6 +141,9 @@ static void vm_swap_handle_delayed_trims(boolean_t);
 static void vm_swap_do_delayed_trim(struct swapfile *);
 static void vm_swap_wait_on_trim_handling_in_progress(void);
 static void vm_swapout_finish(c_segment_t c_seg, uint64_t f_offset, uint32_t size, kern_return_t kr);
+static void vm_swapfile_account_io(struct swapfile *swf, bool write, uint64_t size, uint64_t start);
+static uint32_t vm_swapout_group(c_segment_t c_seg, uint64_t now);
+static void vm_swapin_prefetch_thread(void);
 
 extern int vnode_getwithref(struct vnode* vp);
 
@@ -535,6 +548,15 @@ vm_compressor_swap_init(void)
 	proc_set_thread_policy_with_tid(kernel_task, thread->thread_id,
 	    TASK_POLICY_INTERNAL, TASK_POLICY_PASSIVE_IO, TASK_POLICY_ENABLE);
 
+	if (kernel_thread_start_priority((thread_continue_t)vm_swapin_prefetch_thread, NULL,
+	    BASEPRI_VM, &thread) != KERN_SUCCESS) {
+		panic("vm_swapin_prefetch_thread: create failed");
+	}
+	thread_set_thread_name(thread, "VM_swapin_prefetch");
+	proc_set_thread_policy_with_tid(kernel_task, thread->thread_id,
+	    TASK_POLICY_INTERNAL, TASK_POLICY_IO, THROTTLE_LEVEL_COMPRESSOR_TIER1);
+	thread_deallocate(thread);
+
 	vm_swap_enabled = 1;
 	printf("VM Swap Subsystem is ON\n");
 }
@@ -995,6 +1017,14 @@ vm_swapfile_gc_thread(void)
 #define   VM_SWAPOUT_LIMIT_T0   8
 #define   VM_SWAPOUT_LIMIT_MAX  8
 
+/*
+ * The limits above are for the default depth of VM_SWAPOUT_LIMIT_MAX
+ * outstanding swapouts: devices with deep queues (e.g. NVMe) can be given
+ * more with the vm_swapout_io_depth boot-arg / vm.swapout_io_depth sysctl,
+ * up to VM_SWAPOUT_IO_DEPTH_MAX, and every limit is scaled accordingly.
+ */
+TUNABLE_WRITEABLE(uint32_t, vm_swapout_io_depth, "vm_swapout_io_depth", VM_SWAPOUT_LIMIT_MAX);
+
 #define   VM_SWAPOUT_START      0
 #define   VM_SWAPOUT_T2_PASSIVE 1
 #define   VM_SWAPOUT_T1_PASSIVE 2
@@ -1125,10 +1155,11 @@ vm_swapout_thread_throttle_adjust(void)
 
 int vm_swapout_found_empty = 0;
 
-struct swapout_io_completion vm_swapout_ctx[VM_SWAPOUT_LIMIT_MAX];
+struct swapout_io_completion vm_swapout_ctx[VM_SWAPOUT_IO_DEPTH_MAX];
 
 int vm_swapout_soc_busy = 0;
 int vm_swapout_soc_done = 0;
+uint64_t vm_swapout_sequential = 0;     /* swapouts placed right after the previous one */
 
 
 static struct swapout_io_completion *
@@ -1136,12 +1167,12 @@ vm_swapout_find_free_soc(void)
 {
 	int      i;
 
-	for (i = 0; i < VM_SWAPOUT_LIMIT_MAX; i++) {
+	for (i = 0; i < VM_SWAPOUT_IO_DEPTH_MAX; i++) {
 		if (vm_swapout_ctx[i].swp_io_busy == 0) {
 			return &vm_swapout_ctx[i];
 		}
 	}
-	assert(vm_swapout_soc_busy == VM_SWAPOUT_LIMIT_MAX);
+	assert(vm_swapout_soc_busy == VM_SWAPOUT_IO_DEPTH_MAX);
 
 	return NULL;
 }
@@ -1152,7 +1183,7 @@ vm_swapout_find_done_soc(void)
 	int      i;
 
 	if (vm_swapout_soc_done) {
-		for (i = 0; i < VM_SWAPOUT_LIMIT_MAX; i++) {
+		for (i = 0; i < VM_SWAPOUT_IO_DEPTH_MAX; i++) {
 			if (vm_swapout_ctx[i].swp_io_done) {
 				return &vm_swapout_ctx[i];
 			}
@@ -1161,6 +1192,27 @@ vm_swapout_find_done_soc(void)
 	return NULL;
 }
 
+/*
+ * Number of swapouts that may be outstanding when unthrottled.
+ */
+static uint32_t
+vm_swapout_io_depth_get(void)
+{
+	uint32_t depth = os_atomic_load(&vm_swapout_io_depth, relaxed);
+
+	return MIN(MAX(depth, 1), VM_SWAPOUT_IO_DEPTH_MAX);
+}
+
+/*
+ * Number of swapouts that may be outstanding at the current throttle
+ * state, scaled from its limit at the default depth.
+ */
+static int
+vm_swapout_io_limit(void)
+{
+	return MAX(1, vm_swapout_limit * (int)vm_swapout_io_depth_get() / VM_SWAPOUT_LIMIT_MAX);
+}
+
 static void
 vm_swapout_complete_soc(struct swapout_io_completion *soc)
 {
@@ -1170,6 +1222,7 @@ vm_swapout_complete_soc(struct swapout_io_completion *soc)
 		kr = KERN_FAILURE;
 	} else {
 		kr = KERN_SUCCESS;
+		vm_swapfile_account_io(soc->swp_swf, true, soc->swp_c_size, soc->swp_start_time);
 	}
 
 	lck_mtx_unlock_always(c_list_lock);
@@ -1205,7 +1258,7 @@ static bool
 should_process_swapout_queue(const queue_head_t *swapout_list_head)
 {
 	bool process_queue = !queue_empty(swapout_list_head) &&
-	    vm_swapout_soc_busy < vm_swapout_limit &&
+	    vm_swapout_soc_busy < vm_swapout_io_limit() &&
 	    !compressor_store_stop_compaction;
 #if CONFIG_JETSAM
 	if (memorystatus_swap_all_apps && swapout_list_head == &c_late_swapout_list_head) {
@@ -1275,6 +1328,9 @@ again:
 			vm_swapout_found_empty++;
 			goto c_seg_is_empty;
 		}
+		if (c_seg->c_prefetched) {
+			vm_swapin_prefetch_retire(c_seg, false);
+		}
 		C_SEG_BUSY(c_seg);
 		c_seg->c_busy_swapping = 1;
 
@@ -1606,6 +1662,9 @@ vm_swap_create_file()
 			swf->swp_csegs = kalloc_type(c_segment_t, swf->swp_nsegs,
 			    Z_WAITOK | Z_ZERO);
 
+			swf->swp_groups = kalloc_data(swf->swp_nsegs * sizeof(uint32_t),
+			    Z_WAITOK | Z_ZERO);
+
 			/*
 			 * passing a NULL trim_list into vnode_trim_list
 			 * will return ENOTSUP if trim isn't supported
@@ -1667,15 +1726,24 @@ vm_swap_create_file()
 }
 
 extern void vnode_put(struct vnode* vp);
+/*
+ * Reads the segment at f_offset back and frees its slot. *group is set
+ * to the swapout group the slot was in, which is lost once it is freed.
+ */
 kern_return_t
-vm_swap_get(c_segment_t c_seg, uint64_t f_offset, uint64_t size)
+vm_swap_get(c_segment_t c_seg, uint64_t f_offset, uint64_t size, uint32_t *group)
 {
 	struct swapfile *swf = NULL;
 	uint64_t        file_offset = 0;
+	unsigned int    segidx;
 	int             retval = 0;
 
 	assert(c_seg->c_store.c_buffer);
 
+	*group = 0;
+	file_offset = (f_offset & SWAP_SLOT_MASK);
+	segidx = (unsigned int)(file_offset / compressed_swap_chunk_size);
+
 	lck_mtx_lock(&vm_swap_data_lock);
 
 	swf = vm_swapfile_for_handle(f_offset);
@@ -1685,6 +1753,9 @@ vm_swap_get(c_segment_t c_seg, uint64_t f_offset, uint64_t size)
 		retval = 1;
 		goto done;
 	}
+	if (segidx < swf->swp_nsegs) {
+		*group = swf->swp_groups[segidx];
+	}
 	swf->swp_io_count++;
 
 	lck_mtx_unlock(&vm_swap_data_lock);
@@ -1692,13 +1763,17 @@ vm_swap_get(c_segment_t c_seg, uint64_t f_offset, uint64_t size)
 #if DEVELOPMENT || DEBUG
 	C_SEG_MAKE_WRITEABLE(c_seg);
 #endif
-	file_offset = (f_offset & SWAP_SLOT_MASK);
-
 	if ((retval = vnode_getwithref(swf->swp_vp)) != 0) {
 		printf("vm_swap_get: vnode_getwithref on swapfile failed with %d\n", retval);
 	} else {
+		uint64_t start = mach_absolute_time();
+
 		retval = vm_swapfile_io(swf->swp_vp, file_offset, (uint64_t)c_seg->c_store.c_buffer, (int)(size / PAGE_SIZE_64), SWAP_READ, NULL);
 		vnode_put(swf->swp_vp);
+
+		if (retval == 0) {
+			vm_swapfile_account_io(swf, false, size, start);
+		}
 	}
 
 #if DEVELOPMENT || DEBUG
@@ -1732,6 +1807,279 @@ done:
 	}
 }
 
+/*
+ * Swapin prefetch.
+ *
+ * Segments swapped out within vm_swapin_prefetch_window_ms of each other,
+ * on behalf of the same task owner when they have one, form a swapout
+ * group: they went cold together, and tend to be needed again together
+ * when their process resumes. Since vm_swap_put() places successive
+ * swapouts in adjacent slots, a group occupies a run of neighbouring
+ * slots in its swapfile.
+ *
+ * When a fault swaps a segment in, the VM_swapin_prefetch thread brings
+ * back up to vm_swapin_prefetch_segs of its neighbours from the same group.
+ * A prefetched segment is used once a page is decompressed from it, and
+ * wasted if it is swapped out again or freed first. No prefetch is issued
+ * while vm_swapin_prefetch_waste_max prefetched segments are still unused.
+ */
+#define VM_SWAPIN_PREFETCH_SEGS_MAX     16
+#define VM_SWAPIN_PREFETCH_QUEUE_LEN    16
+
+TUNABLE_WRITEABLE(uint32_t, vm_swapin_prefetch_segs, "vm_swapin_prefetch_segs", 4);
+TUNABLE_WRITEABLE(uint32_t, vm_swapin_prefetch_waste_max, "vm_swapin_prefetch_waste_max", 32);
+TUNABLE(uint32_t, vm_swapin_prefetch_window_ms, "vm_swapin_prefetch_window_ms", 100);
+
+SCALABLE_COUNTER_DEFINE(vm_swapin_prefetch_issued);
+SCALABLE_COUNTER_DEFINE(vm_swapin_prefetch_used);
+SCALABLE_COUNTER_DEFINE(vm_swapin_prefetch_wasted);
+SCALABLE_COUNTER_DEFINE(vm_swapin_prefetch_throttled);
+uint32_t        vm_swapin_prefetch_outstanding = 0;
+
+static uint32_t vm_swapout_group_id = 1;
+static uint64_t vm_swapout_group_ts = 0;
+static void     *vm_swapout_group_owner = NULL;
+
+/*
+ * The group is captured by vm_swap_get(): by the time the request is
+ * served, the slot at vspr_f_offset is free and may be in another group.
+ */
+struct vm_swapin_prefetch_req {
+	uint64_t        vspr_f_offset;
+	uint32_t        vspr_group;
+};
+
+static LCK_SPIN_DECLARE(vm_swapin_prefetch_lock, &vm_swap_data_lock_grp);
+static struct vm_swapin_prefetch_req vm_swapin_prefetch_queue[VM_SWAPIN_PREFETCH_QUEUE_LEN];
+static uint32_t vm_swapin_prefetch_head = 0;
+static uint32_t vm_swapin_prefetch_tail = 0;
+static bool     vm_swapin_prefetch_thread_running = false;
+static bool     vm_swapin_prefetch_thread_inited = false;
+
+/*
+ * Returns the swapout group of a segment being swapped out at "now".
+ * Called with the vm_swap_data_lock held.
+ */
+static uint32_t
+vm_swapout_group(__unused c_segment_t c_seg, uint64_t now)
+{
+	void            *owner = NULL;
+	uint64_t        window;
+
+#if CONFIG_FREEZE
+	owner = c_seg->c_task_owner;
+#endif /* CONFIG_FREEZE */
+	nanoseconds_to_absolutetime((uint64_t)vm_swapin_prefetch_window_ms * NSEC_PER_MSEC, &window);
+
+	if (owner != vm_swapout_group_owner || now - vm_swapout_group_ts > window) {
+		if (++vm_swapout_group_id == 0) {
+			vm_swapout_group_id = 1;
+		}
+		vm_swapout_group_owner = owner;
+	}
+	vm_swapout_group_ts = now;
+
+	return vm_swapout_group_id;
+}
+
+/*
+ * A fault just swapped in the segment that was at f_offset, in group:
+ * ask for the rest of its group to be brought back.
+ */
+void
+vm_swapin_prefetch_note(uint64_t f_offset, uint32_t group)
+{
+	if (group == 0 || os_atomic_load(&vm_swapin_prefetch_segs, relaxed) == 0) {
+		return;
+	}
+	lck_spin_lock(&vm_swapin_prefetch_lock);
+
+	if (vm_swapin_prefetch_tail - vm_swapin_prefetch_head < VM_SWAPIN_PREFETCH_QUEUE_LEN) {
+		vm_swapin_prefetch_queue[vm_swapin_prefetch_tail++ % VM_SWAPIN_PREFETCH_QUEUE_LEN] =
+		    (struct vm_swapin_prefetch_req){
+			.vspr_f_offset = f_offset,
+			.vspr_group = group,
+		};
+
+		if (!vm_swapin_prefetch_thread_running) {
+			vm_swapin_prefetch_thread_running = true;
+			thread_wakeup((event_t)&vm_swapin_prefetch_queue);
+		}
+	}
+	lck_spin_unlock(&vm_swapin_prefetch_lock);
+}
+
+/*
+ * c_seg, which was prefetched, is being used or going away:
+ * called with the c_seg locked.
+ */
+void
+vm_swapin_prefetch_retire(c_segment_t c_seg, bool used)
+{
+	assert(c_seg->c_prefetched);
+
+	c_seg->c_prefetched = 0;
+	os_atomic_dec(&vm_swapin_prefetch_outstanding, relaxed);
+
+	if (used) {
+		counter_inc(&vm_swapin_prefetch_used);
+	} else {
+		counter_inc(&vm_swapin_prefetch_wasted);
+	}
+}
+
+/*
+ * Swaps in the segment in slot segidx of swf if it is still swapped out and
+ * part of group. Called with the vm_swap_data_lock held and page replacement
+ * disallowed; returns with the vm_swap_data_lock dropped if it swapped
+ * something in, and held otherwise.
+ */
+static bool
+vm_swapin_prefetch_seg(struct swapfile *swf, unsigned int segidx, uint32_t group)
+{
+	c_segment_t     c_seg;
+
+	if (((swf->swp_bitmap)[segidx >> 3] & (1 << (segidx % 8))) == 0 ||
+	    swf->swp_groups[segidx] != group ||
+	    (c_seg = swf->swp_csegs[segidx]) == NULL) {
+		return false;
+	}
+	lck_mtx_lock_spin_always(&c_seg->c_lock);
+
+	if (c_seg->c_busy || !C_SEG_IS_ONDISK(c_seg)) {
+		lck_mtx_unlock_always(&c_seg->c_lock);
+		return false;
+	}
+#if CONFIG_FREEZE
+	if (freezer_incore_cseg_acct) {
+		uint32_t incore_seg_count = c_segment_count - c_swappedout_count - c_swappedout_sparse_count;
+
+		if ((c_seg->c_slots_used + c_segment_pages_compressed_incore) >= c_segment_pages_compressed_nearing_limit ||
+		    (incore_seg_count + 1) >= c_segments_nearing_limit) {
+			lck_mtx_unlock_always(&c_seg->c_lock);
+			return false;
+		}
+	}
+#endif /* CONFIG_FREEZE */
+	lck_mtx_unlock(&vm_swap_data_lock);
+
+	/*
+	 * not aged on the swapped-in queue:
+	 * nothing asked for this segment yet
+	 */
+	c_seg_swapin(c_seg, FALSE, FALSE);
+
+	if (c_seg->c_state != C_ON_BAD_Q) {
+		c_seg->c_prefetched = 1;
+		os_atomic_inc(&vm_swapin_prefetch_outstanding, relaxed);
+		counter_inc(&vm_swapin_prefetch_issued);
+	}
+	lck_mtx_unlock_always(&c_seg->c_lock);
+
+	return true;
+}
+
+static void
+vm_swapin_prefetch_group(uint64_t f_offset, uint32_t group)
+{
+	struct swapfile *swf;
+	unsigned int    segidx, idx;
+	uint32_t        limit, issued = 0;
+	int             dir, dist;
+
+	limit = MIN(os_atomic_load(&vm_swapin_prefetch_segs, relaxed), VM_SWAPIN_PREFETCH_SEGS_MAX);
+	segidx = (unsigned int)((f_offset & SWAP_SLOT_MASK) / compressed_swap_chunk_size);
+
+	PAGE_REPLACEMENT_DISALLOWED(TRUE);
+	lck_mtx_lock(&vm_swap_data_lock);
+
+	swf = vm_swapfile_for_handle(f_offset);
+
+	if (swf == NULL || !(swf->swp_flags & SWAP_READY) || segidx >= swf->swp_nsegs) {
+		goto done;
+	}
+
+	/*
+	 * Look ahead first, where the rest of the group was written, then
+	 * behind. Slots of the group that were already swapped in are
+	 * skipped, but not more of them than we may prefetch.
+	 */
+	for (dir = 1; dir >= -1; dir -= 2) {
+		for (dist = 1; dist <= 2 * (int)limit && issued < limit; dist++) {
+			int64_t pos = (int64_t)segidx + dir * dist;
+
+			if (pos < 0 || pos >= swf->swp_nsegs) {
+				break;
+			}
+			idx = (unsigned int)pos;
+
+			if (((swf->swp_bitmap)[idx >> 3] & (1 << (idx % 8))) &&
+			    swf->swp_groups[idx] != group) {
+				break;
+			}
+			if (compressor_store_stop_compaction || hibernate_flushing) {
+				goto done;
+			}
+			if (os_atomic_load(&vm_swapin_prefetch_outstanding, relaxed) >=
+			    os_atomic_load(&vm_swapin_prefetch_waste_max, relaxed) ||
+			    vm_page_free_count < vm_page_free_target) {
+				counter_inc(&vm_swapin_prefetch_throttled);
+				goto done;
+			}
+			if (!vm_swapin_prefetch_seg(swf, idx, group)) {
+				continue;
+			}
+			issued++;
+
+			/*
+			 * the swapfile may have been marked for reclaim
+			 * while we were doing the I/O
+			 */
+			lck_mtx_lock(&vm_swap_data_lock);
+
+			if (!(swf->swp_flags & SWAP_READY)) {
+				goto done;
+			}
+		}
+	}
+done:
+	lck_mtx_unlock(&vm_swap_data_lock);
+	PAGE_REPLACEMENT_DISALLOWED(FALSE);
+}
+
+static void
+vm_swapin_prefetch_thread(void)
+{
+	struct vm_swapin_prefetch_req req;
+
+	if (!vm_swapin_prefetch_thread_inited) {
+#if CONFIG_THREAD_GROUPS
+		thread_group_vm_add();
+#endif /* CONFIG_THREAD_GROUPS */
+		vm_swapin_prefetch_thread_inited = true;
+	}
+
+	lck_spin_lock(&vm_swapin_prefetch_lock);
+
+	while (vm_swapin_prefetch_head != vm_swapin_prefetch_tail) {
+		req = vm_swapin_prefetch_queue[vm_swapin_prefetch_head++ % VM_SWAPIN_PREFETCH_QUEUE_LEN];
+		lck_spin_unlock(&vm_swapin_prefetch_lock);
+
+		vm_swapin_prefetch_group(req.vspr_f_offset, req.vspr_group);
+
+		lck_spin_lock(&vm_swapin_prefetch_lock);
+	}
+	vm_swapin_prefetch_thread_running = false;
+
+	assert_wait((event_t)&vm_swapin_prefetch_queue, THREAD_UNINT);
+
+	lck_spin_unlock(&vm_swapin_prefetch_lock);
+
+	thread_block((thread_continue_t)vm_swapin_prefetch_thread);
+
+	/* NOTREACHED */
+}
+
 kern_return_t
 vm_swap_put(vm_offset_t addr, uint64_t *f_offset, uint32_t size, c_segment_t c_seg, struct swapout_io_completion *soc)
 {
@@ -1763,6 +2111,16 @@ retry:
 		swf_eligible =  (swf->swp_flags & SWAP_READY) && (swf->swp_nseginuse < swf->swp_nsegs);
 
 		if (swf_eligible) {
+			/*
+			 * Keep successive swapouts in adjacent slots while we
+			 * can, rather than backfilling slots freed by swapins:
+			 * the device then sees one sequential stream of writes
+			 * it can merge, instead of scattered segment-sized ones.
+			 */
+			if (swf->swp_next_seg > segidx && swf->swp_next_seg < swf->swp_nsegs &&
+			    !((swf->swp_bitmap)[swf->swp_next_seg >> 3] & (1 << (swf->swp_next_seg % 8)))) {
+				segidx = swf->swp_next_seg;
+			}
 			while (segidx < swf->swp_nsegs) {
 				byte_for_segidx = segidx >> 3;
 				offset_within_byte = segidx % 8;
@@ -1778,6 +2136,10 @@ retry:
 				swf->swp_nseginuse++;
 				swf->swp_io_count++;
 				swf->swp_csegs[segidx] = c_seg;
+				if (segidx == swf->swp_next_seg) {
+					vm_swapout_sequential++;
+				}
+				swf->swp_next_seg = segidx + 1;
 
 				swapfile_index = swf->swp_index;
 				vm_swapfile_total_segs_used++;
@@ -1787,6 +2149,8 @@ retry:
 
 				now = mach_absolute_time();
 
+				swf->swp_groups[segidx] = vm_swapout_group(c_seg, now);
+
 				if (vm_swapfile_should_create(now) && !vm_swapfile_create_thread_running) {
 					thread_wakeup((event_t) &vm_swapfile_create_needed);
 				}
@@ -1850,11 +2214,14 @@ issue_io:
 
 	*f_offset = (swapfile_index << SWAP_DEVICE_SHIFT) | file_offset;
 
+	now = mach_absolute_time();
+
 	if (soc) {
 		soc->swp_c_seg = c_seg;
 		soc->swp_c_size = size;
 
 		soc->swp_swf = swf;
+		soc->swp_start_time = now;
 
 		soc->swp_io_error = 0;
 		soc->swp_io_done = 0;
@@ -1867,6 +2234,10 @@ issue_io:
 	} else {
 		error = vm_swapfile_io(swf->swp_vp, file_offset, addr, (int) (size / PAGE_SIZE_64), SWAP_WRITE, upl_ctx);
 		drop_iocount = TRUE;
+
+		if (error == 0 && upl_ctx == NULL) {
+			vm_swapfile_account_io(swf, true, size, now);
+		}
 	}
 
 	if (error || upl_ctx == NULL) {
@@ -1902,6 +2273,61 @@ vm_swap_put_finish(struct swapfile *swf, uint64_t *f_offset, int error, boolean_
 	return KERN_SUCCESS;
 }
 
+static void
+vm_swapfile_account_io(struct swapfile *swf, bool write, uint64_t size, uint64_t start)
+{
+	uint64_t elapsed = mach_absolute_time() - start;
+
+	if (write) {
+		os_atomic_add(&swf->swp_write_bytes, size, relaxed);
+		os_atomic_inc(&swf->swp_write_count, relaxed);
+		os_atomic_add(&swf->swp_write_time, elapsed, relaxed);
+	} else {
+		os_atomic_add(&swf->swp_read_bytes, size, relaxed);
+		os_atomic_inc(&swf->swp_read_count, relaxed);
+		os_atomic_add(&swf->swp_read_time, elapsed, relaxed);
+	}
+}
+
+/*
+ * Fills in up to max entries, one per swapfile in use,
+ * and returns how many such entries there are.
+ */
+uint32_t
+vm_swap_stats_snapshot(struct vm_swapfile_stats *out, uint32_t max)
+{
+	struct swapfile *swf;
+	uint32_t n = 0;
+
+	lck_mtx_lock(&vm_swap_data_lock);
+
+	queue_iterate(&swf_global_queue, swf, struct swapfile *, swp_queue) {
+		if (!(swf->swp_flags & (SWAP_READY | SWAP_RECLAIM))) {
+			continue;
+		}
+		if (n < max) {
+			struct vm_swapfile_stats *vss = &out[n];
+			uint64_t ns;
+
+			vss->vss_index = swf->swp_index;
+			vss->vss_size = swf->swp_size;
+			vss->vss_used = (uint64_t)swf->swp_nseginuse * compressed_swap_chunk_size;
+			vss->vss_write_bytes = os_atomic_load(&swf->swp_write_bytes, relaxed);
+			vss->vss_writes = os_atomic_load(&swf->swp_write_count, relaxed);
+			absolutetime_to_nanoseconds(os_atomic_load(&swf->swp_write_time, relaxed), &ns);
+			vss->vss_write_time_us = ns / NSEC_PER_USEC;
+			vss->vss_read_bytes = os_atomic_load(&swf->swp_read_bytes, relaxed);
+			vss->vss_reads = os_atomic_load(&swf->swp_read_count, relaxed);
+			absolutetime_to_nanoseconds(os_atomic_load(&swf->swp_read_time, relaxed), &ns);
+			vss->vss_read_time_us = ns / NSEC_PER_USEC;
+		}
+		n++;
+	}
+	lck_mtx_unlock(&vm_swap_data_lock);
+
+	return n;
+}
+
 
 static void
 vm_swap_free_now(struct swapfile *swf, uint64_t f_offset)
@@ -2281,6 +2707,8 @@ ReTry_for_cseg:
 			vm_swap_get_failures++;
 			goto swap_io_failed;
 		} else {
+			uint64_t start = mach_absolute_time();
+
 			if (vm_swapfile_io(swf->swp_vp, f_offset, addr, (int)(c_size / PAGE_SIZE_64), SWAP_READ, NULL)) {
 				/*
 				 * reading the data back in failed, so convert c_seg
@@ -2295,6 +2723,7 @@ ReTry_for_cseg:
 				goto swap_io_failed;
 			}
 			vnode_put(swf->swp_vp);
+			vm_swapfile_account_io(swf, false, c_size, start);
 		}
 
 		counter_add(&vm_statistics_swapins, c_size >> PAGE_SHIFT);
@@ -2370,6 +2799,7 @@ swap_io_failed:
 	vm_swapfile_close((uint64_t)(swf->swp_path), swf->swp_vp);
 
 	kfree_type(c_segment_t, swf->swp_nsegs, swf->swp_csegs);
+	kfree_data(swf->swp_groups, swf->swp_nsegs * sizeof(uint32_t));
 	kfree_data(swf->swp_bitmap, MAX((swf->swp_nsegs >> 3), 1));
 
 	lck_mtx_lock(&vm_swap_data_lock);
@@ -2468,9 +2898,10 @@ vm_swap_out_of_space(void)
 	}
 
 	if (vm_swapfile_total_segs_alloced - vm_swapfile_total_segs_used <
-	    VM_SWAPOUT_LIMIT_MAX) {
+	    vm_swapout_io_depth_get()) {
 		/*
-		 * We have run out of swapfile segments
+		 * We don't have room left for as many swapouts as
+		 * may be outstanding at once
 		 */
 		if (vm_num_swap_files == vm_num_swap_files_config) {
 			/* And we can't create any more swapfiles */
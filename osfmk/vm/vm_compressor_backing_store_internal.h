@@ -89,11 +89,15 @@ struct swapout_io_completion {
 
 	struct swapfile *swp_swf;
 	uint64_t        swp_f_offset;
+	uint64_t        swp_start_time;
 
 	struct upl_io_completion swp_upl_ctx;
 };
 void vm_swapout_iodone(void *, int);
 
+void vm_swapin_prefetch_note(uint64_t f_offset, uint32_t group);
+void vm_swapin_prefetch_retire(c_segment_t c_seg, bool used);
+
 
 kern_return_t vm_swap_put_finish(struct swapfile *, uint64_t *, int, boolean_t);
 kern_return_t vm_swap_put(vm_offset_t, uint64_t*, uint32_t, c_segment_t, struct swapout_io_completion *);
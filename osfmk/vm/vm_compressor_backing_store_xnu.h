@@ -33,6 +33,25 @@
 uint64_t vm_swap_get_total_space(void);
 uint64_t vm_swap_get_free_space(void);
 
+/* most swapouts that may be outstanding at once (vm.swapout_io_depth) */
+#define VM_SWAPOUT_IO_DEPTH_MAX         64
+
+/* Cumulative I/O statistics of a swapfile, as reported by vm.swapfile_stats */
+struct vm_swapfile_stats {
+	uint32_t vss_index;
+	uint32_t vss_reserved;
+	uint64_t vss_size;              /* bytes */
+	uint64_t vss_used;              /* bytes */
+	uint64_t vss_write_bytes;
+	uint64_t vss_writes;
+	uint64_t vss_write_time_us;     /* summed over writes */
+	uint64_t vss_read_bytes;
+	uint64_t vss_reads;
+	uint64_t vss_read_time_us;      /* summed over reads */
+};
+
+uint32_t vm_swap_stats_snapshot(struct vm_swapfile_stats *out, uint32_t max);
+
 #if CONFIG_FREEZE
 boolean_t vm_swap_max_budget(uint64_t *);
 #endif /* CONFIG_FREEZE */
@@ -247,11 +247,12 @@ struct c_segment {
 	    c_state:4,                          /* what state is the segment in which dictates which q to find it on */
 	    c_overage_swap:1,
 	    c_has_donated_pages:1,
+	    c_prefetched:1,                     /* swapped in ahead of a fault, not used yet */
 #if CONFIG_FREEZE
 	    c_has_freezer_pages:1,
-	    c_reserved:21;
+	    c_reserved:20;
 #else /* CONFIG_FREEZE */
-	c_reserved:22;
+	c_reserved:21;
 #endif /* CONFIG_FREEZE */
 
 	int             c_slot_var_array_len;  /* length of the allocated c_slot_var_array */
@@ -396,7 +397,7 @@ void vm_decompressor_unlock(void);
 void vm_compressor_delay_trim(void);
 void vm_compressor_do_warmup(void);
 
-extern kern_return_t    vm_swap_get(c_segment_t, uint64_t, uint64_t);
+extern kern_return_t    vm_swap_get(c_segment_t, uint64_t, uint64_t, uint32_t *);
 
 extern uint32_t         c_age_count;
 extern uint32_t         c_early_swapout_count, c_regular_swapout_count, c_late_swapout_count;
@@ -949,7 +949,7 @@ vm_fault_enqueue_throttled_locked(vm_page_t m)
  * page queue lock must NOT be held
  */
 static int
-vm_fault_zero_page(vm_page_t m, boolean_t no_zero_fill)
+vm_fault_zero_page(vm_page_t m, boolean_t no_zero_fill, bool zeroed)
 {
 	int my_fault = DBG_ZERO_FILL_FAULT;
 	vm_object_t     object;
@@ -981,9 +981,11 @@ vm_fault_zero_page(vm_page_t m, boolean_t no_zero_fill)
 			return my_fault;
 		}
 	} else {
-		vm_page_zero_fill(
-			m
-			);
+		if (!zeroed) {
+			vm_page_zero_fill(
+				m
+				);
+		}
 
 		counter_inc(&vm_statistics_zero_fill_count);
 		DTRACE_VM2(zfod, int, 1, (uint64_t *), NULL);
@@ -1454,7 +1456,7 @@ vm_fault_page(
 					 * zero-fill the page and put it on
 					 * the correct paging queue
 					 */
-					my_fault = vm_fault_zero_page(m, no_zero_fill);
+					my_fault = vm_fault_zero_page(m, no_zero_fill, false);
 
 					break;
 				} else {
@@ -2125,8 +2127,14 @@ dont_look_for_page:
 				return error;
 			}
 
+			bool zeroed = false;
+
 			if (m == VM_PAGE_NULL) {
-				m = vm_page_grab_options(grab_options);
+				if (no_zero_fill) {
+					m = vm_page_grab_options(grab_options);
+				} else {
+					m = vm_page_grab_zeroed(grab_options, &zeroed);
+				}
 
 				if (m == VM_PAGE_NULL) {
 					vm_fault_cleanup(object, VM_PAGE_NULL);
@@ -2141,7 +2149,7 @@ dont_look_for_page:
 				clear_absent_on_error = true;
 			}
 
-			my_fault = vm_fault_zero_page(m, no_zero_fill);
+			my_fault = vm_fault_zero_page(m, no_zero_fill, zeroed);
 
 			break;
 		} else {
@@ -4360,6 +4368,286 @@ vm_fault_type_for_tracing(boolean_t need_copy_on_read, int type_of_fault)
 	return type_of_fault;
 }
 
+/*
+ * Fault-around: once a fault has mapped a resident page, also map the
+ * resident pages of the same VM object around it, so that touching them
+ * does not cost a fault of its own.
+ *
+ * Map entries opt in with MADV_FAULT_AROUND (VM_BEHAVIOR_FAULT_AROUND),
+ * or all of them do when "vm_fault_around_default" is set, except those
+ * advised VM_BEHAVIOR_RANDOM. The window is "vm_fault_around_pages" long:
+ * aligned on its own size around the faulting page, or following (preceding)
+ * it for VM_BEHAVIOR_SEQUENTIAL (VM_BEHAVIOR_RSEQNTL) entries.
+ *
+ * Only pages that need none of the work of a real fault are mapped ahead:
+ * no paging in, no copy-on-write, no code-signing validation and no page
+ * queue manipulation. They are mapped read-only and non-executable, and
+ * without marking them referenced, so that they still look idle to the
+ * pageout daemon until they are actually touched.
+ */
+#define VM_FAULT_AROUND_MAX     64      /* bits in map->fault_around_pending */
+
+TUNABLE_WRITEABLE(uint32_t, vm_fault_around_pages, "vm_fault_around_pages", 16);
+TUNABLE_WRITEABLE(bool, vm_fault_around_default, "vm_fault_around_default", false);
+
+SCALABLE_COUNTER_DEFINE(vm_fault_around_mapped);
+SCALABLE_COUNTER_DEFINE(vm_fault_around_sampled);
+SCALABLE_COUNTER_DEFINE(vm_fault_around_touched);
+
+static inline bool
+vm_fault_around_wanted(vm_object_fault_info_t fault_info)
+{
+	if (fault_info->behavior == VM_BEHAVIOR_RANDOM) {
+		return false;
+	}
+	return fault_info->fi_fault_around || vm_fault_around_default;
+}
+
+/*
+ * Pages mapped ahead by the previous fault-around in this map before
+ * anything referenced them: see how many have been touched since.
+ * This is only a sample (a page can also be referenced through another
+ * mapping) and racing faults may lose one, which is fine for statistics.
+ */
+static void
+vm_fault_around_sample(vm_map_t map, pmap_t pmap)
+{
+	vm_map_offset_t start;
+	uint64_t        pending;
+	uint32_t        touched = 0;
+
+	pending = os_atomic_xchg(&map->fault_around_pending, 0, relaxed);
+	if (pending == 0) {
+		return;
+	}
+	start = os_atomic_load(&map->fault_around_start, relaxed);
+	counter_add(&vm_fault_around_sampled, __builtin_popcountll(pending));
+
+	while (pending) {
+		int i = __builtin_ctzll(pending);
+		ppnum_t pn;
+
+		pending &= pending - 1;
+		pn = pmap_find_phys(pmap, start + ptoa_64(i));
+		if (pn != 0 && pmap_is_referenced(pn)) {
+			touched++;
+		}
+	}
+	counter_add(&vm_fault_around_touched, touched);
+}
+
+/*
+ * The page at "offset" in "object" was just entered at "vaddr" in "pmap",
+ * with "prot", on behalf of a fault in "map".
+ *
+ * The map must be locked shared, the object locked shared or exclusive.
+ * Nothing is ever blocked on: pages that aren't ready are skipped and the
+ * window is cut short if the pmap layer would need to allocate.
+ */
+static void
+vm_fault_around(
+	vm_map_t                map,
+	pmap_t                  pmap,
+	vm_map_offset_t         vaddr,
+	vm_object_t             object,
+	vm_object_offset_t      offset,
+	vm_prot_t               prot,
+	vm_object_fault_info_t  fault_info)
+{
+	int64_t         npages, first, last, idx;
+	uint64_t        pending = 0;
+	uint32_t        mapped = 0;
+
+	npages = MIN(os_atomic_load(&vm_fault_around_pages, relaxed), VM_FAULT_AROUND_MAX);
+	prot &= ~(VM_PROT_WRITE | VM_PROT_EXECUTE);
+	if (npages <= 1 ||
+	    !(prot & VM_PROT_READ) ||
+	    pmap == kernel_pmap ||
+	    object->code_signed ||
+	    object->phys_contiguous ||
+	    object->all_reusable) {
+		return;
+	}
+
+	vm_fault_around_sample(map, pmap);
+
+	/* window, in pages relative to vaddr, clipped to the map entry */
+	switch (fault_info->behavior) {
+	case VM_BEHAVIOR_SEQUENTIAL:
+		first = 0;
+		break;
+	case VM_BEHAVIOR_RSEQNTL:
+		first = 1 - npages;
+		break;
+	default:
+		first = -(int64_t)(atop_64(vaddr) % (uint64_t)npages);
+		break;
+	}
+	last = first + npages;
+	first = MAX(first, -(int64_t)atop_64(offset - fault_info->lo_offset));
+	last = MIN(last, (int64_t)atop_64(fault_info->hi_offset - offset));
+
+	for (idx = first; idx < last; idx++) {
+		vm_map_offset_t va = vaddr + (vm_map_offset_t)(idx * PAGE_SIZE_64);
+		vm_page_t       m;
+		ppnum_t         pn;
+		bool            referenced;
+		kern_return_t   kr;
+
+		if (idx == 0) {
+			continue;
+		}
+		m = vm_page_lookup(object, offset + (vm_object_offset_t)(idx * PAGE_SIZE_64));
+		if (m == VM_PAGE_NULL ||
+		    m->vmp_busy ||
+		    m->vmp_unusual ||
+		    m->vmp_cleaning ||
+		    m->vmp_laundry ||
+		    m->vmp_reusable ||
+		    m->vmp_q_state == VM_PAGE_ON_SECLUDED_Q ||
+		    vm_page_is_fictitious(m)) {
+			continue;
+		}
+		if (pmap_find_phys(pmap, va) != 0) {
+			/* already mapped */
+			continue;
+		}
+
+		pn = VM_PAGE_GET_PHYS_PAGE(m);
+		referenced = pmap_is_referenced(pn);
+		if (!m->vmp_pmapped) {
+			/* we may only hold the object lock shared: see vm_fault_enter_set_mapped() */
+			pmap_lock_phys_page(pn);
+			m->vmp_pmapped = TRUE;
+			pmap_unlock_phys_page(pn);
+		}
+		kr = pmap_enter_options_check(pmap, va, 0, m, prot, VM_PROT_NONE,
+		    FALSE, fault_info->pmap_options | PMAP_OPTIONS_NOWAIT);
+		if (kr != KERN_SUCCESS) {
+			break;
+		}
+		mapped++;
+		if (!referenced) {
+			pending |= 1ull << (idx - first);
+		}
+	}
+
+	if (mapped) {
+		counter_add(&vm_fault_around_mapped, mapped);
+		if (pending) {
+			os_atomic_store(&map->fault_around_start,
+			    vaddr - ptoa_64(-first), relaxed);
+			os_atomic_store(&map->fault_around_pending, pending, relaxed);
+		}
+	}
+}
+
+/*
+ * Speculative faults: resolve the simplest faults, a resident page of an
+ * anonymous VM object mapped directly in the faulting map, without taking
+ * the map lock (see vm_map_lookup_speculative()). Threads faulting on such
+ * pages no longer queue behind threads changing unrelated parts of the
+ * address space (mmap(), mprotect(), ...) with the map locked exclusive.
+ *
+ * Anything that is not that simple, or that would need to block, falls back
+ * to the regular fault path.
+ */
+TUNABLE_WRITEABLE(bool, vm_fault_speculative, "vm_fault_speculative", true);
+
+SCALABLE_COUNTER_DEFINE(vm_fault_speculative_hits);
+SCALABLE_COUNTER_DEFINE(vm_fault_speculative_fallbacks);
+
+static bool
+vm_fault_speculative_enter(
+	vm_map_t                map,
+	vm_map_offset_t         vaddr,
+	vm_map_offset_t         trace_real_vaddr,
+#if CONFIG_DTRACE
+	vm_map_offset_t         real_vaddr,
+#else
+	__unused vm_map_offset_t real_vaddr,
+#endif /* CONFIG_DTRACE */
+	vm_prot_t               caller_prot,
+	vm_object_fault_info_t  fault_info,
+	int                     *type_of_fault)
+{
+	struct vm_object_fault_info spec_info = *fault_info;
+	vm_object_t             object;
+	vm_object_offset_t      offset;
+	vm_prot_t               prot;
+	vm_page_t               m;
+	boolean_t               need_retry = FALSE;
+	bool                    page_sleep_needed = false;
+	uint8_t                 object_lock_type = OBJECT_LOCK_EXCLUSIVE;
+	kern_return_t           kr;
+
+	if (vm_map_lookup_speculative(map, vaddr, caller_prot,
+	    &object, &offset, &prot, &spec_info) != KERN_SUCCESS) {
+		counter_inc(&vm_fault_speculative_fallbacks);
+		return false;
+	}
+
+	if (!object->internal ||
+	    object->phys_contiguous ||
+	    object->blocked_access ||
+	    VM_OBJECT_PURGEABLE_FAULT_ERROR(object)) {
+		goto fallback;
+	}
+	if (object->vo_copy != VM_OBJECT_NULL) {
+		/* a write would have to push the page into the copy object */
+		if ((caller_prot & VM_PROT_WRITE) ||
+		    pmap_has_prot_policy(map->pmap, spec_info.pmap_options & PMAP_OPTIONS_TRANSLATED_ALLOW_EXECUTE, prot)) {
+			goto fallback;
+		}
+		prot &= ~VM_PROT_WRITE;
+	}
+
+	m = vm_page_lookup(object, vm_object_trunc_page(offset));
+	if (m == VM_PAGE_NULL ||
+	    !vm_page_is_canonical(m) ||
+	    m->vmp_busy ||
+	    m->vmp_unusual ||
+	    m->vmp_cleaning ||
+	    m->vmp_laundry ||
+	    m->vmp_q_state == VM_PAGE_ON_PAGEOUT_Q ||
+#if CONFIG_TRACK_UNMODIFIED_ANON_PAGES
+	    ((caller_prot & VM_PROT_WRITE) && m->vmp_unmodified_ro) ||
+#endif /* CONFIG_TRACK_UNMODIFIED_ANON_PAGES */
+	    vm_fault_cs_need_validation(map->pmap, m, object, PAGE_SIZE, 0)) {
+		goto fallback;
+	}
+
+	/* never block in pmap_enter(): exclusive lockers wait for us */
+	kr = vm_fault_enter(m, map->pmap, vaddr, PAGE_SIZE, 0, prot, caller_prot,
+	    FALSE, VM_KERN_MEMORY_NONE, &spec_info, &need_retry,
+	    type_of_fault, &object_lock_type, &page_sleep_needed);
+	if (kr != KERN_SUCCESS || need_retry || page_sleep_needed) {
+		goto fallback;
+	}
+
+	KDBG_RELEASE(MACHDBG_CODE(DBG_MACH_WORKINGSET, VM_REAL_FAULT_ADDR_INTERNAL) | DBG_FUNC_NONE,
+	    trace_real_vaddr, (spec_info.user_tag << 16) | (caller_prot << 8) | *type_of_fault,
+	    m->vmp_offset, get_current_unique_pid());
+	KDBG_FILTERED(MACHDBG_CODE(DBG_MACH_WORKINGSET, VM_REAL_FAULT_FAST), get_current_unique_pid());
+	DTRACE_VM6(real_fault, vm_map_offset_t, real_vaddr, vm_map_offset_t, m->vmp_offset,
+	    int, MACHDBG_CODE(DBG_MACH_WORKINGSET, VM_REAL_FAULT_ADDR_INTERNAL), int, caller_prot,
+	    int, *type_of_fault, int, spec_info.user_tag);
+
+	vm_fault_is_sequential(object, offset, spec_info.behavior);
+	vm_fault_deactivate_behind(object, offset, spec_info.behavior);
+
+	vm_object_unlock(object);
+	vm_map_spec_fault_end(map);
+	counter_inc(&vm_fault_speculative_hits);
+	return true;
+
+fallback:
+	vm_object_unlock(object);
+	vm_map_spec_fault_end(map);
+	counter_inc(&vm_fault_speculative_fallbacks);
+	return false;
+}
+
 uint64_t vm_fault_resilient_media_initiate = 0;
 uint64_t vm_fault_resilient_media_retry = 0;
 uint64_t vm_fault_resilient_media_proceed = 0;
@@ -4399,6 +4687,7 @@ vm_fault_internal(
 	kern_return_t           kr;
 
 	vm_page_t               m;      /* Fast access to result_page */
+	bool                    m_zeroed = false; /* m came pre-zeroed */
 	kern_return_t           error_code;
 	vm_object_t             cur_object;
 	vm_object_t             m_object = NULL;
@@ -4580,6 +4869,21 @@ RetryFault:
 	 */
 	fault_type = original_fault_type;
 	map = original_map;
+
+	if (vm_fault_speculative &&
+	    caller_pmap == PMAP_NULL &&
+	    physpage_p == NULL &&
+	    !fault_info->fi_change_wiring &&
+	    !resilient_media_retry &&
+	    !rtfault &&
+	    map->pmap != kernel_pmap &&
+	    fault_page_size == PAGE_SIZE &&
+	    vm_fault_speculative_enter(map, vaddr, trace_real_vaddr, real_vaddr,
+	    caller_prot, fault_info, &type_of_fault)) {
+		kr = KERN_SUCCESS;
+		goto done;
+	}
+
 	vm_map_lock_read(map);
 
 	if (resilient_media_retry) {
@@ -5251,6 +5555,16 @@ FastPmapEnter:
 					    &page_sleep_needed);
 				}
 
+				if (kr == KERN_SUCCESS && !need_retry && !page_sleep_needed &&
+				    caller_pmap == PMAP_NULL && !wired &&
+				    !fault_info->fi_change_wiring &&
+				    top_object == VM_OBJECT_NULL && m_object == object &&
+				    map == original_map && real_map == map &&
+				    fault_page_size == PAGE_SIZE &&
+				    vm_fault_around_wanted(fault_info)) {
+					vm_fault_around(map, pmap, vaddr, object, offset, prot, fault_info);
+				}
+
 				vm_fault_complete(
 					map,
 					real_map,
@@ -5808,7 +6122,11 @@ FastPmapEnter:
 				}
 #endif /* MACH_ASSERT */
 
-				m = vm_page_grab_options(grab_options);
+				if (map->no_zero_fill) {
+					m = vm_page_grab_options(grab_options);
+				} else {
+					m = vm_page_grab_zeroed(grab_options, &m_zeroed);
+				}
 				m_object = NULL;
 
 				if (m == VM_PAGE_NULL) {
@@ -5946,7 +6264,8 @@ FastPmapEnter:
 					}
 					if (type_of_fault == DBG_ZERO_FILL_FAULT) {
 						/*
-						 * Now zero fill page...
+						 * Now zero fill page, unless it came
+						 * pre-zeroed...
 						 * the page is probably going to
 						 * be written soon, so don't bother
 						 * to clear the modified bit
@@ -5954,9 +6273,11 @@ FastPmapEnter:
 						 *   NOTE: This code holds the map
 						 *   lock across the zero fill.
 						 */
-						vm_page_zero_fill(
-							m
-							);
+						if (!m_zeroed) {
+							vm_page_zero_fill(
+								m
+								);
+						}
 						counter_inc(&vm_statistics_zero_fill_count);
 						DTRACE_VM2(zfod, int, 1, (uint64_t *), NULL);
 					}
@@ -6660,6 +6981,15 @@ handle_copy_delay:
 				m->vmp_dirty = TRUE;
 			}
 		}
+		if (caller_pmap == PMAP_NULL && !wired &&
+		    !fault_info->fi_change_wiring &&
+		    top_page == VM_PAGE_NULL && m_object == object &&
+		    map == original_map && real_map == map &&
+		    fault_page_size == PAGE_SIZE &&
+		    vm_fault_around_wanted(fault_info)) {
+			/* map the rest of the cluster that was just paged in */
+			vm_fault_around(map, pmap, vaddr, m_object, offset, prot, fault_info);
+		}
 	} else {
 		vm_map_entry_t          entry;
 		vm_map_offset_t         laddr;
@@ -140,6 +140,7 @@ typedef enum __enum_closed {
 	VMLPAN(VM_MAP_REMAP_EXTRACT),
 	VMLPAN(VM_MAP_REMOVE_AND_UNLOCK),
 	VMLPAN(VM_MAP_REMOVE_GUARD),
+	VMLPAN(VM_MAP_REMOVE_RANGES),
 	VMLPAN(VM_MAP_REUSABLE_PAGES),
 	VMLPAN(VM_MAP_REUSE_PAGES),
 	VMLPAN(VM_MAP_SET_CACHE_ATTR),
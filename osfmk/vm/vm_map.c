@@ -79,6 +79,7 @@
 #include <mach/memory_object.h>
 #include <mach/mach_vm_server.h>
 #include <machine/cpu_capabilities.h>
+#include <machine/machine_cpu.h>
 #include <mach/sdt.h>
 
 #include <kern/assert.h>
@@ -757,6 +758,7 @@ vm_map_lock_read_to_write(vm_map_t map)
 	vmlp_lock_event_locked(VMLP_EVENT_LOCK_TRY_UPGRADE, map);
 	assert(!vm_map_is_sealed(map));
 	if (lck_rw_lock_shared_to_exclusive(&(map)->lock)) {
+		vm_map_seq_write_begin(map);
 		DTRACE_VM(vm_map_lock_upgrade);
 		vmlp_lock_event_locked(VMLP_EVENT_LOCK_GOT_UPGRADE, map);
 		return 0;
@@ -771,6 +773,7 @@ vm_map_try_lock(vm_map_t map)
 {
 	vmlp_lock_event_unlocked(VMLP_EVENT_LOCK_TRY_EXCL, map);
 	if (lck_rw_try_lock_exclusive(&(map)->lock)) {
+		vm_map_seq_write_begin(map);
 		DTRACE_VM(vm_map_lock_w);
 		vmlp_lock_event_locked(VMLP_EVENT_LOCK_GOT_EXCL, map);
 		return TRUE;
@@ -812,6 +815,295 @@ kdp_vm_map_is_acquired_exclusive(vm_map_t map)
 	return kdp_lck_rw_lock_is_acquired_exclusive(&map->lock);
 }
 
+/*
+ *	Range locks.
+ *
+ *	Maps of processes that opt in (see vm_map_enable_range_locks()) let
+ *	vm_map_protect() and vm_map_remove() lock the address range they
+ *	operate on before taking the map lock. The map lock is then only held
+ *	to update the map entries: the expensive pmap work (pmap_protect(),
+ *	pmap_remove()) is done with just the range locked and the entries
+ *	marked "in_transition", so that operations on disjoint ranges from
+ *	different threads can proceed in parallel.
+ *
+ *	Held ranges never overlap, so they are kept in a red-black tree
+ *	sorted by start address, like the map entries in the RB store, and
+ *	the lookup for an overlapping range is a plain tree descent.
+ *	Range lock structures live on the stack of their holder.
+ *
+ *	The range lock must never be waited for with the map lock held.
+ */
+struct vm_map_range_lock {
+	RB_ENTRY(vm_map_range_lock) vmrl_link;
+	vm_map_offset_t         vmrl_start;
+	vm_map_offset_t         vmrl_end;
+	bool                    vmrl_held;
+};
+
+RB_HEAD(vm_map_range_tree, vm_map_range_lock);
+
+struct vm_map_range_locks {
+	lck_mtx_t               vmrls_lock;
+	struct vm_map_range_tree vmrls_tree;
+	uint32_t                vmrls_waiters;
+};
+
+static int
+vm_map_range_lock_compare(
+	struct vm_map_range_lock *node,
+	struct vm_map_range_lock *parent)
+{
+	if (node->vmrl_end <= parent->vmrl_start) {
+		return -1;
+	}
+	if (node->vmrl_start >= parent->vmrl_end) {
+		return 1;
+	}
+	/* overlapping ranges compare equal */
+	return 0;
+}
+
+RB_PROTOTYPE_SC(static, vm_map_range_tree, vm_map_range_lock, vmrl_link,
+    vm_map_range_lock_compare);
+RB_GENERATE(vm_map_range_tree, vm_map_range_lock, vmrl_link,
+    vm_map_range_lock_compare);
+
+SCALABLE_COUNTER_DEFINE(vm_map_range_lock_count);
+SCALABLE_COUNTER_DEFINE(vm_map_range_lock_contended);
+SCALABLE_COUNTER_DEFINE(vm_map_range_lock_wait_us);
+
+kern_return_t
+vm_map_enable_range_locks(
+	vm_map_t                map)
+{
+	struct vm_map_range_locks *rls;
+
+	if (map->pmap == kernel_pmap) {
+		return KERN_INVALID_ARGUMENT;
+	}
+	if (os_atomic_load(&map->vmmap_range_locks, relaxed)) {
+		return KERN_SUCCESS;
+	}
+
+	rls = kalloc_type(struct vm_map_range_locks, Z_WAITOK | Z_ZERO | Z_NOFAIL);
+	lck_mtx_init(&rls->vmrls_lock, &vm_map_lck_grp, LCK_ATTR_NULL);
+	RB_INIT(&rls->vmrls_tree);
+
+	if (!os_atomic_cmpxchg(&map->vmmap_range_locks, NULL, rls, release)) {
+		lck_mtx_destroy(&rls->vmrls_lock, &vm_map_lck_grp);
+		kfree_type(struct vm_map_range_locks, rls);
+	}
+	return KERN_SUCCESS;
+}
+
+bool
+vm_map_has_range_locks(
+	vm_map_t                map)
+{
+	return os_atomic_load(&map->vmmap_range_locks, relaxed) != NULL;
+}
+
+static void
+vm_map_range_locks_destroy(
+	vm_map_t                map)
+{
+	struct vm_map_range_locks *rls = map->vmmap_range_locks;
+
+	if (rls) {
+		assert(RB_EMPTY(&rls->vmrls_tree));
+		map->vmmap_range_locks = NULL;
+		lck_mtx_destroy(&rls->vmrls_lock, &vm_map_lck_grp);
+		kfree_type(struct vm_map_range_locks, rls);
+	}
+}
+
+/*
+ * Locks [start, end) in "map", waiting for any overlapping range held by
+ * another thread. Does nothing for maps without range locks: check with
+ * vm_map_range_locked().
+ */
+static void
+vm_map_range_lock(
+	vm_map_t                map,
+	vm_map_offset_t         start,
+	vm_map_offset_t         end,
+	struct vm_map_range_lock *rl)
+{
+	struct vm_map_range_locks *rls;
+	uint64_t wait_start = 0;
+
+	rls = os_atomic_load(&map->vmmap_range_locks, acquire);
+	rl->vmrl_held = false;
+	if (rls == NULL || start >= end) {
+		return;
+	}
+	vm_map_lock_assert_notheld(map);
+
+	rl->vmrl_start = start;
+	rl->vmrl_end = end;
+
+	lck_mtx_lock(&rls->vmrls_lock);
+	while (RB_INSERT(vm_map_range_tree, &rls->vmrls_tree, rl) != NULL) {
+		if (wait_start == 0) {
+			wait_start = mach_absolute_time();
+			counter_inc(&vm_map_range_lock_contended);
+		}
+		rls->vmrls_waiters++;
+		lck_mtx_sleep(&rls->vmrls_lock, LCK_SLEEP_DEFAULT,
+		    (event_t)&rls->vmrls_tree, THREAD_UNINT);
+		rls->vmrls_waiters--;
+	}
+	lck_mtx_unlock(&rls->vmrls_lock);
+
+	rl->vmrl_held = true;
+	counter_inc(&vm_map_range_lock_count);
+	if (wait_start) {
+		uint64_t wait_ns;
+
+		absolutetime_to_nanoseconds(mach_absolute_time() - wait_start, &wait_ns);
+		counter_add(&vm_map_range_lock_wait_us, wait_ns / NSEC_PER_USEC);
+	}
+}
+
+static void
+vm_map_range_unlock(
+	vm_map_t                map,
+	struct vm_map_range_lock *rl)
+{
+	struct vm_map_range_locks *rls = map->vmmap_range_locks;
+
+	if (!rl->vmrl_held) {
+		return;
+	}
+	rl->vmrl_held = false;
+
+	lck_mtx_lock(&rls->vmrls_lock);
+	RB_REMOVE(vm_map_range_tree, &rls->vmrls_tree, rl);
+	if (rls->vmrls_waiters) {
+		thread_wakeup((event_t)&rls->vmrls_tree);
+	}
+	lck_mtx_unlock(&rls->vmrls_lock);
+}
+
+static inline bool
+vm_map_range_locked(
+	struct vm_map_range_lock *rl,
+	vm_map_offset_t         start,
+	vm_map_offset_t         end)
+{
+	return rl->vmrl_held && rl->vmrl_start <= start && end <= rl->vmrl_end;
+}
+
+/*
+ * pmap operations deferred until the map is unlocked, on entries marked
+ * "in_transition" meanwhile.
+ */
+#define VM_MAP_RANGE_PMAP_OPS   8
+
+struct vm_map_range_pmap_ops {
+	uint32_t                count;
+	struct {
+		vm_map_offset_t start;
+		vm_map_offset_t end;
+		vm_prot_t       prot;   /* VM_PROT_NONE for pmap_remove() */
+		int             options;
+		bool            remove;
+	} ops[VM_MAP_RANGE_PMAP_OPS];
+};
+
+/*
+ * Defers a pmap operation on "entry", with the map locked exclusive.
+ * Returns false if there's no more room: the caller must do it now.
+ */
+static bool
+vm_map_range_pmap_defer(
+	struct vm_map_range_pmap_ops *pops,
+	vm_map_entry_t          entry,
+	bool                    remove,
+	vm_prot_t               prot,
+	int                     options)
+{
+	if (pops->count > 0) {
+		__auto_type last = &pops->ops[pops->count - 1];
+
+		if (last->end == entry->vme_start && last->remove == remove &&
+		    last->prot == prot && last->options == options) {
+			last->end = entry->vme_end;
+			goto done;
+		}
+	}
+	if (pops->count == VM_MAP_RANGE_PMAP_OPS) {
+		return false;
+	}
+	pops->ops[pops->count].start = entry->vme_start;
+	pops->ops[pops->count].end = entry->vme_end;
+	pops->ops[pops->count].prot = prot;
+	pops->ops[pops->count].options = options;
+	pops->ops[pops->count].remove = remove;
+	pops->count++;
+done:
+	assert(!entry->in_transition);
+	entry->in_transition = TRUE;
+	return true;
+}
+
+/*
+ * Performs the deferred pmap operations and takes the entries out of
+ * transition. If "unlock" is true, the map is unlocked while doing the
+ * pmap operations, otherwise it stays locked throughout.
+ */
+static void
+vm_map_range_pmap_flush(
+	vm_map_t                map,
+	struct vm_map_range_pmap_ops *pops,
+	bool                    unlock)
+{
+	vm_map_entry_t entry;
+	bool wakeup = false;
+
+	if (pops->count == 0) {
+		return;
+	}
+	if (unlock) {
+		vm_map_unlock(map);
+	}
+	for (uint32_t i = 0; i < pops->count; i++) {
+		if (pops->ops[i].remove) {
+			pmap_remove(map->pmap, pops->ops[i].start, pops->ops[i].end);
+		} else {
+			pmap_protect_options(map->pmap, pops->ops[i].start,
+			    pops->ops[i].end, pops->ops[i].prot,
+			    pops->ops[i].options, NULL);
+		}
+	}
+	if (unlock) {
+		vm_map_lock(map);
+	}
+
+	/*
+	 * Entries may have been clipped meanwhile, but nobody else
+	 * puts entries of a locked range in transition: all the ones
+	 * in the ranges we deferred operations on are ours.
+	 */
+	for (uint32_t i = 0; i < pops->count; i++) {
+		vm_map_lookup_entry_or_next(map, pops->ops[i].start, &entry);
+		while (entry != vm_map_to_entry(map) &&
+		    entry->vme_start < pops->ops[i].end) {
+			assert(entry->in_transition);
+			entry->in_transition = FALSE;
+			if (entry->needs_wakeup) {
+				entry->needs_wakeup = FALSE;
+				wakeup = true;
+			}
+			entry = entry->vme_next;
+		}
+	}
+	if (wakeup) {
+		vm_map_entry_wakeup(map);
+	}
+	pops->count = 0;
+}
+
 /*
  * Routines to get the page size the caller should
  * use while inspecting the target address space.
@@ -2088,6 +2380,7 @@ vm_map_destroy(
 	}
 
 	lck_rw_destroy(&map->lock, &vm_map_lck_grp);
+	vm_map_range_locks_destroy(map);
 
 #if CONFIG_MAP_RANGES
 	kfree_data(map->extra_ranges,
@@ -2931,6 +3224,7 @@ vm_map_enter(
 	kern_return_t           kr;
 	vm_map_size_t           chunk_size = 0;
 	vm_object_t             caller_object;
+	struct vm_map_range_lock range_lock;
 	VM_MAP_ZAP_DECLARE(zap_old_list);
 	VM_MAP_ZAP_DECLARE(zap_new_list);
 
@@ -3211,6 +3505,12 @@ vm_map_enter(
 		return KERN_NO_SPACE;
 	}
 
+	if (!anywhere && vmk_flags.vmf_overwrite) {
+		/* wait for operations in progress on the range we replace */
+		vm_map_range_lock(map, *address, *address + size, &range_lock);
+	} else {
+		range_lock.vmrl_held = false;
+	}
 	vm_map_lock(map);
 	map_locked = TRUE;
 
@@ -3405,6 +3705,7 @@ vm_map_enter(
 	    entry->vme_permanent) &&
 	    (!entry->superpage_size && !superpage_size) &&
 	    (!entry->zero_wired_pages) &&
+	    (!entry->vme_fault_around) &&
 	    (!entry->used_for_jit && !entry_for_jit) &&
 #if __arm64e__
 	    (!entry->used_for_tpro && !entry_for_tpro) &&
@@ -3942,6 +4243,8 @@ BailOut:
 		}
 	}
 
+	vm_map_range_unlock(map, &range_lock);
+
 	vmlp_api_end(VM_MAP_ENTER, result);
 	return result;
 
@@ -5812,6 +6115,8 @@ vm_map_protect(
 	kern_return_t                   kr;
 	vm_map_offset_t                 start, original_start;
 	vm_map_offset_t                 end;
+	struct vm_map_range_lock        range_lock;
+	struct vm_map_range_pmap_ops    pmap_ops = { .count = 0 };
 
 	vmlp_api_start(VM_MAP_PROTECT);
 
@@ -5905,6 +6210,7 @@ vm_map_protect(
 		new_prot &= ~VM_PROT_COPY;
 	}
 
+	vm_map_range_lock(map, start, end, &range_lock);
 	vm_map_lock(map);
 	vmlp_range_event(map, start, end - start);
 
@@ -5916,6 +6222,7 @@ restart_after_unlock:
 	 */
 	if (start >= map->max_offset) {
 		vm_map_unlock(map);
+		vm_map_range_unlock(map, &range_lock);
 		vmlp_api_end(VM_MAP_PROTECT, KERN_INVALID_ADDRESS);
 		return KERN_INVALID_ADDRESS;
 	}
@@ -5927,6 +6234,7 @@ restart_after_unlock:
 		 */
 		if (!vm_map_lookup_entry(map, start, &entry)) {
 			vm_map_unlock(map);
+			vm_map_range_unlock(map, &range_lock);
 			vmlp_api_end(VM_MAP_PROTECT, KERN_INVALID_ADDRESS);
 			return KERN_INVALID_ADDRESS;
 		}
@@ -5955,6 +6263,7 @@ restart_after_unlock:
 		 */
 		if (current->vme_start != prev) {
 			vm_map_unlock(map);
+			vm_map_range_unlock(map, &range_lock);
 			vmlp_api_end(VM_MAP_PROTECT, KERN_INVALID_ADDRESS);
 			return KERN_INVALID_ADDRESS;
 		}
@@ -5973,6 +6282,7 @@ restart_after_unlock:
 #endif
 		if ((new_prot & new_max) != new_prot) {
 			vm_map_unlock(map);
+			vm_map_range_unlock(map, &range_lock);
 			vmlp_api_end(VM_MAP_PROTECT, KERN_PROTECTION_FAILURE);
 			return KERN_PROTECTION_FAILURE;
 		}
@@ -5980,6 +6290,7 @@ restart_after_unlock:
 		if (current->used_for_jit &&
 		    pmap_has_prot_policy(map->pmap, current->translated_allow_execute, current->protection)) {
 			vm_map_unlock(map);
+			vm_map_range_unlock(map, &range_lock);
 			vmlp_api_end(VM_MAP_PROTECT, KERN_PROTECTION_FAILURE);
 			return KERN_PROTECTION_FAILURE;
 		}
@@ -5988,6 +6299,7 @@ restart_after_unlock:
 		/* Disallow protecting hw assisted TPRO mappings */
 		if (current->used_for_tpro) {
 			vm_map_unlock(map);
+			vm_map_range_unlock(map, &range_lock);
 			vmlp_api_end(VM_MAP_PROTECT, KERN_PROTECTION_FAILURE);
 			return KERN_PROTECTION_FAILURE;
 		}
@@ -6029,6 +6341,7 @@ restart_after_unlock:
 			new_prot &= ~VM_PROT_ALLEXEC;
 			if (VM_MAP_POLICY_WX_FAIL(map)) {
 				vm_map_unlock(map);
+				vm_map_range_unlock(map, &range_lock);
 				vmlp_api_end(VM_MAP_PROTECT, KERN_PROTECTION_FAILURE);
 				return KERN_PROTECTION_FAILURE;
 			}
@@ -6044,6 +6357,7 @@ restart_after_unlock:
 			if ((new_prot & VM_PROT_ALLEXEC) ||
 			    ((current->protection & VM_PROT_EXECUTE) && (new_prot & VM_PROT_WRITE))) {
 				vm_map_unlock(map);
+				vm_map_range_unlock(map, &range_lock);
 				vmlp_api_end(VM_MAP_PROTECT, KERN_PROTECTION_FAILURE);
 				return KERN_PROTECTION_FAILURE;
 			}
@@ -6055,6 +6369,7 @@ restart_after_unlock:
 
 	if (end > prev) {
 		vm_map_unlock(map);
+		vm_map_range_unlock(map, &range_lock);
 		vmlp_api_end(VM_MAP_PROTECT, KERN_INVALID_ADDRESS);
 		return KERN_INVALID_ADDRESS;
 	}
@@ -6084,6 +6399,7 @@ restart_after_unlock:
 			 * Let the other thread know we are waiting.
 			 */
 			current_start = current->vme_start;
+			vm_map_range_pmap_flush(map, &pmap_ops, false);
 			current->needs_wakeup = true;
 			/* wait for the other thread to be done */
 			wait_result = vm_map_entry_wait(map, TH_UNINT);
@@ -6256,7 +6572,9 @@ restart_after_unlock:
 				    current->vme_start,
 				    current->vme_end,
 				    prot);
-			} else {
+			} else if (!vm_map_range_locked(&range_lock, current->vme_start, current->vme_end) ||
+			    current->wired_count ||
+			    !vm_map_range_pmap_defer(&pmap_ops, current, false, prot, pmap_options)) {
 				pmap_protect_options(map->pmap,
 				    current->vme_start,
 				    current->vme_end,
@@ -6268,6 +6586,12 @@ restart_after_unlock:
 		current = current->vme_next;
 	}
 
+	if (pmap_ops.count) {
+		/* update the pmap with only our range locked */
+		vm_map_range_pmap_flush(map, &pmap_ops, true);
+		entry = VM_MAP_ENTRY_NULL;
+	}
+
 	if (entry == VM_MAP_ENTRY_NULL) {
 		/*
 		 * Re-lookup the original start of our range.
@@ -6283,6 +6607,7 @@ restart_after_unlock:
 	}
 
 	vm_map_unlock(map);
+	vm_map_range_unlock(map, &range_lock);
 	vmlp_api_end(VM_MAP_PROTECT, KERN_SUCCESS);
 	return KERN_SUCCESS;
 }
@@ -9081,6 +9406,7 @@ in_transition:
 			vmlp_lock_event_locked(VMLP_EVENT_LOCK_YIELD_BEGIN, map);
 			unsigned int last_timestamp = map->timestamp++;
 
+			vm_map_seq_write_end(map);
 			if (lck_rw_lock_yield_exclusive(&map->lock,
 			    LCK_RW_YIELD_ANY_WAITER)) {
 				if (last_timestamp != map->timestamp + 1) {
@@ -9090,6 +9416,7 @@ in_transition:
 				/* we didn't yield, undo our change */
 				map->timestamp--;
 			}
+			vm_map_seq_write_begin(map);
 			vmlp_lock_event_locked(VMLP_EVENT_LOCK_YIELD_END, map);
 		}
 	}
@@ -9127,6 +9454,49 @@ out:
 	return ret;
 }
 
+/*
+ * With [start, end) range locked, removes the pmap translations of the
+ * plain mappings in that range with the map unlocked, before
+ * vm_map_delete() does the rest of the work with the map locked.
+ */
+static void
+vm_map_range_remove_prepare(
+	vm_map_t                map,
+	vm_map_offset_t         start,
+	vm_map_offset_t         end)
+{
+	struct vm_map_range_pmap_ops pmap_ops = { .count = 0 };
+	vm_map_entry_t entry;
+
+	if (map->mapped_in_other_pmaps) {
+		return;
+	}
+
+	vm_map_lookup_entry_or_next(map, start, &entry);
+	while (entry != vm_map_to_entry(map) && entry->vme_start < end) {
+		if (entry->in_transition ||
+		    entry->wired_count ||
+		    entry->superpage_size ||
+		    entry->vme_permanent ||
+		    entry->is_sub_map ||
+		    entry->vme_kernel_object ||
+		    VME_OBJECT(entry) == VM_OBJECT_NULL ||
+		    VME_OBJECT(entry) == compressor_object) {
+			/* leave it all to vm_map_delete() */
+			entry = entry->vme_next;
+			continue;
+		}
+		vm_map_clip_start(map, entry, start);
+		vm_map_clip_end(map, entry, end);
+		if (!vm_map_range_pmap_defer(&pmap_ops, entry, true, VM_PROT_NONE, 0)) {
+			break;
+		}
+		entry = entry->vme_next;
+	}
+
+	vm_map_range_pmap_flush(map, &pmap_ops, true);
+}
+
 kmem_return_t
 vm_map_remove_and_unlock(
 	vm_map_t        map,
@@ -9164,15 +9534,90 @@ vm_map_remove_guard(
 	vmr_flags_t     flags,
 	kmem_guard_t    guard)
 {
+	struct vm_map_range_lock range_lock;
 	kmem_return_t ret;
 	vmlp_api_start(VM_MAP_REMOVE_GUARD);
+	vm_map_range_lock(map, start, end, &range_lock);
 	vm_map_lock(map);
 	vmlp_range_event(map, start, end - start);
+	if (vm_map_range_locked(&range_lock, start, end)) {
+		vm_map_range_remove_prepare(map, start, end);
+	}
 	ret = vm_map_remove_and_unlock(map, start, end, flags, guard);
+	vm_map_range_unlock(map, &range_lock);
 	vmlp_api_end(VM_MAP_REMOVE_GUARD, ret.kmr_return);
 	return ret;
 }
 
+/*
+ *	vm_map_remove_ranges:
+ *
+ *	Remove several address ranges from the target map with a single
+ *	hold of the map lock, and dispose of all the removed entries once
+ *	the map is unlocked.
+ *
+ *	The span from the lowest to the highest of the ranges is range locked
+ *	throughout, so the pmap work of each range can be done with the map
+ *	unlocked as in vm_map_remove_guard().
+ *
+ *	Stops at the first range that can't be removed: the number of ranges
+ *	removed, which is also the index of the failing one, is returned in
+ *	"removed".
+ */
+kern_return_t
+vm_map_remove_ranges(
+	vm_map_t                map,
+	const struct mach_vm_range *ranges,
+	uint32_t                count,
+	vmr_flags_t             flags,
+	uint32_t               *removed)
+{
+	struct vm_map_range_lock range_lock;
+	kmem_return_t ret = { .kmr_return = KERN_SUCCESS };
+	VM_MAP_ZAP_DECLARE(zap);
+	vm_map_offset_t min = 0, max = 0;
+	uint32_t i;
+
+	vmlp_api_start(VM_MAP_REMOVE_RANGES);
+
+	for (i = 0; i < count; i++) {
+		if (ranges[i].min_address >= ranges[i].max_address) {
+			continue;
+		}
+		if (min == max) {
+			min = ranges[i].min_address;
+			max = ranges[i].max_address;
+		} else {
+			min = MIN(min, ranges[i].min_address);
+			max = MAX(max, ranges[i].max_address);
+		}
+	}
+
+	vm_map_range_lock(map, min, max, &range_lock);
+	vm_map_lock(map);
+	for (i = 0; i < count; i++) {
+		vm_map_offset_t start = ranges[i].min_address;
+		vm_map_offset_t end = ranges[i].max_address;
+
+		vmlp_range_event(map, start, end - start);
+		if (start < end && vm_map_range_locked(&range_lock, start, end)) {
+			vm_map_range_remove_prepare(map, start, end);
+		}
+		ret = vm_map_delete(map, start, end, flags, KMEM_GUARD_NONE, &zap);
+		if (ret.kmr_return != KERN_SUCCESS) {
+			break;
+		}
+	}
+	vm_map_unlock(map);
+	vm_map_range_unlock(map, &range_lock);
+
+	vm_map_zap_dispose(&zap);
+
+	*removed = i;
+	vmlp_api_end(VM_MAP_REMOVE_RANGES, ret.kmr_return);
+	return ret.kmr_return;
+}
+
 
 /*
  *  vm_map_setup:
@@ -14202,6 +14647,64 @@ uint64_t vm_map_lookup_and_lock_object_copy_strategically_error = 0;
 uint64_t vm_map_lookup_and_lock_object_copy_shadow_count = 0;
 uint64_t vm_map_lookup_and_lock_object_copy_shadow_size = 0;
 uint64_t vm_map_lookup_and_lock_object_copy_shadow_max = 0;
+
+/*
+ * Initialize fault information according to the entry being faulted from.
+ */
+static void
+vm_map_fault_info_init(
+	vm_map_t                map,
+	vm_map_entry_t          entry,
+	vm_object_fault_info_t  fault_info)
+{
+#if !CODE_SIGNING_MONITOR
+#pragma unused(map)
+#endif /* !CODE_SIGNING_MONITOR */
+	fault_info->user_tag = VME_ALIAS(entry);
+	fault_info->pmap_options = 0;
+	if (entry->iokit_acct ||
+	    (!entry->is_sub_map && !entry->use_pmap)) {
+		fault_info->pmap_options |= PMAP_OPTIONS_ALT_ACCT;
+	}
+	if (fault_info->behavior == VM_BEHAVIOR_DEFAULT) {
+		fault_info->behavior = entry->behavior;
+	}
+	fault_info->lo_offset = VME_OFFSET(entry);
+	fault_info->hi_offset =
+	    (entry->vme_end - entry->vme_start) + VME_OFFSET(entry);
+	fault_info->no_cache  = entry->no_cache;
+	fault_info->fi_fault_around = entry->vme_fault_around;
+	fault_info->io_sync = FALSE;
+	fault_info->cs_bypass = (entry->used_for_jit ||
+#if CODE_SIGNING_MONITOR
+	    (csm_address_space_exempt(map->pmap) == KERN_SUCCESS) ||
+#endif
+	    entry->vme_resilient_codesign);
+	fault_info->mark_zf_absent = FALSE;
+	fault_info->batch_pmap_op = FALSE;
+	/*
+	 * The pmap layer will validate this page
+	 * before allowing it to be executed from.
+	 */
+#if CODE_SIGNING_MONITOR
+	fault_info->csm_associated = entry->csm_associated;
+#else
+	fault_info->csm_associated = FALSE;
+#endif
+
+	fault_info->resilient_media = entry->vme_resilient_media;
+	fault_info->fi_xnu_user_debug = entry->vme_xnu_user_debug;
+	fault_info->no_copy_on_read = entry->vme_no_copy_on_read;
+#if __arm64e__
+	fault_info->fi_used_for_tpro = entry->used_for_tpro;
+#else /* __arm64e__ */
+	fault_info->fi_used_for_tpro = FALSE;
+#endif
+	if (entry->translated_allow_execute) {
+		fault_info->pmap_options |= PMAP_OPTIONS_TRANSLATED_ALLOW_EXECUTE;
+	}
+}
+
 /*
  *	vm_map_lookup_and_lock_object:
  *
@@ -14953,52 +15456,7 @@ protection_failure:
 	KDBG_FILTERED(MACHDBG_CODE(DBG_MACH_WORKINGSET, VM_MAP_LOOKUP_OBJECT), VM_KERNEL_UNSLIDE_OR_PERM(*object), (unsigned long) VME_ALIAS(entry), 0, 0);
 
 	if (fault_info) {
-		/*
-		 * Initialize fault information according to the entry being faulted
-		 * from.
-		 */
-		fault_info->user_tag = VME_ALIAS(entry);
-		fault_info->pmap_options = 0;
-		if (entry->iokit_acct ||
-		    (!entry->is_sub_map && !entry->use_pmap)) {
-			fault_info->pmap_options |= PMAP_OPTIONS_ALT_ACCT;
-		}
-		if (fault_info->behavior == VM_BEHAVIOR_DEFAULT) {
-			fault_info->behavior = entry->behavior;
-		}
-		fault_info->lo_offset = VME_OFFSET(entry);
-		fault_info->hi_offset =
-		    (entry->vme_end - entry->vme_start) + VME_OFFSET(entry);
-		fault_info->no_cache  = entry->no_cache;
-		fault_info->io_sync = FALSE;
-		fault_info->cs_bypass = (entry->used_for_jit ||
-#if CODE_SIGNING_MONITOR
-		    (csm_address_space_exempt(map->pmap) == KERN_SUCCESS) ||
-#endif
-		    entry->vme_resilient_codesign);
-		fault_info->mark_zf_absent = FALSE;
-		fault_info->batch_pmap_op = FALSE;
-		/*
-		 * The pmap layer will validate this page
-		 * before allowing it to be executed from.
-		 */
-#if CODE_SIGNING_MONITOR
-		fault_info->csm_associated = entry->csm_associated;
-#else
-		fault_info->csm_associated = FALSE;
-#endif
-
-		fault_info->resilient_media = entry->vme_resilient_media;
-		fault_info->fi_xnu_user_debug = entry->vme_xnu_user_debug;
-		fault_info->no_copy_on_read = entry->vme_no_copy_on_read;
-#if __arm64e__
-		fault_info->fi_used_for_tpro = entry->used_for_tpro;
-#else /* __arm64e__ */
-		fault_info->fi_used_for_tpro = FALSE;
-#endif
-		if (entry->translated_allow_execute) {
-			fault_info->pmap_options |= PMAP_OPTIONS_TRANSLATED_ALLOW_EXECUTE;
-		}
+		vm_map_fault_info_init(map, entry, fault_info);
 	}
 
 	/*
@@ -15026,6 +15484,134 @@ protection_failure:
 }
 
 
+/*
+ *	Speculative map lookups for page faults.
+ *
+ *	Instead of taking the map lock, a speculative fault registers itself
+ *	in "vmmap_spec_faults" and checks that "vmmap_seq" is even, i.e. that
+ *	nobody holds the map lock exclusive. Exclusive lockers make the count
+ *	odd and then wait for the speculative faults in flight to be done
+ *	(see vm_map_seq_write_begin()), so the map entry found and its VM object
+ *	stay valid until vm_map_spec_fault_end(), without the fault ever
+ *	queueing behind an exclusive locker: if the map is being changed, the
+ *	fault just falls back to vm_map_lookup_and_lock_object().
+ *
+ *	Speculative faults never block, so exclusive lockers only ever wait
+ *	for a handful of them to complete.
+ */
+#define VM_MAP_SPEC_FAULT_SPIN  1024
+
+void
+vm_map_spec_fault_drain(
+	vm_map_t                map)
+{
+	uint32_t spins = 0;
+
+	while (os_atomic_load(&map->vmmap_spec_faults, relaxed) != 0) {
+		if (++spins < VM_MAP_SPEC_FAULT_SPIN) {
+			cpu_pause();
+		} else {
+			mutex_pause(0);
+		}
+	}
+	os_atomic_thread_fence(acquire);
+}
+
+static bool
+vm_map_spec_fault_begin(
+	vm_map_t                map)
+{
+	os_atomic_inc(&map->vmmap_spec_faults, relaxed);
+	os_atomic_thread_fence(seq_cst);
+	if (os_atomic_load(&map->vmmap_seq, relaxed) & 1) {
+		vm_map_spec_fault_end(map);
+		return false;
+	}
+	return true;
+}
+
+void
+vm_map_spec_fault_end(
+	vm_map_t                map)
+{
+	os_atomic_dec(&map->vmmap_spec_faults, release);
+}
+
+/*
+ *	vm_map_lookup_speculative:
+ *
+ *	Finds the VM object, offset, and protection for a fault on
+ *	"vaddr" without taking the map lock, for the simple cases only:
+ *	a mapping of the top-level map, not wired, with a VM object,
+ *	and no copy-on-write to resolve for this fault.
+ *
+ *	On success, the VM object is returned locked exclusive, and the
+ *	caller must call vm_map_spec_fault_end() once done with it.
+ *	On failure, the caller should use vm_map_lookup_and_lock_object().
+ */
+kern_return_t
+vm_map_lookup_speculative(
+	vm_map_t                map,
+	vm_map_offset_t         vaddr,
+	vm_prot_t               fault_type,
+	vm_object_t             *object,                /* OUT */
+	vm_object_offset_t      *offset,                /* OUT */
+	vm_prot_t               *out_prot,              /* OUT */
+	vm_object_fault_info_t  fault_info)             /* OUT */
+{
+	vm_map_entry_t          entry;
+	vm_prot_t               prot;
+
+	if (!vm_map_spec_fault_begin(map)) {
+		return KERN_FAILURE;
+	}
+
+	if (!vm_map_lookup_entry(map, vaddr, &entry) ||
+	    entry->is_sub_map ||
+	    entry->in_transition ||
+	    entry->wired_count != 0 ||
+	    entry->used_for_jit ||
+	    entry->superpage_size ||
+	    entry->iokit_acct ||
+	    entry->vme_resilient_codesign ||
+	    entry->vme_resilient_media ||
+	    entry->vme_xnu_user_debug ||
+	    entry->translated_allow_execute ||
+#if __arm64e__
+	    entry->used_for_tpro ||
+#endif /* __arm64e__ */
+	    (entry->needs_copy && (fault_type & VM_PROT_WRITE))) {
+		goto fallback;
+	}
+
+	prot = entry->protection;
+	if (override_nx(map, VME_ALIAS(entry)) && prot) {
+		prot |= VM_PROT_EXECUTE;
+	}
+	if ((fault_type & prot) != fault_type) {
+		/* let the slow path report (or excuse) the protection failure */
+		goto fallback;
+	}
+	if (entry->needs_copy) {
+		prot &= ~VM_PROT_WRITE;
+	}
+
+	if (VME_OBJECT(entry) == VM_OBJECT_NULL ||
+	    !vm_object_lock_try(VME_OBJECT(entry))) {
+		goto fallback;
+	}
+
+	*object = VME_OBJECT(entry);
+	*offset = (vaddr - entry->vme_start) + VME_OFFSET(entry);
+	*out_prot = prot;
+	vm_map_fault_info_init(map, entry, fault_info);
+	return KERN_SUCCESS;
+
+fallback:
+	vm_map_spec_fault_end(map);
+	return KERN_FAILURE;
+}
+
 /*
  *	vm_map_verify:
  *
@@ -16348,6 +16934,7 @@ vm_map_simplify_entry(
 	    (prev_entry->no_cache == this_entry->no_cache) &&
 	    (prev_entry->vme_permanent == this_entry->vme_permanent) &&
 	    (prev_entry->zero_wired_pages == this_entry->zero_wired_pages) &&
+	    (prev_entry->vme_fault_around == this_entry->vme_fault_around) &&
 	    (prev_entry->used_for_jit == this_entry->used_for_jit) &&
 #if __arm64e__
 	    (prev_entry->used_for_tpro == this_entry->used_for_tpro) &&
@@ -16677,6 +17264,7 @@ vm_map_behavior_set(
 	case VM_BEHAVIOR_SEQUENTIAL:
 	case VM_BEHAVIOR_RSEQNTL:
 	case VM_BEHAVIOR_ZERO_WIRED_PAGES:
+	case VM_BEHAVIOR_FAULT_AROUND:
 		vm_map_lock(map);
 
 		/*
@@ -16726,8 +17314,17 @@ vm_map_behavior_set(
 #endif /* __arm64e__ */
 				assert(!entry->used_for_jit);
 				entry->zero_wired_pages = TRUE;
+			} else if (new_behavior == VM_BEHAVIOR_FAULT_AROUND) {
+				if (!entry->is_sub_map) {
+					entry->vme_fault_around = TRUE;
+				}
 			} else {
 				entry->behavior = new_behavior;
+				if (new_behavior == VM_BEHAVIOR_DEFAULT ||
+				    new_behavior == VM_BEHAVIOR_RANDOM) {
+					/* back to normal advice: no more fault-around */
+					entry->vme_fault_around = FALSE;
+				}
 			}
 			entry = entry->vme_next;
 		}
@@ -262,6 +262,14 @@ extern kmem_return_t vm_map_remove_and_unlock(
 	vmr_flags_t     flags,
 	kmem_guard_t    guard) __result_use_check;
 
+/* Deallocate several regions under one hold of the map lock */
+extern kern_return_t vm_map_remove_ranges(
+	vm_map_t                map,
+	const struct mach_vm_range *ranges,
+	uint32_t                count,
+	vmr_flags_t             flags,
+	uint32_t               *removed) __result_use_check;
+
 /* Deallocate a region */
 static inline void
 vm_map_remove(
@@ -516,6 +524,20 @@ extern kern_return_t    vm_map_lookup_and_lock_object(
 	vm_map_t                *real_map,                              /* OUT */
 	bool                    *contended);                            /* OUT */
 
+/* Same, without the map lock, for the simple cases of a page fault. */
+extern kern_return_t    vm_map_lookup_speculative(
+	vm_map_t                map,
+	vm_map_offset_t         vaddr,
+	vm_prot_t               fault_type,
+	vm_object_t             *object,                                /* OUT */
+	vm_object_offset_t      *offset,                                /* OUT */
+	vm_prot_t               *out_prot,                              /* OUT */
+	vm_object_fault_info_t  fault_info);                            /* OUT */
+
+/* Ends the speculative fault started by vm_map_lookup_speculative(). */
+extern void             vm_map_spec_fault_end(
+	vm_map_t                map);
+
 /* Verifies that the map has not changed since the given version. */
 extern boolean_t        vm_map_verify(
 	vm_map_t                map,
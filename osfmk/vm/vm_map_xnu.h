@@ -259,7 +259,7 @@ struct vm_map_entry {
 	/* boolean_t         */ vme_no_copy_on_read:1,
 	/* boolean_t         */ translated_allow_execute:1, /* execute in translated processes */
 	/* boolean_t         */ vme_kernel_object:1,        /* vme_object is a kernel_object */
-	/* boolean_t         */ __unused:1;
+	/* boolean_t         */ vme_fault_around:1;         /* map adjacent resident pages on faults */
 
 	unsigned short          wired_count;                /* can be paged if = 0 */
 	unsigned short          user_wired_count;           /* for vm_wire */
@@ -465,6 +465,23 @@ struct _vm_map {
 	/* reserved */ res0:1,
 	/* reserved  */pad:6;
 	unsigned int            timestamp;          /* Version number */
+
+	/*
+	 * Last fault-around window in this map, and which of its pages
+	 * were mapped ahead before anything referenced them: sampled
+	 * for references by the next fault-around (see vm_fault_around()).
+	 */
+	vm_map_offset_t         fault_around_start;
+	uint64_t                fault_around_pending;
+	/*
+	 * Speculative page faults (see vm_map_lookup_speculative()):
+	 * the sequence count is odd while the map is locked exclusive,
+	 * and exclusive lockers wait for the speculative faults in flight.
+	 */
+	uint32_t                vmmap_seq;
+	uint32_t                vmmap_spec_faults;
+	/* range locks, if the owning process opted in (see vm_map_range_lock()) */
+	struct vm_map_range_locks *vmmap_range_locks;
 	/*
 	 * Weak reference to the task that owns this map. This will be NULL if the
 	 * map has terminated, so you must have a task reference to be able to safely
@@ -620,14 +637,42 @@ ZONE_DECLARE_ID(ZONE_ID_VM_MAP, struct _vm_map);
 
 #define vm_map_lock_init(map)                                           \
 	((map)->timestamp = 0 ,                                         \
+	(map)->vmmap_seq = 0 ,                                          \
 	lck_rw_init(&(map)->lock, &vm_map_lck_grp, &vm_map_lck_rw_attr))
 
+extern void             vm_map_spec_fault_drain(
+	vm_map_t                map);
+
+/*
+ * Called with the map lock held exclusive: speculative faults can no
+ * longer start, wait for the ones in flight to be done with the map.
+ */
+static inline void
+vm_map_seq_write_begin(vm_map_t map)
+{
+	os_atomic_store(&map->vmmap_seq, map->vmmap_seq | 1, relaxed);
+	os_atomic_thread_fence(seq_cst);
+	if (os_atomic_load(&map->vmmap_spec_faults, relaxed) != 0) {
+		vm_map_spec_fault_drain(map);
+	}
+}
+
+/*
+ * Called before the map lock stops being held exclusive.
+ */
+static inline void
+vm_map_seq_write_end(vm_map_t map)
+{
+	os_atomic_store(&map->vmmap_seq, map->vmmap_seq + 1, release);
+}
+
 #define vm_map_lock(map)                     \
 	MACRO_BEGIN                          \
 	DTRACE_VM(vm_map_lock_w);            \
 	vmlp_lock_event_unlocked(VMLP_EVENT_LOCK_REQ_EXCL, map); \
 	assert(!vm_map_is_sealed(map));      \
 	lck_rw_lock_exclusive(&(map)->lock); \
+	vm_map_seq_write_begin(map);         \
 	vmlp_lock_event_locked(VMLP_EVENT_LOCK_GOT_EXCL, map); \
 	MACRO_END
 
@@ -636,6 +681,7 @@ ZONE_DECLARE_ID(ZONE_ID_VM_MAP, struct _vm_map);
 	DTRACE_VM(vm_map_lock_w);                \
 	assert(vm_map_is_sealed(map));           \
 	lck_rw_lock_exclusive(&(map)->lock);     \
+	vm_map_seq_write_begin(map);             \
 	(map)->vmmap_sealed = VM_MAP_NOT_SEALED; \
 	MACRO_END
 
@@ -645,6 +691,7 @@ ZONE_DECLARE_ID(ZONE_ID_VM_MAP, struct _vm_map);
 	vmlp_lock_event_locked(VMLP_EVENT_LOCK_UNLOCK_EXCL, map); \
 	assert(!vm_map_is_sealed(map)); \
 	(map)->timestamp++;         \
+	vm_map_seq_write_end(map);  \
 	lck_rw_done(&(map)->lock);  \
 	MACRO_END
 
@@ -668,6 +715,7 @@ ZONE_DECLARE_ID(ZONE_ID_VM_MAP, struct _vm_map);
 	DTRACE_VM(vm_map_lock_downgrade);              \
 	vmlp_lock_event_locked(VMLP_EVENT_LOCK_DOWNGRADE, map); \
 	(map)->timestamp++;                            \
+	vm_map_seq_write_end(map);                     \
 	lck_rw_lock_exclusive_to_shared(&(map)->lock); \
 	MACRO_END
 
@@ -717,8 +765,10 @@ _vm_map_entry_wait_helper(vm_map_t map, wait_interrupt_t interruptible)
 {
 	vmlp_lock_event_locked(VMLP_EVENT_LOCK_SLEEP_BEGIN, map);
 	map->timestamp++;
+	vm_map_seq_write_end(map);
 	wait_result_t res = lck_rw_sleep(&map->lock, LCK_SLEEP_EXCLUSIVE | LCK_SLEEP_PROMOTED_PRI,
 	    (event_t)&map->hdr, interruptible);
+	vm_map_seq_write_begin(map);
 	vmlp_lock_event_locked(VMLP_EVENT_LOCK_SLEEP_END, map);
 	return res;
 }
@@ -966,6 +1016,12 @@ extern void             vm_map_set_extra_jumbo(
 extern void             vm_map_set_jit_entitled(
 	vm_map_t                map);
 
+extern kern_return_t    vm_map_enable_range_locks(
+	vm_map_t                map);
+
+extern bool             vm_map_has_range_locks(
+	vm_map_t                map);
+
 extern void             vm_map_set_max_addr(
 	vm_map_t                map,
 	vm_map_offset_t         new_max_offset,
@@ -713,6 +713,27 @@ vm_page_grab(void)
  */
 extern vm_grab_options_t vm_page_grab_options_for_object(vm_object_t object);
 
+/*!
+ * @abstract
+ * Allocates a page for a zero-fill fault, taking it from the current CPU's
+ * pool of pre-zeroed pages when possible.
+ *
+ * @discussion
+ * Behaves like @c vm_page_grab_options() otherwise, and sets @c *zeroed
+ * when the returned page is already filled with zeroes.
+ */
+extern vm_page_t vm_page_grab_zeroed(vm_grab_options_t options, bool *zeroed);
+
+/*!
+ * @abstract
+ * Gives the pages of every CPU's pre-zeroed pool back to the free queues.
+ *
+ * @discussion
+ * Called by the pageout daemon when memory runs short, the pools are
+ * refilled once the free count is back above its target.
+ */
+extern void vm_page_zero_pool_release(void);
+
 #if XNU_VM_HAS_LOPAGE
 extern vm_page_t vm_page_grablo(vm_grab_options_t options);
 #else
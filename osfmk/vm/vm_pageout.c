@@ -3067,6 +3067,9 @@ vm_pageout_scan(void)
 	/* Ask the pmap layer to return any pages it no longer needs. */
 	pmap_release_pages_fast();
 
+	/* Pre-zeroed pages aren't worth keeping when memory is short. */
+	vm_page_zero_pool_release();
+
 	vm_page_lock_queues();
 
 	delayed_unlock = 1;
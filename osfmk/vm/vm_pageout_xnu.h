@@ -93,6 +93,9 @@ extern kern_return_t vm_page_alloc_list(
 	vm_size_t   page_count,
 	kma_flags_t flags,
 	vm_page_t  *list);
+
+/* most pre-zeroed pages kept per cpu (vm.page_zero_pool_size) */
+#define VM_PAGE_ZERO_POOL_SIZE_MAX      256
 #if XNU_TARGET_OS_OSX
 extern kern_return_t    vm_pageout_wait(uint64_t deadline);
 #endif /* XNU_TARGET_OS_OSX */
@@ -500,6 +503,9 @@ struct vm_compressor_swapper_stats {
 	uint64_t free_count_below_reserve;
 	uint64_t thrashing_detected;
 	uint64_t fragmentation_detected;
+	uint64_t major_compactions;
+	uint64_t major_compactions_parallel;
+	uint64_t major_compactions_per_sec;
 };
 extern struct vm_compressor_swapper_stats vmcs_stats;
 
@@ -26,6 +26,7 @@
  * @APPLE_OSREFERENCE_LICENSE_HEADER_END@
  */
 
+#include <kern/counter.h>
 #include <kern/exc_guard.h>
 #include <kern/locks.h>
 #include <kern/task.h>
@@ -33,6 +34,7 @@
 #include <kern/misc_protos.h>
 #include <kern/sched_prim.h>
 #include <kern/startup.h>
+#include <kern/thread_call.h>
 #include <kern/thread_group.h>
 #include <libkern/OSAtomic.h>
 #include <mach/kern_return.h>
@@ -97,6 +99,11 @@ TUNABLE_DT_DEV_WRITEABLE(uint64_t, vm_reclaim_max_threshold, "/defaults",
     "kern.vm_reclaim_max_threshold", "vm_reclaim_max_threshold", 0, TUNABLE_DT_NONE);
 #endif /* CONFIG_WORKING_SET_ESTIMATION */
 TUNABLE(bool, panic_on_kill, "vm_reclaim_panic_on_kill", false);
+/*
+ * Drain the rings of suspended tasks from thread calls, which run in
+ * parallel, rather than one after the other from the scavenger thread.
+ */
+TUNABLE_DEV_WRITEABLE(bool, vm_reclaim_async_drain, "vm_reclaim_async_drain", true);
 #if DEVELOPMENT || DEBUG
 TUNABLE_WRITEABLE(bool, vm_reclaim_debug, "vm_reclaim_debug", false);
 #endif
@@ -148,6 +155,7 @@ static void vmdr_garbage_collect(vm_deferred_reclamation_gc_action_t action,
 static kern_return_t reclaim_chunk(vm_deferred_reclamation_metadata_t metadata,
     uint64_t bytes_to_reclaim, uint64_t *bytes_reclaimed_out,
     mach_vm_reclaim_count_t chunk_size, mach_vm_reclaim_count_t *num_reclaimed_out);
+static void vmdr_async_drain(thread_call_param_t param0, thread_call_param_t param1);
 
 struct vm_deferred_reclamation_metadata_s {
 	/*
@@ -197,6 +205,24 @@ struct vm_deferred_reclamation_metadata_s {
 	 * The last amount of reclaimable bytes reported to the kernel.
 	 */
 	uint64_t vdrm_reclaimable_bytes_last;
+	/* Drains the ring once the task is suspended (immutable) */
+	thread_call_t vdrm_drain_call;
+	/*
+	 * The entries below index vdrm_latency_mark were in the ring by
+	 * vdrm_latency_mark_abs, or there is no mark if it is 0: used to
+	 * measure how long entries wait to be reclaimed. Protected by
+	 * @c vdrm_gate.
+	 */
+	uint64_t vdrm_latency_mark;
+	uint64_t vdrm_latency_mark_abs;
+	/*
+	 * Lifetime reclamation statistics. Updated atomically by the owner of
+	 * the buffer so that they can be read without any lock.
+	 */
+	uint64_t vdrm_bytes_reclaimed_total;
+	uint64_t vdrm_latency_count;
+	uint64_t vdrm_latency_total_abs;
+	uint64_t vdrm_latency_max_abs;
 #if CONFIG_WORKING_SET_ESTIMATION
 	/*
 	 * Exponential moving average of the minimum reclaimable buffer size
@@ -239,6 +265,22 @@ _Atomic uint32_t vm_reclaim_buffer_count;
 uint64_t vm_reclaim_sampling_period_abs = 0;
 static SECURITY_READ_ONLY_LATE(thread_t) vm_reclaim_scavenger_thread = THREAD_NULL;
 static sched_cond_atomic_t vm_reclaim_scavenger_cond = SCHED_COND_INIT;
+/* Number of rings drained asynchronously after their task was suspended */
+SCALABLE_COUNTER_DEFINE(vm_reclaim_async_drains);
+/* Number of entries reclaimed together with an adjacent entry */
+SCALABLE_COUNTER_DEFINE(vm_reclaim_entries_coalesced);
+/* Number of bytes reclaimed from every ring */
+SCALABLE_COUNTER_DEFINE(vm_reclaim_bytes_reclaimed);
+/*
+ * Reclamation throughput: the bytes reclaimed since the start of the
+ * current window, and the rate measured over the previous window.
+ * A window is closed by the first reclamation at least a second after
+ * it started.
+ */
+static uint64_t vm_reclaim_rate_window_abs;
+static uint64_t vm_reclaim_rate_window_bytes;
+static uint64_t vm_reclaim_rate_bytes_per_sec;
+static uint64_t vm_reclaim_rate_period_abs;
 
 #pragma mark Buffer Initialization/Destruction
 
@@ -264,6 +306,9 @@ vmdr_metadata_alloc(
 	metadata->vdrm_ring_addr = buffer;
 	metadata->vdrm_ring_size = size;
 	metadata->vdrm_buffer_len = len;
+	metadata->vdrm_drain_call = thread_call_allocate_with_options(
+		vmdr_async_drain, metadata, THREAD_CALL_PRIORITY_KERNEL,
+		THREAD_CALL_OPTIONS_ONCE);
 
 	if (os_atomic_inc(&vm_reclaim_buffer_count, relaxed) == UINT32_MAX) {
 		panic("Overflowed vm_reclaim_buffer_count");
@@ -280,6 +325,11 @@ vmdr_metadata_alloc(
 static void
 vmdr_metadata_free(vm_deferred_reclamation_metadata_t metadata)
 {
+	__assert_only boolean_t freed;
+
+	/* a pending drain holds a reference, so the call can't be armed */
+	freed = thread_call_free(metadata->vdrm_drain_call);
+	assert(freed);
 	vm_map_deallocate(metadata->vdrm_map);
 	lck_mtx_gate_destroy(&metadata->vdrm_lock, &metadata->vdrm_gate);
 	lck_mtx_destroy(&metadata->vdrm_lock, &vm_reclaim_lock_grp);
@@ -792,6 +842,20 @@ reclaim_copyin_tail(vm_deferred_reclamation_metadata_t metadata, uint64_t *tail)
 		vmdr_log_error(
 			"Unable to copy tail ptr from 0x%llx: err=%d\n", tail_ptr, result);
 	}
+	if (kr == KERN_SUCCESS) {
+		/*
+		 * Entries are timed from the first time the kernel sees them
+		 * in the ring, one batch at a time.
+		 */
+		if (*tail < metadata->vdrm_latency_mark) {
+			/* userspace took entries back */
+			metadata->vdrm_latency_mark = *tail;
+		} else if (*tail > metadata->vdrm_latency_mark &&
+		    metadata->vdrm_latency_mark_abs == 0) {
+			metadata->vdrm_latency_mark = *tail;
+			metadata->vdrm_latency_mark_abs = mach_absolute_time();
+		}
+	}
 	return kr;
 }
 
@@ -913,6 +977,77 @@ reclaim_copyout_min_reclaimable_bytes(vm_deferred_reclamation_metadata_t metadat
 
 #pragma mark Reclamation
 
+/*
+ * Accounts for the entries below @c head having been reclaimed, along with
+ * @c bytes_reclaimed bytes. Caller must have the buffer owned.
+ */
+static void
+vmdr_account_reclaimed(vm_deferred_reclamation_metadata_t metadata,
+    uint64_t head, uint64_t bytes_reclaimed)
+{
+	uint64_t now = mach_absolute_time();
+	uint64_t window_start, window_bytes, window_ns;
+
+	os_atomic_add(&metadata->vdrm_bytes_reclaimed_total, bytes_reclaimed, relaxed);
+	counter_add(&vm_reclaim_bytes_reclaimed, bytes_reclaimed);
+
+	if (metadata->vdrm_latency_mark_abs != 0 &&
+	    head >= metadata->vdrm_latency_mark) {
+		uint64_t latency = now - metadata->vdrm_latency_mark_abs;
+
+		/* in this order, so that readers never see total / count > max */
+		os_atomic_max(&metadata->vdrm_latency_max_abs, latency, relaxed);
+		os_atomic_inc(&metadata->vdrm_latency_count, release);
+		os_atomic_add(&metadata->vdrm_latency_total_abs, latency, release);
+		metadata->vdrm_latency_mark_abs = 0;
+	}
+
+	window_start = os_atomic_load(&vm_reclaim_rate_window_abs, relaxed);
+	if (now - window_start >= vm_reclaim_rate_period_abs &&
+	    os_atomic_cmpxchg(&vm_reclaim_rate_window_abs, window_start, now, relaxed)) {
+		window_bytes = os_atomic_xchg(&vm_reclaim_rate_window_bytes, 0, relaxed);
+		absolutetime_to_nanoseconds(now - window_start, &window_ns);
+		os_atomic_store(&vm_reclaim_rate_bytes_per_sec,
+		    window_bytes * USEC_PER_SEC / (window_ns / NSEC_PER_USEC), relaxed);
+	}
+	os_atomic_add(&vm_reclaim_rate_window_bytes, bytes_reclaimed, relaxed);
+}
+
+/*
+ * Deallocates the ranges of the entries gathered by reclaim_chunk, under a
+ * single hold of the map lock. @c range_addrs holds the address of the
+ * first entry of each range, to report with a guard exception.
+ */
+static kern_return_t
+reclaim_remove_ranges(vm_deferred_reclamation_metadata_t metadata,
+    const struct mach_vm_range *ranges, const mach_vm_address_t *range_addrs,
+    uint32_t num_ranges)
+{
+	kern_return_t kr;
+	uint32_t num_removed;
+
+	if (num_ranges == 0) {
+		return KERN_SUCCESS;
+	}
+	kr = vm_map_remove_ranges(metadata->vdrm_map, ranges, num_ranges,
+	    VM_MAP_REMOVE_GAPS_FAIL, &num_removed);
+	if (kr == KERN_INVALID_VALUE) {
+		vmdr_log_error(
+			"[%d] Killing due to virtual-memory guard at (0x%llx, 0x%llx)\n",
+			metadata->vdrm_pid, ranges[num_removed].min_address,
+			ranges[num_removed].max_address);
+		reclaim_kill_with_reason(metadata, kGUARD_EXC_DEALLOC_GAP,
+		    range_addrs[num_removed]);
+	} else if (kr != KERN_SUCCESS) {
+		vmdr_log_error(
+			"[%d] Killing due to deallocation failure at (0x%llx, 0x%llx) err=%d\n",
+			metadata->vdrm_pid, ranges[num_removed].min_address,
+			ranges[num_removed].max_address, kr);
+		reclaim_kill_with_reason(metadata, kGUARD_EXC_RECLAIM_DEALLOCATE_FAILURE, kr);
+	}
+	return kr;
+}
+
 /*
  * @func reclaim_chunk
  *
@@ -936,6 +1071,10 @@ reclaim_copyout_min_reclaimable_bytes(vm_deferred_reclamation_metadata_t metadat
  * If the buffer has been exhausted of entries (tail == head),
  * num_reclaimed_out will be zero. It is important that the caller abort any
  * loops if such a condition is met.
+ *
+ * Entries to deallocate are coalesced with the adjacent ones and removed
+ * from the map together, with one hold of the map lock for the whole chunk
+ * (or until the next entry to free).
  */
 static kern_return_t
 reclaim_chunk(vm_deferred_reclamation_metadata_t metadata,
@@ -950,6 +1089,9 @@ reclaim_chunk(vm_deferred_reclamation_metadata_t metadata,
 	vm_map_t map = metadata->vdrm_map;
 	vm_map_switch_context_t switch_ctx;
 	struct mach_vm_reclaim_entry_s copied_entries[kReclaimChunkSize];
+	struct mach_vm_range ranges[kReclaimChunkSize];
+	mach_vm_address_t range_addrs[kReclaimChunkSize];
+	uint32_t num_ranges = 0;
 
 	assert(metadata != NULL);
 	LCK_MTX_ASSERT(&metadata->vdrm_lock, LCK_MTX_ASSERT_NOTOWNED);
@@ -1120,24 +1262,29 @@ reclaim_chunk(vm_deferred_reclamation_metadata_t metadata,
 			vmdr_log_debug("[%d] Reclaiming entry %llu (0x%llx, 0x%llx)\n", metadata->vdrm_pid, head + num_reclaimed, start, end);
 			switch (entry->behavior) {
 			case VM_RECLAIM_DEALLOCATE:
-				kr = vm_map_remove_guard(map,
-				    start, end, VM_MAP_REMOVE_GAPS_FAIL,
-				    KMEM_GUARD_NONE).kmr_return;
-				if (kr == KERN_INVALID_VALUE) {
-					vmdr_log_error(
-						"[%d] Killing due to virtual-memory guard at (0x%llx, 0x%llx)\n",
-						metadata->vdrm_pid, start, end);
-					reclaim_kill_with_reason(metadata, kGUARD_EXC_DEALLOC_GAP, entry->address);
-					goto done;
-				} else if (kr != KERN_SUCCESS) {
-					vmdr_log_error(
-						"[%d] Killing due to deallocation failure at (0x%llx, 0x%llx) err=%d\n",
-						metadata->vdrm_pid, start, end, kr);
-					reclaim_kill_with_reason(metadata, kGUARD_EXC_RECLAIM_DEALLOCATE_FAILURE, kr);
-					goto done;
+				if (num_ranges > 0 &&
+				    ranges[num_ranges - 1].max_address == start) {
+					ranges[num_ranges - 1].max_address = end;
+					counter_inc(&vm_reclaim_entries_coalesced);
+				} else if (num_ranges > 0 &&
+				    ranges[num_ranges - 1].min_address == end) {
+					ranges[num_ranges - 1].min_address = start;
+					range_addrs[num_ranges - 1] = entry->address;
+					counter_inc(&vm_reclaim_entries_coalesced);
+				} else {
+					ranges[num_ranges].min_address = start;
+					ranges[num_ranges].max_address = end;
+					range_addrs[num_ranges] = entry->address;
+					num_ranges++;
 				}
 				break;
 			case VM_RECLAIM_FREE:
+				/* Deallocate the entries before this one first */
+				kr = reclaim_remove_ranges(metadata, ranges, range_addrs, num_ranges);
+				if (kr != KERN_SUCCESS) {
+					goto done;
+				}
+				num_ranges = 0;
 				/*
 				 * TODO: This should free the backing pages directly instead of using
 				 * VM_BEHAVIOR_REUSABLE, which will mark the pages as clean and let them
@@ -1165,12 +1312,20 @@ reclaim_chunk(vm_deferred_reclamation_metadata_t metadata,
 		}
 	}
 
+	kr = reclaim_remove_ranges(metadata, ranges, range_addrs, num_ranges);
+	if (kr != KERN_SUCCESS) {
+		goto done;
+	}
+
 	assert(head + num_reclaimed <= busy);
 	head += num_reclaimed;
 	kr = reclaim_copyout_head(metadata, head);
 	if (kr != KERN_SUCCESS) {
 		goto done;
 	}
+	if (num_reclaimed > 0) {
+		vmdr_account_reclaimed(metadata, head, bytes_reclaimed);
+	}
 	if (busy > head) {
 		busy = head;
 		kr = reclaim_copyout_busy(metadata, busy);
@@ -1799,11 +1954,61 @@ vm_deferred_reclamation_task_drain(task_t task,
 	return kr;
 }
 
+/*
+ * Drains the ring of a suspended task. Runs from a thread call, so that the
+ * rings of many tasks suspended together are drained in parallel.
+ */
+static void
+vmdr_async_drain(thread_call_param_t param0, __unused thread_call_param_t param1)
+{
+	vm_deferred_reclamation_metadata_t metadata = param0;
+	mach_vm_size_t bytes_reclaimed = 0;
+
+	vmdr_metadata_lock(metadata);
+	task_t task = metadata->vdrm_task;
+	if (task == TASK_NULL ||
+	    !task_is_active(task) ||
+	    task_is_halting(task) ||
+	    !task_is_app_suspended(task)) {
+		goto out;
+	}
+	vmdr_metadata_own_locked(metadata, RECLAIM_OPTIONS_NONE);
+	vmdr_metadata_unlock(metadata);
+
+	vmdr_log_debug("draining suspended buffer [%d]\n", metadata->vdrm_pid);
+	(void)vmdr_drain(metadata, &bytes_reclaimed, RECLAIM_OPTIONS_NONE);
+	metadata->vdrm_kernel_bytes_reclaimed += bytes_reclaimed;
+	counter_inc(&vm_reclaim_async_drains);
+
+	vmdr_metadata_lock(metadata);
+	vmdr_metadata_disown_locked(metadata);
+	if (metadata->vdrm_waiters) {
+		thread_wakeup((event_t)&metadata->vdrm_waiters);
+	}
+out:
+	vmdr_metadata_unlock(metadata);
+	vmdr_metadata_release(metadata);
+}
+
 void
 vm_deferred_reclamation_task_suspend(task_t task)
 {
-	if (task->deferred_reclamation_metadata) {
-		sched_cond_signal(&vm_reclaim_scavenger_cond, vm_reclaim_scavenger_thread);
+	vm_deferred_reclamation_metadata_t metadata;
+
+	if (!vm_reclaim_async_drain) {
+		if (task->deferred_reclamation_metadata) {
+			sched_cond_signal(&vm_reclaim_scavenger_cond, vm_reclaim_scavenger_thread);
+		}
+		return;
+	}
+
+	metadata = vmdr_acquire_task_metadata(task);
+	if (metadata == NULL) {
+		return;
+	}
+	/* the reference is handed to the drain, unless one is already pending */
+	if (thread_call_enter(metadata->vdrm_drain_call)) {
+		vmdr_metadata_release(metadata);
 	}
 }
 
@@ -1884,6 +2089,55 @@ vm_deferred_reclamation_settle_ledger(task_t task)
 	vmdr_metadata_release(meta);
 }
 
+uint64_t
+vm_deferred_reclamation_bytes_per_sec(void)
+{
+	uint64_t now = mach_absolute_time();
+	uint64_t window_start = os_atomic_load(&vm_reclaim_rate_window_abs, relaxed);
+	uint64_t window_ns;
+
+	if (now - window_start < vm_reclaim_rate_period_abs) {
+		return os_atomic_load(&vm_reclaim_rate_bytes_per_sec, relaxed);
+	}
+	/* nothing closed the current window yet: report the rate over it */
+	absolutetime_to_nanoseconds(now - window_start, &window_ns);
+	return os_atomic_load(&vm_reclaim_rate_window_bytes, relaxed) *
+	       USEC_PER_SEC / (window_ns / NSEC_PER_USEC);
+}
+
+uint32_t
+vm_deferred_reclamation_stats_snapshot(struct vm_reclaim_task_stats *out, uint32_t max)
+{
+	vm_deferred_reclamation_metadata_t metadata;
+	uint32_t n = 0;
+
+	lck_mtx_lock(&reclaim_buffers_lock);
+	TAILQ_FOREACH(metadata, &reclaim_buffers, vdrm_list) {
+		if (n < max) {
+			struct vm_reclaim_task_stats *vrts = &out[n];
+			uint64_t total, count, ns;
+
+			vrts->vrts_pid = metadata->vdrm_pid;
+			vrts->vrts_bytes_reclaimed =
+			    os_atomic_load(&metadata->vdrm_bytes_reclaimed_total, relaxed);
+			total = os_atomic_load(&metadata->vdrm_latency_total_abs, acquire);
+			count = os_atomic_load(&metadata->vdrm_latency_count, acquire);
+			vrts->vrts_latency_count = count;
+			if (count) {
+				absolutetime_to_nanoseconds(total / count, &ns);
+				vrts->vrts_latency_avg_us = ns / NSEC_PER_USEC;
+			}
+			absolutetime_to_nanoseconds(
+				os_atomic_load(&metadata->vdrm_latency_max_abs, relaxed), &ns);
+			vrts->vrts_latency_max_us = ns / NSEC_PER_USEC;
+		}
+		n++;
+	}
+	lck_mtx_unlock(&reclaim_buffers_lock);
+
+	return n;
+}
+
 #pragma mark Global Reclamation GC
 
 static void
@@ -2039,6 +2293,7 @@ vm_deferred_reclamation_init(void)
 	vm_reclaim_log_handle = os_log_create("com.apple.xnu", "vm_reclaim");
 	nanoseconds_to_absolutetime((uint64_t)vm_reclaim_sampling_period_ns,
 	    &vm_reclaim_sampling_period_abs);
+	nanoseconds_to_absolutetime(NSEC_PER_SEC, &vm_reclaim_rate_period_abs);
 
 	sched_cond_init(&vm_reclaim_scavenger_cond);
 	lck_mtx_gate_init(&reclaim_buffers_lock, &vm_reclaim_gc_gate);
@@ -135,6 +135,27 @@ void vm_deferred_reclamation_gc(vm_deferred_reclamation_gc_action_t action,
  */
 void vm_deferred_reclamation_settle_ledger(task_t task);
 
+/* Lifetime reclamation statistics of a task, as reported by vm.reclaim.task_stats */
+struct vm_reclaim_task_stats {
+	int32_t  vrts_pid;
+	uint32_t vrts_reserved;
+	uint64_t vrts_bytes_reclaimed;
+	uint64_t vrts_latency_count;    /* batches of entries timed */
+	uint64_t vrts_latency_avg_us;   /* from first seen in the ring to reclaimed */
+	uint64_t vrts_latency_max_us;
+};
+
+/*
+ * Fill up to @c max task statistics, returns the number of tasks with a
+ * reclamation ring.
+ */
+uint32_t vm_deferred_reclamation_stats_snapshot(struct vm_reclaim_task_stats *out, uint32_t max);
+
+/*
+ * Bytes reclaimed per second from all the rings, over the last second or so.
+ */
+uint64_t vm_deferred_reclamation_bytes_per_sec(void);
+
 #endif /* CONFIG_DEFERRED_RECLAIM */
 #endif /* XNU_KERNEL_PRIVATE */
 #endif  /* __VM_RECLAIM_XNU__ */
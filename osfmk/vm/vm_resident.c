@@ -4808,6 +4808,251 @@ vm_page_grab_options_for_object(vm_object_t object __unused)
 	return options;
 }
 
+#pragma mark pre-zeroed pages
+
+/*
+ * A low priority thread takes pages off the free queues while memory is
+ * plentiful, zeroes them with non-temporal stores so that doing so doesn't
+ * evict anybody's working set from the caches, and stashes them in per-cpu
+ * pools that zero-fill faults take from first.
+ *
+ * Pooled pages are in the same state as the pages of the per-cpu free
+ * magazines (busy, VM_PAGE_ON_FREE_LOCAL_Q), and are only accounted to
+ * the task that ends up faulting them in.
+ */
+
+#define VM_PAGE_ZERO_POOL_BATCH         16
+
+struct vm_page_zero_pool {
+	hw_lck_ticket_t         vzp_lock;
+	vm_page_list_t          vzp_pages;
+#if HIBERNATION
+	bool                    vzp_suspended;  /* kept empty while hibernating */
+#endif /* HIBERNATION */
+};
+
+static struct vm_page_zero_pool PERCPU_DATA(vm_page_zero_pool);
+static thread_t vm_page_zero_thread;
+static sched_cond_atomic_t vm_page_zero_cond = SCHED_COND_INIT;
+
+/* pre-zeroed pages kept per cpu, 0 to disable, see VM_PAGE_ZERO_POOL_SIZE_MAX */
+TUNABLE_WRITEABLE(uint32_t, vm_page_zero_pool_size, "vm_page_zero_pool_size", 32);
+
+SCALABLE_COUNTER_DEFINE(vm_page_zero_pool_hits);
+SCALABLE_COUNTER_DEFINE(vm_page_zero_pool_misses);
+SCALABLE_COUNTER_DEFINE(vm_page_zero_pool_zeroed);
+
+static void
+vm_page_zero_pool_push(struct vm_page_zero_pool *pool, vm_page_list_t *list)
+{
+	vm_page_t freeq = VM_PAGE_NULL;
+	vm_page_t mem;
+
+	hw_lck_ticket_lock(&pool->vzp_lock, &vm_page_lck_grp_local);
+	while ((mem = vm_page_list_pop(list)) != VM_PAGE_NULL) {
+#if HIBERNATION
+		if (pool->vzp_suspended) {
+			mem->vmp_q_state = VM_PAGE_NOT_ON_Q;
+			_vm_page_list_push(&freeq, mem);
+			continue;
+		}
+#endif /* HIBERNATION */
+		vm_page_list_push(&pool->vzp_pages, mem);
+	}
+	hw_lck_ticket_unlock(&pool->vzp_lock);
+
+	if (freeq != VM_PAGE_NULL) {
+		vm_page_free_list(freeq, false);
+	}
+}
+
+/*
+ * Gives back the pages of a pool beyond keep to the free queues.
+ */
+static void
+vm_page_zero_pool_trim(struct vm_page_zero_pool *pool, uint32_t keep)
+{
+	vm_page_t freeq = VM_PAGE_NULL;
+	vm_page_t mem;
+
+	hw_lck_ticket_lock(&pool->vzp_lock, &vm_page_lck_grp_local);
+	while (pool->vzp_pages.vmpl_count > keep) {
+		mem = vm_page_list_pop(&pool->vzp_pages);
+		mem->vmp_q_state = VM_PAGE_NOT_ON_Q;
+		_vm_page_list_push(&freeq, mem);
+	}
+	hw_lck_ticket_unlock(&pool->vzp_lock);
+
+	if (freeq != VM_PAGE_NULL) {
+		vm_page_free_list(freeq, false);
+	}
+}
+
+/*
+ * Tops up a pool, as long as the free queues stay above their target.
+ * Returns false when memory got too tight to keep going.
+ */
+static bool
+vm_page_zero_pool_fill(struct vm_page_zero_pool *pool, uint32_t size)
+{
+	uint32_t count = os_atomic_load(&pool->vzp_pages.vmpl_count, relaxed);
+
+	while (count < size) {
+		uint32_t batch = MIN(size - count, VM_PAGE_ZERO_POOL_BATCH);
+		vm_page_list_t list = { };
+		vm_page_t mem;
+
+		vm_free_page_lock();
+#if HIBERNATION
+		if (hibernate_rebuild_needed || pool->vzp_suspended) {
+			batch = 0;
+		}
+#endif /* HIBERNATION */
+		if (batch != 0 && vm_page_free_count > vm_page_free_target + batch) {
+			list = vm_page_free_queue_grab(VM_PAGE_GRAB_OPTIONS_NONE,
+			    VM_MEMORY_CLASS_REGULAR, batch, VM_PAGE_ON_FREE_LOCAL_Q);
+		}
+		vm_free_page_unlock();
+
+		if (list.vmpl_count == 0) {
+			return false;
+		}
+
+		vm_page_list_foreach(mem, list) {
+			bzero_phys_nc(ptoa_64(VM_PAGE_GET_PHYS_PAGE(mem)), PAGE_SIZE);
+		}
+		counter_add(&vm_page_zero_pool_zeroed, list.vmpl_count);
+		count += list.vmpl_count;
+		vm_page_zero_pool_push(pool, &list);
+	}
+	return true;
+}
+
+__attribute__((noreturn))
+static void
+vm_page_zero_thread_continue(__unused void *param, __unused wait_result_t wr)
+{
+	sched_cond_ack(&vm_page_zero_cond);
+
+	while (true) {
+		uint32_t size = vm_page_zero_pool_size;
+		bool plenty = vm_page_free_count > vm_page_free_target;
+
+		percpu_foreach(pool, vm_page_zero_pool) {
+			if (!plenty || pool->vzp_pages.vmpl_count > size) {
+				vm_page_zero_pool_trim(pool, plenty ? size : 0);
+			} else {
+				plenty = vm_page_zero_pool_fill(pool, size);
+			}
+		}
+
+		sched_cond_wait(&vm_page_zero_cond, THREAD_UNINT,
+		    vm_page_zero_thread_continue);
+	}
+}
+
+__attribute__((noreturn))
+static void
+vm_page_zero_thread_init(__unused void *param, __unused wait_result_t wr)
+{
+	thread_set_thread_name(current_thread(), "VM_page_zero");
+#if CONFIG_THREAD_GROUPS
+	thread_group_vm_add();
+#endif /* CONFIG_THREAD_GROUPS */
+	sched_cond_wait(&vm_page_zero_cond, THREAD_UNINT,
+	    vm_page_zero_thread_continue);
+	__builtin_unreachable();
+}
+
+__startup_func
+static void
+vm_page_zero_pool_init(void)
+{
+	kern_return_t kr;
+
+	vm_page_zero_pool_size = MIN(vm_page_zero_pool_size, VM_PAGE_ZERO_POOL_SIZE_MAX);
+
+	percpu_foreach(pool, vm_page_zero_pool) {
+		hw_lck_ticket_init(&pool->vzp_lock, &vm_page_lck_grp_local);
+	}
+
+	sched_cond_init(&vm_page_zero_cond);
+	/* only runs when nothing else wants the cpus */
+	kr = kernel_thread_start_priority(vm_page_zero_thread_init, NULL,
+	    MAXPRI_THROTTLE, &vm_page_zero_thread);
+	if (kr != KERN_SUCCESS) {
+		panic("Unable to create VM page zero thread, %d", kr);
+	}
+}
+STARTUP(EARLY_BOOT, STARTUP_RANK_MIDDLE, vm_page_zero_pool_init);
+
+void
+vm_page_zero_pool_release(void)
+{
+	percpu_foreach(pool, vm_page_zero_pool) {
+		if (os_atomic_load(&pool->vzp_pages.vmpl_count, relaxed) != 0) {
+			vm_page_zero_pool_trim(pool, 0);
+		}
+	}
+}
+
+#if HIBERNATION
+/*
+ * The hibernation image treats pooled pages as free: their contents
+ * aren't saved, yet they'd still be handed out as zeroed on wake.
+ * Empty the pools, and have pages zeroed concurrently freed instead of
+ * pooled, until resumed.
+ */
+static void
+vm_page_zero_pool_suspend(bool suspend)
+{
+	percpu_foreach(pool, vm_page_zero_pool) {
+		hw_lck_ticket_lock(&pool->vzp_lock, &vm_page_lck_grp_local);
+		pool->vzp_suspended = suspend;
+		hw_lck_ticket_unlock(&pool->vzp_lock);
+
+		if (suspend) {
+			vm_page_zero_pool_trim(pool, 0);
+		}
+	}
+}
+#endif /* HIBERNATION */
+
+vm_page_t
+vm_page_grab_zeroed(vm_grab_options_t options, bool *zeroed)
+{
+	struct vm_page_zero_pool *pool;
+	vm_page_t mem = VM_PAGE_NULL;
+	uint32_t  left = 0;
+
+	if (vm_page_zero_pool_size == 0) {
+		*zeroed = false;
+		return vm_page_grab_options(options);
+	}
+
+	disable_preemption();
+	pool = PERCPU_GET(vm_page_zero_pool);
+	hw_lck_ticket_lock_nopreempt(&pool->vzp_lock, &vm_page_lck_grp_local);
+	mem = vm_page_list_pop(&pool->vzp_pages);
+	left = pool->vzp_pages.vmpl_count;
+	hw_lck_ticket_unlock_nopreempt(&pool->vzp_lock);
+	enable_preemption();
+
+	if (left < vm_page_zero_pool_size / 2) {
+		sched_cond_signal(&vm_page_zero_cond, vm_page_zero_thread);
+	}
+
+	if (mem != VM_PAGE_NULL) {
+		counter_inc(&vm_page_zero_pool_hits);
+		*zeroed = true;
+		return vm_page_grab_finalize(options, mem);
+	}
+
+	counter_inc(&vm_page_zero_pool_misses);
+	*zeroed = false;
+	return vm_page_grab_options(options);
+}
+
 /*!
  * @function vm_page_free_queue_steal()
  *
@@ -8590,6 +8835,9 @@ hibernate_discard_page(vm_page_t m)
 void
 hibernate_vm_lock_queues(void)
 {
+	/* before the free queue lock: emptying the pools frees pages */
+	vm_page_zero_pool_suspend(true);
+
 	vm_object_lock(compressor_object);
 	vm_page_lock_queues();
 	vm_free_page_lock();
@@ -8614,6 +8862,8 @@ hibernate_vm_unlock_queues(void)
 	vm_free_page_unlock();
 	vm_page_unlock_queues();
 	vm_object_unlock(compressor_object);
+
+	vm_page_zero_pool_suspend(false);
 }
 
 #if CONFIG_SPTM
@@ -8745,6 +8995,10 @@ hibernate_page_list_setall(hibernate_page_list_t * page_list,
 				hib_free_boilerplate(m);
 			}
 		}
+		percpu_foreach(zero_pool, vm_page_zero_pool) {
+			/* emptied by hibernate_vm_lock_queues(), see vm_page_zero_pool_suspend() */
+			assert(zero_pool->vzp_pages.vmpl_count == 0);
+		}
 	}
 
 #if CONFIG_SPTM
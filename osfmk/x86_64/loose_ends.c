@@ -212,12 +212,26 @@ flsll(unsigned long long mask)
 	return (sizeof(mask) << 3) - __builtin_clzll(mask);
 }
 
+/*
+ * Zero with non-temporal stores, for memory that isn't about to be used:
+ * this keeps the zeroes from displacing the cache contents.
+ */
 void
 bzero_phys_nc(
 	addr64_t src64,
 	uint32_t bytes)
 {
-	bzero_phys(src64, bytes);
+	uint64_t *dst = (uint64_t *)PHYSMAP_PTOV(src64);
+
+	if ((((uintptr_t)dst | bytes) & (sizeof(uint64_t) - 1)) != 0) {
+		bzero_phys(src64, bytes);
+		return;
+	}
+
+	for (uint32_t i = 0; i < bytes / sizeof(uint64_t); i++) {
+		__builtin_nontemporal_store(0ull, &dst[i]);
+	}
+	__asm__ volatile ("sfence" ::: "memory");
 }
 
 void
@@ -0,0 +1,392 @@
+#include <darwintest.h>
+#include <darwintest_utils.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/aio_private.h>
+#include <sys/event.h>
+#include <sys/mman.h>
+#include <sys/param.h>
+#include <sys/socket.h>
+
+T_GLOBAL_META(
+	T_META_NAMESPACE("xnu.file_descriptors.aio"),
+	T_META_RADAR_COMPONENT_NAME("xnu"),
+	T_META_RADAR_COMPONENT_VERSION("file descriptors"),
+	T_META_CHECK_LEAKS(false),
+	T_META_TAG_VM_PREFERRED);
+
+#define RING_ENTRIES    64
+#define RING_KQ_IDENT   0x72696e67
+
+struct test_ring {
+	struct aio_ring_shared *sh;
+	struct aio_ring_sqe    *sq;
+	struct aio_ring_cqe    *cq;
+	size_t                  size;
+	uint32_t                sq_entries;
+	uint32_t                cq_entries;
+	uint32_t                sq_tail;
+	uint32_t                enters;
+};
+
+static void
+ring_init(struct test_ring *r, uint32_t entries, int kq)
+{
+	struct aio_ring_params params = {
+		.sq_entries = entries,
+		.cq_entries = 2 * entries,
+		.kq_fd = kq,
+		.kq_ident = RING_KQ_IDENT,
+	};
+	int ret;
+
+	memset(r, 0, sizeof(*r));
+	r->sq_entries = params.sq_entries;
+	r->cq_entries = params.cq_entries;
+	r->size = round_page(AIO_RING_SIZE(params.sq_entries, params.cq_entries));
+
+	r->sh = mmap(NULL, r->size, PROT_READ | PROT_WRITE,
+	    MAP_ANON | MAP_PRIVATE, -1, 0);
+	T_QUIET; T_ASSERT_NE(r->sh, MAP_FAILED, "mmap ring");
+	r->sq = (struct aio_ring_sqe *)((char *)r->sh + AIO_RING_SQ_OFFSET);
+	r->cq = (struct aio_ring_cqe *)((char *)r->sh +
+	    AIO_RING_CQ_OFFSET(params.sq_entries));
+
+	params.ring_addr = (uint64_t)r->sh;
+	params.ring_size = r->size;
+
+	ret = aio_ring_setup(&params);
+	if (ret == -1 && errno == ENOTSUP) {
+		T_SKIP("aio rings require the per process aio workqueue");
+	}
+	T_ASSERT_POSIX_SUCCESS(ret, "aio_ring_setup");
+	T_QUIET; T_ASSERT_TRUE(r->sh->sq_flags & AIO_RING_SQ_NEED_WAKEUP,
+	    "an idle ring asks for a wakeup");
+}
+
+static void
+ring_fini(struct test_ring *r)
+{
+	T_ASSERT_POSIX_SUCCESS(aio_ring_enter(0, 0, AIO_RING_ENTER_UNREGISTER),
+	    "unregister the ring");
+	munmap(r->sh, r->size);
+}
+
+static struct aio_ring_sqe *
+ring_get_sqe(struct test_ring *r)
+{
+	uint32_t head = __atomic_load_n(&r->sh->sq_head, __ATOMIC_ACQUIRE);
+	struct aio_ring_sqe *sqe;
+
+	if (r->sq_tail - head >= r->sq_entries) {
+		return NULL;
+	}
+	sqe = &r->sq[r->sq_tail++ & (r->sq_entries - 1)];
+	memset(sqe, 0, sizeof(*sqe));
+	return sqe;
+}
+
+static void
+ring_submit(struct test_ring *r)
+{
+	__atomic_store_n(&r->sh->sq_tail, r->sq_tail, __ATOMIC_RELEASE);
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+	if (__atomic_load_n(&r->sh->sq_flags, __ATOMIC_RELAXED) &
+	    AIO_RING_SQ_NEED_WAKEUP) {
+		T_QUIET; T_ASSERT_POSIX_SUCCESS(aio_ring_enter(0, 0, 0),
+		    "aio_ring_enter");
+		r->enters++;
+	}
+}
+
+static bool
+ring_reap(struct test_ring *r, struct aio_ring_cqe *cqe)
+{
+	uint32_t head = r->sh->cq_head;
+
+	if (head == __atomic_load_n(&r->sh->cq_tail, __ATOMIC_ACQUIRE)) {
+		return false;
+	}
+	*cqe = r->cq[head & (r->cq_entries - 1)];
+	__atomic_store_n(&r->sh->cq_head, head + 1, __ATOMIC_RELEASE);
+	return true;
+}
+
+static void
+ring_wait(struct test_ring *r, uint32_t count)
+{
+	T_QUIET; T_ASSERT_POSIX_SUCCESS(aio_ring_enter(0, count,
+	    AIO_RING_ENTER_GETEVENTS), "wait for %d completions", count);
+	r->enters++;
+}
+
+static int
+make_testfile(void)
+{
+	char path[MAXPATHLEN];
+	int fd;
+
+	snprintf(path, sizeof(path), "%s/aio_ring.XXXXXX", dt_tmpdir());
+	T_QUIET; T_ASSERT_POSIX_SUCCESS(fd = mkstemp(path), "mkstemp");
+	unlink(path);
+	return fd;
+}
+
+T_DECL(aio_ring_linked_rw, "write then read back through a linked chain",
+    T_META_TAG_VM_PREFERRED)
+{
+	char wbuf[4096], rbuf[4096];
+	struct aio_ring_sqe *sqe;
+	struct aio_ring_cqe cqe;
+	struct test_ring r;
+	int fd = make_testfile();
+
+	memset(wbuf, 0xa5, sizeof(wbuf));
+	memset(rbuf, 0, sizeof(rbuf));
+	ring_init(&r, RING_ENTRIES, -1);
+
+	sqe = ring_get_sqe(&r);
+	sqe->opcode = AIO_RING_OP_WRITE;
+	sqe->flags = AIO_RING_SQE_LINK;
+	sqe->fd = fd;
+	sqe->offset = 8192;
+	sqe->buf = (uint64_t)wbuf;
+	sqe->nbytes = sizeof(wbuf);
+	sqe->user_data = 1;
+
+	sqe = ring_get_sqe(&r);
+	sqe->opcode = AIO_RING_OP_READ;
+	sqe->fd = fd;
+	sqe->offset = 8192;
+	sqe->buf = (uint64_t)rbuf;
+	sqe->nbytes = sizeof(rbuf);
+	sqe->user_data = 2;
+
+	ring_submit(&r);
+	ring_wait(&r, 2);
+
+	T_ASSERT_TRUE(ring_reap(&r, &cqe), "first completion");
+	T_EXPECT_EQ(cqe.user_data, 1ull, "write completes first");
+	T_EXPECT_EQ(cqe.result, (int64_t)sizeof(wbuf), "write result");
+	T_ASSERT_TRUE(ring_reap(&r, &cqe), "second completion");
+	T_EXPECT_EQ(cqe.user_data, 2ull, "read completes second");
+	T_EXPECT_EQ(cqe.result, (int64_t)sizeof(rbuf), "read result");
+	T_EXPECT_EQ(memcmp(wbuf, rbuf, sizeof(rbuf)), 0, "data round trips");
+
+	ring_fini(&r);
+	close(fd);
+}
+
+T_DECL(aio_ring_chain_cancel, "a failed SQE cancels the rest of its chain",
+    T_META_TAG_VM_PREFERRED)
+{
+	char buf[64];
+	struct aio_ring_sqe *sqe;
+	struct aio_ring_cqe cqe;
+	struct test_ring r;
+
+	ring_init(&r, RING_ENTRIES, -1);
+
+	sqe = ring_get_sqe(&r);
+	sqe->opcode = AIO_RING_OP_READ;
+	sqe->flags = AIO_RING_SQE_LINK;
+	sqe->fd = -1;
+	sqe->offset = AIO_RING_OFFSET_CURRENT;
+	sqe->buf = (uint64_t)buf;
+	sqe->nbytes = sizeof(buf);
+	sqe->user_data = 1;
+
+	sqe = ring_get_sqe(&r);
+	sqe->opcode = AIO_RING_OP_NOP;
+	sqe->user_data = 2;
+
+	sqe = ring_get_sqe(&r);
+	sqe->opcode = AIO_RING_OP_NOP;
+	sqe->user_data = 3;
+
+	ring_submit(&r);
+	ring_wait(&r, 3);
+
+	for (int i = 0; i < 3; i++) {
+		T_QUIET; T_ASSERT_TRUE(ring_reap(&r, &cqe), "completion %d", i);
+		switch (cqe.user_data) {
+		case 1:
+			T_EXPECT_EQ(cqe.result, (int64_t)-EBADF, "bad fd fails");
+			break;
+		case 2:
+			T_EXPECT_EQ(cqe.result, (int64_t)-ECANCELED, "linked SQE is cancelled");
+			break;
+		case 3:
+			T_EXPECT_EQ(cqe.result, 0ll, "unlinked SQE runs");
+			break;
+		default:
+			T_FAIL("unexpected user_data %llu", cqe.user_data);
+		}
+	}
+
+	ring_fini(&r);
+}
+
+T_DECL(aio_ring_unregister_pending_recv,
+    "unregistering cancels a chain blocked in a recv",
+    T_META_TIMEOUT(30), T_META_TAG_VM_PREFERRED)
+{
+	char buf[64];
+	struct aio_ring_sqe *sqe;
+	struct aio_ring_cqe cqe;
+	struct test_ring r;
+	int fds[2];
+
+	T_ASSERT_POSIX_SUCCESS(socketpair(AF_UNIX, SOCK_STREAM, 0, fds),
+	    "socketpair");
+	ring_init(&r, RING_ENTRIES, -1);
+
+	sqe = ring_get_sqe(&r);
+	sqe->opcode = AIO_RING_OP_RECV;
+	sqe->flags = AIO_RING_SQE_LINK;
+	sqe->fd = fds[0];
+	sqe->buf = (uint64_t)buf;
+	sqe->nbytes = sizeof(buf);
+	sqe->user_data = 1;
+
+	sqe = ring_get_sqe(&r);
+	sqe->opcode = AIO_RING_OP_NOP;
+	sqe->user_data = 2;
+
+	ring_submit(&r);
+
+	/* nothing is ever sent: wait for the recv to be picked up and block */
+	while (__atomic_load_n(&r.sh->sq_head, __ATOMIC_ACQUIRE) != r.sq_tail) {
+		usleep(1000);
+	}
+	usleep(100 * 1000);
+	T_QUIET; T_ASSERT_FALSE(ring_reap(&r, &cqe), "the recv is still pending");
+
+	T_ASSERT_POSIX_SUCCESS(aio_ring_enter(0, 0, AIO_RING_ENTER_UNREGISTER),
+	    "unregister the ring with a recv pending");
+
+	for (int i = 0; i < 2; i++) {
+		T_QUIET; T_ASSERT_TRUE(ring_reap(&r, &cqe), "completion %d", i);
+		T_EXPECT_EQ(cqe.result, (int64_t)-ECANCELED,
+		    "SQE %llu is cancelled", cqe.user_data);
+	}
+	T_EXPECT_FALSE(ring_reap(&r, &cqe), "no other completion");
+
+	T_EXPECT_POSIX_FAILURE(aio_ring_enter(0, 0, 0), ENXIO,
+	    "the ring is unregistered");
+
+	munmap(r.sh, r.size);
+	close(fds[0]);
+	close(fds[1]);
+}
+
+T_DECL(aio_ring_kevent, "completions trigger the registered EVFILT_USER knote",
+    T_META_TAG_VM_PREFERRED)
+{
+	struct kevent64_s kev;
+	struct timespec ts = { .tv_sec = 10 };
+	struct aio_ring_sqe *sqe;
+	struct aio_ring_cqe cqe;
+	struct test_ring r;
+	char buf[16] = "aio ring socket";
+	char rbuf[16];
+	int sv[2];
+	int kq;
+
+	T_ASSERT_POSIX_SUCCESS(kq = kqueue(), "kqueue");
+	EV_SET64(&kev, RING_KQ_IDENT, EVFILT_USER, EV_ADD | EV_CLEAR, 0, 0, 0, 0, 0);
+	T_ASSERT_POSIX_SUCCESS(kevent64(kq, &kev, 1, NULL, 0, 0, NULL), "add knote");
+	T_ASSERT_POSIX_SUCCESS(socketpair(AF_UNIX, SOCK_STREAM, 0, sv), "socketpair");
+
+	ring_init(&r, RING_ENTRIES, kq);
+
+	sqe = ring_get_sqe(&r);
+	sqe->opcode = AIO_RING_OP_SEND;
+	sqe->flags = AIO_RING_SQE_LINK;
+	sqe->fd = sv[0];
+	sqe->buf = (uint64_t)buf;
+	sqe->nbytes = sizeof(buf);
+	sqe->user_data = 1;
+
+	sqe = ring_get_sqe(&r);
+	sqe->opcode = AIO_RING_OP_RECV;
+	sqe->fd = sv[1];
+	sqe->buf = (uint64_t)rbuf;
+	sqe->nbytes = sizeof(rbuf);
+	sqe->user_data = 2;
+
+	ring_submit(&r);
+
+	T_ASSERT_EQ(kevent64(kq, NULL, 0, &kev, 1, 0, &ts), 1, "knote fires");
+	T_EXPECT_EQ(kev.ident, (uint64_t)RING_KQ_IDENT, "on the registered ident");
+
+	ring_wait(&r, 2);
+	T_ASSERT_TRUE(ring_reap(&r, &cqe), "send completion");
+	T_EXPECT_EQ(cqe.result, (int64_t)sizeof(buf), "send result");
+	T_ASSERT_TRUE(ring_reap(&r, &cqe), "recv completion");
+	T_EXPECT_EQ(cqe.result, (int64_t)sizeof(rbuf), "recv result");
+	T_EXPECT_EQ(memcmp(buf, rbuf, sizeof(rbuf)), 0, "data round trips");
+
+	ring_fini(&r);
+	close(sv[0]);
+	close(sv[1]);
+	close(kq);
+}
+
+T_DECL(aio_ring_syscalls_per_io, "a busy ring needs few system calls",
+    T_META_TAG_VM_PREFERRED)
+{
+	const uint32_t total = 64 * 1024;
+	uint32_t submitted = 0, completed = 0, spins = 0;
+	struct aio_ring_cqe cqe;
+	struct test_ring r;
+	char buf[512];
+	int fd = make_testfile();
+
+	memset(buf, 0x5a, sizeof(buf));
+	T_QUIET; T_ASSERT_POSIX_SUCCESS(pwrite(fd, buf, sizeof(buf), 0), "pwrite");
+
+	ring_init(&r, RING_ENTRIES, -1);
+
+	while (completed < total) {
+		struct aio_ring_sqe *sqe;
+		bool queued = false;
+
+		while (submitted < total &&
+		    submitted - completed < r.sq_entries &&
+		    (sqe = ring_get_sqe(&r))) {
+			sqe->opcode = AIO_RING_OP_READ;
+			sqe->fd = fd;
+			sqe->offset = 0;
+			sqe->buf = (uint64_t)buf;
+			sqe->nbytes = sizeof(buf);
+			sqe->user_data = submitted++;
+			queued = true;
+		}
+		if (queued) {
+			ring_submit(&r);
+		}
+
+		if (!ring_reap(&r, &cqe)) {
+			if (++spins == 1000) {
+				spins = 0;
+				ring_wait(&r, 1);
+			}
+			continue;
+		}
+		spins = 0;
+		T_QUIET; T_ASSERT_EQ(cqe.result, (int64_t)sizeof(buf), "read result");
+		completed++;
+	}
+
+	T_LOG("%u reads, %u system calls (%.3f per I/O)", total, r.enters,
+	    (double)r.enters / total);
+	T_EXPECT_LT(r.enters, total, "less than one system call per I/O");
+
+	ring_fini(&r);
+	close(fd);
+}
@@ -0,0 +1,58 @@
+/*
+ * Copyright (c) 2025 Apple Inc. All rights reserved.
+ *
+ * @APPLE_OSREFERENCE_LICENSE_HEADER_START@
+ *
+ * This file contains Original Code and/or Modifications of Original Code
+ * as defined in and that are subject to the Apple Public Source License
+ * Version 2.0 (the 'License'). You may not use this file except in
+ * compliance with the License. The rights granted to you under the License
+ * may not be used to create, or enable the creation or redistribution of,
+ * unlawful or unlicensed copies of an Apple operating system, or to
+ * circumvent, violate, or enable the circumvention or violation of, any
+ * terms of an Apple operating system software license agreement.
+ *
+ * Please obtain a copy of the License at
+ * http://www.opensource.apple.com/apsl/ and read it before using this file.
+ *
+ * The Original Code and all software distributed under the License are
+ * distributed on an 'AS IS' basis, WITHOUT WARRANTY OF ANY KIND, EITHER
+ * EXPRESS OR IMPLIED, AND APPLE HEREBY DISCLAIMS ALL SUCH WARRANTIES,
+ * INCLUDING WITHOUT LIMITATION, ANY WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE, QUIET ENJOYMENT OR NON-INFRINGEMENT.
+ * Please see the License for the specific language governing rights and
+ * limitations under the License.
+ *
+ * @APPLE_OSREFERENCE_LICENSE_HEADER_END@
+ */
+
+#include <sys/sysctl.h>
+
+#include <darwintest.h>
+
+T_GLOBAL_META(
+	T_META_NAMESPACE("xnu.net"),
+	T_META_RADAR_COMPONENT_NAME("xnu"),
+	T_META_RADAR_COMPONENT_VERSION("networking"),
+	T_META_CHECK_LEAKS(false));
+
+static int64_t
+run_sysctl_test(const char *t, int64_t value)
+{
+	char name[1024];
+	int64_t result = 0;
+	size_t s = sizeof(value);
+	int rc;
+
+	snprintf(name, sizeof(name), "debug.test.%s", t);
+	rc = sysctlbyname(name, &result, &s, &value, s);
+	T_QUIET; T_ASSERT_POSIX_SUCCESS(rc, "sysctlbyname(%s)", t);
+	return result;
+}
+
+T_DECL(bpf_jit_differential, "compiled BPF filters match the interpreter",
+    T_META_ASROOT(true), T_META_TAG_VM_PREFERRED)
+{
+	T_EXPECT_EQ(0ll, run_sysctl_test("bpf_jit_test", 0),
+	    "no mismatches between bpf_filter and bpf_jit_filter");
+}
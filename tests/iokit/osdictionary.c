@@ -0,0 +1,47 @@
+#include <sys/sysctl.h>
+#include <time.h>
+
+#include <darwintest.h>
+#include <darwintest_utils.h>
+
+T_GLOBAL_META(
+	T_META_NAMESPACE("xnu.iokit"),
+	T_META_RADAR_COMPONENT_NAME("xnu"),
+	T_META_RADAR_COMPONENT_VERSION("IOKit"),
+	T_META_CHECK_LEAKS(false));
+
+static int64_t
+run_sysctl_test(const char *t, int64_t value)
+{
+	char name[1024];
+	int64_t result = 0;
+	size_t s = sizeof(value);
+	int rc;
+
+	snprintf(name, sizeof(name), "debug.test.%s", t);
+	rc = sysctlbyname(name, &result, &s, &value, s);
+	T_QUIET; T_ASSERT_POSIX_SUCCESS(rc, "sysctlbyname(%s)", t);
+	return result;
+}
+
+T_DECL(dictionary_basic, "OSDictionary linear and hashed storage",
+    T_META_TAG_VM_PREFERRED)
+{
+	for (int64_t n = 1; n <= 10000; n *= 10) {
+		T_EXPECT_EQ(1ll, run_sysctl_test("iokit_dictionary", n),
+		    "%lld keys", n);
+	}
+}
+
+T_DECL(dictionary_bench, "OSDictionary insert and lookup scaling",
+    T_META_TAG_PERF, T_META_TAG_VM_NOT_ELIGIBLE)
+{
+	for (int64_t n = 10; n <= 10000; n *= 10) {
+		dt_stat_t s = dt_stat_create("ns/key", "insert+lookup %lld keys", n);
+
+		while (!dt_stat_stable(s)) {
+			dt_stat_add(s, (double)run_sysctl_test("iokit_dictionary_bench", n) / n);
+		}
+		dt_stat_finalize(s);
+	}
+}
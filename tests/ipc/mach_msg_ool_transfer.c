@@ -0,0 +1,497 @@
+#include <darwintest.h>
+#include <darwintest_utils.h>
+
+#include <mach/mach.h>
+#include <mach/mach_types.h>
+#include <mach/mach_port.h>
+#include <mach/message.h>
+#include <mach/mach_error.h>
+#include <mach/task_info.h>
+#include <mach/vm_map.h>
+#include <sys/sysctl.h>
+#include <string.h>
+
+T_GLOBAL_META(
+	T_META_NAMESPACE("xnu.ipc"),
+	T_META_CHECK_LEAKS(false),
+	T_META_RUN_CONCURRENTLY(true),
+	T_META_RADAR_COMPONENT_NAME("xnu"),
+	T_META_RADAR_COMPONENT_VERSION("IPC"));
+
+/*
+ * This file checks the transfer policies of large out-of-line memory
+ * descriptors: copy-on-write sends of physical copies above
+ * kern.ipc_ool_remap_threshold, and delivery into a receive region
+ * registered with TASK_OOL_RCV_REGION_INFO.
+ */
+
+#pragma mark helpers
+
+typedef struct {
+	mach_msg_header_t         header;
+	mach_msg_body_t           body;
+	mach_msg_ool_descriptor_t ool;
+} t_ool_msg_t;
+
+typedef struct {
+	t_ool_msg_t               msg;
+	mach_msg_max_trailer_t    trailer;
+} t_ool_rcv_msg_t;
+
+static const mach_vm_size_t t_sizes[] = {
+	16 << 10, 64 << 10, 256 << 10, 1 << 20, 4 << 20,
+};
+
+static mach_port_name_t
+t_port_construct(void)
+{
+	mach_port_options_t opts = {
+		.flags = MPO_INSERT_SEND_RIGHT | MPO_QLIMIT,
+		.mpl.mpl_qlimit = MACH_PORT_QLIMIT_LARGE,
+	};
+	mach_port_name_t name;
+	kern_return_t kr;
+
+	kr = mach_port_construct(mach_task_self(), &opts, 0, &name);
+	T_QUIET; T_ASSERT_MACH_SUCCESS(kr, "mach_port_construct");
+
+	return name;
+}
+
+static void
+t_port_destruct(mach_port_name_t name)
+{
+	kern_return_t kr;
+
+	kr = mach_port_destruct(mach_task_self(), name, -1, 0);
+	T_QUIET; T_ASSERT_MACH_SUCCESS(kr, "mach_port_destruct");
+}
+
+static void
+t_send_ool(mach_port_name_t port, void *addr, mach_vm_size_t size,
+    mach_msg_copy_options_t copy)
+{
+	t_ool_msg_t msg = {
+		.header = {
+			.msgh_bits = MACH_MSGH_BITS_SET(MACH_MSG_TYPE_COPY_SEND,
+			    0, 0, MACH_MSGH_BITS_COMPLEX),
+			.msgh_size = sizeof(msg),
+			.msgh_remote_port = port,
+		},
+		.body.msgh_descriptor_count = 1,
+		.ool = {
+			.address = addr,
+			.size = (mach_msg_size_t)size,
+			.deallocate = false,
+			.copy = copy,
+			.type = MACH_MSG_OOL_DESCRIPTOR,
+		},
+	};
+	kern_return_t kr;
+
+	kr = mach_msg(&msg.header, MACH_SEND_MSG, sizeof(msg), 0,
+	    MACH_PORT_NULL, MACH_MSG_TIMEOUT_NONE, MACH_PORT_NULL);
+	T_QUIET; T_ASSERT_MACH_SUCCESS(kr, "mach_msg(send, %lld bytes)", size);
+}
+
+static mach_vm_address_t
+t_receive_ool(mach_port_name_t port, mach_vm_size_t size)
+{
+	t_ool_rcv_msg_t msg = { };
+	kern_return_t kr;
+
+	kr = mach_msg(&msg.msg.header, MACH_RCV_MSG, 0, sizeof(msg),
+	    port, MACH_MSG_TIMEOUT_NONE, MACH_PORT_NULL);
+	T_QUIET; T_ASSERT_MACH_SUCCESS(kr, "mach_msg(receive)");
+	T_QUIET; T_ASSERT_EQ(msg.msg.body.msgh_descriptor_count, 1u, "one descriptor");
+	T_QUIET; T_ASSERT_EQ((mach_vm_size_t)msg.msg.ool.size, size, "descriptor size");
+
+	return (mach_vm_address_t)msg.msg.ool.address;
+}
+
+static void *
+t_allocate(mach_vm_size_t size)
+{
+	mach_vm_address_t addr = 0;
+	kern_return_t kr;
+
+	kr = mach_vm_allocate(mach_task_self(), &addr, size, VM_FLAGS_ANYWHERE);
+	T_QUIET; T_ASSERT_MACH_SUCCESS(kr, "mach_vm_allocate(%lld)", size);
+
+	return (void *)addr;
+}
+
+static void
+t_deallocate(mach_vm_address_t addr, mach_vm_size_t size)
+{
+	kern_return_t kr;
+
+	kr = mach_vm_deallocate(mach_task_self(), addr, size);
+	T_QUIET; T_ASSERT_MACH_SUCCESS(kr, "mach_vm_deallocate");
+}
+
+static void
+t_fill(void *addr, mach_vm_size_t size, uint32_t seed)
+{
+	uint32_t *p = addr;
+
+	for (mach_vm_size_t i = 0; i < size / sizeof(uint32_t); i++) {
+		p[i] = seed ^ (uint32_t)i;
+	}
+}
+
+static bool
+t_check(mach_vm_address_t addr, mach_vm_size_t size, uint32_t seed)
+{
+	const uint32_t *p = (const uint32_t *)addr;
+
+	for (mach_vm_size_t i = 0; i < size / sizeof(uint32_t); i++) {
+		if (p[i] != (seed ^ (uint32_t)i)) {
+			return false;
+		}
+	}
+	return true;
+}
+
+static kern_return_t
+t_set_rcv_region(mach_vm_address_t addr, mach_vm_size_t size)
+{
+	task_ool_rcv_region_info_data_t region = {
+		.address = addr,
+		.size = size,
+	};
+
+	return task_set_info(mach_task_self(), TASK_OOL_RCV_REGION_INFO,
+	           (task_info_t)&region, TASK_OOL_RCV_REGION_INFO_COUNT);
+}
+
+static kern_return_t
+t_ack_rcv_region(mach_vm_address_t consumed)
+{
+	task_ool_rcv_region_ack_info_data_t ack = {
+		.consumed = consumed,
+	};
+
+	return task_set_info(mach_task_self(), TASK_OOL_RCV_REGION_ACK_INFO,
+	           (task_info_t)&ack, TASK_OOL_RCV_REGION_ACK_INFO_COUNT);
+}
+
+static mach_vm_size_t
+t_rcv_region_used(void)
+{
+	task_ool_rcv_region_info_data_t info = { };
+	mach_msg_type_number_t count = TASK_OOL_RCV_REGION_INFO_COUNT;
+	kern_return_t kr;
+
+	kr = task_info(mach_task_self(), TASK_OOL_RCV_REGION_INFO,
+	    (task_info_t)&info, &count);
+	T_QUIET; T_ASSERT_MACH_SUCCESS(kr, "task_info(TASK_OOL_RCV_REGION_INFO)");
+
+	return info.used;
+}
+
+static void
+t_port_use_rcv_region(mach_port_name_t port)
+{
+	int value = 1;
+	kern_return_t kr;
+
+	kr = mach_port_set_attributes(mach_task_self(), port,
+	    MACH_PORT_OOL_RCV_REGION, (mach_port_info_t)&value,
+	    MACH_PORT_OOL_RCV_REGION_COUNT);
+	T_QUIET; T_ASSERT_MACH_SUCCESS(kr, "mach_port_set_attributes(MACH_PORT_OOL_RCV_REGION)");
+}
+
+static bool
+t_in_region(mach_vm_address_t addr, mach_vm_size_t size,
+    mach_vm_address_t region, mach_vm_size_t region_size)
+{
+	return addr < region + region_size && addr + size > region;
+}
+
+#pragma mark tests
+
+T_DECL(mach_msg_ool_physical_copy_snapshot,
+    "physical copies are snapshots of the sender's memory at any size",
+    T_META_TAG_VM_PREFERRED)
+{
+	uint32_t threshold = 0;
+	size_t threshold_size = sizeof(threshold);
+	mach_port_name_t port = t_port_construct();
+
+	T_ASSERT_POSIX_SUCCESS(sysctlbyname("kern.ipc_ool_remap_threshold",
+	    &threshold, &threshold_size, NULL, 0), "kern.ipc_ool_remap_threshold");
+	T_LOG("copy-on-write threshold: %u bytes", threshold);
+
+	for (size_t i = 0; i < sizeof(t_sizes) / sizeof(t_sizes[0]); i++) {
+		mach_vm_size_t size = t_sizes[i];
+		void *buf = t_allocate(size);
+		mach_vm_address_t rcv;
+
+		t_fill(buf, size, 0x5ca1ab1e);
+		t_send_ool(port, buf, size, MACH_MSG_PHYSICAL_COPY);
+
+		/* the receiver must not observe writes made after the send */
+		t_fill(buf, size, 0xdeadbeef);
+
+		rcv = t_receive_ool(port, size);
+		T_EXPECT_TRUE(t_check(rcv, size, 0x5ca1ab1e),
+		    "%lld bytes received as they were sent", size);
+		T_EXPECT_TRUE(t_check((mach_vm_address_t)buf, size, 0xdeadbeef),
+		    "%lld bytes sender buffer unaffected", size);
+
+		t_deallocate(rcv, size);
+		t_deallocate((mach_vm_address_t)buf, size);
+	}
+
+	t_port_destruct(port);
+}
+
+T_DECL(mach_msg_ool_rcv_region,
+    "out-of-line memory is delivered in the registered receive region",
+    T_META_RUN_CONCURRENTLY(false), T_META_TAG_VM_PREFERRED)
+{
+	const mach_vm_size_t region_size = 2 << 20;
+	const mach_vm_size_t size = 512 << 10;
+	task_ool_rcv_region_info_data_t info = { };
+	mach_msg_type_number_t count = TASK_OOL_RCV_REGION_INFO_COUNT;
+	mach_port_name_t port = t_port_construct();
+	mach_vm_address_t region = (mach_vm_address_t)t_allocate(region_size);
+	void *buf = t_allocate(4 << 20);
+	mach_vm_address_t rcv;
+	kern_return_t kr;
+
+	t_port_use_rcv_region(port);
+
+	T_EXPECT_MACH_ERROR(t_set_rcv_region(region + 1, region_size),
+	    KERN_INVALID_ARGUMENT, "misaligned regions are rejected");
+
+	T_ASSERT_MACH_SUCCESS(t_set_rcv_region(region, region_size),
+	    "register a %lld bytes receive region", region_size);
+
+	kr = task_info(mach_task_self(), TASK_OOL_RCV_REGION_INFO,
+	    (task_info_t)&info, &count);
+	T_ASSERT_MACH_SUCCESS(kr, "task_info(TASK_OOL_RCV_REGION_INFO)");
+	T_EXPECT_EQ(info.address, region, "region address");
+	T_EXPECT_EQ(info.size, region_size, "region size");
+	T_EXPECT_EQ(info.used, 0ull, "region is empty");
+
+	/* go around the region a couple of times, consuming as we go */
+	for (uint32_t i = 0; i <= 2 * region_size / size; i++) {
+		mach_vm_address_t expected = region + (i * size) % region_size;
+
+		t_fill(buf, size, i);
+		t_send_ool(port, buf, size, i & 1 ?
+		    MACH_MSG_VIRTUAL_COPY : MACH_MSG_PHYSICAL_COPY);
+		rcv = t_receive_ool(port, size);
+
+		T_EXPECT_EQ(rcv, expected, "message %u delivered at offset %lld",
+		    i, rcv - region);
+		T_EXPECT_TRUE(t_check(rcv, size, i), "message %u contents", i);
+		T_QUIET; T_EXPECT_MACH_SUCCESS(t_ack_rcv_region(rcv + size),
+		    "acknowledge message %u", i);
+	}
+	T_EXPECT_EQ(t_rcv_region_used(), 0ull, "everything was acknowledged");
+
+	T_EXPECT_MACH_ERROR(t_ack_rcv_region(region + region_size + PAGE_SIZE),
+	    KERN_INVALID_ARGUMENT, "acknowledging outside of the region fails");
+
+	/* small copies are delivered in the region too */
+	t_fill(buf, PAGE_SIZE / 2, 42);
+	t_send_ool(port, buf, PAGE_SIZE / 2, MACH_MSG_PHYSICAL_COPY);
+	rcv = t_receive_ool(port, PAGE_SIZE / 2);
+	T_EXPECT_TRUE(t_in_region(rcv, PAGE_SIZE / 2, region, region_size),
+	    "small copy delivered in the region");
+	T_EXPECT_TRUE(t_check(rcv, PAGE_SIZE / 2, 42), "small copy contents");
+	T_EXPECT_MACH_SUCCESS(t_ack_rcv_region(rcv + PAGE_SIZE),
+	    "acknowledge the small copy");
+
+	/* copies larger than the region get a mapping of their own */
+	t_fill(buf, 4 << 20, 7);
+	t_send_ool(port, buf, 4 << 20, MACH_MSG_PHYSICAL_COPY);
+	rcv = t_receive_ool(port, 4 << 20);
+	T_EXPECT_FALSE(t_in_region(rcv, 4 << 20, region, region_size),
+	    "large copy delivered outside of the region");
+	T_EXPECT_TRUE(t_check(rcv, 4 << 20, 7), "large copy contents");
+	t_deallocate(rcv, 4 << 20);
+
+	T_ASSERT_MACH_SUCCESS(t_set_rcv_region(0, 0), "unregister the region");
+
+	t_send_ool(port, buf, size, MACH_MSG_PHYSICAL_COPY);
+	rcv = t_receive_ool(port, size);
+	T_EXPECT_FALSE(t_in_region(rcv, size, region, region_size),
+	    "delivered outside of the region once unregistered");
+	t_deallocate(rcv, size);
+
+	t_deallocate((mach_vm_address_t)buf, 4 << 20);
+	t_deallocate(region, region_size);
+	t_port_destruct(port);
+}
+
+T_DECL(mach_msg_ool_rcv_region_full,
+    "a full receive region doesn't overwrite unacknowledged memory",
+    T_META_RUN_CONCURRENTLY(false), T_META_TAG_VM_PREFERRED)
+{
+	const mach_vm_size_t region_size = 1 << 20;
+	const mach_vm_size_t size = 256 << 10;
+	const uint32_t n = region_size / size;
+	mach_port_name_t port = t_port_construct();
+	mach_vm_address_t region = (mach_vm_address_t)t_allocate(region_size);
+	mach_vm_address_t rcv[n];
+	void *buf = t_allocate(size);
+	mach_vm_address_t extra;
+
+	t_port_use_rcv_region(port);
+	T_ASSERT_MACH_SUCCESS(t_set_rcv_region(region, region_size),
+	    "register a %lld bytes receive region", region_size);
+
+	/* fill the region without acknowledging anything */
+	for (uint32_t i = 0; i < n; i++) {
+		t_fill(buf, size, i);
+		t_send_ool(port, buf, size, MACH_MSG_PHYSICAL_COPY);
+		rcv[i] = t_receive_ool(port, size);
+		T_QUIET; T_EXPECT_EQ(rcv[i], region + i * size,
+		    "message %u delivered in the region", i);
+	}
+	T_EXPECT_EQ(t_rcv_region_used(), region_size, "region is full");
+
+	/* the next message falls back to a new mapping */
+	t_fill(buf, size, n);
+	t_send_ool(port, buf, size, MACH_MSG_PHYSICAL_COPY);
+	extra = t_receive_ool(port, size);
+	T_EXPECT_FALSE(t_in_region(extra, size, region, region_size),
+	    "message delivered outside of the full region");
+	T_EXPECT_TRUE(t_check(extra, size, n), "fallback message contents");
+	t_deallocate(extra, size);
+
+	for (uint32_t i = 0; i < n; i++) {
+		T_EXPECT_TRUE(t_check(rcv[i], size, i),
+		    "message %u wasn't overwritten", i);
+	}
+
+	/* releasing the oldest message makes room at the start again */
+	T_ASSERT_MACH_SUCCESS(t_ack_rcv_region(rcv[0] + size),
+	    "acknowledge the oldest message");
+	T_EXPECT_EQ(t_rcv_region_used(), region_size - size, "one slot free");
+
+	t_fill(buf, size, n + 1);
+	t_send_ool(port, buf, size, MACH_MSG_PHYSICAL_COPY);
+	extra = t_receive_ool(port, size);
+	T_EXPECT_EQ(extra, region, "message delivered in the released slot");
+	T_EXPECT_TRUE(t_check(extra, size, n + 1), "message contents");
+	T_EXPECT_TRUE(t_check(rcv[1], size, 1), "next message wasn't overwritten");
+
+	/* acknowledging up to the head of a full region releases everything */
+	T_ASSERT_MACH_SUCCESS(t_ack_rcv_region(extra + size),
+	    "acknowledge everything");
+	T_EXPECT_EQ(t_rcv_region_used(), 0ull, "region is empty");
+
+	T_ASSERT_MACH_SUCCESS(t_set_rcv_region(0, 0), "unregister the region");
+	t_deallocate((mach_vm_address_t)buf, size);
+	t_deallocate(region, region_size);
+	t_port_destruct(port);
+}
+
+T_DECL(mach_msg_ool_rcv_region_foreign,
+    "only ports that opted in deliver memory in the receive region",
+    T_META_RUN_CONCURRENTLY(false), T_META_TAG_VM_PREFERRED)
+{
+	const mach_vm_size_t region_size = 1 << 20;
+	const mach_vm_size_t size = 256 << 10;
+	mach_port_name_t port = t_port_construct();
+	mach_vm_address_t region = (mach_vm_address_t)t_allocate(region_size);
+	void *buf = t_allocate(size);
+	mach_msg_type_number_t count = MACH_PORT_OOL_RCV_REGION_COUNT;
+	vm_offset_t data = 0;
+	mach_msg_type_number_t data_size = 0;
+	mach_vm_address_t rcv;
+	int value = -1;
+	kern_return_t kr;
+
+	T_ASSERT_MACH_SUCCESS(t_set_rcv_region(region, region_size),
+	    "register a %lld bytes receive region", region_size);
+
+	kr = mach_port_get_attributes(mach_task_self(), port,
+	    MACH_PORT_OOL_RCV_REGION, (mach_port_info_t)&value, &count);
+	T_ASSERT_MACH_SUCCESS(kr, "mach_port_get_attributes(MACH_PORT_OOL_RCV_REGION)");
+	T_EXPECT_EQ(value, 0, "ports don't use the region by default");
+
+	/* messages on a port that didn't opt in get a mapping of their own */
+	t_fill(buf, size, 1);
+	t_send_ool(port, buf, size, MACH_MSG_PHYSICAL_COPY);
+	rcv = t_receive_ool(port, size);
+	T_EXPECT_FALSE(t_in_region(rcv, size, region, region_size),
+	    "message on a regular port delivered outside of the region");
+	T_EXPECT_TRUE(t_check(rcv, size, 1), "message contents");
+	t_deallocate(rcv, size);
+
+	/* replies to kernel MIG calls, that callers deallocate, too */
+	t_port_use_rcv_region(port);
+	kr = vm_read(mach_task_self(), (vm_address_t)buf, (vm_size_t)size,
+	    &data, &data_size);
+	T_ASSERT_MACH_SUCCESS(kr, "vm_read");
+	T_EXPECT_FALSE(t_in_region(data, data_size, region, region_size),
+	    "MIG reply delivered outside of the region");
+	T_EXPECT_TRUE(t_check(data, data_size, 1), "MIG reply contents");
+	t_deallocate(data, data_size);
+	T_EXPECT_EQ(t_rcv_region_used(), 0ull, "region is unused");
+
+	T_ASSERT_MACH_SUCCESS(t_set_rcv_region(0, 0), "unregister the region");
+	t_deallocate((mach_vm_address_t)buf, size);
+	t_deallocate(region, region_size);
+	t_port_destruct(port);
+}
+
+T_DECL(mach_msg_ool_transfer_perf,
+    "send and receive latency of physically copied OOL memory",
+    T_META_RUN_CONCURRENTLY(false), T_META_TAG_PERF,
+    T_META_TAG_VM_NOT_ELIGIBLE)
+{
+	mach_port_name_t port = t_port_construct();
+
+	for (int use_region = 0; use_region < 2; use_region++) {
+		mach_vm_address_t region = 0;
+
+		if (use_region) {
+			region = (mach_vm_address_t)t_allocate(8 << 20);
+			T_QUIET; T_ASSERT_MACH_SUCCESS(t_set_rcv_region(region, 8 << 20),
+			    "register receive region");
+			t_port_use_rcv_region(port);
+		}
+
+		for (size_t i = 0; i < sizeof(t_sizes) / sizeof(t_sizes[0]); i++) {
+			mach_vm_size_t size = t_sizes[i];
+			void *buf = t_allocate(size);
+			dt_stat_time_t s = dt_stat_time_create("%lld bytes%s", size,
+			    use_region ? " (receive region)" : "");
+
+			t_fill(buf, size, 0);
+
+			while (!dt_stat_stable(s)) {
+				dt_stat_token t = dt_stat_time_begin(s);
+				mach_vm_address_t rcv;
+
+				t_send_ool(port, buf, size, MACH_MSG_PHYSICAL_COPY);
+				rcv = t_receive_ool(port, size);
+				dt_stat_time_end(s, t);
+
+				if (use_region) {
+					t_ack_rcv_region(rcv + size);
+				} else {
+					t_deallocate(rcv, size);
+				}
+			}
+			dt_stat_finalize(s);
+
+			t_deallocate((mach_vm_address_t)buf, size);
+		}
+
+		if (use_region) {
+			T_QUIET; T_ASSERT_MACH_SUCCESS(t_set_rcv_region(0, 0),
+			    "unregister receive region");
+			t_deallocate(region, 8 << 20);
+		}
+	}
+
+	t_port_destruct(port);
+}
@@ -0,0 +1,224 @@
+#include <darwintest.h>
+
+#include <errno.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/event.h>
+#include <sys/param.h>
+#include <sys/resource.h>
+#include <sys/sysctl.h>
+
+T_GLOBAL_META(
+	T_META_NAMESPACE("xnu.kevent"),
+	T_META_RADAR_COMPONENT_NAME("xnu"),
+	T_META_RADAR_COMPONENT_VERSION("kevent"),
+	T_META_CHECK_LEAKS(false),
+	T_META_RUN_CONCURRENTLY(false));
+
+/*
+ * Registers EVFILT_READ knotes on many descriptors at once, and has them
+ * all fire together, to exercise how large changelists are copied in and
+ * how many events are returned by a single kevent call.
+ *
+ * All descriptors are dups of the read end of one pipe, so writing a byte
+ * makes every knote fire.
+ */
+
+#define KEVENT_BATCH_NFDS       100000
+
+static int *batch_fds;
+static int batch_nfds;
+static int batch_pipe[2];
+
+static void
+batch_fds_cleanup(void)
+{
+	for (int i = 0; i < batch_nfds; i++) {
+		close(batch_fds[i]);
+	}
+	free(batch_fds);
+	close(batch_pipe[0]);
+	close(batch_pipe[1]);
+}
+
+static void
+batch_fds_setup(int nfds)
+{
+	struct rlimit rl;
+	int maxfiles;
+	size_t size = sizeof(maxfiles);
+
+	T_QUIET; T_ASSERT_POSIX_SUCCESS(sysctlbyname("kern.maxfilesperproc",
+	    &maxfiles, &size, NULL, 0), "kern.maxfilesperproc");
+	T_QUIET; T_ASSERT_POSIX_SUCCESS(getrlimit(RLIMIT_NOFILE, &rl), "getrlimit");
+
+	rl.rlim_cur = MIN(rl.rlim_max, (rlim_t)maxfiles);
+	T_QUIET; T_ASSERT_POSIX_SUCCESS(setrlimit(RLIMIT_NOFILE, &rl), "setrlimit");
+	if (rl.rlim_cur < (rlim_t)nfds + 64) {
+		T_SKIP("can't open %d descriptors (limit is %llu)",
+		    nfds, (unsigned long long)rl.rlim_cur);
+	}
+
+	T_QUIET; T_ASSERT_POSIX_SUCCESS(pipe(batch_pipe), "pipe");
+
+	batch_fds = calloc((size_t)nfds, sizeof(int));
+	T_QUIET; T_ASSERT_NOTNULL(batch_fds, "calloc");
+	for (batch_nfds = 0; batch_nfds < nfds; batch_nfds++) {
+		batch_fds[batch_nfds] = dup(batch_pipe[0]);
+		T_QUIET; T_ASSERT_POSIX_SUCCESS(batch_fds[batch_nfds], "dup");
+	}
+	T_ATEND(batch_fds_cleanup);
+}
+
+static void
+batch_fill_changes(struct kevent64_s *kevs, int nfds, uint16_t flags)
+{
+	for (int i = 0; i < nfds; i++) {
+		EV_SET64(&kevs[i], batch_fds[i], EVFILT_READ, flags, 0, 0,
+		    (uint64_t)i, 0, 0);
+	}
+}
+
+T_DECL(kevent_batch_receipts, "receipts for a large changelist, in place and not",
+    T_META_TAG_VM_PREFERRED)
+{
+	int nfds = KEVENT_BATCH_NFDS / 10;
+	struct kevent64_s *changes, *events;
+	int kq, rc;
+
+	batch_fds_setup(nfds);
+	changes = calloc((size_t)nfds, sizeof(*changes));
+	events = calloc((size_t)nfds + 1, sizeof(*events));
+	T_QUIET; T_ASSERT_NOTNULL(changes, "calloc");
+	T_QUIET; T_ASSERT_NOTNULL(events, "calloc");
+
+	T_ASSERT_POSIX_SUCCESS(kq = kqueue(), "kqueue");
+
+	/* separate eventlist */
+	batch_fill_changes(changes, nfds, EV_ADD | EV_RECEIPT);
+	rc = kevent64(kq, changes, nfds, events, nfds, 0, NULL);
+	T_ASSERT_EQ(rc, nfds, "one receipt per change");
+	for (int i = 0; i < nfds; i++) {
+		T_QUIET; T_ASSERT_EQ(events[i].ident, (uint64_t)batch_fds[i], "ident");
+		T_QUIET; T_ASSERT_TRUE(events[i].flags & EV_ERROR, "EV_ERROR");
+		T_QUIET; T_ASSERT_EQ(events[i].data, 0ll, "no error");
+	}
+
+	/* eventlist is the changelist */
+	batch_fill_changes(changes, nfds, EV_DELETE | EV_RECEIPT);
+	rc = kevent64(kq, changes, nfds, changes, nfds, 0, NULL);
+	T_ASSERT_EQ(rc, nfds, "one receipt per change, in place");
+	for (int i = 0; i < nfds; i++) {
+		T_QUIET; T_ASSERT_EQ(changes[i].ident, (uint64_t)batch_fds[i], "ident");
+		T_QUIET; T_ASSERT_EQ(changes[i].data, 0ll, "no error");
+	}
+
+	/*
+	 * eventlist one entry past the changelist: each receipt overwrites
+	 * the next change before it is read, so every change ends up being
+	 * a copy of the first one.
+	 */
+	batch_fill_changes(events, nfds, EV_ADD | EV_RECEIPT);
+	rc = kevent64(kq, events, nfds, events + 1, nfds, 0, NULL);
+	T_ASSERT_EQ(rc, nfds, "one receipt per change, overlapping");
+	for (int i = 1; i <= nfds; i++) {
+		T_QUIET; T_ASSERT_EQ(events[i].ident, (uint64_t)batch_fds[0], "ident");
+		T_QUIET; T_ASSERT_EQ(events[i].data, 0ll, "no error");
+	}
+
+	close(kq);
+	free(events);
+	free(changes);
+}
+
+T_DECL(kevent_batch_delivery, "return events from many fired knotes",
+    T_META_TAG_VM_PREFERRED)
+{
+	int nfds = KEVENT_BATCH_NFDS / 10;
+	struct kevent64_s *kevs;
+	struct kevent *events;
+	uint8_t *seen;
+	int kq, rc, total = 0;
+
+	batch_fds_setup(nfds);
+	kevs = calloc((size_t)nfds, sizeof(*kevs));
+	events = calloc((size_t)nfds, sizeof(*events));
+	seen = calloc((size_t)nfds, 1);
+	T_QUIET; T_ASSERT_NOTNULL(kevs, "calloc");
+	T_QUIET; T_ASSERT_NOTNULL(events, "calloc");
+	T_QUIET; T_ASSERT_NOTNULL(seen, "calloc");
+
+	T_ASSERT_POSIX_SUCCESS(kq = kqueue(), "kqueue");
+	batch_fill_changes(kevs, nfds, EV_ADD | EV_DISPATCH);
+	T_ASSERT_POSIX_SUCCESS(kevent64(kq, kevs, nfds, NULL, 0, 0, NULL),
+	    "register %d knotes", nfds);
+
+	T_ASSERT_POSIX_SUCCESS(write(batch_pipe[1], "x", 1), "write");
+
+	/* odd sized eventlists to end on partial batches */
+	for (int want = 13; total < nfds; want = want * 3 + 1) {
+		struct timespec ts = { };
+
+		rc = kevent(kq, NULL, 0, events, MIN(want, nfds - total), &ts);
+		T_QUIET; T_ASSERT_POSIX_SUCCESS(rc, "kevent");
+		T_QUIET; T_ASSERT_GT(rc, 0, "events returned");
+		for (int i = 0; i < rc; i++) {
+			int idx = (int)(uintptr_t)events[i].udata;
+
+			T_QUIET; T_ASSERT_LT(idx, nfds, "udata");
+			T_QUIET; T_ASSERT_EQ((int)events[i].ident, batch_fds[idx], "ident");
+			T_QUIET; T_ASSERT_EQ(events[i].filter, EVFILT_READ, "filter");
+			T_QUIET; T_ASSERT_EQ(events[i].data, 1l, "data");
+			T_QUIET; T_ASSERT_FALSE(seen[idx], "delivered once");
+			seen[idx] = 1;
+		}
+		total += rc;
+	}
+	T_ASSERT_EQ(total, nfds, "every knote fired once");
+
+	close(kq);
+	free(seen);
+	free(events);
+	free(kevs);
+}
+
+T_DECL(kevent_batch_register_bench, "register and deliver 100k fd knotes",
+    T_META_TAG_PERF, T_META_TAG_VM_NOT_ELIGIBLE)
+{
+	dt_stat_time_t reg = dt_stat_time_create("register");
+	dt_stat_time_t del = dt_stat_time_create("deliver");
+	int nfds = KEVENT_BATCH_NFDS;
+	struct kevent64_s *kevs;
+	char c;
+
+	batch_fds_setup(nfds);
+	kevs = calloc((size_t)nfds, sizeof(*kevs));
+	T_QUIET; T_ASSERT_NOTNULL(kevs, "calloc");
+
+	while (!dt_stat_stable(reg) || !dt_stat_stable(del)) {
+		dt_stat_token t;
+		int kq, rc;
+
+		T_QUIET; T_ASSERT_POSIX_SUCCESS(kq = kqueue(), "kqueue");
+		batch_fill_changes(kevs, nfds, EV_ADD | EV_DISPATCH);
+
+		t = dt_stat_time_begin(reg);
+		rc = kevent64(kq, kevs, nfds, NULL, 0, 0, NULL);
+		dt_stat_time_end_batch(reg, nfds, t);
+		T_QUIET; T_ASSERT_POSIX_SUCCESS(rc, "kevent64 register");
+
+		T_QUIET; T_ASSERT_POSIX_SUCCESS(write(batch_pipe[1], "x", 1), "write");
+
+		t = dt_stat_time_begin(del);
+		rc = kevent64(kq, NULL, 0, kevs, nfds, KEVENT_FLAG_IMMEDIATE, NULL);
+		dt_stat_time_end_batch(del, nfds, t);
+		T_QUIET; T_ASSERT_EQ(rc, nfds, "kevent64 deliver");
+
+		T_QUIET; T_ASSERT_POSIX_SUCCESS(read(batch_pipe[0], &c, 1), "read");
+		close(kq);
+	}
+
+	dt_stat_finalize(reg);
+	dt_stat_finalize(del);
+	free(kevs);
+}
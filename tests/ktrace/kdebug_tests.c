@@ -1199,6 +1199,130 @@ T_DECL(stress, "emit events on all but one CPU with a small buffer",
 	dispatch_main();
 }
 
+/*
+ * Matches TRACE_EVENTS_PER_STORAGE_UNIT in the kernel.
+ */
+#define WRAP_EVENTS_PER_UNIT (2048)
+#define WRAP_UNITS_PER_CPU (16)
+#define WRAP_LOST_UNITS_PER_CPU (2)
+#define WRAP_DEBUGID (0xfeedfad0)
+#define WRAP_TIMEOUT_SECS (30)
+
+static volatile bool continue_wrapping = true;
+
+static void *
+kdebug_wrapper_thread(void *ctx)
+{
+	unsigned int id = (unsigned int)(uintptr_t)ctx;
+	uint64_t i = 0;
+	while (continue_wrapping) {
+		kdebug_trace(WRAP_DEBUGID, id, i, 0, 0);
+		i++;
+	}
+
+	return NULL;
+}
+
+/*
+ * Storage units move between the free list, per-CPU reserves, and the CPUs
+ * writing to them.  Once the buffer wraps, every unit should hold events,
+ * except the one each CPU is currently filling.
+ */
+T_DECL(wrapping_all_cpus,
+    "wrap a small buffer from all CPUs and check that no storage units are lost",
+    T_META_CHECK_LEAKS(false),
+	T_META_TAG_VM_PREFERRED)
+{
+	start_controlling_ktrace();
+
+	T_SETUPBEGIN;
+	int ncpus = 0;
+	size_t ncpus_size = sizeof(ncpus);
+	int ret = sysctlbyname("hw.logicalcpu_max", &ncpus, &ncpus_size, NULL, 0);
+	T_QUIET; T_ASSERT_POSIX_SUCCESS(ret, "sysctlbyname(\"hw.logicalcpu_max\"");
+	T_QUIET; T_ASSERT_GT(ncpus, 0, "realistic number of CPUs");
+
+	int nevents = ncpus * WRAP_UNITS_PER_CPU * WRAP_EVENTS_PER_UNIT;
+	T_ASSERT_POSIX_SUCCESS(sysctl(
+		    (int[]){ CTL_KERN, KERN_KDEBUG, KERN_KDSETBUF, nevents }, 4,
+		    NULL, 0, NULL, 0), "KERN_KDSETBUF %d events", nevents);
+	T_ASSERT_POSIX_SUCCESS(sysctl(
+		    (int[]){ CTL_KERN, KERN_KDEBUG, KERN_KDSETUP }, 3,
+		    NULL, &(size_t){ 0 }, NULL, 0), "KERN_KDSETUP");
+
+	pthread_t *threads = calloc((unsigned int)ncpus, sizeof(pthread_t));
+	T_WITH_ERRNO; T_QUIET; T_ASSERT_NOTNULL(threads, "calloc(%d threads)",
+	    ncpus);
+	for (int i = 0; i < ncpus; i++) {
+		int error = pthread_create(&threads[i], NULL, kdebug_wrapper_thread,
+		    (void *)(uintptr_t)i);
+		T_QUIET; T_ASSERT_POSIX_ZERO(error,
+		    "pthread_create wrapper thread %d", i);
+	}
+	T_SETUPEND;
+
+	T_ASSERT_POSIX_SUCCESS(sysctl(
+		    (int[]){ CTL_KERN, KERN_KDEBUG, KERN_KDENABLE, 1 }, 4,
+		    NULL, 0, NULL, 0), "KERN_KDENABLE");
+
+	/*
+	 * Wait for the buffer to wrap, then keep going for a bit so that every
+	 * CPU has had to steal units from the others.
+	 */
+	kbufinfo_t buf_info = { 0 };
+	int secs = 0;
+	do {
+		sleep(1);
+		T_QUIET;
+		T_ASSERT_POSIX_SUCCESS(sysctl(
+			    (int[]){ CTL_KERN, KERN_KDEBUG, KERN_KDGETBUF }, 3,
+			    &buf_info, &(size_t){ sizeof(buf_info) }, NULL, 0),
+		    "KERN_KDGETBUF");
+	} while (!(buf_info.flags & KDBG_WRAPPED) && ++secs < WRAP_TIMEOUT_SECS);
+	T_ASSERT_TRUE(buf_info.flags & KDBG_WRAPPED,
+	    "trace wrapped after %d seconds", secs);
+	sleep(1);
+
+	T_ASSERT_POSIX_SUCCESS(sysctl(
+		    (int[]){ CTL_KERN, KERN_KDEBUG, KERN_KDENABLE, 0 }, 4,
+		    NULL, 0, NULL, 0), "KERN_KDENABLE 0");
+
+	continue_wrapping = false;
+	for (int i = 0; i < ncpus; i++) {
+		int error = pthread_join(threads[i], NULL);
+		T_QUIET; T_EXPECT_POSIX_ZERO(error, "pthread_join thread %d", i);
+	}
+	free(threads);
+
+	static kd_buf events[4096];
+	uint64_t nread = 0;
+	while (true) {
+		size_t events_size = sizeof(events);
+		T_QUIET;
+		T_ASSERT_POSIX_SUCCESS(sysctl(
+			    (int[]){ CTL_KERN, KERN_KDEBUG, KERN_KDREADTR }, 3,
+			    events, &events_size, NULL, 0), "KERN_KDREADTR");
+		if (events_size == 0) {
+			break;
+		}
+		nread += events_size;
+	}
+
+	uint64_t capacity = (uint64_t)buf_info.nkdbufs;
+	uint64_t allowed_loss = (uint64_t)ncpus * WRAP_LOST_UNITS_PER_CPU *
+	    WRAP_EVENTS_PER_UNIT;
+	T_LOG("read %llu events from a %llu event buffer on %d CPUs", nread,
+	    capacity, ncpus);
+	T_EXPECT_LE(nread, capacity, "read no more events than the buffer holds");
+	T_EXPECT_GE(nread + allowed_loss, capacity,
+	    "at most %d partially-filled units per CPU after wrapping",
+	    WRAP_LOST_UNITS_PER_CPU);
+
+	T_ASSERT_POSIX_SUCCESS(sysctl(
+		    (int[]){ CTL_KERN, KERN_KDEBUG, KERN_KDREMOVE }, 3,
+		    NULL, 0, NULL, 0), "KERN_KDREMOVE");
+}
+
 #define ROUND_TRIP_PERIOD UINT64_C(10 * 1000)
 #define ROUND_TRIPS_THRESHOLD UINT64_C(25)
 #define ROUND_TRIPS_TIMEOUT_SECS (2 * 60)
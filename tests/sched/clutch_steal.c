@@ -0,0 +1,270 @@
+// Copyright (c) 2025 Apple Inc.  All rights reserved.
+
+#include <string.h>
+
+#include "sched_test_harness/sched_policy_darwintest.h"
+#include "sched_test_harness/sched_clutch_harness.h"
+
+T_GLOBAL_META(T_META_NAMESPACE("xnu.scheduler"),
+    T_META_RADAR_COMPONENT_NAME("xnu"),
+    T_META_RADAR_COMPONENT_VERSION("scheduler"),
+    T_META_RUN_CONCURRENTLY(true));
+
+/*
+ * Work stealing between the psets of a single node, as on x86 where each
+ * LLC is its own pset. CPU 0 (pset 0, die 0) does the stealing in the
+ * targeted tests: pset 1 is on the same die, psets 2 and 3 on the other.
+ */
+
+static void
+init_steal_harness(void)
+{
+	init_harness_logging(T_NAME);
+	set_hw_topology(smp_dual_die);
+	clutch_impl_init_steal_harness(smp_dual_die);
+}
+
+static test_thread_t
+create_df_thread(struct thread_group *tg)
+{
+	return create_thread(TH_BUCKET_SHARE_DF, tg, root_bucket_to_highest_pri[TH_BUCKET_SHARE_DF]);
+}
+
+SCHED_POLICY_T_DECL(steal_thresholds,
+    "Threads are only stolen from psets with enough excess runnable threads")
+{
+	init_steal_harness();
+	struct thread_group *tg = create_tg(0);
+	test_thread_t threads[3];
+	for (int i = 0; i < 3; i++) {
+		threads[i] = create_df_thread(tg);
+	}
+
+	T_QUIET; T_EXPECT_NULL(clutch_impl_steal_thread(0), "nothing to steal");
+
+	enqueue_thread(pset_target(1), threads[0]);
+	T_QUIET; T_EXPECT_EQ(clutch_impl_steal_thread(0), threads[0], "steal from the pset on the same die");
+	T_QUIET; T_EXPECT_TRUE(runqueue_empty(pset_target(1)), "stolen thread left its pset");
+	SCHED_POLICY_PASS("Steal a single excess thread from the same die");
+
+	enqueue_thread(pset_target(2), threads[1]);
+	T_QUIET; T_EXPECT_NULL(clutch_impl_steal_thread(0), "one thread is not enough across dies");
+	enqueue_thread(pset_target(2), threads[2]);
+	test_thread_t stolen = clutch_impl_steal_thread(0);
+	T_QUIET; T_EXPECT_TRUE(stolen == threads[1] || stolen == threads[2], "steal across dies");
+	T_QUIET; T_EXPECT_NULL(clutch_impl_steal_thread(0), "remaining thread stays on its die");
+	T_QUIET; T_EXPECT_FALSE(runqueue_empty(pset_target(2)), "remaining thread still enqueued");
+	SCHED_POLICY_PASS("Steal across dies needs the remote threshold");
+
+	clutch_impl_set_steal_thresholds(2, 1);
+	stolen = clutch_impl_steal_thread(0);
+	T_QUIET; T_EXPECT_TRUE(stolen == threads[1] || stolen == threads[2], "steal with the lowered remote threshold");
+	SCHED_POLICY_PASS("Steal thresholds are configurable");
+}
+
+SCHED_POLICY_T_DECL(steal_distance,
+    "Nearer psets are preferred when the excess over their threshold is the same")
+{
+	init_steal_harness();
+	struct thread_group *tg = create_tg(0);
+	test_thread_t local[2], remote[3];
+	for (int i = 0; i < 2; i++) {
+		local[i] = create_df_thread(tg);
+		enqueue_thread(pset_target(1), local[i]);
+	}
+	for (int i = 0; i < 3; i++) {
+		remote[i] = create_df_thread(tg);
+		enqueue_thread(pset_target(3), remote[i]);
+	}
+
+	test_thread_t stolen = clutch_impl_steal_thread(0);
+	T_QUIET; T_EXPECT_TRUE(stolen == local[0] || stolen == local[1], "same excess, steal from the same die");
+	SCHED_POLICY_PASS("Steal from the nearer pset on ties");
+
+	test_thread_t more_remote = create_df_thread(tg);
+	enqueue_thread(pset_target(3), more_remote);
+	stolen = clutch_impl_steal_thread(0);
+	T_QUIET; T_EXPECT_TRUE(stolen == remote[0] || stolen == remote[1] || stolen == remote[2] || stolen == more_remote,
+	    "larger excess on the other die wins");
+	SCHED_POLICY_PASS("Steal from the most backlogged pset");
+}
+
+SCHED_POLICY_T_DECL(steal_warmth_and_affinity,
+    "Cache-warm threads and co-located thread groups are more expensive to steal")
+{
+	init_steal_harness();
+	struct thread_group *tg = create_tg(0);
+	struct thread_group *other_tg = create_tg(0);
+	test_thread_t warm = create_df_thread(tg);
+	test_thread_t extra = create_df_thread(tg);
+
+	clutch_impl_set_thread_last_run(warm, mock_absolute_time());
+	enqueue_thread(pset_target(1), warm);
+	T_QUIET; T_EXPECT_NULL(clutch_impl_steal_thread(0), "thread that just ran stays on its pset");
+	increment_mock_time_us(10 * 1000);
+	T_QUIET; T_EXPECT_EQ(clutch_impl_steal_thread(0), warm, "thread is stolen once its cache footprint is cold");
+	SCHED_POLICY_PASS("Warm threads cost more to steal");
+
+	test_thread_t running = create_df_thread(tg);
+	cpu_set_thread_current(pset_id_to_cpu_id(1), running);
+	enqueue_thread(pset_target(1), extra);
+	T_QUIET; T_EXPECT_NULL(clutch_impl_steal_thread(0), "thread group running on its pset");
+	test_thread_t local_running = create_df_thread(tg);
+	cpu_set_thread_current(pset_id_to_cpu_id(0) + 1, local_running);
+	T_QUIET; T_EXPECT_EQ(clutch_impl_steal_thread(0), extra, "thread group running on both psets");
+	SCHED_POLICY_PASS("Thread group affinity is factored in");
+
+	cpu_clear_thread_current(pset_id_to_cpu_id(0) + 1);
+	test_thread_t unrelated = create_df_thread(other_tg);
+	enqueue_thread(pset_target(1), unrelated);
+	T_QUIET; T_EXPECT_EQ(clutch_impl_steal_thread(0), unrelated, "other thread groups are not held back");
+	SCHED_POLICY_PASS("Affinity only applies to the running thread group");
+}
+
+SCHED_POLICY_T_DECL(steal_timeshare_only,
+    "Fixed priority threads are not stolen")
+{
+	init_steal_harness();
+	struct thread_group *tg = create_tg(0);
+	test_thread_t fixpri = create_thread(TH_BUCKET_FIXPRI, tg, root_bucket_to_highest_pri[TH_BUCKET_FIXPRI]);
+	set_thread_sched_mode(fixpri, TH_MODE_FIXED);
+	enqueue_thread(pset_target(1), fixpri);
+	T_QUIET; T_EXPECT_NULL(clutch_impl_steal_thread(0), "fixed priority thread stays on its pset");
+
+	test_thread_t timeshare = create_df_thread(tg);
+	enqueue_thread(pset_target(1), timeshare);
+	T_QUIET; T_EXPECT_EQ(clutch_impl_steal_thread(0), timeshare, "timeshare thread behind it is stolen");
+	T_QUIET; T_EXPECT_TRUE(dequeue_thread_expect(pset_target(1), fixpri), "fixed priority thread left");
+	SCHED_POLICY_PASS("Only timeshare threads are stolen");
+}
+
+/*
+ * Discrete-time simulation of a skewed load: most threads are made runnable
+ * on pset 0, the way wakeups follow their waker's LLC. Every tick, each idle
+ * CPU picks the next thread from its pset, or tries to steal one. Compares
+ * the distribution of the time threads wait to run with and without stealing.
+ */
+
+#define SIM_TICK_US             100
+#define SIM_ARRIVAL_TICKS       2000
+#define SIM_MAX_THREADS         (SIM_ARRIVAL_TICKS * 4)
+#define SIM_NUM_TGS             4
+
+typedef struct {
+	test_thread_t thread;
+	int runnable_tick;
+	int run_ticks;
+} sim_job_t;
+
+static sim_job_t sim_jobs[SIM_MAX_THREADS];
+static int sim_waits[SIM_MAX_THREADS];
+
+static int
+sim_job_index(test_thread_t thread, int num_jobs)
+{
+	for (int i = 0; i < num_jobs; i++) {
+		if (sim_jobs[i].thread == thread) {
+			return i;
+		}
+	}
+	T_ASSERT_FAIL("unknown thread %p", thread);
+}
+
+static int
+sim_cmp_int(const void *a, const void *b)
+{
+	return *(const int *)a - *(const int *)b;
+}
+
+static void
+sim_add_job(int pset_id, struct thread_group *tg, int tick, int *num_jobs)
+{
+	sim_job_t *job = &sim_jobs[(*num_jobs)++];
+	job->thread = create_df_thread(tg);
+	job->runnable_tick = tick;
+	job->run_ticks = 1 + rand() % 4;
+	enqueue_thread(pset_target(pset_id), job->thread);
+}
+
+static int
+sim_run(const char *name, unsigned int seed)
+{
+	test_hw_topology_t topo = smp_dual_die;
+	struct thread_group *tgs[SIM_NUM_TGS];
+	int cpu_job[topo.total_cpus];
+	int cpu_ticks_left[topo.total_cpus];
+	int num_jobs = 0, num_done = 0;
+
+	for (int i = 0; i < SIM_NUM_TGS; i++) {
+		tgs[i] = create_tg(0);
+	}
+	for (int c = 0; c < topo.total_cpus; c++) {
+		cpu_job[c] = -1;
+		cpu_ticks_left[c] = 0;
+	}
+
+	srand(seed);
+	for (int tick = 0; tick < SIM_ARRIVAL_TICKS || num_done < num_jobs; tick++) {
+		if (tick < SIM_ARRIVAL_TICKS) {
+			/* About 3.75 CPUs worth of work on the 4 CPUs of pset 0 */
+			int arrivals = rand() % 4;
+			for (int a = 0; a < arrivals; a++) {
+				sim_add_job(0, tgs[rand() % SIM_NUM_TGS], tick, &num_jobs);
+			}
+			/* And a trickle everywhere */
+			if (rand() % 4 == 0) {
+				sim_add_job(rand() % topo.num_psets, tgs[rand() % SIM_NUM_TGS], tick, &num_jobs);
+			}
+		}
+
+		for (int c = 0; c < topo.total_cpus; c++) {
+			if (cpu_job[c] != -1 && --cpu_ticks_left[c] == 0) {
+				cpu_clear_thread_current(c);
+				cpu_job[c] = -1;
+				num_done++;
+			}
+		}
+		for (int c = 0; c < topo.total_cpus; c++) {
+			if (cpu_job[c] != -1) {
+				continue;
+			}
+			test_thread_t thread = impl_cpu_dequeue_thread(c);
+			if (thread == NULL) {
+				thread = clutch_impl_steal_thread(c);
+			}
+			if (thread == NULL) {
+				continue;
+			}
+			int job = sim_job_index(thread, num_jobs);
+			sim_waits[job] = tick - sim_jobs[job].runnable_tick;
+			cpu_job[c] = job;
+			cpu_ticks_left[c] = sim_jobs[job].run_ticks;
+			cpu_set_thread_current(c, thread);
+		}
+		increment_mock_time_us(SIM_TICK_US);
+	}
+
+	T_QUIET; T_EXPECT_EQ(num_done, num_jobs, "every thread ran");
+	qsort(sim_waits, (size_t)num_jobs, sizeof(sim_waits[0]), sim_cmp_int);
+	int p99 = sim_waits[(num_jobs * 99) / 100];
+	T_LOG("%s: %d threads, wait in %dus ticks: p50 %d p90 %d p99 %d max %d", name, num_jobs, SIM_TICK_US,
+	    sim_waits[num_jobs / 2], sim_waits[(num_jobs * 9) / 10], p99, sim_waits[num_jobs - 1]);
+	return p99;
+}
+
+SCHED_POLICY_T_DECL(steal_sim_tail_latency,
+    "Work stealing bounds the tail latency of a simulated skewed load")
+{
+	init_steal_harness();
+
+	int steal_p99 = sim_run("stealing", 377111);
+	SCHED_POLICY_PASS("Simulated load with work stealing");
+
+	clutch_impl_set_steal_thresholds(UINT32_MAX, UINT32_MAX);
+	T_QUIET; T_EXPECT_NULL(clutch_impl_steal_thread(0), "nothing left to steal");
+	int no_steal_p99 = sim_run("no stealing", 377111);
+	SCHED_POLICY_PASS("Simulated load without work stealing");
+
+	T_EXPECT_LT(steal_p99, no_steal_p99, "stealing improves p99 wait");
+	SCHED_POLICY_PASS("Work stealing bounds tail latency");
+}
@@ -0,0 +1,112 @@
+// Copyright (c) 2025 Apple Inc.  All rights reserved.
+
+#include <dispatch/dispatch.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <sys/sysctl.h>
+
+#include <darwintest.h>
+
+T_GLOBAL_META(T_META_NAMESPACE("xnu.scheduler"),
+    T_META_RADAR_COMPONENT_NAME("xnu"),
+    T_META_RADAR_COMPONENT_VERSION("scheduler"),
+    T_META_TAG_VM_PREFERRED);
+
+/* Mirrors struct sched_latency_hist and struct thread_group_latency_snapshot */
+#define LATENCY_KINDS           2
+#define LATENCY_SCHED_BUCKETS   6
+#define LATENCY_BUCKETS         32
+
+struct tg_latency {
+	uint64_t tgls_id;
+	uint32_t tgls_sched_bucket;
+	uint64_t tgls_runnable[LATENCY_BUCKETS];
+	uint64_t tgls_preempted[LATENCY_BUCKETS];
+} __attribute__((packed));
+
+#define PING_PONG_ITERATIONS    1000
+
+static dispatch_semaphore_t ping, pong;
+
+static void *
+ponger(__unused void *arg)
+{
+	for (int i = 0; i < PING_PONG_ITERATIONS; i++) {
+		dispatch_semaphore_wait(ping, DISPATCH_TIME_FOREVER);
+		dispatch_semaphore_signal(pong);
+	}
+	return NULL;
+}
+
+static uint64_t
+total_wakeups(void)
+{
+	uint64_t hist[LATENCY_KINDS][LATENCY_SCHED_BUCKETS][LATENCY_BUCKETS];
+	size_t len = sizeof(hist);
+	uint64_t total = 0;
+
+	T_QUIET; T_ASSERT_POSIX_SUCCESS(sysctlbyname("kern.sched_latency", hist, &len, NULL, 0),
+	    "kern.sched_latency");
+	T_QUIET; T_ASSERT_EQ(len, sizeof(hist), "histogram size");
+	for (int b = 0; b < LATENCY_SCHED_BUCKETS; b++) {
+		for (int i = 0; i < LATENCY_BUCKETS; i++) {
+			total += hist[0][b][i];
+		}
+	}
+	return total;
+}
+
+T_DECL(sched_latency_hist,
+    "Threads waking each other up are counted in the scheduling latency histograms")
+{
+	pthread_t thread;
+	uint64_t before, after;
+
+	ping = dispatch_semaphore_create(0);
+	pong = dispatch_semaphore_create(0);
+
+	before = total_wakeups();
+	T_ASSERT_POSIX_ZERO(pthread_create(&thread, NULL, ponger, NULL), "pthread_create");
+	for (int i = 0; i < PING_PONG_ITERATIONS; i++) {
+		dispatch_semaphore_signal(ping);
+		dispatch_semaphore_wait(pong, DISPATCH_TIME_FOREVER);
+	}
+	T_ASSERT_POSIX_ZERO(pthread_join(thread, NULL), "pthread_join");
+	after = total_wakeups();
+
+	T_EXPECT_GE(after - before, (uint64_t)PING_PONG_ITERATIONS, "at least one wakeup counted per ping");
+}
+
+T_DECL(sched_latency_thread_groups,
+    "Thread groups report their scheduling latency for the buckets they ran at")
+{
+	struct tg_latency *tgls;
+	size_t len = 0;
+	uint64_t samples = 0;
+
+	T_ASSERT_POSIX_SUCCESS(sysctlbyname("kern.sched_latency_thread_groups", NULL, &len, NULL, 0),
+	    "kern.sched_latency_thread_groups size");
+	if (len == 0) {
+		T_SKIP("no thread group latency reported");
+	}
+	T_ASSERT_EQ(len % sizeof(*tgls), 0ul, "whole entries");
+
+	tgls = calloc(1, len);
+	T_QUIET; T_ASSERT_NOTNULL(tgls, "calloc");
+	T_ASSERT_POSIX_SUCCESS(sysctlbyname("kern.sched_latency_thread_groups", tgls, &len, NULL, 0),
+	    "kern.sched_latency_thread_groups");
+	T_ASSERT_GT(len, 0ul, "thread groups have run threads");
+
+	for (size_t n = 0; n < len / sizeof(*tgls); n++) {
+		uint64_t total = 0;
+
+		T_QUIET; T_EXPECT_LT(tgls[n].tgls_sched_bucket, LATENCY_SCHED_BUCKETS, "sched bucket");
+		for (int i = 0; i < LATENCY_BUCKETS; i++) {
+			total += tgls[n].tgls_runnable[i] + tgls[n].tgls_preempted[i];
+		}
+		T_QUIET; T_EXPECT_GT(total, 0ull, "only buckets threads ran at are reported");
+		samples += total;
+	}
+	T_LOG("%zu thread group buckets, %llu samples", len / sizeof(*tgls), samples);
+	free(tgls);
+}
@@ -90,3 +90,84 @@ impl_pop_tracepoint(uint64_t *clutch_trace_code, uint64_t *arg1, uint64_t *arg2,
 {
 	clutch_impl_pop_tracepoint(clutch_trace_code, arg1, arg2, arg3, arg4);
 }
+
+/* Work stealing between the psets of a single-node (SMP) topology */
+
+static test_pset_t smp_dual_die_psets[4] = {
+	{
+		.cpu_type = TEST_CPU_TYPE_PERFORMANCE,
+		.num_cpus = 4,
+		.cluster_id = 0,
+		.die_id = 0,
+	},
+	{
+		.cpu_type = TEST_CPU_TYPE_PERFORMANCE,
+		.num_cpus = 4,
+		.cluster_id = 1,
+		.die_id = 0,
+	},
+	{
+		.cpu_type = TEST_CPU_TYPE_PERFORMANCE,
+		.num_cpus = 4,
+		.cluster_id = 2,
+		.die_id = 1,
+	},
+	{
+		.cpu_type = TEST_CPU_TYPE_PERFORMANCE,
+		.num_cpus = 4,
+		.cluster_id = 3,
+		.die_id = 1,
+	},
+};
+test_hw_topology_t smp_dual_die = {
+	.psets = &smp_dual_die_psets[0],
+	.num_psets = 4,
+	.total_cpus = 16,
+};
+
+void
+clutch_impl_init_steal_harness(test_hw_topology_t hw_topology)
+{
+	assert(curr_hw_topo.num_psets == 0);
+	clutch_impl_init_topology(hw_topology);
+	curr_hw_topo = hw_topology;
+	sched_clutch_init();
+	for (int i = 0; i < hw_topology.num_psets; i++) {
+		pset_array[i] = psets[i];
+		bzero(&psets[i]->cpu_state_map, sizeof(psets[i]->cpu_state_map));
+		sched_clutch_pset_init(psets[i]);
+		sched_rt_init_pset(psets[i]);
+	}
+	for (int c = 0; c < hw_topology.total_cpus; c++) {
+		processor_array[c] = cpus[c];
+		cpus[c]->current_thread_group = NULL;
+		sched_clutch_processor_init(cpus[c]);
+	}
+	increment_mock_time(100);
+	clutch_impl_init_params();
+	clutch_impl_init_tracepoints();
+	sched_rt_init_completed();
+}
+
+test_thread_t
+clutch_impl_steal_thread(int cpu_id)
+{
+	_curr_cpu = cpu_id;
+	processor_set_t pset = cpus[cpu_id]->processor_set;
+	pset_lock(pset);
+	/* Drops the pset lock */
+	return sched_clutch_steal_thread(pset);
+}
+
+void
+clutch_impl_set_steal_thresholds(uint32_t threshold, uint32_t remote_threshold)
+{
+	sched_clutch_steal_threshold = threshold;
+	sched_clutch_steal_remote_threshold = remote_threshold;
+}
+
+void
+clutch_impl_set_thread_last_run(test_thread_t thread, uint64_t timestamp)
+{
+	((thread_t)thread)->last_run_time = timestamp;
+}
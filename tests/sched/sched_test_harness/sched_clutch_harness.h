@@ -31,3 +31,10 @@ extern void clutch_impl_cpu_set_thread_current(int cpu_id, test_thread_t thread)
 extern test_thread_t clutch_impl_cpu_clear_thread_current(int cpu_id);
 extern void clutch_impl_log_tracepoint(uint64_t trace_code, uint64_t a1, uint64_t a2, uint64_t a3, uint64_t a4);
 extern void clutch_impl_pop_tracepoint(uint64_t *clutch_trace_code, uint64_t *arg1, uint64_t *arg2, uint64_t *arg3, uint64_t *arg4);
+
+/* Work stealing between the psets of a single-node (SMP) topology */
+extern test_hw_topology_t smp_dual_die; // 4 psets of 4 CPUs, 2 psets per die
+extern void clutch_impl_init_steal_harness(test_hw_topology_t hw_topology);
+extern test_thread_t clutch_impl_steal_thread(int cpu_id);
+extern void clutch_impl_set_steal_thresholds(uint32_t threshold, uint32_t remote_threshold);
+extern void clutch_impl_set_thread_last_run(test_thread_t thread, uint64_t timestamp);
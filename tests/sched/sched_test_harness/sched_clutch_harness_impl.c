@@ -140,6 +140,7 @@ clutch_impl_init_topology(test_hw_topology_t hw_topology)
 		}
 		psets[i]->pset_cluster_id = i;
 		psets[i]->pset_id = i;
+		psets[i]->pset_die_id = hw_topology.psets[i].die_id;
 		psets[i]->cpu_set_low = total_cpus;
 		psets[i]->cpu_set_count = hw_topology.psets[i].num_cpus;
 		psets[i]->cpu_bitmask = 0;
@@ -254,6 +255,7 @@ clutch_impl_create_thread(int root_bucket, struct thread_group *tg, int pri)
 	thread->sched_mode = TH_MODE_TIMESHARE;
 	bzero(&thread->realtime, sizeof(thread->realtime));
 	thread->last_made_runnable_time = 0;
+	thread->last_run_time = 0;
 	thread->state = TH_RUN;
 	return thread;
 }
@@ -300,6 +302,8 @@ clutch_impl_cpu_clear_thread_current(int cpu_id)
 {
 	test_thread_t thread = cpus[cpu_id]->active_thread;
 	cpus[cpu_id]->active_thread = cpus[cpu_id]->idle_thread;
+	/* Equivalent logic of processor_state_update_idle() */
+	cpus[cpu_id]->current_thread_group = NULL;
 	bit_clear(cpus[cpu_id]->processor_set->realtime_map, cpu_id);
 	return thread;
 }
@@ -0,0 +1,185 @@
+/*
+ * Copyright (c) 2024 Apple Inc. All rights reserved.
+ *
+ * @APPLE_OSREFERENCE_LICENSE_HEADER_START@
+ *
+ * This file contains Original Code and/or Modifications of Original Code
+ * as defined in and that are subject to the Apple Public Source License
+ * Version 2.0 (the 'License'). You may not use this file except in
+ * compliance with the License. The rights granted to you under the License
+ * may not be used to create, or enable the creation or redistribution of,
+ * unlawful or unlicensed copies of an Apple operating system, or to
+ * circumvent, violate, or enable the circumvention or violation of, any
+ * terms of an Apple operating system software license agreement.
+ *
+ * Please obtain a copy of the License at
+ * http://www.opensource.apple.com/apsl/ and read it before using this file.
+ *
+ * The Original Code and all software distributed under the License are
+ * distributed on an 'AS IS' basis, WITHOUT WARRANTY OF ANY KIND, EITHER
+ * EXPRESS OR IMPLIED, AND APPLE HEREBY DISCLAIMS ALL SUCH WARRANTIES,
+ * INCLUDING WITHOUT LIMITATION, ANY WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE, QUIET ENJOYMENT OR NON-INFRINGEMENT.
+ * Please see the License for the specific language governing rights and
+ * limitations under the License.
+ *
+ * @APPLE_OSREFERENCE_LICENSE_HEADER_END@
+ */
+
+#include <sys/socket.h>
+
+#include <netinet/in.h>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <arpa/inet.h>
+
+#include <darwintest.h>
+
+T_GLOBAL_META(
+	T_META_NAMESPACE("xnu.net"),
+	T_META_RADAR_COMPONENT_NAME("xnu"),
+	T_META_RADAR_COMPONENT_VERSION("networking"),
+	T_META_ASROOT(true)
+	);
+
+#ifndef SO_REUSEPORT_LB
+#define SO_REUSEPORT_LB 0x1138
+#endif
+
+#define NLISTENERS      4
+#define NCONNECTIONS    64
+
+static int
+lb_listener(int domain, in_port_t *port)
+{
+	struct sockaddr_storage ss = { 0 };
+	socklen_t len;
+	int fd, one = 1;
+
+	T_QUIET; T_ASSERT_POSIX_SUCCESS(fd = socket(domain, SOCK_STREAM, 0), NULL);
+	T_QUIET; T_ASSERT_POSIX_SUCCESS(setsockopt(fd, SOL_SOCKET, SO_REUSEPORT,
+	    &one, sizeof(one)), NULL);
+	T_QUIET; T_ASSERT_POSIX_SUCCESS(setsockopt(fd, SOL_SOCKET, SO_REUSEPORT_LB,
+	    &one, sizeof(one)), NULL);
+
+	if (domain == PF_INET) {
+		struct sockaddr_in *sin = (struct sockaddr_in *)&ss;
+
+		sin->sin_len = sizeof(*sin);
+		sin->sin_family = AF_INET;
+		sin->sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+		sin->sin_port = *port;
+	} else {
+		struct sockaddr_in6 *sin6 = (struct sockaddr_in6 *)&ss;
+
+		sin6->sin6_len = sizeof(*sin6);
+		sin6->sin6_family = AF_INET6;
+		sin6->sin6_addr = in6addr_loopback;
+		sin6->sin6_port = *port;
+	}
+
+	T_QUIET; T_ASSERT_POSIX_SUCCESS(bind(fd, (struct sockaddr *)&ss,
+	    ss.ss_len), NULL);
+	T_QUIET; T_ASSERT_POSIX_SUCCESS(listen(fd, NCONNECTIONS), NULL);
+	T_QUIET; T_ASSERT_POSIX_SUCCESS(fcntl(fd, F_SETFL, O_NONBLOCK), NULL);
+
+	len = sizeof(ss);
+	T_QUIET; T_ASSERT_POSIX_SUCCESS(getsockname(fd, (struct sockaddr *)&ss,
+	    &len), NULL);
+	*port = domain == PF_INET ? ((struct sockaddr_in *)&ss)->sin_port :
+	    ((struct sockaddr_in6 *)&ss)->sin6_port;
+
+	return fd;
+}
+
+static void
+test_so_reuseport_lb(int domain)
+{
+	struct sockaddr_storage ss;
+	int lfds[NLISTENERS], cfds[NCONNECTIONS];
+	int accepted[NLISTENERS] = { 0 };
+	int total = 0, used = 0;
+	in_port_t port = 0;
+
+	for (int i = 0; i < NLISTENERS; i++) {
+		lfds[i] = lb_listener(domain, &port);
+	}
+
+	for (int i = 0; i < NCONNECTIONS; i++) {
+		socklen_t len = sizeof(ss);
+
+		T_QUIET; T_ASSERT_POSIX_SUCCESS(getsockname(lfds[0],
+		    (struct sockaddr *)&ss, &len), NULL);
+		T_QUIET; T_ASSERT_POSIX_SUCCESS(cfds[i] = socket(domain,
+		    SOCK_STREAM, 0), NULL);
+		T_QUIET; T_ASSERT_POSIX_SUCCESS(connect(cfds[i],
+		    (struct sockaddr *)&ss, ss.ss_len), NULL);
+	}
+
+	for (int i = 0; i < NLISTENERS; i++) {
+		int fd;
+
+		while ((fd = accept(lfds[i], NULL, NULL)) >= 0) {
+			accepted[i]++;
+			close(fd);
+		}
+		T_QUIET; T_ASSERT_EQ(errno, EWOULDBLOCK, "accept drained");
+		T_LOG("listener %d accepted %d connections", i, accepted[i]);
+		total += accepted[i];
+		used += accepted[i] != 0;
+	}
+
+	T_EXPECT_EQ(total, NCONNECTIONS, "all connections were accepted");
+	T_EXPECT_GT(used, 1, "connections were spread among listeners");
+
+	for (int i = 0; i < NCONNECTIONS; i++) {
+		close(cfds[i]);
+	}
+	for (int i = 0; i < NLISTENERS; i++) {
+		close(lfds[i]);
+	}
+}
+
+T_DECL(so_reuseport_lb_ipv4, "SO_REUSEPORT_LB spreads IPv4 connections",
+    T_META_TAG_VM_PREFERRED)
+{
+	test_so_reuseport_lb(PF_INET);
+}
+
+T_DECL(so_reuseport_lb_ipv6, "SO_REUSEPORT_LB spreads IPv6 connections",
+    T_META_TAG_VM_PREFERRED)
+{
+	test_so_reuseport_lb(PF_INET6);
+}
+
+T_DECL(so_reuseport_lb_sockopt, "SO_REUSEPORT_LB socket option checks",
+    T_META_TAG_VM_PREFERRED)
+{
+	int fd, one = 1, val;
+	socklen_t len = sizeof(val);
+
+	T_ASSERT_POSIX_SUCCESS(fd = socket(PF_INET, SOCK_DGRAM, 0), NULL);
+	T_EXPECT_POSIX_FAILURE(setsockopt(fd, SOL_SOCKET, SO_REUSEPORT_LB,
+	    &one, sizeof(one)), ENOPROTOOPT, "not supported for UDP");
+	close(fd);
+
+	T_ASSERT_POSIX_SUCCESS(fd = socket(PF_INET, SOCK_STREAM, 0), NULL);
+	T_ASSERT_POSIX_SUCCESS(getsockopt(fd, SOL_SOCKET, SO_REUSEPORT_LB,
+	    &val, &len), NULL);
+	T_EXPECT_EQ(val, 0, "off by default");
+	T_ASSERT_POSIX_SUCCESS(setsockopt(fd, SOL_SOCKET, SO_REUSEPORT_LB,
+	    &one, sizeof(one)), NULL);
+	T_ASSERT_POSIX_SUCCESS(getsockopt(fd, SOL_SOCKET, SO_REUSEPORT_LB,
+	    &val, &len), NULL);
+	T_EXPECT_EQ(val, 1, "set");
+	T_ASSERT_POSIX_SUCCESS(listen(fd, 1), NULL);
+	T_EXPECT_POSIX_FAILURE(setsockopt(fd, SOL_SOCKET, SO_REUSEPORT_LB,
+	    &one, sizeof(one)), EINVAL, "can't be changed once listening");
+	close(fd);
+}
@@ -0,0 +1,189 @@
+#include <errno.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/kern_memorystatus.h>
+#include <sys/mman.h>
+#include <sys/sysctl.h>
+#include <sys/wait.h>
+#include <mach/mach.h>
+#include <mach/vm_page_size.h>
+
+#include <darwintest.h>
+
+#include "swap_test_helpers.h"
+
+struct swapped_child_cmd {
+	uint64_t scc_first;
+	uint64_t scc_count;     /* 0: exit */
+};
+
+/*
+ * Only the first few hundred bytes of each page vary, which gives about
+ * the compression ratio the compressor sees on real workloads. The page
+ * index is stamped at the start so misplaced pages are caught.
+ */
+static void
+swapped_page_fill(char *page, uint64_t index)
+{
+	memset(page, 0, vm_page_size);
+	for (size_t i = sizeof(index); i < 512; i++) {
+		page[i] = (char)(i + index);
+	}
+	memcpy(page, &index, sizeof(index));
+}
+
+static bool
+swapped_page_check(const char *page, uint64_t index)
+{
+	uint64_t found;
+
+	memcpy(&found, page, sizeof(found));
+	if (found != index) {
+		return false;
+	}
+	for (size_t i = sizeof(index); i < 512; i++) {
+		if (page[i] != (char)(i + index)) {
+			return false;
+		}
+	}
+	return true;
+}
+
+static void __dead2
+swapped_child_main(size_t pages, int cmd_fd, int ack_fd)
+{
+	memorystatus_priority_properties_t props = {
+		.priority = JETSAM_PRIORITY_IDLE,
+	};
+	struct swapped_child_cmd cmd;
+	char *region, ack = 1;
+
+	region = mmap(NULL, pages * vm_page_size, PROT_READ | PROT_WRITE,
+	    MAP_ANON | MAP_PRIVATE, -1, 0);
+	if (region == MAP_FAILED) {
+		exit(1);
+	}
+	for (size_t n = 0; n < pages; n++) {
+		swapped_page_fill(region + n * vm_page_size, n);
+	}
+
+	/* freezing moves us to an elevated band: start from idle like an app would */
+	if (memorystatus_control(MEMORYSTATUS_CMD_SET_PROCESS_IS_FREEZABLE, getpid(), 1, NULL, 0) != 0 ||
+	    memorystatus_control(MEMORYSTATUS_CMD_SET_PRIORITY_PROPERTIES, getpid(), 0, &props, sizeof(props)) != 0) {
+		exit(2);
+	}
+	if (write(ack_fd, &ack, sizeof(ack)) != sizeof(ack)) {
+		exit(3);
+	}
+
+	while (read(cmd_fd, &cmd, sizeof(cmd)) == sizeof(cmd) && cmd.scc_count != 0) {
+		ack = 1;
+		for (uint64_t n = cmd.scc_first; n < cmd.scc_first + cmd.scc_count && n < pages; n++) {
+			if (!swapped_page_check(region + n * vm_page_size, n)) {
+				ack = 0;
+			}
+		}
+		if (write(ack_fd, &ack, sizeof(ack)) != sizeof(ack)) {
+			exit(3);
+		}
+	}
+	exit(0);
+}
+
+void
+swapped_child_spawn(struct swapped_child *sc, size_t pages)
+{
+	int cmd_pipe[2], ack_pipe[2];
+	char ack = 0;
+
+	T_QUIET; T_ASSERT_POSIX_SUCCESS(pipe(cmd_pipe), "pipe");
+	T_QUIET; T_ASSERT_POSIX_SUCCESS(pipe(ack_pipe), "pipe");
+
+	sc->sc_pages = pages;
+	sc->sc_pid = fork();
+	T_QUIET; T_ASSERT_POSIX_SUCCESS(sc->sc_pid, "fork");
+	if (sc->sc_pid == 0) {
+		close(cmd_pipe[1]);
+		close(ack_pipe[0]);
+		swapped_child_main(pages, cmd_pipe[0], ack_pipe[1]);
+	}
+
+	close(cmd_pipe[0]);
+	close(ack_pipe[1]);
+	sc->sc_cmd_fd = cmd_pipe[1];
+	sc->sc_ack_fd = ack_pipe[0];
+
+	T_QUIET; T_ASSERT_EQ(read(sc->sc_ack_fd, &ack, sizeof(ack)), (ssize_t)sizeof(ack),
+	    "child dirtied %zu pages", pages);
+}
+
+bool
+swapped_child_freeze(struct swapped_child *sc)
+{
+	pid_t pid = sc->sc_pid;
+
+	if (sysctlbyname("kern.memorystatus_freeze", NULL, NULL, &pid, sizeof(pid)) != 0) {
+		T_LOG("kern.memorystatus_freeze(%d): %s", pid, strerror(errno));
+		return false;
+	}
+	return true;
+}
+
+void
+swapped_child_touch(struct swapped_child *sc, size_t first, size_t count)
+{
+	struct swapped_child_cmd cmd = {
+		.scc_first = first,
+		.scc_count = count,
+	};
+	char ack = 0;
+
+	T_QUIET; T_ASSERT_EQ(write(sc->sc_cmd_fd, &cmd, sizeof(cmd)), (ssize_t)sizeof(cmd),
+	    "touch command");
+	T_QUIET; T_ASSERT_EQ(read(sc->sc_ack_fd, &ack, sizeof(ack)), (ssize_t)sizeof(ack),
+	    "touch acknowledgement");
+	T_ASSERT_EQ(ack, 1, "pages [%zu, %zu) kept their contents", first, first + count);
+}
+
+void
+swapped_child_exit(struct swapped_child *sc)
+{
+	struct swapped_child_cmd cmd = { };
+	int status = 0;
+
+	(void)write(sc->sc_cmd_fd, &cmd, sizeof(cmd));
+	close(sc->sc_cmd_fd);
+	close(sc->sc_ack_fd);
+	T_QUIET; T_ASSERT_POSIX_SUCCESS(waitpid(sc->sc_pid, &status, 0), "waitpid");
+	T_QUIET; T_EXPECT_TRUE(WIFEXITED(status) && WEXITSTATUS(status) == 0,
+	    "child exited cleanly (status 0x%x)", status);
+}
+
+uint64_t
+vm_swapouts(void)
+{
+	vm_statistics64_data_t vm_stat;
+	mach_msg_type_number_t count = HOST_VM_INFO64_COUNT;
+
+	T_QUIET; T_ASSERT_MACH_SUCCESS(host_statistics64(mach_host_self(), HOST_VM_INFO64,
+	    (host_info64_t)&vm_stat, &count), "host_statistics64");
+	return vm_stat.swapouts;
+}
+
+bool
+swapouts_wait(uint64_t swapouts, int timeout_secs)
+{
+	uint64_t last = swapouts, now;
+
+	for (int i = 0; i < timeout_secs * 2; i++) {
+		usleep(500 * 1000);
+		now = vm_swapouts();
+		if (now > swapouts && now == last) {
+			return true;
+		}
+		last = now;
+	}
+	return last > swapouts;
+}
@@ -0,0 +1,59 @@
+#ifndef SWAP_TEST_HELPERS_H
+#define SWAP_TEST_HELPERS_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+#include <TargetConditionals.h>
+
+/*
+ * Helpers to get a known region of anonymous memory out to the swapfile
+ * and to fault it back in page by page.
+ *
+ * The region lives in a forked child which is frozen, so the tests using
+ * these need the freezer to be backed by swap: T_META_ENABLED(HAS_FREEZER),
+ * T_META_ASROOT(true) and T_META_REQUIRES_SYSCTL_EQ("vm.freeze_enabled", 1).
+ */
+
+#define HAS_FREEZER ((TARGET_OS_IOS && !TARGET_OS_XR) || TARGET_OS_WATCH)
+
+struct swapped_child {
+	pid_t   sc_pid;
+	int     sc_cmd_fd;      /* parent -> child commands */
+	int     sc_ack_fd;      /* child -> parent acknowledgements */
+	size_t  sc_pages;
+};
+
+/*
+ * Fork a child dirtying `pages` pages of compressible anonymous memory,
+ * each tagged with its index, and wait until it is ready to be frozen.
+ */
+void swapped_child_spawn(struct swapped_child *sc, size_t pages);
+
+/*
+ * Freeze the child. Returns false (without failing the test) when the
+ * kernel declines to freeze it, e.g. because of the freezer budget.
+ */
+bool swapped_child_freeze(struct swapped_child *sc);
+
+/*
+ * Have the child touch pages [first, first + count) and check they kept
+ * their contents.
+ */
+void swapped_child_touch(struct swapped_child *sc, size_t first, size_t count);
+
+/* Tell the child to exit and reap it. */
+void swapped_child_exit(struct swapped_child *sc);
+
+/*
+ * Wait for swapouts to start and then settle, for at most timeout_secs.
+ * Returns whether any page was swapped out since `swapouts`, a value
+ * previously returned by vm_swapouts().
+ */
+bool swapouts_wait(uint64_t swapouts, int timeout_secs);
+
+/* Pages swapped out so far */
+uint64_t vm_swapouts(void);
+
+#endif /* SWAP_TEST_HELPERS_H */
@@ -1,9 +1,11 @@
 #include <darwintest.h>
 
 #include <stdatomic.h>
+#include <stdlib.h>
 
 #include <unistd.h>
 #include <pthread.h>
+#include <sys/sysctl.h>
 #include <sys/ulock.h>
 
 #include <os/tsd.h>
@@ -146,3 +148,95 @@ T_DECL(ulock_wait_deadline, "ulock_wait2 with deadline", T_META_CHECK_LEAKS(fals
 	pthread_join(waiter, NULL);
 	T_END;
 }
+
+#pragma mark ulock_contention_bench
+
+/*
+ * Pairs of threads ping-ponging a word with compare-and-wait ulocks,
+ * so that many ulocks are waited on and woken concurrently and the
+ * kernel hash is busy with lookups, insertions and removals.
+ */
+
+#define ULOCK_BENCH_ROUNDS      1000
+
+struct ulock_bench_pair {
+	_Atomic uint32_t word;
+} __attribute__((aligned(128)));
+
+static struct ulock_bench_pair *ulock_bench_pairs;
+
+static void *
+ulock_bench_thread(void *arg)
+{
+	struct ulock_bench_pair *pair = &ulock_bench_pairs[(uintptr_t)arg / 2];
+	uint32_t me = (uint32_t)((uintptr_t)arg & 1);
+
+	for (int i = 0; i < ULOCK_BENCH_ROUNDS; i++) {
+		uint32_t cur;
+
+		while ((cur = atomic_load_explicit(&pair->word, memory_order_acquire)) != me) {
+			int rc = __ulock_wait(UL_COMPARE_AND_WAIT | ULF_NO_ERRNO,
+			    &pair->word, cur, 0);
+			if (rc < 0 && rc != -EINTR && rc != -EFAULT) {
+				T_ASSERT_POSIX_ZERO(-rc, "__ulock_wait");
+			}
+		}
+		atomic_store_explicit(&pair->word, !me, memory_order_release);
+		__ulock_wake(UL_COMPARE_AND_WAIT | ULF_NO_ERRNO, &pair->word, 0);
+	}
+	return NULL;
+}
+
+static uint64_t
+ulock_bench_counter(const char *name)
+{
+	uint64_t value = 0;
+	size_t size = sizeof(value);
+
+	if (sysctlbyname(name, &value, &size, NULL, 0) != 0) {
+		return 0;
+	}
+	return value;
+}
+
+T_DECL(ulock_contention_bench, "wait/wake pairs on many ulocks from many threads",
+    T_META_CHECK_LEAKS(false), T_META_RUN_CONCURRENTLY(false),
+    T_META_TAG_PERF, T_META_TAG_VM_NOT_ELIGIBLE)
+{
+	for (uint32_t npairs = 1; npairs <= 512; npairs *= 8) {
+		dt_stat_time_t s = dt_stat_time_create("%u threads", 2 * npairs);
+		uint64_t hits = ulock_bench_counter("kern.ulock_hash.smr_hits");
+		uint64_t misses = ulock_bench_counter("kern.ulock_hash.smr_misses");
+		pthread_t *threads;
+
+		ulock_bench_pairs = calloc(npairs, sizeof(*ulock_bench_pairs));
+		threads = calloc(2 * npairs, sizeof(*threads));
+		T_QUIET; T_ASSERT_NOTNULL(ulock_bench_pairs, "calloc");
+		T_QUIET; T_ASSERT_NOTNULL(threads, "calloc");
+
+		while (!dt_stat_stable(s)) {
+			for (uint32_t i = 0; i < npairs; i++) {
+				atomic_store(&ulock_bench_pairs[i].word, 0);
+			}
+
+			dt_stat_token t = dt_stat_time_begin(s);
+			for (uintptr_t i = 0; i < 2 * npairs; i++) {
+				T_QUIET; T_ASSERT_POSIX_ZERO(pthread_create(&threads[i], NULL,
+				    ulock_bench_thread, (void *)i), "pthread_create");
+			}
+			for (uint32_t i = 0; i < 2 * npairs; i++) {
+				T_QUIET; T_ASSERT_POSIX_ZERO(pthread_join(threads[i], NULL),
+				    "pthread_join");
+			}
+			dt_stat_time_end_batch(s, ULOCK_BENCH_ROUNDS * (int)npairs, t);
+		}
+		dt_stat_finalize(s);
+
+		T_LOG("%u threads: %llu lockless hits, %llu misses", 2 * npairs,
+		    ulock_bench_counter("kern.ulock_hash.smr_hits") - hits,
+		    ulock_bench_counter("kern.ulock_hash.smr_misses") - misses);
+
+		free(threads);
+		free(ulock_bench_pairs);
+	}
+}
@@ -0,0 +1,239 @@
+/*
+ * Copyright (c) 2025 Apple Computer, Inc. All rights reserved.
+ *
+ * @APPLE_OSREFERENCE_LICENSE_HEADER_START@
+ *
+ * This file contains Original Code and/or Modifications of Original Code
+ * as defined in and that are subject to the Apple Public Source License
+ * Version 2.0 (the 'License'). You may not use this file except in
+ * compliance with the License. The rights granted to you under the License
+ * may not be used to create, or enable the creation or redistribution of,
+ * unlawful or unlicensed copies of an Apple operating system, or to
+ * circumvent, violate, or enable the circumvention or violation of, any
+ * terms of an Apple operating system software license agreement.
+ *
+ * Please obtain a copy of the License at
+ * http://www.opensource.apple.com/apsl/ and read it before using this file.
+ *
+ * The Original Code and all software distributed under the License are
+ * distributed on an 'AS IS' basis, WITHOUT WARRANTY OF ANY KIND, EITHER
+ * EXPRESS OR IMPLIED, AND APPLE HEREBY DISCLAIMS ALL SUCH WARRANTIES,
+ * INCLUDING WITHOUT LIMITATION, ANY WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE, QUIET ENJOYMENT OR NON-INFRINGEMENT.
+ * Please see the License for the specific language governing rights and
+ * limitations under the License.
+ *
+ * @APPLE_OSREFERENCE_LICENSE_HEADER_END@
+ */
+
+/* compile: xcrun -sdk macosx.internal clang -ldarwintest -o negative_lookup negative_lookup.c -g -Weverything */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/syslimits.h>
+
+#include <darwintest.h>
+#include <darwintest/utils.h>
+
+T_GLOBAL_META(
+	T_META_NAMESPACE("xnu.vfs"),
+	T_META_RADAR_COMPONENT_NAME("xnu"),
+	T_META_RADAR_COMPONENT_VERSION("vfs"),
+	T_META_ASROOT(false),
+	T_META_CHECK_LEAKS(false));
+
+/*
+ * Lookups that end on a negative name cache entry fail without calling into
+ * the filesystem.  Make sure every way of creating the name purges the entry.
+ */
+
+#define NEGATIVE_LOOKUP_DEPTH   16
+#define NEGATIVE_LOOKUP_LOOPS   100
+#define NEGATIVE_RACE_THREADS   4
+#define NEGATIVE_RACE_ROUNDS    50
+
+static char template[MAXPATHLEN];
+static char *testdir = NULL;
+static char deepdir[PATH_MAX];
+
+static void
+cleanup(void)
+{
+	char path[PATH_MAX];
+	char *slash;
+
+	if (testdir == NULL || deepdir[0] == '\0') {
+		return;
+	}
+	snprintf(path, sizeof(path), "%s/other", deepdir);
+	(void)unlink(path);
+	snprintf(path, sizeof(path), "%s/name/below", deepdir);
+	(void)rmdir(path);
+	snprintf(path, sizeof(path), "%s/name", deepdir);
+	if (unlink(path) != 0) {
+		(void)rmdir(path);
+	}
+	while (strcmp(deepdir, testdir) != 0) {
+		(void)rmdir(deepdir);
+		if ((slash = strrchr(deepdir, '/')) == NULL) {
+			break;
+		}
+		*slash = '\0';
+	}
+	rmdir(testdir);
+}
+
+static void
+expect_enoent(const char *path, const char *what)
+{
+	struct stat sb;
+
+	for (int i = 0; i < NEGATIVE_LOOKUP_LOOPS; i++) {
+		T_QUIET; T_ASSERT_POSIX_FAILURE(stat(path, &sb), ENOENT, "stat %s", what);
+	}
+	T_PASS("%s doesn't exist", what);
+}
+
+static void
+expect_type(const char *path, mode_t type, const char *what)
+{
+	struct stat sb;
+
+	T_ASSERT_POSIX_SUCCESS(stat(path, &sb), "stat %s", what);
+	T_ASSERT_EQ(sb.st_mode & S_IFMT, type, "%s has the right type", what);
+}
+
+T_DECL(negative_lookup,
+    "names cached as missing can be created with every namespace operation",
+    T_META_TAG_VM_PREFERRED)
+{
+	char path[PATH_MAX], other[PATH_MAX], below[PATH_MAX];
+	int fd;
+
+	T_ATEND(cleanup);
+	T_SETUPBEGIN;
+	snprintf(template, sizeof(template), "%s/negative_lookup-XXXXXX", dt_tmpdir());
+	T_ASSERT_POSIX_NOTNULL((testdir = mkdtemp(template)), "Creating test root dir");
+
+	strlcpy(deepdir, testdir, sizeof(deepdir));
+	for (int i = 0; i < NEGATIVE_LOOKUP_DEPTH; i++) {
+		strlcat(deepdir, "/d", sizeof(deepdir));
+		T_QUIET; T_ASSERT_POSIX_SUCCESS(mkdir(deepdir, 0755), "mkdir %s", deepdir);
+	}
+	snprintf(path, sizeof(path), "%s/name", deepdir);
+	snprintf(other, sizeof(other), "%s/other", deepdir);
+	snprintf(below, sizeof(below), "%s/name/below", deepdir);
+	T_SETUPEND;
+
+	expect_enoent(path, "name");
+	T_ASSERT_POSIX_SUCCESS((fd = open(path, O_CREAT | O_EXCL | O_RDWR, 0644)), "open(O_CREAT)");
+	T_ASSERT_POSIX_SUCCESS(close(fd), "close");
+	expect_type(path, S_IFREG, "created file");
+
+	T_ASSERT_POSIX_SUCCESS(unlink(path), "unlink");
+	expect_enoent(path, "unlinked file");
+	T_ASSERT_POSIX_SUCCESS(mkdir(path, 0755), "mkdir");
+	expect_type(path, S_IFDIR, "created directory");
+
+	expect_enoent(below, "name below a new directory");
+	T_ASSERT_POSIX_SUCCESS(mkdir(below, 0755), "mkdir below");
+	expect_type(below, S_IFDIR, "created subdirectory");
+	T_ASSERT_POSIX_SUCCESS(rmdir(below), "rmdir below");
+	T_ASSERT_POSIX_SUCCESS(rmdir(path), "rmdir");
+	expect_enoent(below, "name below a removed directory");
+	expect_enoent(path, "removed directory");
+
+	T_ASSERT_POSIX_SUCCESS((fd = open(other, O_CREAT | O_EXCL | O_RDWR, 0644)), "open(O_CREAT) other");
+	T_ASSERT_POSIX_SUCCESS(close(fd), "close");
+	T_ASSERT_POSIX_SUCCESS(rename(other, path), "rename over a missing name");
+	expect_type(path, S_IFREG, "renamed file");
+	expect_enoent(other, "rename source");
+
+	T_ASSERT_POSIX_SUCCESS(link(path, other), "link");
+	expect_type(other, S_IFREG, "hard link");
+	T_ASSERT_POSIX_SUCCESS(unlink(other), "unlink hard link");
+	expect_enoent(other, "removed hard link");
+
+	T_ASSERT_POSIX_SUCCESS(symlink("name", other), "symlink");
+	expect_type(other, S_IFREG, "symlink target");
+}
+
+static char race_path[PATH_MAX];
+static _Atomic bool race_created;
+static _Atomic bool race_done;
+static _Atomic uint64_t race_stale;
+
+/*
+ * Look the name up in a loop: once it was created before a lookup started,
+ * that lookup must find it, whether or not it raced with the negative entry
+ * being purged.
+ */
+static void *
+negative_race_lookup(__unused void *arg)
+{
+	struct stat sb;
+
+	while (!atomic_load(&race_done)) {
+		bool created = atomic_load(&race_created);
+
+		if (stat(race_path, &sb) != 0 && errno == ENOENT && created) {
+			atomic_fetch_add(&race_stale, 1);
+		}
+	}
+	return NULL;
+}
+
+T_DECL(negative_lookup_race,
+    "names created while their lookups hit the negative entry are found",
+    T_META_TAG_VM_PREFERRED)
+{
+	pthread_t threads[NEGATIVE_RACE_THREADS];
+	int fd;
+
+	T_ATEND(cleanup);
+	T_SETUPBEGIN;
+	snprintf(template, sizeof(template), "%s/negative_lookup-XXXXXX", dt_tmpdir());
+	T_ASSERT_POSIX_NOTNULL((testdir = mkdtemp(template)), "Creating test root dir");
+
+	strlcpy(deepdir, testdir, sizeof(deepdir));
+	for (int i = 0; i < NEGATIVE_LOOKUP_DEPTH; i++) {
+		strlcat(deepdir, "/d", sizeof(deepdir));
+		T_QUIET; T_ASSERT_POSIX_SUCCESS(mkdir(deepdir, 0755), "mkdir %s", deepdir);
+	}
+	snprintf(race_path, sizeof(race_path), "%s/name", deepdir);
+	T_SETUPEND;
+
+	for (int round = 0; round < NEGATIVE_RACE_ROUNDS; round++) {
+		atomic_store(&race_created, false);
+		atomic_store(&race_done, false);
+		for (int i = 0; i < NEGATIVE_RACE_THREADS; i++) {
+			T_QUIET; T_ASSERT_POSIX_ZERO(pthread_create(&threads[i], NULL,
+			    negative_race_lookup, NULL), "pthread_create");
+		}
+
+		/* let the lookups settle on the negative entry */
+		usleep(10 * 1000);
+		T_QUIET; T_ASSERT_POSIX_SUCCESS((fd = open(race_path, O_CREAT | O_EXCL | O_RDWR, 0644)),
+		    "open(O_CREAT)");
+		T_QUIET; T_ASSERT_POSIX_SUCCESS(close(fd), "close");
+		atomic_store(&race_created, true);
+		usleep(10 * 1000);
+
+		atomic_store(&race_done, true);
+		for (int i = 0; i < NEGATIVE_RACE_THREADS; i++) {
+			T_QUIET; T_ASSERT_POSIX_ZERO(pthread_join(threads[i], NULL), "pthread_join");
+		}
+		T_QUIET; T_ASSERT_POSIX_SUCCESS(unlink(race_path), "unlink");
+	}
+
+	T_EXPECT_EQ(atomic_load(&race_stale), 0ull,
+	    "no lookup started after the name was created failed with ENOENT");
+}
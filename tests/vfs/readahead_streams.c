@@ -0,0 +1,146 @@
+/*
+ * Copyright (c) 2025 Apple Computer, Inc. All rights reserved.
+ *
+ * @APPLE_OSREFERENCE_LICENSE_HEADER_START@
+ *
+ * This file contains Original Code and/or Modifications of Original Code
+ * as defined in and that are subject to the Apple Public Source License
+ * Version 2.0 (the 'License'). You may not use this file except in
+ * compliance with the License. The rights granted to you under the License
+ * may not be used to create, or enable the creation or redistribution of,
+ * unlawful or unlicensed copies of an Apple operating system, or to
+ * circumvent, violate, or enable the circumvention or violation of, any
+ * terms of an Apple operating system software license agreement.
+ *
+ * Please obtain a copy of the License at
+ * http://www.opensource.apple.com/apsl/ and read it before using this file.
+ *
+ * The Original Code and all software distributed under the License are
+ * distributed on an 'AS IS' basis, WITHOUT WARRANTY OF ANY KIND, EITHER
+ * EXPRESS OR IMPLIED, AND APPLE HEREBY DISCLAIMS ALL SUCH WARRANTIES,
+ * INCLUDING WITHOUT LIMITATION, ANY WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE, QUIET ENJOYMENT OR NON-INFRINGEMENT.
+ * Please see the License for the specific language governing rights and
+ * limitations under the License.
+ *
+ * @APPLE_OSREFERENCE_LICENSE_HEADER_END@
+ */
+
+/* compile: xcrun -sdk macosx.internal clang -ldarwintest -o readahead_streams readahead_streams.c -g -Weverything */
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/sysctl.h>
+#include <sys/syslimits.h>
+
+#include <darwintest.h>
+#include <darwintest/utils.h>
+
+T_GLOBAL_META(
+	T_META_NAMESPACE("xnu.vfs"),
+	T_META_RADAR_COMPONENT_NAME("xnu"),
+	T_META_RADAR_COMPONENT_VERSION("vfs"),
+	T_META_ASROOT(false),
+	T_META_CHECK_LEAKS(false));
+
+/*
+ * Two sequential cursors and one strided reader interleave their reads
+ * over a single file: each of them must get its own read-ahead stream,
+ * so that most of what is prefetched is then read, and little is wasted.
+ */
+
+#define RA_REGION_SIZE          (16ull << 20)
+#define RA_FILE_SIZE            (3 * RA_REGION_SIZE)
+#define RA_SEQ_READ_SIZE        (64 << 10)
+#define RA_STRIDE_READ_SIZE     (16 << 10)
+#define RA_STRIDE               (256 << 10)
+
+static char path[PATH_MAX];
+static char buf[RA_SEQ_READ_SIZE];
+
+static void
+cleanup(void)
+{
+	if (path[0]) {
+		(void)unlink(path);
+	}
+}
+
+static uint64_t
+readahead_counter(const char *name)
+{
+	char oid[64];
+	uint64_t value = 0;
+	size_t len = sizeof(value);
+
+	snprintf(oid, sizeof(oid), "vfs.generic.readahead.%s", name);
+	T_QUIET; T_ASSERT_POSIX_SUCCESS(sysctlbyname(oid, &value, &len, NULL, 0),
+	    "%s", oid);
+	return value;
+}
+
+static void
+read_at(int fd, off_t offset, size_t size)
+{
+	T_QUIET; T_ASSERT_EQ(pread(fd, buf, size, offset), (ssize_t)size,
+	    "pread(%zu bytes at %lld)", size, offset);
+}
+
+T_DECL(readahead_streams,
+    "interleaved sequential and strided readers each get their read-ahead",
+    T_META_RUN_CONCURRENTLY(false), T_META_TAG_VM_PREFERRED)
+{
+	uint64_t useful, wasted;
+	void *map;
+	int fd;
+
+	T_ATEND(cleanup);
+	T_SETUPBEGIN;
+	snprintf(path, sizeof(path), "%s/readahead_streams-XXXXXX", dt_tmpdir());
+	T_ASSERT_POSIX_SUCCESS((fd = mkstemp(path)), "create %s", path);
+	memset(buf, 0x5a, sizeof(buf));
+	for (off_t off = 0; off < (off_t)RA_FILE_SIZE; off += sizeof(buf)) {
+		T_QUIET; T_ASSERT_EQ(write(fd, buf, sizeof(buf)), (ssize_t)sizeof(buf), "write");
+	}
+	T_ASSERT_POSIX_SUCCESS(fsync(fd), "fsync");
+
+	/* evict the file from the cache, so that the reads below hit the disk */
+	map = mmap(NULL, RA_FILE_SIZE, PROT_READ, MAP_SHARED, fd, 0);
+	T_ASSERT_NE(map, MAP_FAILED, "mmap");
+	T_ASSERT_POSIX_SUCCESS(msync(map, RA_FILE_SIZE, MS_INVALIDATE), "msync(MS_INVALIDATE)");
+	T_ASSERT_POSIX_SUCCESS(munmap(map, RA_FILE_SIZE), "munmap");
+	T_SETUPEND;
+
+	useful = readahead_counter("useful_pages");
+	wasted = readahead_counter("wasted_pages");
+
+	/*
+	 * cursor A reads the first region, cursor B the second one,
+	 * and the strided reader samples the third one.
+	 */
+	for (off_t off = 0, s = 0; off < (off_t)RA_REGION_SIZE; off += RA_SEQ_READ_SIZE) {
+		read_at(fd, off, RA_SEQ_READ_SIZE);
+		read_at(fd, RA_REGION_SIZE + off, RA_SEQ_READ_SIZE);
+		if (s < (off_t)RA_REGION_SIZE && off % (4 * RA_SEQ_READ_SIZE) == 0) {
+			read_at(fd, 2 * RA_REGION_SIZE + s, RA_STRIDE_READ_SIZE);
+			s += RA_STRIDE;
+		}
+	}
+
+	useful = readahead_counter("useful_pages") - useful;
+	wasted = readahead_counter("wasted_pages") - wasted;
+	T_LOG("read-ahead: %llu useful pages, %llu wasted pages", useful, wasted);
+
+	/* the sequential cursors alone read 2 * 16M worth of pages */
+	T_EXPECT_GE(useful, (2 * RA_REGION_SIZE / PAGE_SIZE) / 2,
+	    "most pages read by the cursors were read ahead");
+	T_EXPECT_LE(wasted, useful / 4,
+	    "few prefetched pages were given up on");
+
+	T_ASSERT_POSIX_SUCCESS(close(fd), "close");
+}
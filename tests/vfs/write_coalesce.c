@@ -0,0 +1,149 @@
+/*
+ * Copyright (c) 2025 Apple Computer, Inc. All rights reserved.
+ *
+ * @APPLE_OSREFERENCE_LICENSE_HEADER_START@
+ *
+ * This file contains Original Code and/or Modifications of Original Code
+ * as defined in and that are subject to the Apple Public Source License
+ * Version 2.0 (the 'License'). You may not use this file except in
+ * compliance with the License. The rights granted to you under the License
+ * may not be used to create, or enable the creation or redistribution of,
+ * unlawful or unlicensed copies of an Apple operating system, or to
+ * circumvent, violate, or enable the circumvention or violation of, any
+ * terms of an Apple operating system software license agreement.
+ *
+ * Please obtain a copy of the License at
+ * http://www.opensource.apple.com/apsl/ and read it before using this file.
+ *
+ * The Original Code and all software distributed under the License are
+ * distributed on an 'AS IS' basis, WITHOUT WARRANTY OF ANY KIND, EITHER
+ * EXPRESS OR IMPLIED, AND APPLE HEREBY DISCLAIMS ALL SUCH WARRANTIES,
+ * INCLUDING WITHOUT LIMITATION, ANY WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE, QUIET ENJOYMENT OR NON-INFRINGEMENT.
+ * Please see the License for the specific language governing rights and
+ * limitations under the License.
+ *
+ * @APPLE_OSREFERENCE_LICENSE_HEADER_END@
+ */
+
+/* compile: xcrun -sdk macosx.internal clang -ldarwintest -o write_coalesce write_coalesce.c -g -Weverything */
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/sysctl.h>
+#include <sys/syslimits.h>
+
+#include <darwintest.h>
+#include <darwintest/utils.h>
+
+T_GLOBAL_META(
+	T_META_NAMESPACE("xnu.vfs"),
+	T_META_RADAR_COMPONENT_NAME("xnu"),
+	T_META_RADAR_COMPONENT_VERSION("vfs"),
+	T_META_ASROOT(false),
+	T_META_CHECK_LEAKS(false));
+
+/*
+ * Pushes of small files written then closed may be deferred and issued
+ * together: their contents must not be affected, whether they are read
+ * back right away, fsync'ed, or removed while their push is pending.
+ */
+
+#define WRITE_COALESCE_FILES    512
+#define WRITE_COALESCE_SIZE     (8 * 1024)
+
+static char template[MAXPATHLEN];
+static char *testdir = NULL;
+static char buf[WRITE_COALESCE_SIZE];
+
+static uint64_t
+deferred_pushes(void)
+{
+	uint64_t deferred = 0;
+	size_t len = sizeof(deferred);
+
+	T_QUIET; T_ASSERT_POSIX_SUCCESS(sysctlbyname("vfs.generic.writecoalesce.deferred",
+	    &deferred, &len, NULL, 0), "vfs.generic.writecoalesce.deferred");
+	return deferred;
+}
+
+static void
+cleanup(void)
+{
+	char path[PATH_MAX];
+
+	if (testdir == NULL) {
+		return;
+	}
+	for (int i = 0; i < WRITE_COALESCE_FILES; i++) {
+		snprintf(path, sizeof(path), "%s/f%d", testdir, i);
+		(void)unlink(path);
+	}
+	rmdir(testdir);
+}
+
+static void
+fill(int i)
+{
+	memset(buf, 'a' + (i % 26), sizeof(buf));
+	snprintf(buf, sizeof(buf), "file %d", i);
+}
+
+T_DECL(write_coalesce,
+    "small files written and closed in a burst keep their contents",
+    T_META_TAG_VM_PREFERRED)
+{
+	char path[PATH_MAX], rbuf[WRITE_COALESCE_SIZE];
+	uint64_t sizes[10];
+	size_t len = sizeof(sizes);
+	uint64_t deferred;
+	int fd;
+
+	T_ATEND(cleanup);
+	T_SETUPBEGIN;
+	snprintf(template, sizeof(template), "%s/write_coalesce-XXXXXX", dt_tmpdir());
+	T_ASSERT_POSIX_NOTNULL((testdir = mkdtemp(template)), "Creating test root dir");
+	deferred = deferred_pushes();
+	T_SETUPEND;
+
+	for (int i = 0; i < WRITE_COALESCE_FILES; i++) {
+		snprintf(path, sizeof(path), "%s/f%d", testdir, i);
+		fill(i);
+		T_QUIET; T_ASSERT_POSIX_SUCCESS((fd = open(path, O_CREAT | O_RDWR, 0644)), "create %s", path);
+		T_QUIET; T_ASSERT_EQ(write(fd, buf, sizeof(buf)), (ssize_t)sizeof(buf), "write");
+		if (i % 7 == 0) {
+			T_QUIET; T_ASSERT_POSIX_SUCCESS(fsync(fd), "fsync");
+		}
+		T_QUIET; T_ASSERT_POSIX_SUCCESS(close(fd), "close");
+		if (i % 11 == 0) {
+			T_QUIET; T_ASSERT_POSIX_SUCCESS(unlink(path), "unlink");
+		}
+	}
+	T_PASS("wrote %d files", WRITE_COALESCE_FILES);
+	T_ASSERT_GT(deferred_pushes(), deferred, "close-time pushes were deferred");
+
+	for (int i = 0; i < WRITE_COALESCE_FILES; i++) {
+		if (i % 11 == 0) {
+			continue;
+		}
+		snprintf(path, sizeof(path), "%s/f%d", testdir, i);
+		fill(i);
+		T_QUIET; T_ASSERT_POSIX_SUCCESS((fd = open(path, O_RDONLY)), "open %s", path);
+		T_QUIET; T_ASSERT_EQ(read(fd, rbuf, sizeof(rbuf)), (ssize_t)sizeof(rbuf), "read");
+		T_QUIET; T_ASSERT_EQ(memcmp(buf, rbuf, sizeof(buf)), 0, "contents of %s", path);
+		T_QUIET; T_ASSERT_POSIX_SUCCESS(close(fd), "close");
+	}
+	T_PASS("read back every file");
+
+	sync();
+	T_ASSERT_POSIX_SUCCESS(sysctlbyname("vfs.generic.writecoalesce.iosizes", sizes, &len, NULL, 0),
+	    "vfs.generic.writecoalesce.iosizes");
+	T_ASSERT_EQ(len, sizeof(sizes), "one counter per I/O size");
+	for (size_t i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++) {
+		T_LOG("writes of %s%zuk: %llu", i == 9 ? "more than " : "up to ",
+		    (size_t)4 << (i == 9 ? 8 : i), sizes[i]);
+	}
+}
@@ -344,6 +344,9 @@ name_for_behavior(vm_behavior_t behavior)
 		[VM_BEHAVIOR_CAN_REUSE]        = "VM_BEHAVIOR_CAN_REUSE",
 		[VM_BEHAVIOR_PAGEOUT]          = "VM_BEHAVIOR_PAGEOUT",
 		[VM_BEHAVIOR_ZERO]             = "VM_BEHAVIOR_ZERO",
+#ifdef VM_BEHAVIOR_FAULT_AROUND
+		[VM_BEHAVIOR_FAULT_AROUND]     = "VM_BEHAVIOR_FAULT_AROUND",
+#endif
 	};
 	static_assert(countof(behavior_name) == VM_BEHAVIOR_LAST_VALID + 1,
 	    "new vm_behavior_t values need names");
@@ -0,0 +1,150 @@
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/sysctl.h>
+
+#include <darwintest.h>
+#include <darwintest/utils.h>
+
+T_GLOBAL_META(
+	T_META_NAMESPACE("xnu.vm"),
+	T_META_RADAR_COMPONENT_NAME("xnu"),
+	T_META_RADAR_COMPONENT_VERSION("VM"),
+	T_META_RUN_CONCURRENTLY(true));
+
+/*
+ * Faults in mappings advised MADV_FAULT_AROUND may map the resident pages
+ * around them too: those pages must show the right contents, and writing
+ * to them must still go through copy-on-write.
+ */
+
+#define FAULT_AROUND_PAGES      256
+
+#ifndef MADV_FAULT_AROUND
+#define MADV_FAULT_AROUND       12
+#endif
+
+static uint64_t
+sysctl_counter(const char *name)
+{
+	uint64_t value = 0;
+	size_t len = sizeof(value);
+
+	T_QUIET; T_ASSERT_POSIX_SUCCESS(sysctlbyname(name, &value, &len, NULL, 0), "%s", name);
+	return value;
+}
+
+static int
+create_file(size_t pgsz, char *path, size_t pathlen)
+{
+	char *page;
+	int fd;
+
+	snprintf(path, pathlen, "%s/fault_around-XXXXXX", dt_tmpdir());
+	T_QUIET; T_ASSERT_POSIX_SUCCESS((fd = mkstemp(path)), "mkstemp");
+	page = malloc(pgsz);
+	T_QUIET; T_ASSERT_NOTNULL(page, "malloc");
+	for (size_t p = 0; p < FAULT_AROUND_PAGES; p++) {
+		memset(page, (int)(p & 0xff), pgsz);
+		T_QUIET; T_ASSERT_EQ(write(fd, page, pgsz), (ssize_t)pgsz, "write page %zu", p);
+	}
+	free(page);
+
+	/* make every page resident */
+	page = malloc(pgsz * FAULT_AROUND_PAGES);
+	T_QUIET; T_ASSERT_NOTNULL(page, "malloc");
+	T_QUIET; T_ASSERT_EQ(pread(fd, page, pgsz * FAULT_AROUND_PAGES, 0),
+	    (ssize_t)(pgsz * FAULT_AROUND_PAGES), "pread");
+	free(page);
+	return fd;
+}
+
+static void
+check_page(const unsigned char *page, size_t pgsz, size_t p)
+{
+	for (size_t i = 0; i < pgsz; i++) {
+		if (page[i] != (unsigned char)(p & 0xff)) {
+			T_ASSERT_FAIL("page %zu byte %zu: 0x%x", p, i, page[i]);
+		}
+	}
+}
+
+T_DECL(fault_around_file,
+    "resident file pages mapped around a fault have the file's contents",
+    T_META_TAG_VM_PREFERRED)
+{
+	size_t pgsz = (size_t)getpagesize();
+	size_t size = pgsz * FAULT_AROUND_PAGES;
+	char path[PATH_MAX];
+	unsigned char *buf;
+	uint64_t mapped;
+	int fd;
+
+	fd = create_file(pgsz, path, sizeof(path));
+	mapped = sysctl_counter("vm.fault_around_mapped");
+
+	buf = mmap(NULL, size, PROT_READ, MAP_FILE | MAP_SHARED, fd, 0);
+	T_QUIET; T_ASSERT_NE((void *)buf, MAP_FAILED, "mmap");
+	T_ASSERT_POSIX_SUCCESS(madvise(buf, size, MADV_FAULT_AROUND), "madvise(MADV_FAULT_AROUND)");
+
+	for (size_t p = 0; p < FAULT_AROUND_PAGES; p++) {
+		check_page(buf + p * pgsz, pgsz, p);
+	}
+	T_PASS("%d pages read back", FAULT_AROUND_PAGES);
+
+	mapped = sysctl_counter("vm.fault_around_mapped") - mapped;
+	T_LOG("%llu pages mapped ahead, %llu of %llu sampled were touched", mapped,
+	    sysctl_counter("vm.fault_around_touched"), sysctl_counter("vm.fault_around_sampled"));
+	if (sysctl_counter("vm.fault_around_pages") > 1) {
+		T_EXPECT_GT(mapped, 0ull, "resident pages were mapped ahead");
+	}
+
+	T_ASSERT_POSIX_SUCCESS(madvise(buf, size, MADV_NORMAL), "madvise(MADV_NORMAL)");
+	T_QUIET; T_ASSERT_POSIX_SUCCESS(munmap(buf, size), "munmap");
+	close(fd);
+	unlink(path);
+}
+
+T_DECL(fault_around_cow,
+    "pages mapped around a fault in a private mapping are still copied on write",
+    T_META_TAG_VM_PREFERRED)
+{
+	size_t pgsz = (size_t)getpagesize();
+	size_t size = pgsz * FAULT_AROUND_PAGES;
+	char path[PATH_MAX];
+	unsigned char *buf, *page;
+	int fd;
+
+	fd = create_file(pgsz, path, sizeof(path));
+
+	buf = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_FILE | MAP_PRIVATE, fd, 0);
+	T_QUIET; T_ASSERT_NE((void *)buf, MAP_FAILED, "mmap");
+	T_ASSERT_POSIX_SUCCESS(madvise(buf, size, MADV_FAULT_AROUND), "madvise(MADV_FAULT_AROUND)");
+
+	/* read faults map pages ahead, then write to every other page */
+	for (size_t p = 0; p < FAULT_AROUND_PAGES; p++) {
+		check_page(buf + p * pgsz, pgsz, p);
+	}
+	for (size_t p = 0; p < FAULT_AROUND_PAGES; p += 2) {
+		memset(buf + p * pgsz, 0xa5, pgsz);
+	}
+	for (size_t p = 1; p < FAULT_AROUND_PAGES; p += 2) {
+		check_page(buf + p * pgsz, pgsz, p);
+	}
+	T_PASS("private copies written");
+
+	page = malloc(pgsz);
+	T_QUIET; T_ASSERT_NOTNULL(page, "malloc");
+	for (size_t p = 0; p < FAULT_AROUND_PAGES; p++) {
+		T_QUIET; T_ASSERT_EQ(pread(fd, page, pgsz, (off_t)(p * pgsz)), (ssize_t)pgsz, "pread");
+		check_page(page, pgsz, p);
+	}
+	free(page);
+	T_PASS("file is unchanged");
+
+	T_QUIET; T_ASSERT_POSIX_SUCCESS(munmap(buf, size), "munmap");
+	close(fd);
+	unlink(path);
+}
@@ -0,0 +1,119 @@
+#include <pthread.h>
+#include <stdatomic.h>
+#include <sys/mman.h>
+#include <sys/sysctl.h>
+#include <unistd.h>
+
+#include <darwintest.h>
+
+T_GLOBAL_META(
+	T_META_NAMESPACE("xnu.vm"),
+	T_META_RADAR_COMPONENT_NAME("xnu"),
+	T_META_RADAR_COMPONENT_VERSION("VM"),
+	T_META_RUN_CONCURRENTLY(true));
+
+/*
+ * Faults on resident anonymous pages may be resolved without the map lock:
+ * while other threads keep changing the address space, faulting threads
+ * must still find their own memory intact.
+ */
+
+#define SPEC_FAULT_THREADS      4
+#define SPEC_FAULT_PAGES        256
+#define SPEC_FAULT_ROUNDS       200
+
+static atomic_bool spec_fault_done;
+
+static uint64_t
+sysctl_counter(const char *name)
+{
+	uint64_t value = 0;
+	size_t len = sizeof(value);
+
+	T_QUIET; T_ASSERT_POSIX_SUCCESS(sysctlbyname(name, &value, &len, NULL, 0), "%s", name);
+	return value;
+}
+
+static void *
+mutator(__unused void *arg)
+{
+	size_t pgsz = (size_t)getpagesize();
+	size_t size = 16 * pgsz;
+
+	while (!atomic_load(&spec_fault_done)) {
+		char *buf = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_ANON | MAP_PRIVATE, -1, 0);
+
+		T_QUIET; T_ASSERT_NE((void *)buf, MAP_FAILED, "mmap");
+		buf[0] = 1;
+		T_QUIET; T_ASSERT_POSIX_SUCCESS(mprotect(buf, size, PROT_READ), "mprotect");
+		T_QUIET; T_ASSERT_POSIX_SUCCESS(mprotect(buf, size, PROT_READ | PROT_EXEC), "mprotect");
+		T_QUIET; T_ASSERT_POSIX_SUCCESS(munmap(buf, size), "munmap");
+	}
+	return NULL;
+}
+
+static void *
+faulter(void *arg)
+{
+	size_t pgsz = (size_t)getpagesize();
+	size_t size = SPEC_FAULT_PAGES * pgsz;
+	uintptr_t id = (uintptr_t)arg;
+	char *buf;
+
+	buf = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_ANON | MAP_PRIVATE, -1, 0);
+	T_QUIET; T_ASSERT_NE((void *)buf, MAP_FAILED, "mmap");
+	for (size_t p = 0; p < SPEC_FAULT_PAGES; p++) {
+		buf[p * pgsz] = (char)id;
+	}
+
+	for (int round = 0; round < SPEC_FAULT_ROUNDS; round++) {
+		/* pages stay resident: the writes below fault on resident pages */
+		T_QUIET; T_ASSERT_POSIX_SUCCESS(mprotect(buf, size, PROT_READ), "mprotect");
+		T_QUIET; T_ASSERT_POSIX_SUCCESS(mprotect(buf, size, PROT_READ | PROT_WRITE), "mprotect");
+		for (size_t p = 0; p < SPEC_FAULT_PAGES; p++) {
+			char *page = buf + p * pgsz;
+
+			if (page[0] != (char)(id + round)) {
+				T_ASSERT_FAIL("thread %lu round %d page %zu: 0x%x", id, round, p, page[0]);
+			}
+			page[0] = (char)(id + round + 1);
+		}
+	}
+
+	T_QUIET; T_ASSERT_POSIX_SUCCESS(munmap(buf, size), "munmap");
+	return NULL;
+}
+
+T_DECL(fault_speculative,
+    "faults on resident pages are correct while the address space keeps changing",
+    T_META_TAG_VM_PREFERRED)
+{
+	pthread_t mutator_thread, faulters[SPEC_FAULT_THREADS];
+	uint64_t hits, fallbacks;
+
+	hits = sysctl_counter("vm.fault_speculative_hits");
+	fallbacks = sysctl_counter("vm.fault_speculative_fallbacks");
+
+	T_ASSERT_POSIX_ZERO(pthread_create(&mutator_thread, NULL, mutator, NULL), "pthread_create");
+	for (uintptr_t i = 0; i < SPEC_FAULT_THREADS; i++) {
+		T_QUIET; T_ASSERT_POSIX_ZERO(pthread_create(&faulters[i], NULL, faulter, (void *)i), "pthread_create");
+	}
+	for (int i = 0; i < SPEC_FAULT_THREADS; i++) {
+		T_QUIET; T_ASSERT_POSIX_ZERO(pthread_join(faulters[i], NULL), "pthread_join");
+	}
+	atomic_store(&spec_fault_done, true);
+	T_ASSERT_POSIX_ZERO(pthread_join(mutator_thread, NULL), "pthread_join");
+	T_PASS("%d threads faulted on their pages %d times", SPEC_FAULT_THREADS, SPEC_FAULT_ROUNDS);
+
+	hits = sysctl_counter("vm.fault_speculative_hits") - hits;
+	fallbacks = sysctl_counter("vm.fault_speculative_fallbacks") - fallbacks;
+	T_LOG("speculative faults: %llu resolved, %llu fell back", hits, fallbacks);
+
+	uint32_t enabled = 0;
+	size_t len = sizeof(enabled);
+	T_QUIET; T_ASSERT_POSIX_SUCCESS(sysctlbyname("vm.fault_speculative", &enabled, &len, NULL, 0),
+	    "vm.fault_speculative");
+	if (enabled) {
+		T_EXPECT_GT(hits, 0ull, "faults were resolved without the map lock");
+	}
+}
@@ -0,0 +1,153 @@
+#include <pthread.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/sysctl.h>
+#include <unistd.h>
+
+#include <darwintest.h>
+
+T_GLOBAL_META(
+	T_META_NAMESPACE("xnu.vm"),
+	T_META_RADAR_COMPONENT_NAME("xnu"),
+	T_META_RADAR_COMPONENT_VERSION("VM"),
+	T_META_RUN_CONCURRENTLY(true));
+
+/*
+ * With range locks, mprotect() and munmap() update the pmap with only
+ * their address range locked: threads working on their own ranges, or
+ * on the same range, must still see the protections they asked for.
+ */
+
+#define RANGE_THREADS           4
+#define RANGE_PAGES             64
+#define RANGE_ROUNDS            500
+
+static char *shared_buf;
+static size_t shared_size;
+
+static uint64_t
+sysctl_counter(const char *name)
+{
+	uint64_t value = 0;
+	size_t len = sizeof(value);
+
+	T_QUIET; T_ASSERT_POSIX_SUCCESS(sysctlbyname(name, &value, &len, NULL, 0), "%s", name);
+	return value;
+}
+
+static void
+enable_range_locks(void)
+{
+	int enable = 1, enabled = 0;
+	size_t len = sizeof(enabled);
+
+	T_ASSERT_POSIX_SUCCESS(sysctlbyname("vm.self_range_locks", NULL, NULL, &enable, sizeof(enable)),
+	    "vm.self_range_locks = 1");
+	T_QUIET; T_ASSERT_POSIX_SUCCESS(sysctlbyname("vm.self_range_locks", &enabled, &len, NULL, 0),
+	    "vm.self_range_locks");
+	T_QUIET; T_ASSERT_EQ(enabled, 1, "range locks enabled");
+}
+
+static void *
+disjoint_worker(void *arg)
+{
+	size_t pgsz = (size_t)getpagesize();
+	size_t size = RANGE_PAGES * pgsz;
+	char value = (char)(uintptr_t)arg;
+
+	for (int round = 0; round < RANGE_ROUNDS; round++) {
+		char *buf = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_ANON | MAP_PRIVATE, -1, 0);
+
+		T_QUIET; T_ASSERT_NE((void *)buf, MAP_FAILED, "mmap");
+		for (size_t p = 0; p < RANGE_PAGES; p++) {
+			buf[p * pgsz] = value;
+		}
+		T_QUIET; T_ASSERT_POSIX_SUCCESS(mprotect(buf, size, PROT_READ), "mprotect(PROT_READ)");
+		for (size_t p = 0; p < RANGE_PAGES; p++) {
+			if (buf[p * pgsz] != value) {
+				T_ASSERT_FAIL("page %zu: 0x%x", p, buf[p * pgsz]);
+			}
+		}
+		T_QUIET; T_ASSERT_POSIX_SUCCESS(mprotect(buf, size, PROT_READ | PROT_WRITE), "mprotect(PROT_READ | PROT_WRITE)");
+		buf[0] = value;
+		T_QUIET; T_ASSERT_POSIX_SUCCESS(munmap(buf, size), "munmap");
+	}
+	return NULL;
+}
+
+T_DECL(map_range_locks_disjoint,
+    "mmap/mprotect/munmap of disjoint ranges with range locks",
+    T_META_TAG_VM_PREFERRED)
+{
+	pthread_t threads[RANGE_THREADS];
+	uint64_t locked;
+
+	enable_range_locks();
+	locked = sysctl_counter("vm.map_range_lock_count");
+
+	for (uintptr_t i = 0; i < RANGE_THREADS; i++) {
+		T_QUIET; T_ASSERT_POSIX_ZERO(pthread_create(&threads[i], NULL, disjoint_worker, (void *)(i + 1)),
+		    "pthread_create");
+	}
+	for (int i = 0; i < RANGE_THREADS; i++) {
+		T_QUIET; T_ASSERT_POSIX_ZERO(pthread_join(threads[i], NULL), "pthread_join");
+	}
+	T_PASS("%d threads changed their own ranges %d times", RANGE_THREADS, RANGE_ROUNDS);
+
+	locked = sysctl_counter("vm.map_range_lock_count") - locked;
+	T_LOG("%llu ranges locked, %llu contended, %llu us waiting", locked,
+	    sysctl_counter("vm.map_range_lock_contended"), sysctl_counter("vm.map_range_lock_wait_us"));
+	T_EXPECT_GE(locked, (uint64_t)(RANGE_THREADS * RANGE_ROUNDS * 3), "mprotect() and munmap() locked their ranges");
+}
+
+static void *
+overlapping_worker(void *arg)
+{
+	size_t pgsz = (size_t)getpagesize();
+	size_t offset = (uintptr_t)arg * (RANGE_PAGES / 4) * pgsz;
+
+	/* each thread overlaps half of its neighbour's range */
+	for (int round = 0; round < RANGE_ROUNDS; round++) {
+		T_QUIET; T_ASSERT_POSIX_SUCCESS(mprotect(shared_buf + offset, RANGE_PAGES / 2 * pgsz, PROT_READ),
+		    "mprotect(PROT_READ)");
+		T_QUIET; T_ASSERT_POSIX_SUCCESS(mprotect(shared_buf + offset, RANGE_PAGES / 2 * pgsz, PROT_READ | PROT_WRITE),
+		    "mprotect(PROT_READ | PROT_WRITE)");
+	}
+	return NULL;
+}
+
+T_DECL(map_range_locks_overlapping,
+    "overlapping mprotect() calls with range locks leave the right protections",
+    T_META_TAG_VM_PREFERRED)
+{
+	size_t pgsz = (size_t)getpagesize();
+	pthread_t threads[RANGE_THREADS];
+
+	enable_range_locks();
+
+	shared_size = (RANGE_THREADS + 1) * (RANGE_PAGES / 4) * pgsz;
+	shared_buf = mmap(NULL, shared_size, PROT_READ | PROT_WRITE, MAP_ANON | MAP_PRIVATE, -1, 0);
+	T_QUIET; T_ASSERT_NE((void *)shared_buf, MAP_FAILED, "mmap");
+	memset(shared_buf, 0x5a, shared_size);
+
+	for (uintptr_t i = 0; i < RANGE_THREADS; i++) {
+		T_QUIET; T_ASSERT_POSIX_ZERO(pthread_create(&threads[i], NULL, overlapping_worker, (void *)i),
+		    "pthread_create");
+	}
+	for (int i = 0; i < RANGE_THREADS; i++) {
+		T_QUIET; T_ASSERT_POSIX_ZERO(pthread_join(threads[i], NULL), "pthread_join");
+	}
+
+	/* every thread left its range writable */
+	for (size_t off = 0; off < shared_size; off += pgsz) {
+		if (shared_buf[off] != 0x5a) {
+			T_ASSERT_FAIL("offset 0x%zx: 0x%x", off, shared_buf[off]);
+		}
+		shared_buf[off] = 0;
+	}
+	T_PASS("range is writable and intact");
+
+	T_QUIET; T_ASSERT_POSIX_SUCCESS(munmap(shared_buf, shared_size), "munmap");
+	T_LOG("%llu range locks contended, %llu us waiting",
+	    sysctl_counter("vm.map_range_lock_contended"), sysctl_counter("vm.map_range_lock_wait_us"));
+}
@@ -0,0 +1,187 @@
+#include <errno.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/sysctl.h>
+#include <mach/vm_page_size.h>
+
+#include <darwintest.h>
+
+#include "swap_test_helpers.h"
+
+T_GLOBAL_META(
+	T_META_NAMESPACE("xnu.vm"),
+	T_META_RADAR_COMPONENT_NAME("xnu"),
+	T_META_RADAR_COMPONENT_VERSION("VM"),
+	T_META_RUN_CONCURRENTLY(true));
+
+/*
+ * Each swapfile in use reports the I/O done to it: the numbers must
+ * be consistent with each other and with the size of the swapfile.
+ */
+
+/* Mirrors struct vm_swapfile_stats */
+struct swapfile_stats {
+	uint32_t vss_index;
+	uint32_t vss_reserved;
+	uint64_t vss_size;
+	uint64_t vss_used;
+	uint64_t vss_write_bytes;
+	uint64_t vss_writes;
+	uint64_t vss_write_time_us;
+	uint64_t vss_read_bytes;
+	uint64_t vss_reads;
+	uint64_t vss_read_time_us;
+};
+
+T_DECL(swapout_io_depth,
+    "the swapout I/O depth is reported",
+    T_META_TAG_VM_PREFERRED)
+{
+	uint32_t depth = 0;
+	size_t len = sizeof(depth);
+
+	T_ASSERT_POSIX_SUCCESS(sysctlbyname("vm.swapout_io_depth", &depth, &len, NULL, 0),
+	    "vm.swapout_io_depth");
+	T_EXPECT_GT(depth, 0u, "at least one swapout may be outstanding");
+}
+
+T_DECL(swapout_io_depth_bounds,
+    "the swapout I/O depth rejects values out of range",
+    T_META_ASROOT(true),
+    T_META_RUN_CONCURRENTLY(false),
+    T_META_TAG_VM_PREFERRED)
+{
+	uint32_t depth = 0, bad;
+	size_t len = sizeof(depth);
+
+	T_ASSERT_POSIX_SUCCESS(sysctlbyname("vm.swapout_io_depth", &depth, &len, NULL, 0),
+	    "vm.swapout_io_depth");
+
+	bad = 0;
+	T_EXPECT_POSIX_FAILURE(sysctlbyname("vm.swapout_io_depth", NULL, NULL, &bad, sizeof(bad)),
+	    EINVAL, "a depth of 0 is rejected");
+	bad = 65;
+	T_EXPECT_POSIX_FAILURE(sysctlbyname("vm.swapout_io_depth", NULL, NULL, &bad, sizeof(bad)),
+	    EINVAL, "a depth above 64 is rejected");
+
+	T_ASSERT_POSIX_SUCCESS(sysctlbyname("vm.swapout_io_depth", NULL, NULL, &depth, sizeof(depth)),
+	    "vm.swapout_io_depth restored to %u", depth);
+}
+
+T_DECL(swapfile_stats,
+    "swapfiles report consistent I/O statistics",
+    T_META_TAG_VM_PREFERRED)
+{
+	struct swapfile_stats *vss;
+	size_t len = 0;
+
+	T_ASSERT_POSIX_SUCCESS(sysctlbyname("vm.swapfile_stats", NULL, &len, NULL, 0),
+	    "vm.swapfile_stats size");
+	if (len == 0) {
+		T_SKIP("no swapfile in use");
+	}
+	T_ASSERT_EQ(len % sizeof(*vss), 0ul, "whole entries");
+
+	vss = calloc(1, len);
+	T_QUIET; T_ASSERT_NOTNULL(vss, "calloc");
+	T_ASSERT_POSIX_SUCCESS(sysctlbyname("vm.swapfile_stats", vss, &len, NULL, 0),
+	    "vm.swapfile_stats");
+	if (len == 0) {
+		free(vss);
+		T_SKIP("no swapfile in use");
+	}
+
+	for (size_t n = 0; n < len / sizeof(*vss); n++) {
+		T_LOG("swapfile %u: %llu/%llu bytes used, %llu writes (%llu bytes, %llu us), %llu reads (%llu bytes, %llu us)",
+		    vss[n].vss_index, vss[n].vss_used, vss[n].vss_size,
+		    vss[n].vss_writes, vss[n].vss_write_bytes, vss[n].vss_write_time_us,
+		    vss[n].vss_reads, vss[n].vss_read_bytes, vss[n].vss_read_time_us);
+		T_EXPECT_LE(vss[n].vss_used, vss[n].vss_size, "swapfile %u: used space fits", vss[n].vss_index);
+		T_EXPECT_EQ(vss[n].vss_writes == 0, vss[n].vss_write_bytes == 0,
+		    "swapfile %u: writes have bytes", vss[n].vss_index);
+		T_EXPECT_EQ(vss[n].vss_reads == 0, vss[n].vss_read_bytes == 0,
+		    "swapfile %u: reads have bytes", vss[n].vss_index);
+	}
+	free(vss);
+}
+
+#define SWAPOUT_TEST_PAGES      ((64ul << 20) / vm_page_size)
+#define SWAPOUT_TIMEOUT_SECS    30
+
+/* Sum the writes of every swapfile in use */
+static void
+swapfile_writes(uint64_t *writes, uint64_t *write_bytes)
+{
+	struct swapfile_stats *vss = NULL;
+	size_t len = 0;
+
+	*writes = *write_bytes = 0;
+	T_QUIET; T_ASSERT_POSIX_SUCCESS(sysctlbyname("vm.swapfile_stats", NULL, &len, NULL, 0),
+	    "vm.swapfile_stats size");
+	if (len == 0) {
+		return;
+	}
+	/* leave room for a swapfile created in between */
+	len += sizeof(*vss);
+	vss = calloc(1, len);
+	T_QUIET; T_ASSERT_NOTNULL(vss, "calloc");
+	T_QUIET; T_ASSERT_POSIX_SUCCESS(sysctlbyname("vm.swapfile_stats", vss, &len, NULL, 0),
+	    "vm.swapfile_stats");
+	for (size_t n = 0; n < len / sizeof(*vss); n++) {
+		*writes += vss[n].vss_writes;
+		*write_bytes += vss[n].vss_write_bytes;
+	}
+	free(vss);
+}
+
+static uint64_t
+swapout_sequential(void)
+{
+	uint64_t value = 0;
+	size_t len = sizeof(value);
+
+	T_QUIET; T_ASSERT_POSIX_SUCCESS(sysctlbyname("vm.swapout_sequential", &value, &len, NULL, 0),
+	    "vm.swapout_sequential");
+	return value;
+}
+
+T_DECL(swapout_accounting,
+    "swapping a frozen process out is accounted for in the swapfile statistics",
+    T_META_ENABLED(HAS_FREEZER),
+    T_META_ASROOT(true),
+    T_META_REQUIRES_SYSCTL_EQ("vm.freeze_enabled", 1),
+    T_META_RUN_CONCURRENTLY(false),
+    T_META_TAG_VM_PREFERRED)
+{
+	uint64_t writes, write_bytes, sequential;
+	uint64_t new_writes, new_write_bytes, new_sequential;
+	struct swapped_child sc;
+
+	swapfile_writes(&writes, &write_bytes);
+	sequential = swapout_sequential();
+
+	swapped_child_spawn(&sc, SWAPOUT_TEST_PAGES);
+	if (!swapped_child_freeze(&sc)) {
+		swapped_child_exit(&sc);
+		T_SKIP("the child could not be frozen");
+	}
+
+	/* frozen segments are written out asynchronously by the swapout thread */
+	for (int i = 0; i < SWAPOUT_TIMEOUT_SECS * 10; i++) {
+		swapfile_writes(&new_writes, &new_write_bytes);
+		new_sequential = swapout_sequential();
+		if (new_writes > writes && new_sequential > sequential) {
+			break;
+		}
+		usleep(100 * 1000);
+	}
+
+	T_LOG("swapouts: %llu -> %llu (%llu -> %llu bytes), %llu -> %llu sequential",
+	    writes, new_writes, write_bytes, new_write_bytes, sequential, new_sequential);
+	T_EXPECT_GT(new_writes, writes, "swapfile writes were counted");
+	T_EXPECT_GT(new_write_bytes, write_bytes, "swapfile write bytes were counted");
+	T_EXPECT_GT(new_sequential, sequential, "consecutive swapouts were placed sequentially");
+
+	swapped_child_touch(&sc, 0, sc.sc_pages);
+	swapped_child_exit(&sc);
+}
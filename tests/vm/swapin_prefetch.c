@@ -0,0 +1,115 @@
+#include <unistd.h>
+#include <sys/sysctl.h>
+#include <mach/vm_page_size.h>
+
+#include <darwintest.h>
+
+#include "swap_test_helpers.h"
+
+T_GLOBAL_META(
+	T_META_NAMESPACE("xnu.vm"),
+	T_META_RADAR_COMPONENT_NAME("xnu"),
+	T_META_RADAR_COMPONENT_VERSION("VM"),
+	T_META_RUN_CONCURRENTLY(true));
+
+/*
+ * Segments swapped in ahead of a fault are each accounted for once:
+ * either used, wasted, or still outstanding.
+ */
+
+static uint64_t
+sysctl_counter(const char *name)
+{
+	uint64_t value = 0;
+	size_t len = sizeof(value);
+
+	T_QUIET; T_ASSERT_POSIX_SUCCESS(sysctlbyname(name, &value, &len, NULL, 0), "%s", name);
+	return value;
+}
+
+static uint32_t
+sysctl_uint(const char *name)
+{
+	uint32_t value = 0;
+	size_t len = sizeof(value);
+
+	T_QUIET; T_ASSERT_POSIX_SUCCESS(sysctlbyname(name, &value, &len, NULL, 0), "%s", name);
+	return value;
+}
+
+T_DECL(swapin_prefetch_accounting,
+    "prefetched segments are used or wasted at most once",
+    T_META_TAG_VM_PREFERRED)
+{
+	uint64_t used, wasted, issued;
+
+	/* read issued last: segments are counted there before anywhere else */
+	used = sysctl_counter("vm.swapin_prefetch_used");
+	wasted = sysctl_counter("vm.swapin_prefetch_wasted");
+	issued = sysctl_counter("vm.swapin_prefetch_issued");
+
+	T_LOG("prefetch: %u segments per swapin, %llu issued, %llu used, %llu wasted, %u outstanding, %llu throttled",
+	    sysctl_uint("vm.swapin_prefetch_segs"), issued, used, wasted,
+	    sysctl_uint("vm.swapin_prefetch_outstanding"), sysctl_counter("vm.swapin_prefetch_throttled"));
+	T_EXPECT_LE(used + wasted, issued, "no prefetched segment is accounted for twice");
+	if (issued > 0) {
+		T_LOG("prefetch accuracy: %llu%%", used * 100 / issued);
+	}
+}
+
+#define PREFETCH_TEST_PAGES     ((64ul << 20) / vm_page_size)
+#define PREFETCH_TIMEOUT_SECS   30
+
+T_DECL(swapin_prefetch_frozen,
+    "faulting on a swapped out region prefetches the rest of it",
+    T_META_ENABLED(HAS_FREEZER),
+    T_META_ASROOT(true),
+    T_META_REQUIRES_SYSCTL_EQ("vm.freeze_enabled", 1),
+    T_META_REQUIRES_SYSCTL_NE("vm.swapin_prefetch_segs", 0),
+    T_META_RUN_CONCURRENTLY(false),
+    T_META_TAG_VM_PREFERRED)
+{
+	uint64_t issued, used, throttled;
+	uint64_t new_issued, new_used;
+	struct swapped_child sc;
+	uint64_t swapouts;
+
+	swapouts = vm_swapouts();
+	swapped_child_spawn(&sc, PREFETCH_TEST_PAGES);
+	if (!swapped_child_freeze(&sc)) {
+		swapped_child_exit(&sc);
+		T_SKIP("the child could not be frozen");
+	}
+	if (!swapouts_wait(swapouts, PREFETCH_TIMEOUT_SECS)) {
+		swapped_child_exit(&sc);
+		T_SKIP("the frozen child was not swapped out");
+	}
+
+	issued = sysctl_counter("vm.swapin_prefetch_issued");
+	used = sysctl_counter("vm.swapin_prefetch_used");
+	throttled = sysctl_counter("vm.swapin_prefetch_throttled");
+
+	/* one fault swaps the first segment in and queues the rest of the group */
+	new_issued = issued;
+	swapped_child_touch(&sc, 0, 1);
+	for (int i = 0; i < PREFETCH_TIMEOUT_SECS * 10; i++) {
+		new_issued = sysctl_counter("vm.swapin_prefetch_issued");
+		if (new_issued > issued) {
+			break;
+		}
+		usleep(100 * 1000);
+	}
+	if (new_issued == issued && sysctl_counter("vm.swapin_prefetch_throttled") > throttled) {
+		swapped_child_exit(&sc);
+		T_SKIP("prefetch was throttled");
+	}
+	T_EXPECT_GT(new_issued, issued, "segments were prefetched after one fault");
+
+	/* the prefetched segments hold the pages right after the first one */
+	swapped_child_touch(&sc, 1, sc.sc_pages - 1);
+	new_used = sysctl_counter("vm.swapin_prefetch_used");
+	T_LOG("prefetch: %llu issued, %llu used", new_issued - issued, new_used - used);
+	T_EXPECT_GT(new_used, used, "prefetched segments were used");
+
+	swapped_child_exit(&sc);
+}
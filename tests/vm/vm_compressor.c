@@ -115,3 +115,44 @@ T_DECL(sysctl_vm_object_dump, "Check that the sysctl that dumps the metadata of
 		offset += sizeof(struct vm_map_entry_info);
 	}
 }
+
+T_DECL(compressor_major_compact_threads, "Check that the parallel major compaction concurrency can be tuned",
+    T_META_ASROOT(true), T_META_RUN_CONCURRENTLY(false))
+{
+	uint32_t threads, threads_max, value;
+	uint64_t compactions, compactions_parallel, compactions_per_sec;
+	size_t len = sizeof(uint32_t);
+	int rc;
+
+	rc = sysctlbyname("vm.compressor_major_compact_threads_max", &threads_max, &len, NULL, 0);
+	T_ASSERT_POSIX_SUCCESS(rc, "query vm.compressor_major_compact_threads_max");
+	T_EXPECT_GE(threads_max, 1U, "at least one compaction thread");
+
+	len = sizeof(threads);
+	rc = sysctlbyname("vm.compressor_major_compact_threads", &threads, &len, NULL, 0);
+	T_ASSERT_POSIX_SUCCESS(rc, "query vm.compressor_major_compact_threads");
+	T_EXPECT_GE(threads, 1U, "compaction threads >= 1");
+	T_EXPECT_LE(threads, threads_max, "compaction threads <= max");
+
+	value = 0;
+	rc = sysctlbyname("vm.compressor_major_compact_threads", NULL, NULL, &value, sizeof(value));
+	T_EXPECT_POSIX_FAILURE(rc, EINVAL, "0 compaction threads is rejected");
+
+	value = threads_max + 1;
+	rc = sysctlbyname("vm.compressor_major_compact_threads", NULL, NULL, &value, sizeof(value));
+	T_EXPECT_POSIX_FAILURE(rc, EINVAL, "more than the max compaction threads is rejected");
+
+	rc = sysctlbyname("vm.compressor_major_compact_threads", NULL, NULL, &threads_max, sizeof(threads_max));
+	T_EXPECT_POSIX_SUCCESS(rc, "set compaction threads to the max");
+	rc = sysctlbyname("vm.compressor_major_compact_threads", NULL, NULL, &threads, sizeof(threads));
+	T_EXPECT_POSIX_SUCCESS(rc, "restore compaction threads");
+
+	len = sizeof(compactions);
+	rc = sysctlbyname("vm.compressor_major_compactions_parallel", &compactions_parallel, &len, NULL, 0);
+	T_EXPECT_POSIX_SUCCESS(rc, "query vm.compressor_major_compactions_parallel");
+	rc = sysctlbyname("vm.compressor_major_compactions", &compactions, &len, NULL, 0);
+	T_EXPECT_POSIX_SUCCESS(rc, "query vm.compressor_major_compactions");
+	T_EXPECT_LE(compactions_parallel, compactions, "parallel compactions are a subset of all compactions");
+	rc = sysctlbyname("vm.compressor_major_compactions_per_sec", &compactions_per_sec, &len, NULL, 0);
+	T_EXPECT_POSIX_SUCCESS(rc, "query vm.compressor_major_compactions_per_sec");
+}
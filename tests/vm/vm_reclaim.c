@@ -8,6 +8,7 @@
 #include <signal.h>
 #include <spawn.h>
 #include <spawn_private.h>
+#include <stdlib.h>
 #include <time.h>
 #include <unistd.h>
 
@@ -1030,3 +1031,88 @@ T_DECL(copy_and_query_buffer,
 	rr = mach_vm_reclaim_copied_ring_free(&copied_ring);
 	T_ASSERT_MACH_SUCCESS(rr, "free reclaim ring");
 }
+
+/* Mirrors struct vm_reclaim_task_stats */
+struct reclaim_task_stats {
+	int32_t  vrts_pid;
+	uint32_t vrts_reserved;
+	uint64_t vrts_bytes_reclaimed;
+	uint64_t vrts_latency_count;
+	uint64_t vrts_latency_avg_us;
+	uint64_t vrts_latency_max_us;
+};
+
+#define COALESCE_ENTRIES 8
+
+static uint64_t
+reclaim_sysctl_counter(const char *name)
+{
+	uint64_t value = 0;
+	size_t len = sizeof(value);
+
+	T_QUIET; T_ASSERT_POSIX_SUCCESS(sysctlbyname(name, &value, &len, NULL, 0), "%s", name);
+	return value;
+}
+
+T_DECL(vm_reclaim_coalesce_adjacent,
+    "Adjacent entries are deallocated together and accounted to the task",
+    T_META_VM_RECLAIM_ENABLED,
+    T_META_TAG_VM_PREFERRED)
+{
+	mach_vm_size_t chunk_size = 4 * vm_page_size;
+	mach_vm_size_t size = COALESCE_ENTRIES * chunk_size;
+	mach_vm_address_t addr = 0;
+	struct reclaim_task_stats *vrts;
+	uint64_t coalesced;
+	size_t len = 0;
+	bool found = false;
+	kern_return_t kr;
+
+	mach_vm_reclaim_ring_t ringbuffer = ringbuffer_init();
+
+	kr = mach_vm_allocate(mach_task_self(), &addr, size, VM_FLAGS_ANYWHERE);
+	T_QUIET; T_ASSERT_MACH_SUCCESS(kr, "mach_vm_allocate");
+	memset((void *)addr, 1, size);
+	coalesced = reclaim_sysctl_counter("vm.reclaim.entries_coalesced");
+
+	for (mach_vm_reclaim_id_t i = 0; i < COALESCE_ENTRIES; i++) {
+		mach_vm_reclaim_id_t id = VM_RECLAIM_ID_NULL;
+		bool should_update_kernel_accounting = false;
+
+		kr = mach_vm_reclaim_try_enter(ringbuffer, addr + i * chunk_size, chunk_size,
+		    VM_RECLAIM_DEALLOCATE, &id, &should_update_kernel_accounting);
+		T_QUIET; T_ASSERT_MACH_SUCCESS(kr, "mach_vm_reclaim_try_enter()");
+		T_QUIET; T_ASSERT_EQ(id, i, "Entry placed at correct index");
+	}
+	kr = mach_vm_reclaim_ring_flush(ringbuffer, COALESCE_ENTRIES);
+	T_ASSERT_MACH_SUCCESS(kr, "mach_vm_reclaim_ring_flush()");
+
+	kr = mach_vm_protect(mach_task_self(), addr, size, FALSE, VM_PROT_READ);
+	T_EXPECT_MACH_ERROR(kr, KERN_INVALID_ADDRESS, "the whole range was deallocated");
+	coalesced = reclaim_sysctl_counter("vm.reclaim.entries_coalesced") - coalesced;
+	T_EXPECT_GE(coalesced, (uint64_t)(COALESCE_ENTRIES - 1), "adjacent entries were coalesced");
+
+	T_ASSERT_POSIX_SUCCESS(sysctlbyname("vm.reclaim.task_stats", NULL, &len, NULL, 0),
+	    "vm.reclaim.task_stats size");
+	T_ASSERT_GT(len, 0ul, "some task has a ring");
+	vrts = calloc(1, len);
+	T_QUIET; T_ASSERT_NOTNULL(vrts, "calloc");
+	T_ASSERT_POSIX_SUCCESS(sysctlbyname("vm.reclaim.task_stats", vrts, &len, NULL, 0),
+	    "vm.reclaim.task_stats");
+	T_QUIET; T_ASSERT_EQ(len % sizeof(*vrts), 0ul, "whole entries");
+	for (size_t n = 0; n < len / sizeof(*vrts); n++) {
+		if (vrts[n].vrts_pid != getpid()) {
+			continue;
+		}
+		found = true;
+		T_LOG("reclaimed %llu bytes, %llu batches timed: %llu us average, %llu us max",
+		    vrts[n].vrts_bytes_reclaimed, vrts[n].vrts_latency_count,
+		    vrts[n].vrts_latency_avg_us, vrts[n].vrts_latency_max_us);
+		T_EXPECT_GE(vrts[n].vrts_bytes_reclaimed, (uint64_t)size, "reclaimed bytes are accounted");
+		T_EXPECT_GT(vrts[n].vrts_latency_count, 0ull, "reclamation was timed");
+		T_EXPECT_LE(vrts[n].vrts_latency_avg_us, vrts[n].vrts_latency_max_us, "average is below max");
+	}
+	free(vrts);
+	T_EXPECT_TRUE(found, "this task reports statistics");
+	T_LOG("reclaiming %llu bytes/s", reclaim_sysctl_counter("vm.reclaim.bytes_per_sec"));
+}
@@ -82,3 +82,9 @@ T_DECL(vm_map_4k_16k_copy_overwrite,
 {
 	T_EXPECT_EQ(1ULL, run_sysctl_test("vm_map_4k_16k", 1), "vm_map_4k_16k_copy_overwrite");
 }
+
+T_DECL(vm_compressor_prescreen,
+    "Check that the compressor pre-screen routes typical pages as expected")
+{
+	T_EXPECT_EQ(1ULL, run_sysctl_test("vm_compressor_prescreen", 0), "vm_compressor_prescreen");
+}
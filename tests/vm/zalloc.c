@@ -44,6 +44,31 @@ T_DECL(zone_gc_stress_test, "stress test for zone_gc", T_META_TAG_VM_PREFERRED)
 	T_EXPECT_EQ(1ull, run_sysctl_test("zone_gc_stress_test", 10), "zone_gc_stress_test");
 }
 
+T_DECL(zone_mag_resize_test, "magazine resizing of the zone caching layer", T_META_TAG_VM_PREFERRED)
+{
+	T_EXPECT_EQ(1ull, run_sysctl_test("zone_mag_resize_test", 0), "zone_mag_resize_test");
+}
+
+T_DECL(zalloc_n_bench, "zalloc/zfree vs. zalloc_n/zfree_n throughput",
+    T_META_TAG_PERF, T_META_TAG_VM_NOT_ELIGIBLE)
+{
+	/* keep in sync with ZALLOC_N_BENCH_{ELEMS,ROUNDS} in zalloc.c */
+	const int batch = 256 * 64;
+	const char *modes[] = { "zalloc_zfree", "zalloc_n_zfree_n" };
+
+	for (int64_t mode = 0; mode < 2; mode++) {
+		dt_stat_time_t s = dt_stat_time_create("%s", modes[mode]);
+
+		while (!dt_stat_stable(s)) {
+			dt_stat_token start = dt_stat_time_begin(s);
+			T_QUIET; T_ASSERT_EQ(1ull,
+			    run_sysctl_test("zalloc_n_bench", mode), "zalloc_n_bench");
+			dt_stat_time_end_batch(s, batch, start);
+		}
+		dt_stat_finalize(s);
+	}
+}
+
 #define ZLOG_ZONE "data.kalloc.128"
 
 T_DECL(zlog_smoke_test, "check that zlog and zone tagging function at all",
@@ -0,0 +1,102 @@
+#include <sys/mman.h>
+#include <sys/sysctl.h>
+#include <unistd.h>
+
+#include <darwintest.h>
+
+T_GLOBAL_META(
+	T_META_NAMESPACE("xnu.vm"),
+	T_META_RADAR_COMPONENT_NAME("xnu"),
+	T_META_RADAR_COMPONENT_VERSION("VM"),
+	T_META_RUN_CONCURRENTLY(true));
+
+/*
+ * Zero-fill faults may be given pages that were zeroed ahead of time:
+ * whichever way they got their page, anonymous memory must read as zeroes.
+ */
+
+#define ZERO_FILL_PAGES         4096
+
+static uint64_t
+sysctl_counter(const char *name)
+{
+	uint64_t value = 0;
+	size_t len = sizeof(value);
+
+	T_QUIET; T_ASSERT_POSIX_SUCCESS(sysctlbyname(name, &value, &len, NULL, 0), "%s", name);
+	return value;
+}
+
+static void
+fault_and_check(size_t pgsz, size_t npages, bool write_first)
+{
+	size_t size = npages * pgsz;
+	char *buf;
+
+	buf = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_ANON | MAP_PRIVATE, -1, 0);
+	T_QUIET; T_ASSERT_NE(buf, MAP_FAILED, "mmap");
+
+	for (size_t p = 0; p < npages; p++) {
+		uint64_t *page = (uint64_t *)(buf + p * pgsz);
+
+		if (write_first) {
+			page[pgsz / sizeof(uint64_t) - 1] = 0;
+		}
+		for (size_t i = 0; i < pgsz / sizeof(uint64_t); i++) {
+			if (page[i] != 0) {
+				T_ASSERT_FAIL("page %zu not zero at offset %zu: 0x%llx", p, i * sizeof(uint64_t), page[i]);
+			}
+		}
+		/* dirty the page so that its frame isn't handed back clean */
+		page[0] = ~0ull;
+	}
+	T_QUIET; T_ASSERT_POSIX_SUCCESS(munmap(buf, size), "munmap");
+}
+
+T_DECL(zero_fill_pool,
+    "anonymous memory reads as zeroes, with or without pre-zeroed pages",
+    T_META_TAG_VM_PREFERRED)
+{
+	size_t pgsz = (size_t)getpagesize();
+	uint64_t hits, misses;
+
+	hits = sysctl_counter("vm.page_zero_pool_hits");
+	misses = sysctl_counter("vm.page_zero_pool_misses");
+
+	for (int round = 0; round < 4; round++) {
+		fault_and_check(pgsz, ZERO_FILL_PAGES, round & 1);
+		/* give the pools a chance to fill back up */
+		usleep(10000);
+	}
+	T_PASS("%d pages read back as zeroes", 4 * ZERO_FILL_PAGES);
+
+	hits = sysctl_counter("vm.page_zero_pool_hits") - hits;
+	misses = sysctl_counter("vm.page_zero_pool_misses") - misses;
+	T_LOG("pre-zeroed pages: %llu hits, %llu misses, %llu zeroed ahead of time", hits, misses,
+	    sysctl_counter("vm.page_zero_pool_zeroed"));
+
+	uint32_t pool_size = 0;
+	size_t len = sizeof(pool_size);
+	T_QUIET; T_ASSERT_POSIX_SUCCESS(sysctlbyname("vm.page_zero_pool_size", &pool_size, &len, NULL, 0),
+	    "vm.page_zero_pool_size");
+	if (pool_size != 0) {
+		T_EXPECT_GE(hits + misses, (uint64_t)ZERO_FILL_PAGES, "zero-fill faults were counted");
+	}
+}
+
+T_DECL(zero_fill_pool_size_bounds,
+    "vm.page_zero_pool_size rejects sizes above its cap",
+    T_META_ASROOT(true),
+    T_META_TAG_VM_PREFERRED)
+{
+	uint32_t pool_size = 0, too_big = 257;
+	size_t len = sizeof(pool_size);
+
+	T_ASSERT_POSIX_SUCCESS(sysctlbyname("vm.page_zero_pool_size", &pool_size, &len, NULL, 0),
+	    "vm.page_zero_pool_size");
+	T_ASSERT_LE(pool_size, 256u, "boot-arg was clamped to the cap");
+	T_ASSERT_POSIX_FAILURE(sysctlbyname("vm.page_zero_pool_size", NULL, NULL, &too_big, sizeof(too_big)),
+	    EINVAL, "setting %u pages", too_big);
+	T_ASSERT_POSIX_SUCCESS(sysctlbyname("vm.page_zero_pool_size", NULL, NULL, &pool_size, sizeof(pool_size)),
+	    "setting %u pages back", pool_size);
+}
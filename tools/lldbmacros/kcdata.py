@@ -140,6 +140,7 @@ kcdata_type_def = {
     'STACKSHOT_KCTYPE_TASK_EXEC_META': 0x957,
     'STACKSHOT_KCTYPE_TASK_MEMORYSTATUS': 0x958,
     'STACKSHOT_KCTYPE_LATENCY_INFO_BUFFER': 0x95a,
+    'STACKSHOT_KCTYPE_THREAD_GROUP_LATENCY': 0x95b,
     'KCDATA_TYPE_BUFFER_END':      0xF19158ED,
 
     'TASK_CRASHINFO_EXTMODINFO':           0x801,
@@ -1261,6 +1262,15 @@ KNOWN_TYPES_COLLECTION[GetTypeForName('STACKSHOT_KCTYPE_LATENCY_INFO_BUFFER')] =
             ),
             'stackshot_latency_buffer')
 
+KNOWN_TYPES_COLLECTION[GetTypeForName('STACKSHOT_KCTYPE_THREAD_GROUP_LATENCY')] = KCTypeDescription(GetTypeForName('STACKSHOT_KCTYPE_THREAD_GROUP_LATENCY'),
+            (
+                        KCSubTypeElement.FromBasicCtype('tgls_id', KCSUBTYPE_TYPE.KC_ST_UINT64, 0),
+                        KCSubTypeElement.FromBasicCtype('tgls_sched_bucket', KCSUBTYPE_TYPE.KC_ST_UINT32, 8),
+                        KCSubTypeElement('tgls_runnable', KCSUBTYPE_TYPE.KC_ST_UINT64, KCSubTypeElement.GetSizeForArray(32, 8), 12, 1),
+                        KCSubTypeElement('tgls_preempted', KCSUBTYPE_TYPE.KC_ST_UINT64, KCSubTypeElement.GetSizeForArray(32, 8), 268, 1),
+            ),
+            'thread_group_latency_snapshot')
+
 KNOWN_TYPES_COLLECTION[GetTypeForName('STACKSHOT_KCTYPE_LATENCY_INFO_TASK')] = KCTypeDescription(GetTypeForName('STACKSHOT_KCTYPE_LATENCY_INFO_TASK'),
             (
                         KCSubTypeElement.FromBasicCtype('task_uniqueid', KCSUBTYPE_TYPE.KC_ST_UINT64, 0),
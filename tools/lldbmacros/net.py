@@ -1708,8 +1708,9 @@ def GetPcbInfo(pcbi, proto):
         hashbase = pcbi.ipi_hashbase
         while (i < hashsize):
             head = hashbase[i]
-            pcb = cast(head.lh_first, 'inpcb *')
-            while pcb != 0:
+            link = head.first.__smr_ptr
+            while link != 0:
+                pcb = ContainerOf(link, 'struct inpcb', 'inp_hash')
                 pcbseen += 1
                 out_string += GetInPcb(pcb, proto) + "\n"
                 so = pcb.inp_socket
@@ -1726,7 +1727,7 @@ def GetPcbInfo(pcbi, proto):
 
                         reass_entry = reass_entry.tqe_q.le_next
 
-                pcb = cast(pcb.inp_hash.le_next, 'inpcb *')
+                link = pcb.inp_hash.next.__smr_ptr
             i += 1
 
     out_string += "total pcbs seen: " + str(int(pcbseen)) + "\n"
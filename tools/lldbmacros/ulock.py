@@ -30,6 +30,13 @@ def GetUlockSummary(ull):
 
     return s + " {ull.ull_owner: <#20x} {ull.ull_turnstile: <#20x} {ull.ull_nwaiters: >7d}".format(ull=ull)
 
+def IterateUlockBucket(bucket):
+    link = bucket.ulb_head.first.__smr_ptr
+    while unsigned(link) != 0:
+        ull = ContainerOf(link, 'ull_t', 'ull_hash_link')
+        yield ull
+        link = ull.ull_hash_link.next.__smr_ptr
+
 @lldb_command('showallulocks', fancy=True)
 def ShowAllUlocks(cmd_args=None, cmd_options={}, O=None):
     """ Display a summary of all the ulocks in the system
@@ -41,5 +48,14 @@ def ShowAllUlocks(cmd_args=None, cmd_options={}, O=None):
         count = kern.globals.ull_hash_buckets;
         buckets = kern.globals.ull_bucket
         for i in range(0, count):
-            for ull in IterateLinkageChain(addressof(buckets[i].ulb_head), 'ull_t *', 'ull_hash_link'):
+            for ull in IterateUlockBucket(buckets[i]):
                 print(GetUlockSummary(ull))
+
+        # per-process tables, see ULL_TASK_HASH_BUCKETS
+        for proc in kern.procs:
+            table = proc.p_ulock_hash
+            if unsigned(table) == 0:
+                continue
+            for i in range(0, 64):
+                for ull in IterateUlockBucket(table[i]):
+                    print(GetUlockSummary(ull))